@@ -0,0 +1,79 @@
+#!/usr/bin/env python3
+"""Reads the results of `make bench` and compares them with an older run.
+
+    python3 bench.py bench.txt                  # results of one run
+    python3 bench.py bench.txt old.txt          # change against old.txt
+    python3 bench.py --threshold 5 new.txt old.txt
+
+With two files the exit status is 1 if a test is missing, the run didn't
+finish, or any benchmark got slower (more cycles/op) by more than the
+threshold percent, so it can gate a commit.
+"""
+
+import argparse
+import sys
+
+
+def parse(path):
+    results = {}
+    tests = []
+    status = None
+    with open(path) as f:
+        for line in f:
+            parts = line.split()
+            if len(parts) >= 3 and parts[0] == "TEST" and parts[2] == "ok":
+                tests.append(parts[1])
+            if len(parts) < 2 or parts[0] != "BENCH":
+                continue
+            if parts[1] == "END":
+                status = int(parts[2].split("=")[1])
+                continue
+            fields = dict(p.split("=", 1) for p in parts[2:] if "=" in p)
+            if "cycles/op" in fields:
+                results[parts[1]] = {k: int(v) for k, v in fields.items()}
+    return results, tests, status
+
+
+def main():
+    ap = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    ap.add_argument("new")
+    ap.add_argument("old", nargs="?")
+    ap.add_argument("--threshold", type=float, default=10.0,
+                    help="allowed slowdown in percent (default %(default)s)")
+    args = ap.parse_args()
+
+    new, new_tests, status = parse(args.new)
+    ok = status == 0
+    print("%d tests passed, run %s" %
+          (len(new_tests), "finished" if status == 0 else
+           "FAILED" if status is not None else "did not finish"))
+
+    if not args.old:
+        for name, r in new.items():
+            print("%-22s %12d cycles/op" % (name, r["cycles/op"]))
+        return 0 if ok else 1
+
+    old, old_tests, _ = parse(args.old)
+    for t in old_tests:
+        if t not in new_tests:
+            print("test %s missing" % t)
+            ok = False
+    print("%-22s %12s %12s %8s" % ("benchmark", "old", "new", "change"))
+    for name in sorted(set(old) | set(new)):
+        if name not in new or name not in old:
+            print("%-22s %s" % (name, "only in " +
+                                ("new" if name in new else "old")))
+            continue
+        o = old[name]["cycles/op"]
+        n = new[name]["cycles/op"]
+        change = 100.0 * (n - o) / o if o else 0.0
+        flag = ""
+        if change > args.threshold:
+            flag = "  REGRESSION"
+            ok = False
+        print("%-22s %12d %12d %+7.1f%%%s" % (name, o, n, change, flag))
+    return 0 if ok else 1
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -12,4 +12,10 @@ fs = fat.open_fs('fat://bin/os.bin')
 
 put_file('./programs/blank/blank.elf', 'blank', fs)
 put_file('./programs/shell/shell.elf', 'shell', fs)
+put_file('./programs/trace/trace.elf', 'trace', fs)
+put_file('./programs/prof/prof.elf', 'prof', fs)
+put_file('./programs/bench/bench.elf', 'bench', fs)
+put_file('./programs/cat/cat.elf', 'cat', fs)
+put_file('./programs/mstress/mstress.elf', 'mstress', fs)
+put_file('./bin/initrd', 'initrd', fs)
 
@@ -0,0 +1,234 @@
+#!/usr/bin/env python3
+"""Decodes the samples dumped by the `prof` user program.
+
+The dump is the text the program prints (PROF BEGIN, PROC lines, one
+`S <hex>` line per sample, PROF END), e.g. copied from the serial console.
+Every sample is the 32 raw bytes of `struct prof_sample` in src/trace/prof.h.
+Addresses are resolved with the symbol tables of the kernel ELF and of the
+user programs (all of them are linked at the same address, so a user ELF is
+picked per pid by the program name from the PROC line).
+
+    python3 prof.py --user programs/blank/blank.elf dump.txt   # flat profile
+    python3 prof.py --user ... --folded dump.txt > out.folded  # flame graph
+    python3 prof.py --kernel build/kernelfull.o ... dump.txt
+
+The folded output (`frame;frame;leaf count` per line) is what
+flamegraph.pl and speedscope take.
+"""
+
+import argparse
+import bisect
+import os
+import struct
+import sys
+from collections import Counter
+
+SAMPLE = struct.Struct("<HBBI6I")
+SAMPLE_KERNEL = 0x1
+SAMPLE_LOST = 0x2
+PID_IDLE = 0xFFFF
+
+SHT_SYMTAB = 2
+STT_FUNC = 2
+
+
+class Symbols:
+    """Function symbols of an ELF32 little endian file."""
+
+    def __init__(self, path):
+        self.path = path
+        self.starts = []
+        self.funcs = []
+        self.text = {}  # section (addr, bytes) to check call sites with
+        with open(path, "rb") as f:
+            self.data = f.read()
+        self._load()
+
+    def _load(self):
+        data = self.data
+        if data[:4] != b"\x7fELF" or data[4] != 1:
+            raise ValueError("%s: not an ELF32 file" % self.path)
+        shoff, = struct.unpack_from("<I", data, 0x20)
+        shentsize, shnum = struct.unpack_from("<HH", data, 0x2E)
+        sections = []
+        for i in range(shnum):
+            sections.append(struct.unpack_from("<IIIIIIIIII", data,
+                                               shoff + i * shentsize))
+        funcs = []
+        for sh in sections:
+            _, typ, flags, addr, off, size, link, _, _, entsize = sh
+            if typ == 1 and flags & 0x4:  # PROGBITS, executable
+                self.text[addr] = data[off:off + size]
+            if typ != SHT_SYMTAB:
+                continue
+            stroff = sections[link][4]
+            for o in range(off, off + size, entsize):
+                name, value, ssize, info, _, _ = struct.unpack_from(
+                    "<IIIBBH", data, o)
+                if info & 0xF != STT_FUNC or value == 0:
+                    continue
+                end = data.index(b"\0", stroff + name)
+                funcs.append((value, ssize,
+                              data[stroff + name:end].decode(errors="replace")))
+        funcs.sort()
+        self.funcs = funcs
+        self.starts = [f[0] for f in funcs]
+
+    def lookup(self, addr):
+        i = bisect.bisect_right(self.starts, addr) - 1
+        if i < 0:
+            return None
+        start, size, name = self.funcs[i]
+        if size and addr >= start + size:
+            return None
+        return name
+
+    def _code(self, addr, n):
+        for start, code in self.text.items():
+            if start <= addr - n and addr <= start + len(code):
+                return code[addr - n - start:addr - start]
+        return None
+
+    def follows_call(self, addr):
+        """Whether addr is right after a call instruction, i.e. a return
+        address and not some other word that happened to be on the stack."""
+        code = self._code(addr, 7)
+        if code is None or len(code) < 7:
+            return False
+        if code[-5] == 0xE8:  # call rel32
+            return True
+        # call r/m32 (FF /2) with a 0, 1 or 4 byte displacement, or a sib
+        for n in (2, 3, 4, 6, 7):
+            if code[-n] == 0xFF and (code[-n + 1] >> 3) & 7 == 2:
+                return True
+        return False
+
+
+def parse(lines):
+    samples = []
+    procs = {}
+    lost = 0
+    for line in lines:
+        line = line.strip()
+        if line.startswith("PROC "):
+            parts = line.split()
+            if len(parts) >= 3:
+                procs[int(parts[1])] = parts[2]
+            continue
+        if not line.startswith("S "):
+            continue
+        raw = bytes.fromhex(line[2:])
+        if len(raw) != SAMPLE.size:
+            continue
+        pid, cpu, flags, eip, *stack = SAMPLE.unpack(raw)
+        if flags & SAMPLE_LOST:
+            lost += eip
+            continue
+        samples.append((pid, cpu, flags, eip, stack))
+    return samples, procs, lost
+
+
+def prog_name(path):
+    return os.path.basename(path.replace(":", "/"))
+
+
+class Resolver:
+    def __init__(self, kernel, users, procs):
+        self.kernel = kernel
+        self.users = {prog_name(u.path).split(".")[0]: u for u in users}
+        self.default_user = users[0] if len(users) == 1 else None
+        self.procs = procs
+
+    def user_syms(self, pid):
+        prog = self.procs.get(pid)
+        if prog is not None and prog_name(prog) in self.users:
+            return self.users[prog_name(prog)]
+        return self.default_user
+
+    def process(self, pid):
+        if pid == PID_IDLE:
+            return "idle"
+        prog = self.procs.get(pid)
+        return prog_name(prog) if prog else "pid%d" % pid
+
+    def name(self, syms, addr):
+        sym = syms.lookup(addr) if syms else None
+        return sym if sym else "0x%08x" % addr
+
+    def frames(self, sample):
+        """Outermost first, the process (or kernel) then the functions."""
+        pid, _, flags, eip, stack = sample
+        if flags & SAMPLE_KERNEL:
+            root = "idle" if pid == PID_IDLE else self.process(pid)
+            return [root, "[kernel]", self.name(self.kernel, eip)]
+        syms = self.user_syms(pid)
+        leaf = self.name(syms, eip)
+        callers = []
+        for ret in stack:
+            if ret == 0 or syms is None or not syms.follows_call(ret):
+                continue
+            # the call is in the function before the return address
+            callers.append(self.name(syms, ret - 1))
+        # a function shows up once per frame, drop the repeats a scan of a
+        # stack without frame pointers finds (locals, saved arguments)
+        chain = []
+        for f in reversed(callers):
+            if not chain or chain[-1] != f:
+                chain.append(f)
+        if chain and chain[-1] == leaf:
+            chain.pop()
+        return [self.process(pid)] + chain + [leaf]
+
+
+def flat(samples, res, out):
+    total = len(samples)
+    if total == 0:
+        print("no samples", file=out)
+        return
+    self_counts = Counter()
+    incl = Counter()
+    for s in samples:
+        fr = res.frames(s)
+        self_counts[(fr[0], fr[-1])] += 1
+        for key in set((fr[0], f) for f in fr[1:]):
+            incl[key] += 1
+    print("%-8s %6s %6s  %-14s %s" % ("self", "%", "total", "process",
+                                      "function"), file=out)
+    for (proc, func), n in self_counts.most_common():
+        print("%-8d %5.1f%% %6d  %-14s %s" %
+              (n, 100.0 * n / total, incl[(proc, func)], proc, func),
+              file=out)
+
+
+def folded(samples, res, out):
+    stacks = Counter(";".join(res.frames(s)) for s in samples)
+    for stack, n in sorted(stacks.items()):
+        print("%s %d" % (stack, n), file=out)
+
+
+def main():
+    ap = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    ap.add_argument("dump", nargs="?", help="prof output, stdin if missing")
+    ap.add_argument("--kernel", default="build/kernelfull.o",
+                    help="kernel ELF with symbols (default %(default)s)")
+    ap.add_argument("--user", action="append", default=[],
+                    help="user program ELF, once per program")
+    ap.add_argument("--folded", action="store_true",
+                    help="print folded stacks for flame graphs")
+    args = ap.parse_args()
+
+    kernel = Symbols(args.kernel) if os.path.exists(args.kernel) else None
+    users = [Symbols(u) for u in args.user]
+
+    f = open(args.dump) if args.dump else sys.stdin
+    samples, procs, lost = parse(f)
+    res = Resolver(kernel, users, procs)
+    if args.folded:
+        folded(samples, res, sys.stdout)
+    else:
+        flat(samples, res, sys.stdout)
+        print("\n%d samples, %d lost" % (len(samples), lost))
+
+
+if __name__ == "__main__":
+    main()
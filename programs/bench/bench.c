@@ -0,0 +1,77 @@
+#include "include/stdio.h"
+#include "include/stdlib.h"
+#include "include/string.h"
+#include "include/unistd.h"
+
+// User half of `make bench` (src/bench/bench.h). The kernel starts it as the
+// only process once its own benchmarks are done, it times what can only be
+// seen from user mode and prints BENCH lines in the same format. Its exit
+// status ends the run. `bench child` is the partner for context switches,
+// mstress prints the malloc benchmark itself.
+
+#define YIELD_ITERS 2000
+#define SWITCH_ITERS 2000
+// the child may start a little late, it must still be around for all of
+// the parent's yields
+#define SWITCH_SLACK 100
+
+// low half of the time stamp counter, enough for the deltas here
+static unsigned int rdtsc32() {
+    unsigned int lo;
+    asm volatile("rdtsc" : "=a"(lo) : : "edx");
+    return lo;
+}
+
+static void report(char *name, int iters, unsigned int cycles) {
+    printf("BENCH %s iters=%d cycles/op=%d\n", name, iters, cycles / iters);
+}
+
+static int child() {
+    for (int i = 0; i < SWITCH_ITERS + SWITCH_SLACK; i++) {
+        yield();
+    }
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    if (argc >= 2 && strncmp(argv[1], "child", 5) == 0) {
+        return child();
+    }
+
+    // alone on the cpu every yield is a syscall that goes through the
+    // scheduler and comes back to us
+    yield();
+    unsigned int start = rdtsc32();
+    for (int i = 0; i < YIELD_ITERS; i++) {
+        yield();
+    }
+    report("syscall_yield", YIELD_ITERS, rdtsc32() - start);
+
+    // with a ready partner every yield switches to the other task
+    int pid = create_proccess("0:/bench", 2, 15, "0:/bench\0child\0");
+    if (pid < 0) {
+        printf("BENCH error: create_proccess %d\n", pid);
+        return 1;
+    }
+    yield();
+    start = rdtsc32();
+    for (int i = 0; i < SWITCH_ITERS; i++) {
+        yield();
+    }
+    // two switches per round: to the child and back
+    report("context_switch", 2 * SWITCH_ITERS, rdtsc32() - start);
+
+    while (waitpid(pid) != 0) {
+        yield();
+    }
+
+    pid = create_proccess("0:/mstress", 1, 11, "0:/mstress\0");
+    if (pid < 0) {
+        printf("BENCH error: create_proccess %d\n", pid);
+        return 1;
+    }
+    while (waitpid(pid) != 0) {
+        yield();
+    }
+    return 0;
+}
@@ -4,6 +4,7 @@
 
 void screen() {
     printf("Yo %d\n", 123);
+    tty_mode(TTY_MODE_RAW);
     while (1) {
         int c = get_key();
         if (c == 0) {
@@ -0,0 +1,49 @@
+#include "include/stdio.h"
+#include "include/stdlib.h"
+#include "include/string.h"
+
+// Prints files, e.g. the kernel statistics: `cat 9:/meminfo 9:/self/stat`
+
+#define CHUNK 512
+
+static int cat(const char *path) {
+    static char buf[CHUNK];
+    int fd = fopen(path, "r");
+    if (fd < 0) {
+        printf("cat: can't open %s: %d\n", path, fd);
+        return 1;
+    }
+    struct file_stat stat;
+    int res = fstat(fd, &stat);
+    if (res < 0) {
+        printf("cat: can't stat %s: %d\n", path, res);
+        fclose(fd);
+        return 1;
+    }
+    // reads are all or nothing, ask for exactly what is left
+    int left = stat.file_size;
+    while (left > 0) {
+        int n = left < CHUNK ? left : CHUNK;
+        if (fread(buf, n, 1, fd) != 1) {
+            printf("cat: read of %s failed\n", path);
+            fclose(fd);
+            return 1;
+        }
+        print(buf, n);
+        left -= n;
+    }
+    fclose(fd);
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    if (argc < 2) {
+        printf("usage: cat <file>...\n");
+        return 1;
+    }
+    int res = 0;
+    for (int i = 1; i < argc; i++) {
+        res |= cat(argv[i]);
+    }
+    return res;
+}
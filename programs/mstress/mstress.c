@@ -0,0 +1,193 @@
+#include "include/stdio.h"
+#include "include/stdlib.h"
+#include "include/string.h"
+
+// Malloc stress test and benchmark: random malloc, free and realloc of
+// random sizes over a table of live allocations, every one filled with a
+// pattern that is checked before it is freed or moved. `mstress [iters]`
+// prints a BENCH line like the ones of `make bench`, which runs it too.
+
+#define SLOTS 1024
+#define DEFAULT_ITERS 50000
+#define ROUND 1000 // ops timed at once, the 32 bit tsc delta must not wrap
+#define CHECK_BYTES 16 // checked at both ends of an allocation
+
+struct slot {
+    unsigned char *ptr;
+    unsigned int size;
+    unsigned char pattern;
+};
+
+static struct slot slots[SLOTS];
+static unsigned int rng_state = 2463534242u;
+
+// low half of the time stamp counter, enough for the deltas here
+static unsigned int rdtsc32() {
+    unsigned int lo;
+    asm volatile("rdtsc" : "=a"(lo) : : "edx");
+    return lo;
+}
+
+static unsigned int rng() {
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 17;
+    rng_state ^= rng_state << 5;
+    return rng_state;
+}
+
+// mostly small sizes, some pages, now and then one big enough for its own
+// mapping
+static unsigned int random_size() {
+    unsigned int r = rng() % 100;
+    if (r < 80) {
+        return 1 + rng() % 256;
+    }
+    if (r < 99) {
+        return 257 + rng() % 8192;
+    }
+    return 128 * 1024 + rng() % (128 * 1024);
+}
+
+static void fill(struct slot *s, unsigned int from) {
+    for (unsigned int i = from; i < s->size; i++) {
+        s->ptr[i] = s->pattern + i;
+    }
+}
+
+// only the ends, checking every byte would time memory instead of malloc
+static int check(struct slot *s, unsigned int size) {
+    for (unsigned int i = 0; i < size; i++) {
+        if (i == CHECK_BYTES && size > 2 * CHECK_BYTES) {
+            i = size - CHECK_BYTES;
+        }
+        if (s->ptr[i] != (unsigned char)(s->pattern + i)) {
+            printf("mstress: slot at %p size %d corrupted at %d\n", s->ptr,
+                   s->size, i);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static int step() {
+    struct slot *s = &slots[rng() % SLOTS];
+    if (!s->ptr) {
+        s->size = random_size();
+        s->pattern = rng();
+        s->ptr = malloc(s->size);
+        if (!s->ptr) {
+            printf("mstress: malloc(%d) failed\n", s->size);
+            return 1;
+        }
+        fill(s, 0);
+        return 0;
+    }
+    if (check(s, s->size)) {
+        return 1;
+    }
+    if (rng() % 4 == 0) {
+        unsigned int size = random_size();
+        unsigned char *ptr = realloc(s->ptr, size);
+        if (!ptr) {
+            printf("mstress: realloc(%d) failed\n", size);
+            return 1;
+        }
+        unsigned int kept = size < s->size ? size : s->size;
+        s->ptr = ptr;
+        if (check(s, kept)) {
+            return 1;
+        }
+        s->size = size;
+        fill(s, kept);
+        return 0;
+    }
+    free(s->ptr);
+    s->ptr = 0;
+    return 0;
+}
+
+// the rate the kernel measured the tsc at, from 9:/stat, 0 if unknown
+static unsigned int tsc_khz() {
+    static char buf[1024];
+    int fd = fopen("9:/stat", "r");
+    if (fd < 0) {
+        return 0;
+    }
+    struct file_stat stat;
+    unsigned int khz = 0;
+    if (fstat(fd, &stat) < 0 || stat.file_size >= sizeof(buf) ||
+        fread(buf, stat.file_size, 1, fd) != 1) {
+        goto out;
+    }
+    buf[stat.file_size] = 0;
+    for (char *p = buf; *p; p++) {
+        if (strncmp(p, "tsc_khz:", 8) != 0) {
+            continue;
+        }
+        for (p += 8; *p == ' '; p++) {
+        }
+        for (; is_digit(*p); p++) {
+            khz = khz * 10 + *p - '0';
+        }
+        break;
+    }
+out:
+    fclose(fd);
+    return khz;
+}
+
+int main(int argc, char **argv) {
+    int iters = DEFAULT_ITERS;
+    if (argc >= 2) {
+        iters = atoi(argv[1]);
+    }
+    if (iters < ROUND) {
+        iters = ROUND;
+    }
+
+    int res = malloc_test();
+    if (res != 0) {
+        printf("TEST malloc FAILED check %d\n", res);
+        return 1;
+    }
+    printf("TEST malloc ok\n");
+
+    unsigned int cycles = 0;
+    int done = 0;
+    while (done < iters) {
+        unsigned int start = rdtsc32();
+        for (int i = 0; i < ROUND; i++) {
+            if (step()) {
+                return 1;
+            }
+        }
+        cycles += rdtsc32() - start;
+        done += ROUND;
+    }
+    for (int i = 0; i < SLOTS; i++) {
+        if (slots[i].ptr && check(&slots[i], slots[i].size)) {
+            return 1;
+        }
+        free(slots[i].ptr);
+        slots[i].ptr = 0;
+    }
+
+    struct malloc_stats stats;
+    malloc_get_stats(&stats);
+    unsigned int per_op = cycles / done;
+    unsigned int khz = tsc_khz();
+    // khz * 1000 / per_op in two steps, the product doesn't fit above 4 GHz
+    unsigned int ops_per_sec = 0;
+    if (per_op) {
+        ops_per_sec = khz / per_op * 1000 + khz % per_op * 1000 / per_op;
+    }
+    printf("BENCH malloc_stress iters=%d cycles/op=%d ops/sec=%d "
+           "peak_rss_kb=%d\n",
+           done, per_op, ops_per_sec, stats.peak_mapped / 1024);
+    if (stats.in_use != 0 || stats.large != 0) {
+        printf("mstress: %d bytes in %d large allocations left in use\n",
+               stats.in_use, stats.large);
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,113 @@
+#include "include/stdio.h"
+#include "include/stdlib.h"
+#include "include/string.h"
+#include "include/unistd.h"
+
+// Runs a program with the kernel's sampling profiler (src/trace/prof.h) on
+// and dumps the samples as text the host can decode with prof.py: a PROF
+// BEGIN line, a `PROC <pid> <path>` line for the profiled program, one
+// `S <hex>` line per 32 byte sample (its raw little endian bytes) and a PROF
+// END line. Samples of every other process and of the idle loop are kept too.
+//
+//   prof <program> [args]      one sample per scheduler tick
+//   prof -f <program> [args]   timers run 10x faster while profiling
+
+#define SAMPLE_SIZE 32
+#define SAMPLES_PER_READ 32
+#define MAX_ARGS_LEN 256
+
+static const char hex[] = "0123456789abcdef";
+
+static void print_sample(unsigned char *s) {
+    char line[2 + SAMPLE_SIZE * 2 + 1];
+    line[0] = 'S';
+    line[1] = ' ';
+    for (int i = 0; i < SAMPLE_SIZE; i++) {
+        line[2 + 2 * i] = hex[s[i] >> 4];
+        line[3 + 2 * i] = hex[s[i] & 0xf];
+    }
+    line[sizeof(line) - 1] = '\n';
+    print(line, sizeof(line));
+}
+
+static int drain(unsigned char *buf) {
+    int n = prof_read(buf, SAMPLE_SIZE * SAMPLES_PER_READ);
+    if (n < 0) {
+        printf("prof_read failed: %d\n", n);
+        return n;
+    }
+    for (int off = 0; off < n; off += SAMPLE_SIZE) {
+        print_sample(buf + off);
+    }
+    return n;
+}
+
+int main(int argc, char **argv) {
+    static unsigned char buf[SAMPLE_SIZE * SAMPLES_PER_READ];
+    static char args[MAX_ARGS_LEN];
+    static char path[128];
+    int first = 1;
+    int mode = PROF_ON;
+    if (argc >= 2 && strncmp(argv[1], "-f", 2) == 0) {
+        mode = PROF_ON_FAST;
+        first = 2;
+    }
+    if (first >= argc) {
+        printf("usage: prof [-f] <program> [args]\n");
+        return 1;
+    }
+
+    // the program's argv is ours from `first` on, "\0" joined
+    int len = 0;
+    for (int i = first; i < argc; i++) {
+        int n = strlen(argv[i]) + 1;
+        if (len + n > MAX_ARGS_LEN) {
+            printf("prof: arguments too long\n");
+            return 1;
+        }
+        strcpy(args + len, argv[i]);
+        len += n;
+    }
+
+    // like the shell, bare names are looked up in the initramfs (8:/), then
+    // on the first disk
+    if (argv[first][0] && strncmp(argv[first] + 1, ":/", 2) == 0) {
+        strncpy(path, argv[first], sizeof(path) - 1);
+    } else {
+        strcpy(path, "8:/");
+        strncpy(path + 3, argv[first], sizeof(path) - 4);
+        int fd = fopen(path, "r");
+        if (fd > 0) {
+            fclose(fd);
+        } else {
+            path[0] = '0';
+        }
+    }
+
+    int res = prof_control(mode);
+    if (res < 0) {
+        printf("prof_control failed: %d\n", res);
+        return 1;
+    }
+    // samples from before we started don't belong to this run
+    while (prof_read(buf, sizeof(buf)) > 0) {
+    }
+
+    printf("PROF BEGIN\n");
+    int pid = create_proccess(path, argc - first, len, args);
+    if (pid < 0) {
+        printf("create_proccess failed: %d\n", pid);
+    } else {
+        printf("PROC %d %s\n", pid, path);
+        while (waitpid(pid) != 0) {
+            if (drain(buf) < 0) {
+                break;
+            }
+        }
+    }
+    prof_control(PROF_OFF);
+    while (drain(buf) > 0) {
+    }
+    printf("PROF END\n");
+    return 0;
+}
@@ -66,9 +66,14 @@ void shell(int argc, char **argv) {
                 FILE_PATH[i] = 0;
             }
 
-            strcpy(FILE_PATH, "0:/");
+            // the initramfs (tmpfs) first, then the boot disk
+            strcpy(FILE_PATH, "8:/");
             strncpy(FILE_PATH + 3, token, 120);
             int res = create_proccess(FILE_PATH, argc, len, buf);
+            if (res < 0) {
+                FILE_PATH[0] = '0';
+                res = create_proccess(FILE_PATH, argc, len, buf);
+            }
             if (res < 0) {
                 printf("Command not found: %s\n", token);
             } else {
@@ -1,11 +1,42 @@
 #ifndef STDIO_H
 #define STDIO_H
 
+enum {
+    TTY_MODE_RAW = 0,
+    TTY_MODE_CANONICAL = 1,
+};
+
 void print(const char *str, int len);
 void put_char(int c);
 int get_key();
+int tty_read(char *buf, int len);
+int tty_mode(int mode);
 int printf(const char *fmt, ...);
 void readline_terminal(char *buf, int max_len);
 void cls();
 
+// files, see src/fs/file.h. Paths look like "0:/hello.txt", the kernel
+// statistics are on "9:/" (src/fs/procfs/procfs.h), files in memory that
+// are gone at reboot on "8:/" (src/fs/tmpfs/tmpfs.h).
+struct file_stat {
+    unsigned int flags;
+    unsigned int file_size;
+};
+
+// returns the fd (>= 1) or -error. "r" reads, "w" creates or empties the
+// file, "a" creates it or writes at its end.
+int fopen(const char *path, const char *mode);
+// reads nmembs items of size bytes, returns the number read or -error
+int fread(void *buf, int size, int nmembs, int fd);
+// returns the number of items written, fewer if the disk is full, or -error
+int fwrite(const void *buf, int size, int nmembs, int fd);
+int fstat(int fd, struct file_stat *stat);
+// cuts the file down to size bytes, or grows it with zeroes
+int ftruncate(int fd, int size);
+// writes go to a cache first, this returns once they are on the disk
+int fsync(int fd);
+int fclose(int fd);
+// removes a file, not while it is open
+int unlink(const char *path);
+
 #endif
\ No newline at end of file
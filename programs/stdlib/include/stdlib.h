@@ -7,13 +7,41 @@ enum {
     O_READ = 1,
     O_WRITE = 2,
     O_EXEC = 4,
+    O_POPULATE = 8, // mmap: frames up front, 4 MB pages where aligned
 };
 
 void *malloc(size_t size);
 void free(void *ptr);
+void *calloc(size_t nmembs, size_t size);
+void *realloc(void *ptr, size_t size);
+
+// what malloc holds from the kernel and hands out, in bytes
+struct malloc_stats {
+    size_t mapped;      // heap plus mmap'd right now
+    size_t peak_mapped; // most mapped at once
+    size_t heap;        // between the start of the heap and the break
+    size_t in_use;      // in chunks malloc'd and not freed
+    size_t peak_in_use;
+    int large; // allocations with a mapping of their own
+};
+void malloc_get_stats(struct malloc_stats *stats);
+int malloc_test();
 
 int mmap(void *va_start, void *va_end, int flags);
-int munmap(void *va_start);
+int munmap(void *va_start, void *va_end);
+int mprotect(void *va_start, void *va_end, int flags);
+// moves the end of the heap, returns the old one or -error
+void *sbrk(int increment);
+
+// kernel trace events, see src/trace/trace.h
+int trace_read(void *buf, int len);
+
+// sampling profiler, see src/trace/prof.h
+#define PROF_OFF 0
+#define PROF_ON 1
+#define PROF_ON_FAST 2
+int prof_control(int mode);
+int prof_read(void *buf, int len);
 
 void itoa(int value, char *buffer);
 int atoi(char *buffer);
@@ -2,6 +2,7 @@
 #define STRING_H
 
 #include <stdbool.h>
+#include <stddef.h>
 
 int strlen(const char *str);
 int strnlen(const char *str, int maxlen);
@@ -14,5 +15,7 @@ char to_lower(char c);
 void str_to_lower(char *str);
 bool is_digit(char c);
 char *strtok(char *str, const char *delimiters);
+void *memset(void *ptr, int c, size_t size);
+void *memcpy(void *dst, const void *src, size_t size);
 
 #endif
\ No newline at end of file
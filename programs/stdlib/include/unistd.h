@@ -12,4 +12,7 @@ int create_proccess(const char *file_path, int argc, int len, char *args);
 // Non blocking waitpid
 // returns 0 if the process exited
 // -ve error code otherwise
-int waitpid(int pid);
\ No newline at end of file
+int waitpid(int pid);
+
+// lets the other ready tasks run first
+void yield();
\ No newline at end of file
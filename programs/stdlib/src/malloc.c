@@ -0,0 +1,624 @@
+#include "include/os.h"
+#include "include/stdlib.h"
+#include "include/string.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+// Segregated fit allocator with boundary tags, after dlmalloc.
+//
+// Small chunks are carved out of the heap past the program break (sbrk),
+// grown at least as much as it already is each time it runs out, so a
+// program doing many allocations makes few syscalls. Every chunk starts with
+// its size and flags, a free chunk also has its size at the start of the
+// chunk after it (prev_size), so a chunk can be merged with both neighbours
+// when it is freed. Free chunks sit in bins: one per size up to
+// MALLOC_SMALL_LIMIT, then one per power of two, searched first fit. When the
+// free chunk at the top of the heap gets bigger than MALLOC_TRIM_THRESHOLD
+// the break is moved back down.
+//
+// In front of that the tcache keeps a few recently freed chunks of every
+// small size as they are, still marked in use, so a free and malloc of the
+// same size is a list push and pop.
+//
+// Requests of MALLOC_MMAP_THRESHOLD or more get a mapping of their own,
+// below MALLOC_MMAP_TOP, unmapped again by free.
+//
+// Mappings of 4 MB or more are laid out on 4 MB boundaries and populated, the
+// kernel maps every aligned 4 MB of them with one large page. The heap is
+// faulted in a page at a time and never gets one.
+
+#define MALLOC_MMAP_TOP 0xc0000000
+#define MALLOC_MMAP_BOTTOM 0x10000000
+#define MALLOC_PAGE_SIZE 4096
+#define MALLOC_HEAP_MIN_GROW (64 * 1024)
+#define MALLOC_HEAP_MAX_GROW (4 * 1024 * 1024)
+#define MALLOC_TRIM_THRESHOLD (512 * 1024) // free top chunk given back from
+#define MALLOC_TOP_PAD (128 * 1024)        // kept of it when trimming
+#define MALLOC_MMAP_THRESHOLD (128 * 1024)
+#define MALLOC_LARGE_PAGE (4 * 1024 * 1024)
+#define MALLOC_ALIGN 8
+#define MALLOC_SMALL_LIMIT 512 // exact size bins below this
+#define MALLOC_SMALL_BINS (MALLOC_SMALL_LIMIT / MALLOC_ALIGN)
+#define MALLOC_LARGE_BINS 16 // 512, 1K, 2K, ... 8M and up
+#define MALLOC_NUM_BINS (MALLOC_SMALL_BINS + MALLOC_LARGE_BINS)
+#define MALLOC_TCACHE_LIMIT 256 // chunk sizes up to this are cached
+#define MALLOC_TCACHE_COUNT 8   // chunks kept per size
+#define MALLOC_MAX_HOLES 32
+
+#define CHUNK_IN_USE 0x1
+#define CHUNK_PREV_IN_USE 0x2
+#define CHUNK_MMAPPED 0x4
+#define CHUNK_FLAGS 0x7
+
+struct malloc_chunk {
+    size_t prev_size; // size of the chunk before, only while that one is free
+    size_t head;      // size of this chunk | CHUNK_* flags
+    // free chunks only, the user's memory otherwise
+    struct malloc_chunk *next;
+    struct malloc_chunk *prev;
+};
+
+// prev_size and head come before the user's memory
+#define CHUNK_OVERHEAD (2 * sizeof(size_t))
+#define CHUNK_MIN_SIZE sizeof(struct malloc_chunk)
+
+// the heap ends in a zero sized in use chunk, so nothing merges past it
+#define HEAP_FENCE_SIZE CHUNK_OVERHEAD
+
+// address space given back by munmap, handed out again before going lower
+struct malloc_hole {
+    uintptr_t start;
+    uintptr_t end;
+};
+
+struct malloc_tcache {
+    struct malloc_chunk *head;
+    int count;
+};
+
+static struct malloc_chunk *bins[MALLOC_NUM_BINS];
+static uint32_t binmap[(MALLOC_NUM_BINS + 31) / 32];
+static struct malloc_tcache tcache[MALLOC_TCACHE_LIMIT / MALLOC_ALIGN + 1];
+static uintptr_t heap_start = 0; // 0 until the first sbrk
+static uintptr_t heap_end = 0;   // the program break
+static struct malloc_hole holes[MALLOC_MAX_HOLES];
+static int num_holes = 0;
+static uintptr_t mmap_low = MALLOC_MMAP_TOP;
+static struct malloc_stats stats;
+
+// ---- chunks ----
+
+static size_t chunk_size(struct malloc_chunk *c) {
+    return c->head & ~CHUNK_FLAGS;
+}
+
+static struct malloc_chunk *chunk_at(void *addr, size_t offset) {
+    return (struct malloc_chunk *)((char *)addr + offset);
+}
+
+static struct malloc_chunk *chunk_next(struct malloc_chunk *c) {
+    return chunk_at(c, chunk_size(c));
+}
+
+static void *chunk_mem(struct malloc_chunk *c) {
+    return (char *)c + CHUNK_OVERHEAD;
+}
+
+static struct malloc_chunk *mem_chunk(void *ptr) {
+    return (struct malloc_chunk *)((char *)ptr - CHUNK_OVERHEAD);
+}
+
+// size of the chunk that holds n bytes, 0 if n is too big for any
+static size_t request_size(size_t n) {
+    if (n > MALLOC_MMAP_TOP - MALLOC_MMAP_BOTTOM) {
+        return 0;
+    }
+    size_t size = (n + CHUNK_OVERHEAD + MALLOC_ALIGN - 1) & ~(MALLOC_ALIGN - 1);
+    return size < CHUNK_MIN_SIZE ? CHUNK_MIN_SIZE : size;
+}
+
+static size_t page_align(size_t n) {
+    return (n + MALLOC_PAGE_SIZE - 1) & ~(MALLOC_PAGE_SIZE - 1);
+}
+
+// ---- bins ----
+
+static int bin_index(size_t size) {
+    if (size < MALLOC_SMALL_LIMIT) {
+        return size / MALLOC_ALIGN;
+    }
+    int idx = MALLOC_SMALL_BINS;
+    for (size_t s = size / MALLOC_SMALL_LIMIT; s > 1; s >>= 1) {
+        idx++;
+    }
+    return idx < MALLOC_NUM_BINS ? idx : MALLOC_NUM_BINS - 1;
+}
+
+static void bin_insert(struct malloc_chunk *c) {
+    int idx = bin_index(chunk_size(c));
+    c->prev = 0;
+    c->next = bins[idx];
+    if (c->next) {
+        c->next->prev = c;
+    }
+    bins[idx] = c;
+    binmap[idx / 32] |= 1u << (idx % 32);
+}
+
+static void bin_remove(struct malloc_chunk *c) {
+    int idx = bin_index(chunk_size(c));
+    if (c->prev) {
+        c->prev->next = c->next;
+    } else {
+        bins[idx] = c->next;
+    }
+    if (c->next) {
+        c->next->prev = c->prev;
+    }
+    if (!bins[idx]) {
+        binmap[idx / 32] &= ~(1u << (idx % 32));
+    }
+}
+
+// First fit in size's own bin, else the head of the next bin that isn't
+// empty, all of whose chunks are big enough
+static struct malloc_chunk *bin_find(size_t size) {
+    int idx = bin_index(size);
+    for (struct malloc_chunk *c = bins[idx]; c; c = c->next) {
+        if (chunk_size(c) >= size) {
+            return c;
+        }
+    }
+    for (idx++; idx < MALLOC_NUM_BINS; idx++) {
+        uint32_t word = binmap[idx / 32] >> (idx % 32);
+        if (!word) {
+            idx |= 31; // nothing else in this word
+            continue;
+        }
+        while (!(word & 1)) {
+            word >>= 1;
+            idx++;
+        }
+        return bins[idx];
+    }
+    return 0;
+}
+
+// ---- address space ----
+
+static void hole_add(uintptr_t start, uintptr_t end) {
+    for (int i = 0; i < num_holes; i++) {
+        if (holes[i].end == start) {
+            holes[i].end = end;
+            return;
+        }
+        if (holes[i].start == end) {
+            holes[i].start = start;
+            return;
+        }
+    }
+    if (num_holes < MALLOC_MAX_HOLES) {
+        holes[num_holes].start = start;
+        holes[num_holes].end = end;
+        num_holes++;
+    }
+}
+
+static void *map_region(size_t len) {
+    uintptr_t start = 0;
+    for (int i = 0; i < num_holes; i++) {
+        if (holes[i].end - holes[i].start >= len) {
+            start = holes[i].start;
+            holes[i].start += len;
+            if (holes[i].start == holes[i].end) {
+                holes[i] = holes[--num_holes];
+            }
+            break;
+        }
+    }
+    bool from_hole = start != 0;
+    if (!from_hole) {
+        if (mmap_low - MALLOC_MMAP_BOTTOM < len) {
+            return 0;
+        }
+        start = mmap_low - len;
+        if (len >= MALLOC_LARGE_PAGE) {
+            // MALLOC_MMAP_BOTTOM is aligned, so this stays above it
+            start &= ~(uintptr_t)(MALLOC_LARGE_PAGE - 1);
+        }
+    }
+    int flags = O_READ | O_WRITE;
+    if (len >= MALLOC_LARGE_PAGE) {
+        flags |= O_POPULATE;
+    }
+    if (mmap((void *)start, (void *)(start + len), flags) != 0) {
+        // what was taken from a hole stays lost, better than retrying it
+        return 0;
+    }
+    if (!from_hole) {
+        if (start + len < mmap_low) {
+            hole_add(start + len, mmap_low);
+        }
+        mmap_low = start;
+    }
+    stats.mapped += len;
+    if (stats.mapped > stats.peak_mapped) {
+        stats.peak_mapped = stats.mapped;
+    }
+    return (void *)start;
+}
+
+static void unmap_region(void *addr, size_t len) {
+    if (munmap(addr, (char *)addr + len) != 0) {
+        return;
+    }
+    stats.mapped -= len;
+    uintptr_t start = (uintptr_t)addr;
+    uintptr_t end = start + len;
+    if (start == mmap_low) {
+        mmap_low = end;
+        // and the alignment gap above it, if there is one
+        for (int i = 0; i < num_holes; i++) {
+            if (holes[i].start == mmap_low) {
+                mmap_low = holes[i].end;
+                holes[i] = holes[--num_holes];
+                break;
+            }
+        }
+        return;
+    }
+    hole_add(start, end);
+}
+
+// ---- heap ----
+
+static void stats_heap(long change) {
+    stats.mapped += change;
+    stats.heap += change;
+    if (stats.mapped > stats.peak_mapped) {
+        stats.peak_mapped = stats.mapped;
+    }
+}
+
+static struct malloc_chunk *heap_fence() {
+    return chunk_at((void *)heap_end, -HEAP_FENCE_SIZE);
+}
+
+// Moves the break up by at least size bytes (at least as much as the heap
+// already has), the new space is one in use chunk not yet freed
+static struct malloc_chunk *heap_grow(size_t size) {
+    if (!heap_start) {
+        void *brk = sbrk(0);
+        if ((intptr_t)brk < 0) {
+            return 0;
+        }
+        heap_start = heap_end = (uintptr_t)brk;
+    }
+    size_t need = page_align(size + HEAP_FENCE_SIZE);
+    size_t len = heap_end - heap_start;
+    if (len < MALLOC_HEAP_MIN_GROW) {
+        len = MALLOC_HEAP_MIN_GROW;
+    }
+    if (len > MALLOC_HEAP_MAX_GROW) {
+        len = MALLOC_HEAP_MAX_GROW;
+    }
+    if (len < need) {
+        len = need;
+    }
+    if ((intptr_t)sbrk(len) < 0) {
+        // try again for just what is needed
+        if (len == need || (intptr_t)sbrk(need) < 0) {
+            return 0;
+        }
+        len = need;
+    }
+    stats_heap(len);
+
+    // the old fence, if there was one, is the start of the new chunk
+    struct malloc_chunk *c;
+    if (heap_end == heap_start) {
+        c = (struct malloc_chunk *)heap_start;
+        c->head = (len - HEAP_FENCE_SIZE) | CHUNK_PREV_IN_USE | CHUNK_IN_USE;
+    } else {
+        c = heap_fence();
+        c->head = len | (c->head & CHUNK_PREV_IN_USE) | CHUNK_IN_USE;
+    }
+    heap_end += len;
+    heap_fence()->head = 0 | CHUNK_PREV_IN_USE | CHUNK_IN_USE;
+    return c;
+}
+
+// Moves the break back down if the free chunk at the top of the heap is big
+static void heap_trim() {
+    if (!heap_start || heap_end == heap_start) {
+        return;
+    }
+    struct malloc_chunk *fence = heap_fence();
+    if (fence->head & CHUNK_PREV_IN_USE) {
+        return;
+    }
+    struct malloc_chunk *top = chunk_at(fence, -fence->prev_size);
+    size_t size = chunk_size(top);
+    if (size < MALLOC_TRIM_THRESHOLD) {
+        return;
+    }
+    size_t release = (size - MALLOC_TOP_PAD) & ~(MALLOC_PAGE_SIZE - 1);
+    if ((intptr_t)sbrk(-(int)release) < 0) {
+        return;
+    }
+    stats_heap(-(long)release);
+    heap_end -= release;
+    bin_remove(top);
+    top->head = (size - release) | (top->head & CHUNK_PREV_IN_USE);
+    fence = heap_fence();
+    fence->prev_size = size - release;
+    fence->head = 0 | CHUNK_IN_USE;
+    bin_insert(top);
+}
+
+// ---- allocation ----
+
+// Marks c (free, out of its bin) in use with size bytes, the rest is split
+// off into a free chunk of its own if it is big enough
+static void chunk_use(struct malloc_chunk *c, size_t size) {
+    size_t csize = chunk_size(c);
+    size_t flags = c->head & CHUNK_PREV_IN_USE;
+    if (csize - size >= CHUNK_MIN_SIZE) {
+        struct malloc_chunk *rest = chunk_at(c, size);
+        rest->head = (csize - size) | CHUNK_PREV_IN_USE;
+        chunk_next(rest)->prev_size = csize - size;
+        bin_insert(rest);
+        csize = size;
+    } else {
+        chunk_at(c, csize)->head |= CHUNK_PREV_IN_USE;
+    }
+    c->head = csize | flags | CHUNK_IN_USE;
+}
+
+// Merges c (in use, not cached) with its free neighbours and bins it
+static void chunk_free(struct malloc_chunk *c) {
+    size_t size = chunk_size(c);
+    struct malloc_chunk *next = chunk_at(c, size);
+    if (!(next->head & CHUNK_IN_USE)) {
+        bin_remove(next);
+        size += chunk_size(next);
+    }
+    if (!(c->head & CHUNK_PREV_IN_USE)) {
+        struct malloc_chunk *prev = chunk_at(c, -c->prev_size);
+        bin_remove(prev);
+        size += chunk_size(prev);
+        c = prev;
+    }
+    // free chunks are never next to each other, so the one before is in use
+    c->head = size | CHUNK_PREV_IN_USE;
+    next = chunk_at(c, size);
+    next->prev_size = size;
+    next->head &= ~CHUNK_PREV_IN_USE;
+    bin_insert(c);
+}
+
+static void *malloc_large(size_t size) {
+    size_t len = page_align(size);
+    struct malloc_chunk *c = map_region(len);
+    if (!c) {
+        return 0;
+    }
+    // prev_size has no neighbour to describe, it keeps the mapping's length
+    c->prev_size = len;
+    c->head = len | CHUNK_MMAPPED | CHUNK_IN_USE;
+    stats.large++;
+    stats.in_use += len;
+    return chunk_mem(c);
+}
+
+void *malloc(size_t n) {
+    size_t size = request_size(n);
+    if (size == 0) {
+        return 0;
+    }
+    if (size >= MALLOC_MMAP_THRESHOLD) {
+        return malloc_large(size);
+    }
+
+    struct malloc_chunk *c;
+    if (size <= MALLOC_TCACHE_LIMIT && tcache[size / MALLOC_ALIGN].head) {
+        struct malloc_tcache *tc = &tcache[size / MALLOC_ALIGN];
+        c = tc->head;
+        tc->head = c->next;
+        tc->count--;
+        stats.in_use += size;
+        return chunk_mem(c);
+    }
+
+    c = bin_find(size);
+    if (!c) {
+        // merged with a free chunk at the old top if there is one
+        c = heap_grow(size);
+        if (!c) {
+            return 0;
+        }
+        chunk_free(c);
+        c = bin_find(size);
+    }
+    bin_remove(c);
+    chunk_use(c, size);
+    stats.in_use += chunk_size(c);
+    if (stats.in_use > stats.peak_in_use) {
+        stats.peak_in_use = stats.in_use;
+    }
+    return chunk_mem(c);
+}
+
+void free(void *ptr) {
+    if (!ptr) {
+        return;
+    }
+    struct malloc_chunk *c = mem_chunk(ptr);
+    if (!(c->head & CHUNK_IN_USE)) {
+        // freed twice, or not ours
+        return;
+    }
+    size_t size = chunk_size(c);
+    stats.in_use -= size;
+    if (c->head & CHUNK_MMAPPED) {
+        stats.large--;
+        unmap_region(c, c->prev_size);
+        return;
+    }
+    if (size <= MALLOC_TCACHE_LIMIT) {
+        struct malloc_tcache *tc = &tcache[size / MALLOC_ALIGN];
+        if (tc->count < MALLOC_TCACHE_COUNT) {
+            c->next = tc->head;
+            tc->head = c;
+            tc->count++;
+            return;
+        }
+    }
+    chunk_free(c);
+    heap_trim();
+}
+
+void *calloc(size_t nmembs, size_t size) {
+    if (size && nmembs > (size_t)-1 / size) {
+        return 0;
+    }
+    void *ptr = malloc(nmembs * size);
+    // fresh mappings come zeroed from the kernel
+    if (ptr && !(mem_chunk(ptr)->head & CHUNK_MMAPPED)) {
+        memset(ptr, 0, nmembs * size);
+    }
+    return ptr;
+}
+
+void *realloc(void *ptr, size_t n) {
+    if (!ptr) {
+        return malloc(n);
+    }
+    if (n == 0) {
+        free(ptr);
+        return 0;
+    }
+    size_t size = request_size(n);
+    if (size == 0) {
+        return 0;
+    }
+    struct malloc_chunk *c = mem_chunk(ptr);
+    size_t csize = chunk_size(c);
+    if (c->head & CHUNK_MMAPPED) {
+        if (size <= csize) {
+            return ptr;
+        }
+    } else if (size < MALLOC_MMAP_THRESHOLD) {
+        // grow into a free chunk right after it
+        struct malloc_chunk *next = chunk_at(c, csize);
+        if (size > csize && !(next->head & CHUNK_IN_USE) &&
+            csize + chunk_size(next) >= size) {
+            bin_remove(next);
+            csize += chunk_size(next);
+            chunk_at(c, csize)->head |= CHUNK_PREV_IN_USE;
+        }
+        if (size <= csize) {
+            // give back whatever is too much
+            stats.in_use += csize - chunk_size(c);
+            c->head = csize | (c->head & CHUNK_FLAGS);
+            if (csize - size >= CHUNK_MIN_SIZE) {
+                struct malloc_chunk *rest = chunk_at(c, size);
+                rest->head = (csize - size) | CHUNK_PREV_IN_USE | CHUNK_IN_USE;
+                c->head = size | (c->head & CHUNK_FLAGS);
+                stats.in_use -= csize - size;
+                chunk_free(rest);
+                heap_trim();
+            }
+            if (stats.in_use > stats.peak_in_use) {
+                stats.peak_in_use = stats.in_use;
+            }
+            return ptr;
+        }
+    }
+
+    void *new_ptr = malloc(n);
+    if (!new_ptr) {
+        return 0;
+    }
+    memcpy(new_ptr, ptr, csize - CHUNK_OVERHEAD < n ? csize - CHUNK_OVERHEAD : n);
+    free(ptr);
+    return new_ptr;
+}
+
+void malloc_get_stats(struct malloc_stats *out) { *out = stats; }
+
+// ------------------- TESTS ------------------- //
+
+// Returns 0 if the allocator kept its books straight, the number of the
+// failed check otherwise
+int malloc_test() {
+    struct malloc_stats before;
+    malloc_get_stats(&before);
+
+    // neighbours merge back into one chunk: the same memory comes back for
+    // something as big as all three together
+    char *a = malloc(600);
+    char *b = malloc(600);
+    char *c = malloc(600);
+    if (!a || !b || !c || b <= a || c <= b) {
+        return 1;
+    }
+    free(a);
+    free(c);
+    free(b);
+    char *all = malloc(1800);
+    if (all != a) {
+        return 2;
+    }
+    free(all);
+
+    // the tcache hands back the chunk just freed
+    char *small = malloc(24);
+    free(small);
+    if (malloc(24) != small) {
+        return 3;
+    }
+    free(small);
+
+    // realloc keeps the contents, in place when the next chunk is free
+    char *r = malloc(1000);
+    char *guard = malloc(1000);
+    for (int i = 0; i < 1000; i++) {
+        r[i] = (char)i;
+    }
+    free(guard);
+    if (realloc(r, 1500) != r) {
+        return 4;
+    }
+    r = realloc(r, 40000);
+    for (int i = 0; i < 1000; i++) {
+        if (r[i] != (char)i) {
+            return 5;
+        }
+    }
+    free(r);
+
+    // large ones are mappings of their own and go away on free
+    char *big = calloc(1, MALLOC_MMAP_THRESHOLD);
+    if (!big || big[MALLOC_MMAP_THRESHOLD - 1] != 0) {
+        return 6;
+    }
+    free(big);
+
+    // the heap grows for these and shrinks back once they are free
+    void *fill[8];
+    for (int i = 0; i < 8; i++) {
+        fill[i] = malloc(MALLOC_MMAP_THRESHOLD - 4096);
+    }
+    for (int i = 0; i < 8; i++) {
+        free(fill[i]);
+    }
+
+    struct malloc_stats after;
+    malloc_get_stats(&after);
+    if (after.in_use != before.in_use || after.large != before.large ||
+        after.heap > before.heap + MALLOC_TRIM_THRESHOLD) {
+        return 7;
+    }
+    return 0;
+}
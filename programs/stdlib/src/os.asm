@@ -11,6 +11,22 @@ global cls:function
 global create_proccess:function
 global exit:function
 global waitpid:function
+global tty_read:function
+global tty_mode:function
+global trace_read:function
+global prof_control:function
+global prof_read:function
+global yield:function
+global fopen:function
+global fread:function
+global fstat:function
+global fclose:function
+global sbrk:function
+global mprotect:function
+global fwrite:function
+global unlink:function
+global ftruncate:function
+global fsync:function
 
 ; void print(const char* str, int len)
 print:
@@ -67,15 +83,16 @@ mmap:
     pop ebp
     ret
 
-;int munmap(void* va_start);
+;int munmap(void* va_start, void* va_end);
 munmap:
     push ebp
     mov ebp, esp
 
     push dword[ebp+8] ; va_start
+    push dword[ebp+12] ; va_end
     mov eax, 5 ; munmap syscall 
     int 0x80
-    add esp, 4 ; pop va_start
+    add esp, 8 ; pop va_start, va_end
 
     pop ebp
     ret
@@ -132,4 +149,224 @@ waitpid:
     add esp, 4 ; pop pid
 
     pop ebp
-    ret
\ No newline at end of file
+    ret
+
+; int tty_read(char* buf, int len)
+tty_read:
+    push ebp
+    mov ebp, esp
+
+    push dword[ebp+8] ; buf
+    push dword[ebp+12] ; len
+    mov eax, 10 ; tty_read syscall
+    int 0x80
+    add esp, 8 ; pop buf, len
+
+    pop ebp
+    ret
+
+; int tty_mode(int mode)
+tty_mode:
+    push ebp
+    mov ebp, esp
+
+    push dword[ebp+8] ; mode
+    mov eax, 11 ; tty_set_mode syscall
+    int 0x80
+    add esp, 4 ; pop mode
+
+    pop ebp
+    ret
+
+; int trace_read(void* buf, int len)
+trace_read:
+    push ebp
+    mov ebp, esp
+
+    push dword[ebp+8] ; buf
+    push dword[ebp+12] ; len
+    mov eax, 12 ; trace_read syscall
+    int 0x80
+    add esp, 8 ; pop buf, len
+
+    pop ebp
+    ret
+
+; int prof_control(int mode)
+prof_control:
+    push ebp
+    mov ebp, esp
+
+    push dword[ebp+8] ; mode
+    mov eax, 13 ; prof_control syscall
+    int 0x80
+    add esp, 4 ; pop mode
+
+    pop ebp
+    ret
+
+; int prof_read(void* buf, int len)
+prof_read:
+    push ebp
+    mov ebp, esp
+
+    push dword[ebp+8] ; buf
+    push dword[ebp+12] ; len
+    mov eax, 14 ; prof_read syscall
+    int 0x80
+    add esp, 8 ; pop buf, len
+
+    pop ebp
+    ret
+
+; void yield()
+yield:
+    push ebp
+    mov ebp, esp
+
+    mov eax, 15 ; yield syscall
+    int 0x80
+
+    pop ebp
+    ret
+
+; int fopen(const char* path, const char* mode)
+fopen:
+    push ebp
+    mov ebp, esp
+
+    push dword[ebp+8] ; path
+    push dword[ebp+12] ; mode
+    mov eax, 16 ; fopen syscall
+    int 0x80
+    add esp, 8 ; pop path, mode
+
+    pop ebp
+    ret
+
+; int fread(void* buf, int size, int nmembs, int fd)
+fread:
+    push ebp
+    mov ebp, esp
+
+    push dword[ebp+8] ; buf
+    push dword[ebp+12] ; size
+    push dword[ebp+16] ; nmembs
+    push dword[ebp+20] ; fd
+    mov eax, 17 ; fread syscall
+    int 0x80
+    add esp, 16 ; pop buf, size, nmembs, fd
+
+    pop ebp
+    ret
+
+; int fstat(int fd, struct file_stat* stat)
+fstat:
+    push ebp
+    mov ebp, esp
+
+    push dword[ebp+8] ; fd
+    push dword[ebp+12] ; stat
+    mov eax, 18 ; fstat syscall
+    int 0x80
+    add esp, 8 ; pop fd, stat
+
+    pop ebp
+    ret
+
+; int fclose(int fd)
+fclose:
+    push ebp
+    mov ebp, esp
+
+    push dword[ebp+8] ; fd
+    mov eax, 19 ; fclose syscall
+    int 0x80
+    add esp, 4 ; pop fd
+
+    pop ebp
+    ret
+
+; void* sbrk(int increment)
+sbrk:
+    push ebp
+    mov ebp, esp
+
+    push dword[ebp+8] ; increment
+    mov eax, 20 ; sbrk syscall
+    int 0x80
+    add esp, 4 ; pop increment
+
+    pop ebp
+    ret
+
+;int mprotect(void* va_start, void* va_end, int flags);
+mprotect:
+    push ebp
+    mov ebp, esp
+
+    push dword[ebp+8] ; va_start
+    push dword[ebp+12] ; va_end
+    push dword[ebp+16] ; flags
+    mov eax, 21 ; mprotect syscall
+    int 0x80
+    add esp, 12 ; pop va_start, va_end, flags
+
+    pop ebp
+    ret
+
+; int fwrite(const void* buf, int size, int nmembs, int fd)
+fwrite:
+    push ebp
+    mov ebp, esp
+
+    push dword[ebp+8] ; buf
+    push dword[ebp+12] ; size
+    push dword[ebp+16] ; nmembs
+    push dword[ebp+20] ; fd
+    mov eax, 22 ; fwrite syscall
+    int 0x80
+    add esp, 16 ; pop buf, size, nmembs, fd
+
+    pop ebp
+    ret
+
+; int unlink(const char* path)
+unlink:
+    push ebp
+    mov ebp, esp
+
+    push dword[ebp+8] ; path
+    mov eax, 23 ; unlink syscall
+    int 0x80
+    add esp, 4 ; pop path
+
+    pop ebp
+    ret
+
+; int ftruncate(int fd, int size)
+ftruncate:
+    push ebp
+    mov ebp, esp
+
+    push dword[ebp+8] ; fd
+    push dword[ebp+12] ; size
+    mov eax, 24 ; ftruncate syscall
+    int 0x80
+    add esp, 8 ; pop fd, size
+
+    pop ebp
+    ret
+
+; int fsync(int fd)
+fsync:
+    push ebp
+    mov ebp, esp
+
+    push dword[ebp+8] ; fd
+    mov eax, 25 ; fsync syscall
+    int 0x80
+    add esp, 4 ; pop fd
+
+    pop ebp
+    ret
@@ -4,14 +4,7 @@
 #include "include/string.h"
 #include <stdarg.h>
 
-// ----------------- Heap implementation start ------------ //
-
-// A very very dirty malloc implementation for now
-// Will come back and update this to use a free list like done in my OS class.
-
-#define HEAP_TOP 0xc0000000
-#define HEAP_INFO_MAGIC 198913
-#define HEAP_ALLOC_CHUNK (1024 * 4) // 4 KB
+// page alignment of user addresses, malloc lives in malloc.c
 
 unsigned int up_align(unsigned int va) {
     if (va % 4096 == 0) {
@@ -22,47 +15,6 @@ unsigned int up_align(unsigned int va) {
 
 unsigned int down_align(unsigned int va) { return va - va % 4096; }
 
-struct malloc_info {
-    size_t size;
-    int magic;
-};
-
-// grows down
-size_t heap_end = HEAP_TOP;
-size_t heap_curr = HEAP_TOP;
-
-void *malloc(size_t size) {
-    size_t alloc_size = size + sizeof(struct malloc_info);
-    if (heap_curr - alloc_size < heap_end) {
-        // need more space
-        unsigned int new_end = down_align(heap_end - alloc_size);
-        // Invariant: heap_end is always aligned
-        int res = mmap((void *)(new_end), (void *)heap_end, O_READ | O_WRITE);
-        if (res != 0) {
-            return (void *)0;
-        }
-        heap_end = new_end;
-    }
-    // enough space
-    heap_curr -= alloc_size;
-    struct malloc_info *info = (struct malloc_info *)heap_curr;
-    info->size = size;
-    info->magic = HEAP_INFO_MAGIC;
-    return (void *)(heap_curr + sizeof(struct malloc_info));
-}
-
-void free(void *ptr) {
-    struct malloc_info *info =
-        (struct malloc_info *)(ptr - sizeof(struct malloc_info));
-    if (info->magic != HEAP_INFO_MAGIC) {
-        return;
-    }
-    // TODO: free memory
-    return;
-}
-
-// ----------------- Heap implementation end ------------ //
-
 // ----------------- String functions start ------------------- //
 #define MAX_DIGITS 13 // 32-bit int max digits (10)
 
@@ -210,6 +162,23 @@ int istrncmp(const char *str1, const char *str2, int maxlen) {
 
 bool is_digit(char c) { return c >= '0' && c <= '9'; }
 
+void *memset(void *ptr, int c, size_t size) {
+    char *p = ptr;
+    for (size_t i = 0; i < size; i++) {
+        p[i] = (char)c;
+    }
+    return ptr;
+}
+
+void *memcpy(void *dst, const void *src, size_t size) {
+    char *d = dst;
+    const char *s = src;
+    for (size_t i = 0; i < size; i++) {
+        d[i] = s[i];
+    }
+    return dst;
+}
+
 void str_to_lower(char *str) {
     int i = 0;
     while (str[i]) {
@@ -344,37 +313,22 @@ int printf(const char *fmt, ...) {
     return 0;
 }
 
-static char get_key_blocking() {
-    char c;
-    while (1) {
-        c = get_key();
-        if (c != 0) {
-            return c;
-        }
-    }
-}
-
-// returns line read while also printing it to the screen
+// returns line read while also printing it to the screen, the kernel does
+// the echoing and line editing while the tty is in canonical mode. It stays
+// canonical after, so what is typed before the next call is a line too.
 void readline_terminal(char *buf, int max_len) {
-    int idx = 0;
-    while (idx < max_len) {
-        char key = get_key_blocking();
-        if (key == 0x0d) {
-            // ENTER key
-            put_char('\n');
-            buf[idx] = 0;
-            return;
-        } else if (key == 0x08) {
-            // BACKSPACE key
-            if (idx > 0) {
-                buf[--idx] = 0;
-                put_char(key);
-            }
-        } else {
-            put_char(key);
-            buf[idx++] = key;
-        }
+    if (max_len <= 0) {
+        return;
+    }
+    tty_mode(TTY_MODE_CANONICAL);
+    int n = tty_read(buf, max_len - 1);
+    if (n < 0) {
+        n = 0;
+    }
+    if (n > 0 && buf[n - 1] == '\n') {
+        n--;
     }
+    buf[n] = 0;
 }
 
 // ---------------- Stdio functions End ------------------ //
@@ -399,7 +353,7 @@ void test_mmap_unmap() {
         }
     }
     // print((char*) va_start, 100);
-    res = munmap((void *)va_start);
+    res = munmap((void *)va_start, (void *)va_end);
     if (res != 0) {
         // print("munmap failed\n", 100);
         while (1) {
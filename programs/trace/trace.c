@@ -0,0 +1,61 @@
+#include "include/stdio.h"
+#include "include/stdlib.h"
+#include "include/string.h"
+
+// Dumps the kernel trace (src/trace/trace.h) as text the host can decode
+// with trace.py: a TRACE BEGIN line, one `T <hex>` line per 16 byte event
+// (its raw little endian bytes) and a TRACE END line.
+//
+//   trace      drains whatever is buffered
+//   trace -f   keeps draining until a key is pressed
+
+#define EVENT_SIZE 16
+#define EVENTS_PER_READ 64
+
+static const char hex[] = "0123456789abcdef";
+
+static void print_event(unsigned char *ev) {
+    char line[2 + EVENT_SIZE * 2 + 1];
+    line[0] = 'T';
+    line[1] = ' ';
+    for (int i = 0; i < EVENT_SIZE; i++) {
+        line[2 + 2 * i] = hex[ev[i] >> 4];
+        line[3 + 2 * i] = hex[ev[i] & 0xf];
+    }
+    line[sizeof(line) - 1] = '\n';
+    print(line, sizeof(line));
+}
+
+static int drain(unsigned char *buf) {
+    int n = trace_read(buf, EVENT_SIZE * EVENTS_PER_READ);
+    if (n < 0) {
+        printf("trace_read failed: %d\n", n);
+        return n;
+    }
+    for (int off = 0; off < n; off += EVENT_SIZE) {
+        print_event(buf + off);
+    }
+    return n;
+}
+
+int main(int argc, char **argv) {
+    static unsigned char buf[EVENT_SIZE * EVENTS_PER_READ];
+    bool follow = argc >= 2 && strncmp(argv[1], "-f", 2) == 0;
+
+    printf("TRACE BEGIN\n");
+    if (follow) {
+        // any key stops it, not just a line
+        tty_mode(TTY_MODE_RAW);
+        while (get_key() == 0) {
+            if (drain(buf) < 0) {
+                break;
+            }
+        }
+        tty_mode(TTY_MODE_CANONICAL);
+    } else {
+        while (drain(buf) > 0) {
+        }
+    }
+    printf("TRACE END\n");
+    return 0;
+}
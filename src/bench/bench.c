@@ -0,0 +1,268 @@
+#include "bench.h"
+#include "console/console.h"
+#include "cpu/cpu.h"
+#include "cpu/spinlock.h"
+#include "dev/serial.h"
+#include "dev/tty.h"
+#include "disk/bcache.h"
+#include "disk/streamer.h"
+#include "fs/ext2/ext2.h"
+#include "fs/fat/fat16.h"
+#include "fs/file.h"
+#include "fs/procfs/procfs.h"
+#include "fs/tmpfs/tmpfs.h"
+#include "fs/utils.h"
+#include "io/io.h"
+#include "kernel.h"
+#include "lib/rbtree/rbtree.h"
+#include "lib/ringbuf/ringbuf.h"
+#include "memory/e820/e820.h"
+#include "memory/heap/kcache.h"
+#include "memory/heap/kheap.h"
+#include "memory/heap/zpool.h"
+#include "memory/memory.h"
+#include "memory/paging/paging.h"
+#include "memory/swap/swap.h"
+#include "memory/vma/vma.h"
+#include "status.h"
+#include "trace/prof.h"
+#include "trace/trace.h"
+
+// runs as the only process once the kernel side is done, measures what can
+// only be measured from user mode (syscalls, context switches)
+#define BENCH_USER_PROGRAM "0:/bench"
+#define BENCH_SPAWN_PROGRAM "0:/blank"
+#define BENCH_READ_FILE "0:/shell"
+// the same file from the initramfs
+#define BENCH_TMPFS_READ_FILE "8:/shell"
+
+struct bench_test {
+    char *name;
+    void (*run)();
+};
+
+// Tests that check their own results and panic when something is wrong,
+// which ends the run with a failure
+static struct bench_test tests[] = {
+    {"ringbuf", ringbuf_test},
+    {"rbtree", rbtree_test},
+    {"spinlock", spinlock_test},
+    {"e820", e820_test},
+    {"kcache", kcache_test},
+    {"zpool", zpool_test},
+    {"memory", memory_test},
+    {"paging", paging_test},
+    {"vma", vma_test},
+    {"swap", swap_test},
+    {"fs_utils", test_fs_utils},
+    {"disk_streamer", disk_streamer_test},
+    {"bcache", bcache_test},
+    {"fat16", fat16_test},
+    {"ext2", ext2_test},
+    {"tmpfs", tmpfs_test},
+    {"trace", trace_test},
+    {"prof", prof_test},
+    {"serial", serial_test},
+    {"procfs", procfs_test},
+};
+
+// Runs the operation iters times. Returns the bytes handled per operation (0
+// if that doesn't mean anything) or -error.
+typedef int (*BENCH_FUNC)(int iters);
+
+struct bench {
+    char *name;
+    BENCH_FUNC run;
+    int iters;
+};
+
+static int bench_pid = -1;
+
+static int bench_kmalloc(int iters, int size) {
+    for (int i = 0; i < iters; i++) {
+        void *ptr = kmalloc(size);
+        if (!ptr) {
+            return -STATUS_NOT_ENOUGH_MEM;
+        }
+        kfree(ptr);
+    }
+    return 0;
+}
+
+static int bench_kmalloc_small(int iters) { return bench_kmalloc(iters, 64); }
+
+static int bench_kmalloc_page(int iters) { return bench_kmalloc(iters, 4096); }
+
+// what every new task pays for its address space
+static int bench_page_table(int iters) {
+    struct page_table_32b pt;
+    for (int i = 0; i < iters; i++) {
+        int res = paging_create_4gb_page_tables(
+            PAGE_PRESENT | PAGE_WRITE_ALLOW, &pt);
+        if (res != STATUS_OK) {
+            return res;
+        }
+        paging_free_page_table(&pt);
+    }
+    return 0;
+}
+
+// Load, exit and reap without ever running it. We hold the big kernel lock,
+// no other cpu can pick the task up in between.
+static int bench_process_spawn(int iters) {
+    for (int i = 0; i < iters; i++) {
+        struct process *proc = 0;
+        int res = process_new(BENCH_SPAWN_PROGRAM, &proc);
+        if (res != STATUS_OK) {
+            return res;
+        }
+        process_exit(proc, 0);
+        process_reap(proc);
+    }
+    return 0;
+}
+
+// open, stat, read all of it and close
+static int bench_read(int iters, const char *path) {
+    int res = 0;
+    void *buf = 0;
+    for (int i = 0; i < iters; i++) {
+        int fd = kfopen(path, "r");
+        if (fd <= 0) {
+            res = -STATUS_IO_ERROR;
+            goto out;
+        }
+        struct file_stat stat;
+        kfstat(fd, &stat);
+        if (!buf) {
+            buf = kmalloc(stat.file_size);
+        }
+        if (!buf || kfread(buf, stat.file_size, 1, fd) != 1) {
+            kfclose(fd);
+            res = buf ? -STATUS_IO_ERROR : -STATUS_NOT_ENOUGH_MEM;
+            goto out;
+        }
+        kfclose(fd);
+        res = stat.file_size;
+    }
+
+out:
+    if (buf) {
+        kfree(buf);
+    }
+    return res;
+}
+
+static int bench_file_read(int iters) {
+    return bench_read(iters, BENCH_READ_FILE);
+}
+
+static int bench_tmpfs_read(int iters) {
+    return bench_read(iters, BENCH_TMPFS_READ_FILE);
+}
+
+static struct bench benches[] = {
+    {"kmalloc_kfree_64", bench_kmalloc_small, 10000},
+    {"kmalloc_kfree_4096", bench_kmalloc_page, 10000},
+    {"page_table_create", bench_page_table, 50},
+    {"process_spawn", bench_process_spawn, 20},
+    {"file_read", bench_file_read, 20},
+    {"tmpfs_read", bench_tmpfs_read, 20},
+};
+
+// 64 by 32 bit division without libgcc
+static uint32_t bench_div(uint64_t n, uint32_t d) {
+    uint64_t q = 0;
+    uint64_t r = 0;
+    for (int i = 63; i >= 0; i--) {
+        r = (r << 1) | ((n >> i) & 1);
+        if (r >= d) {
+            r -= d;
+            q |= 1ULL << i;
+        }
+    }
+    return (uint32_t)q;
+}
+
+static void bench_report(struct bench *b, uint64_t cycles, int bytes) {
+    print("BENCH ");
+    print(b->name);
+    print(" iters=");
+    print_int(b->iters);
+    print(" cycles/op=");
+    print_int(bench_div(cycles, b->iters));
+    if (bytes > 0) {
+        print(" bytes/op=");
+        print_int(bytes);
+    }
+    println("");
+}
+
+static void bench_run_kernel(struct bench *b) {
+    // once untimed, so caches (and the kcache magazines) are warm
+    int res = b->run(1);
+    uint64_t start = cpu_read_tsc();
+    if (res >= 0) {
+        res = b->run(b->iters);
+    }
+    uint64_t cycles = cpu_read_tsc() - start;
+    if (res < 0) {
+        print("BENCH ");
+        print(b->name);
+        print(" error=");
+        print_int(res);
+        println("");
+        bench_exit(1);
+        return;
+    }
+    bench_report(b, cycles, res);
+}
+
+// Called instead of loading the shells, kernel_main then starts the user
+// benchmark as the first process
+void bench_run() {
+    println("BENCH BEGIN");
+    for (int i = 0; i < sizeof(tests) / sizeof(tests[0]); i++) {
+        tests[i].run();
+        print("TEST ");
+        print(tests[i].name);
+        println(" ok");
+    }
+    for (int i = 0; i < sizeof(benches) / sizeof(benches[0]); i++) {
+        bench_run_kernel(&benches[i]);
+    }
+
+    struct process *proc = 0;
+    int res = process_new(BENCH_USER_PROGRAM, &proc);
+    if (res != STATUS_OK) {
+        print("BENCH error: can't load " BENCH_USER_PROGRAM " ");
+        print_int(res);
+        println("");
+        bench_exit(1);
+        return;
+    }
+    process_set_parent_pid(proc, proc->pid);
+    process_set_terminal(proc, KERNEL_TERMINAL);
+    process_add_arguments(proc, 1, sizeof(BENCH_USER_PROGRAM),
+                          BENCH_USER_PROGRAM);
+    tty_set_foreground(KERNEL_TERMINAL, proc->pid);
+    bench_pid = proc->pid;
+}
+
+// The run is over when the user benchmark exits
+void bench_process_exited(struct process *proc, int status) {
+    if (!KERNEL_BENCH || proc->pid != bench_pid) {
+        return;
+    }
+    print("BENCH END status=");
+    print_int(status);
+    println("");
+    bench_exit(status);
+}
+
+// qemu exits with (value << 1) | 1, so 1 is a pass and 3 a failure. Without
+// the isa-debug-exit device this returns and the kernel carries on.
+void bench_exit(int status) {
+    serial_flush();
+    port_io_out_byte(BENCH_EXIT_PORT, status ? 1 : 0);
+}
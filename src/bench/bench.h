@@ -0,0 +1,22 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+#include "config.h"
+#include "task/process.h"
+
+// Headless regression run, only in kernels built with KERNEL_BENCH=1 (see
+// `make bench`). Results go to the kernel terminal, and with it to COM1, as
+// lines the host can parse:
+//
+//   BENCH BEGIN
+//   TEST <name> ok
+//   BENCH <name> iters=<n> cycles/op=<c> [bytes/op=<b>]
+//   BENCH END status=<s>
+//
+// then qemu is stopped through its isa-debug-exit device.
+
+void bench_run();
+void bench_process_exited(struct process *proc, int status);
+void bench_exit(int status);
+
+#endif
@@ -6,6 +6,20 @@ BITS 16
 CODE_SEG equ gdt_code - gdt_start
 DATA_SEG equ gdt_data - gdt_start
 
+; the bios memory map goes here for the kernel (E820_MAP_ADDR and
+; E820_MAX_ENTRIES in config.h): a dword count, then 24 byte entries
+E820_MAP equ 0x500
+E820_MAX equ 32
+SMAP equ 0x534D4150 ; 'SMAP'
+
+; sectors before the FAT, the boot sector and then the kernel. The Makefile
+; passes it and fails the build if kernel.bin doesn't fit.
+%ifndef RESERVED_SECTORS
+%error "RESERVED_SECTORS not defined, build with the Makefile"
+%endif
+KERNEL_SECTORS equ RESERVED_SECTORS - 1
+ATA_MAX_SECTORS equ 255 ; the sector count register is a byte
+
 jmp short start ; jump to start of boot sector
 nop
 
@@ -13,7 +27,7 @@ nop
 OEMIdentifier           db 'AMOGOS  '
 BytesPerSector          dw 0x200
 SectorsPerCluster       db 0x80
-ReservedSectors         dw 200
+ReservedSectors         dw RESERVED_SECTORS
 FATCopies               db 0x02
 RootDirEntries          dw 0x40
 NumSectors              dw 0x00
@@ -45,6 +59,8 @@ start16:
     mov sp, 0x7c00 ; BIOS loads the boot sector at 0x7c00
     sti 
 
+    call e820_detect
+
     ; setup & switch to protected mode (32 bit) (4 GB)
     cli
     lgdt[gdt_descriptor] ; setting gdt is necessary to 
@@ -93,14 +109,58 @@ gdt_descriptor:
     dw gdt_end - gdt_start - 1
     dd gdt_start
 
+; Asks the bios for the physical memory map (int 0x15, eax 0xE820) while
+; there is a bios to ask. Count 0 if it has none, the kernel falls back to a
+; fixed heap then.
+e820_detect:
+    mov di, E820_MAP + 4
+    xor ebx, ebx ; continuation, 0 for the first entry
+    xor bp, bp   ; entries stored
+.next:
+    mov eax, 0xE820
+    mov edx, SMAP
+    mov ecx, 24
+    mov dword [di + 20], 1 ; acpi 3 attributes "valid", for bioses that
+                           ; only write 20 bytes
+    int 0x15
+    jc .done ; unsupported, or past the last entry
+    cmp eax, SMAP
+    jne .done
+    jcxz .skip ; empty entry
+    inc bp
+    add di, 24
+    cmp bp, E820_MAX
+    je .done
+.skip:
+    test ebx, ebx ; 0 after the last entry
+    jnz .next
+.done:
+    mov [E820_MAP], bp
+    mov word [E820_MAP + 2], 0
+    ret
+
 [BITS 32] ; Code for protected mode, 32 bit
 load32:
-    ; load kernel into memory
+    ; load kernel into memory, everything up to the FAT
     mov eax, 1    ; start of the kernel sector
                   ; (0th sector is the boot sector)
-    mov ecx, 100  ; number of sectors to read
+    mov esi, KERNEL_SECTORS ; sectors left to read
     mov edi, 0x0100000 ; load kernel at 1 MB
-    call ata_lba_read
+.next_read:
+    mov ecx, esi
+    cmp ecx, ATA_MAX_SECTORS
+    jbe .read
+    mov ecx, ATA_MAX_SECTORS
+.read:
+    sub esi, ecx
+    push eax
+    push ecx
+    call ata_lba_read ; moves edi past what it read
+    pop ecx
+    pop eax
+    add eax, ecx
+    test esi, esi
+    jnz .next_read
     jmp CODE_SEG:0x0100000
 
 ; small ATA driver to read kernel from disk
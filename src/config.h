@@ -9,15 +9,87 @@
 #define MASTER_PIC_INTR_ACK 0x20
 
 #define N_CPU_MAX 32
+#define BSP_KERNEL_STACK_TOP 0x600000      // tss.esp0 of the bootstrap cpu
+#define CPU_KERNEL_STACK_SIZE (1024 * 16) // kmalloc'd for the other cpus
+#define AP_TRAMPOLINE_ADDR 0x70000 // page aligned, below 1MB, see trampoline.asm
+#define LAPIC_TIMER_HZ 100         // scheduler tick of the non boot cpus
+
+// a task that left its cpu less than this many cycles ago is cache hot and
+// is not stolen by idle cpus, unless this many steal attempts in a row failed
+#define SCHED_MIGRATION_COST_CYCLES 1000000 // ~0.5ms at 2GHz
+#define SCHED_CACHE_NICE_TRIES 2
+
+// 1 checks the order spinlocks are taken in, see spinlock.c
+#define LOCKDEP_ENABLED 0
+
+// objects per magazine and full magazines a kcache depot keeps, see kcache.h
+#define KCACHE_MAGAZINE_ROUNDS 16
+#define KCACHE_DEPOT_MAX_FULL 8
+
+// pre-zeroed pages the idle cpus keep ready, and how many they zero between
+// looks for runnable tasks, see zpool.h
+#define ZPOOL_MAX_PAGES 256
+#define ZPOOL_REFILL_BATCH 8
+
+// disk the swap goes to (the primary slave) and pages written out at a time
+#define SWAP_DRIVE 1
+#define SWAP_BATCH 16
+
+// tlb flushes of more pages than this reload cr3 instead of invlpg each one
+#define TLB_FLUSH_MAX_PAGES 32
+
+// per cpu ring of kernel events (16 bytes each, power of two), see trace.h
+#define TRACE_ENABLED 1
+#define TRACE_BUFFER_EVENTS 4096
+
+// per cpu ring of profiler samples (32 bytes each, power of two), see prof.h
+#define PROF_ENABLED 1
+#define PROF_BUFFER_SAMPLES 1024
+#define PROF_STACK_DEPTH 6       // possible return addresses kept per sample
+#define PROF_STACK_SCAN_WORDS 64 // user stack words looked at per sample
+#define PROF_TIMER_MULTIPLIER 10 // PROF_ON_FAST: ~182Hz on the bsp, 1kHz on aps
+
+// 1 boots into the benchmark/test run instead of the shells, see bench.h.
+// Set by `make bench`.
+#ifndef KERNEL_BENCH
+#define KERNEL_BENCH 0
+#endif
+#define BENCH_EXIT_PORT 0xf4 // qemu -device isa-debug-exit,iobase=0xf4
 
 #define DISK_SECTOR_SIZE 512
 
+// sectors the buffer cache holds, sectors read per miss, dirty sectors before
+// they all go to the disk, how long one may stay dirty and sectors written
+// per disk write, see bcache.h
+#define BCACHE_BUFFERS 1024
+#define BCACHE_HASH_BUCKETS 256
+#define BCACHE_READ_AHEAD 8
+#define BCACHE_DIRTY_MAX 512
+#define BCACHE_FLUSH_MS 1000
+#define BCACHE_WRITE_BATCH 128
+
 #define FS_MAX_PATH_LEN 108
 
 #define MAX_FILESYSTEMS 8
+// directories whose names ext2 keeps hashed in memory, and buckets each
+#define EXT2_DIR_CACHE_DIRS 16
+#define EXT2_DIR_HASH_BUCKETS 256
+// drive of the kernel statistics files ("9:/meminfo"), see procfs.h
+#define PROCFS_DRIVE 9
+#define PROCFS_FILE_MAX 4096 // longest text a procfs file is generated to
+// drive of the files in memory ("8:/shell"), the pages they may take and the
+// archive unpacked there at boot, see tmpfs.h
+#define TMPFS_DRIVE 8
+#define TMPFS_MAX_PAGES 4096 // 16 MB
+#define INITRAMFS_FILE "0:/initrd"
 #define MAX_FILE_DESCRIPTORS 1024
 
-#define TOTAL_GDT_SEGS 6
+// null, kernel code/data, user code/data, then one TSS per cpu
+#define TOTAL_GDT_SEGS (5 + N_CPU_MAX)
+
+// where boot.asm leaves the bios memory map, see e820.h
+#define E820_MAP_ADDR 0x500
+#define E820_MAX_ENTRIES 32
 
 #define KHEAP_SAFE_BOUNDARY                                                    \
     0x8000000 // INVARIANT: Kernel will not use physical addresses beyond this
@@ -33,10 +105,27 @@
 
 #define MAX_PROCS 64
 
-#define PROCESS_VMEM_MAX_BLOCKS 10
 #define PROCESS_MAX_OPEN_FILES 10
 
 #define NUM_SYS_CALLS 64
-#define PROCESS_KEYBOARD_BUFFER_SIZE 1024
+#define TTY_INPUT_BUFFER_SIZE 1024 // power of two, see ringbuf
+#define TTY_LINE_MAX 256
+
+#define NUM_TERMINALS 4
+#define TERMINAL_SCROLLBACK_LINES 200 // per terminal, includes the screen
+
+// COM1 mirrors this terminal's output (the kernel log for KERNEL_TERMINAL)
+// and feeds its tty, see serial.h
+#define SERIAL_ENABLED 1
+#define SERIAL_TERMINAL 0
+#define SERIAL_BAUD 115200
+#define SERIAL_TX_BUFFER_SIZE (1024 * 16) // power of two, see ringbuf
+
+// memcpy/memset use SSE2 (if the cpu has it) for at least this many bytes,
+// 0 disables the SSE2 path. Off by default, cpus with fast rep movs/stos
+// beat the SSE2 loop (see memory_bench), try 256 on older ones. Only with
+// the FPU/SSE state of user programs saved, which task switches don't do yet,
+// as the kernel would clobber their xmm registers.
+#define MEMORY_SSE2_MIN_BYTES 0
 
 #endif
\ No newline at end of file
@@ -1,87 +1,306 @@
 #include "console.h"
+#include "config.h"
+#include "io/io.h"
+#include <stdbool.h>
 #include <stdint.h>
 
+#define VGA_CRTC_INDEX_PORT 0x3D4
+#define VGA_CRTC_DATA_PORT 0x3D5
+#define VGA_CRTC_CURSOR_START 0x0A
+#define VGA_CRTC_CURSOR_END 0x0B
+#define VGA_CRTC_CURSOR_HIGH 0x0E
+#define VGA_CRTC_CURSOR_LOW 0x0F
+
+#define CONSOLE_COLOR 15
+
+// A virtual terminal. Output is kept in a ring of lines, the screen shows the
+// last VGA_HEIGHT lines of the ring (or older ones when the view is scrolled
+// back). Terminals that are not active never touch video memory.
+struct terminal {
+    uint16_t lines[TERMINAL_SCROLLBACK_LINES][VGA_WIDTH];
+    // ring index of the line shown on the first screen row
+    int top;
+    // number of lines above the screen that still hold output
+    int history;
+    // number of lines the view is scrolled back, 0 follows the output
+    int view_offset;
+    uint16_t curr_x;
+    uint16_t curr_y;
+    // gets the text written to the terminal as is, 0 if none
+    CONSOLE_SINK sink;
+};
+
 uint16_t *video_mem = 0;
-uint16_t curr_y = 0;
-uint16_t curr_x = 0;
+
+static struct terminal terminals[NUM_TERMINALS];
+static int active_terminal = KERNEL_TERMINAL;
+
+// Screen rows [dirty_start, dirty_end) of the active terminal differ from
+// video memory, they are copied over (and the hardware cursor moved) once per
+// write call in terminal_commit
+static int dirty_start = 0;
+static int dirty_end = 0;
 
 uint16_t make_char(char c, char color) {
     return (color << 8) | c; // Little Endian
 }
 
+// Two cells per word, VGA_WIDTH is even so rows are always word aligned
+static void console_copy_words(uint32_t *dst, const uint32_t *src, int nwords) {
+    for (int i = 0; i < nwords; i++) {
+        dst[i] = src[i];
+    }
+}
+
+static void console_fill_words(uint32_t *dst, uint32_t value, int nwords) {
+    for (int i = 0; i < nwords; i++) {
+        dst[i] = value;
+    }
+}
+
+static uint32_t console_blank_word() {
+    uint32_t blank = make_char(' ', CONSOLE_COLOR);
+    return (blank << 16) | blank;
+}
+
+static struct terminal *terminal_get(int term) {
+    if (term < 0 || term >= NUM_TERMINALS) {
+        return &terminals[KERNEL_TERMINAL];
+    }
+    return &terminals[term];
+}
+
+static bool terminal_is_active(struct terminal *t) {
+    return t == &terminals[active_terminal];
+}
+
+// ring line shown on screen row `row` when following the output
+static uint16_t *terminal_line(struct terminal *t, int row) {
+    return t->lines[(t->top + row) % TERMINAL_SCROLLBACK_LINES];
+}
+
+// ring line shown on screen row `row` taking the scrollback view into account
+static uint16_t *terminal_view_line(struct terminal *t, int row) {
+    int idx = t->top - t->view_offset + row + TERMINAL_SCROLLBACK_LINES;
+    return t->lines[idx % TERMINAL_SCROLLBACK_LINES];
+}
+
+static void terminal_mark_dirty(struct terminal *t, int row_start,
+                                int row_end) {
+    if (!terminal_is_active(t)) {
+        return;
+    }
+    if (dirty_start == dirty_end) {
+        dirty_start = row_start;
+        dirty_end = row_end;
+        return;
+    }
+    if (row_start < dirty_start) {
+        dirty_start = row_start;
+    }
+    if (row_end > dirty_end) {
+        dirty_end = row_end;
+    }
+}
+
+static void console_set_cursor(int x, int y) {
+    uint16_t pos = y * VGA_WIDTH + x;
+    port_io_out_byte(VGA_CRTC_INDEX_PORT, VGA_CRTC_CURSOR_LOW);
+    port_io_out_byte(VGA_CRTC_DATA_PORT, (uint8_t)(pos & 0xFF));
+    port_io_out_byte(VGA_CRTC_INDEX_PORT, VGA_CRTC_CURSOR_HIGH);
+    port_io_out_byte(VGA_CRTC_DATA_PORT, (uint8_t)(pos >> 8));
+}
+
+// Copies the dirty rows of the active terminal to video memory and moves the
+// hardware cursor, should be called once at the end of every write
+static void terminal_commit(struct terminal *t) {
+    if (!terminal_is_active(t)) {
+        return;
+    }
+    for (int row = dirty_start; row < dirty_end; row++) {
+        console_copy_words((uint32_t *)(video_mem + row * VGA_WIDTH),
+                           (uint32_t *)terminal_view_line(t, row),
+                           VGA_WIDTH / 2);
+    }
+    dirty_start = 0;
+    dirty_end = 0;
+
+    if (t->view_offset == 0) {
+        console_set_cursor(t->curr_x, t->curr_y);
+    } else {
+        // park the cursor off screen while looking at the scrollback
+        console_set_cursor(0, VGA_HEIGHT);
+    }
+}
+
+// Scrolling only moves the start of the ring, the old first row stays
+// around as scrollback
+static void terminal_scroll(struct terminal *t) {
+    t->top = (t->top + 1) % TERMINAL_SCROLLBACK_LINES;
+    console_fill_words((uint32_t *)terminal_line(t, VGA_HEIGHT - 1),
+                       console_blank_word(), VGA_WIDTH / 2);
+    if (t->history < TERMINAL_SCROLLBACK_LINES - VGA_HEIGHT) {
+        t->history++;
+    }
+    terminal_mark_dirty(t, 0, VGA_HEIGHT);
+}
+
+static void terminal_init(struct terminal *t) {
+    console_fill_words((uint32_t *)t->lines, console_blank_word(),
+                       TERMINAL_SCROLLBACK_LINES * VGA_WIDTH / 2);
+    t->top = 0;
+    t->history = 0;
+    t->view_offset = 0;
+    t->curr_x = 0;
+    t->curr_y = 0;
+    t->sink = 0;
+}
+
 void console_init() {
     video_mem = (uint16_t *)(0xB8000);
-    for (int y = 0; y < VGA_HEIGHT; y++) {
-        for (int x = 0; x < VGA_WIDTH; x++) {
-            video_mem[VGA_WIDTH * y + x] = make_char(' ', 0);
-        }
+    for (int i = 0; i < NUM_TERMINALS; i++) {
+        terminal_init(&terminals[i]);
     }
+    active_terminal = KERNEL_TERMINAL;
+
+    // underline cursor, scanlines 14-15
+    port_io_out_byte(VGA_CRTC_INDEX_PORT, VGA_CRTC_CURSOR_START);
+    port_io_out_byte(VGA_CRTC_DATA_PORT, 14);
+    port_io_out_byte(VGA_CRTC_INDEX_PORT, VGA_CRTC_CURSOR_END);
+    port_io_out_byte(VGA_CRTC_DATA_PORT, 15);
+
+    struct terminal *t = terminal_get(KERNEL_TERMINAL);
+    terminal_mark_dirty(t, 0, VGA_HEIGHT);
+    terminal_commit(t);
+}
+
+static void terminal_put_char(struct terminal *t, int x, int y, char c,
+                              char color) {
+    terminal_line(t, y)[x] = make_char(c, color);
+    terminal_mark_dirty(t, y, y + 1);
 }
 
-void console_put_char(int x, int y, char c, char color) {
-    video_mem[y * VGA_WIDTH + x] = make_char(c, color);
+static void terminal_newline(struct terminal *t) {
+    t->curr_x = 0;
+    if (t->curr_y == VGA_HEIGHT - 1) {
+        terminal_scroll(t);
+    } else {
+        t->curr_y++;
+    }
 }
 
-void console_backspace() {
-    if (curr_x == 0 && curr_y == 0) {
+static void terminal_backspace(struct terminal *t) {
+    if (t->curr_x == 0 && t->curr_y == 0) {
         return;
     }
-    if (curr_x == 0) {
-        curr_y--;
-        curr_x = VGA_WIDTH - 1;
+    if (t->curr_x == 0) {
+        t->curr_y--;
+        t->curr_x = VGA_WIDTH - 1;
     } else {
-        curr_x--;
+        t->curr_x--;
     }
-    console_put_char(curr_x, curr_y, ' ', 0);
+    terminal_put_char(t, t->curr_x, t->curr_y, ' ', CONSOLE_COLOR);
 }
 
-void console_write_char(char c, char color) {
+// Only updates the terminal's lines, callers must terminal_commit()
+static void terminal_write_char(struct terminal *t, char c, char color) {
     if (c == '\n') {
-        curr_y++;
-        curr_x = 0;
+        terminal_newline(t);
         return;
     }
     if (c == 0x08) {
-        console_backspace();
+        terminal_backspace(t);
         return;
     }
 
-    console_put_char(curr_x, curr_y, c, color);
-    curr_x++;
-    if (curr_x == VGA_WIDTH) {
-        curr_y++;
-        curr_x = 0;
+    terminal_put_char(t, t->curr_x, t->curr_y, c, color);
+    t->curr_x++;
+    if (t->curr_x == VGA_WIDTH) {
+        terminal_newline(t);
     }
 }
 
-void print(char *str) {
-    char *c = str;
-    while (*c) {
-        console_write_char(*c, 15);
-        c++;
+static void terminal_sink(struct terminal *t, const char *buf, int len) {
+    if (t->sink && len > 0) {
+        t->sink(buf, len);
     }
 }
 
-void printn(char *str, int n) {
-    for (int i = 0; i < n; i++) {
+// New output snaps a scrolled back view to the bottom
+static struct terminal *terminal_begin_write(int term) {
+    struct terminal *t = terminal_get(term);
+    if (t->view_offset != 0) {
+        t->view_offset = 0;
+        terminal_mark_dirty(t, 0, VGA_HEIGHT);
+    }
+    return t;
+}
+
+void terminal_printn(int term, char *str, int n) {
+    struct terminal *t = terminal_begin_write(term);
+    int i;
+    for (i = 0; i < n; i++) {
         if (str[i] == '\0') {
             break;
         }
-        console_write_char(str[i], 15);
+        terminal_write_char(t, str[i], CONSOLE_COLOR);
     }
+    terminal_commit(t);
+    terminal_sink(t, str, i);
+}
+
+void terminal_print_char(int term, char c) {
+    struct terminal *t = terminal_begin_write(term);
+    terminal_write_char(t, c, CONSOLE_COLOR);
+    terminal_commit(t);
+    terminal_sink(t, &c, 1);
 }
 
-void print_char(char c) { console_write_char(c, 15); }
+void terminal_clear(int term) {
+    struct terminal *t = terminal_begin_write(term);
+    // push the whole screen into the scrollback instead of dropping it
+    for (int i = 0; i <= t->curr_y; i++) {
+        terminal_scroll(t);
+    }
+    t->curr_x = 0;
+    t->curr_y = 0;
+    terminal_commit(t);
+}
+
+void print(char *str) {
+    struct terminal *t = terminal_begin_write(KERNEL_TERMINAL);
+    char *c = str;
+    while (*c) {
+        terminal_write_char(t, *c, CONSOLE_COLOR);
+        c++;
+    }
+    terminal_commit(t);
+    terminal_sink(t, str, c - str);
+}
+
+void printn(char *str, int n) { terminal_printn(KERNEL_TERMINAL, str, n); }
+
+void print_char(char c) { terminal_print_char(KERNEL_TERMINAL, c); }
 
 void println(char *str) {
-    print(str);
-    print("\n");
+    struct terminal *t = terminal_begin_write(KERNEL_TERMINAL);
+    char *c = str;
+    while (*c) {
+        terminal_write_char(t, *c, CONSOLE_COLOR);
+        c++;
+    }
+    terminal_write_char(t, '\n', CONSOLE_COLOR);
+    terminal_commit(t);
+    terminal_sink(t, str, c - str);
+    terminal_sink(t, "\n", 1);
 }
 
 #define MAX_INT_DIGITS 12 // 32 bit int max ~(2e9) = 10 digits + sign + null
 void print_int(int x) {
+    struct terminal *t = terminal_begin_write(KERNEL_TERMINAL);
     if (x < 0) {
-        print("-");
+        terminal_write_char(t, '-', CONSOLE_COLOR);
+        terminal_sink(t, "-", 1);
         x = -x;
     }
     int cx = x;
@@ -102,17 +321,53 @@ void print_int(int x) {
         x /= 10;
     }
 
+    char digits[MAX_INT_DIGITS];
     for (int j = num_digits - 1; j >= 0; j--) {
-        console_write_char(buf[j], 15);
+        terminal_write_char(t, buf[j], CONSOLE_COLOR);
+        digits[num_digits - 1 - j] = buf[j];
     }
+    terminal_commit(t);
+    terminal_sink(t, digits, num_digits);
 }
 
-void clear_screen() {
-    for (int y = 0; y < VGA_HEIGHT; y++) {
-        for (int x = 0; x < VGA_WIDTH; x++) {
-            video_mem[VGA_WIDTH * y + x] = make_char(' ', 0);
-        }
+void clear_screen() { terminal_clear(KERNEL_TERMINAL); }
+
+int console_active_terminal() { return active_terminal; }
+
+// Makes `term` the visible terminal and repaints the screen from its lines
+void console_switch_terminal(int term) {
+    if (term < 0 || term >= NUM_TERMINALS || term == active_terminal) {
+        return;
     }
-    curr_x = 0;
-    curr_y = 0;
-}
\ No newline at end of file
+    active_terminal = term;
+    struct terminal *t = terminal_get(term);
+    terminal_mark_dirty(t, 0, VGA_HEIGHT);
+    terminal_commit(t);
+}
+
+// Moves the view of the active terminal `lines` lines back (> 0) or forward
+// (< 0) in its scrollback
+void console_scroll_view(int lines) {
+    struct terminal *t = terminal_get(active_terminal);
+    int offset = t->view_offset + lines;
+    if (offset < 0) {
+        offset = 0;
+    }
+    if (offset > t->history) {
+        offset = t->history;
+    }
+    if (offset == t->view_offset) {
+        return;
+    }
+    t->view_offset = offset;
+    terminal_mark_dirty(t, 0, VGA_HEIGHT);
+    terminal_commit(t);
+}
+
+// Output written to `term` from now on is also passed to sink, 0 removes it
+void console_set_sink(int term, CONSOLE_SINK sink) {
+    if (term < 0 || term >= NUM_TERMINALS) {
+        return;
+    }
+    terminal_get(term)->sink = sink;
+}
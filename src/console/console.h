@@ -2,7 +2,13 @@
 #define CONSOLE_H
 
 #define VGA_WIDTH 80
-#define VGA_HEIGHT 20
+#define VGA_HEIGHT 25
+
+// Kernel messages (print, println, ...) always go to the first terminal
+#define KERNEL_TERMINAL 0
+
+// Gets a copy of everything written to a terminal, e.g. the serial port
+typedef void (*CONSOLE_SINK)(const char *buf, int len);
 
 void print(char *str);
 void println(char *str);
@@ -12,4 +18,13 @@ void printn(char *str, int n);
 void print_char(char c);
 void clear_screen();
 
-#endif
\ No newline at end of file
+void terminal_printn(int term, char *str, int n);
+void terminal_print_char(int term, char c);
+void terminal_clear(int term);
+
+int console_active_terminal();
+void console_switch_terminal(int term);
+void console_scroll_view(int lines);
+void console_set_sink(int term, CONSOLE_SINK sink);
+
+#endif
@@ -0,0 +1,95 @@
+#include "cpu.h"
+
+#define CR0_MP (1 << 1)
+#define CR0_EM (1 << 2)
+#define CR0_WP (1 << 16) // read only pages are read only for the kernel too
+#define CR4_PGE (1 << 7)
+#define CR4_OSFXSR (1 << 9)
+#define CR4_OSXMMEXCPT (1 << 10)
+
+void cpu_cpuid(uint32_t leaf, uint32_t *eax, uint32_t *ebx, uint32_t *ecx,
+               uint32_t *edx) {
+    asm volatile("cpuid"
+                 : "=a"(*eax), "=b"(*ebx), "=c"(*ecx), "=d"(*edx)
+                 : "a"(leaf), "c"(0));
+}
+
+bool cpu_has_feature_edx(uint32_t feature) {
+    uint32_t eax, ebx, ecx, edx;
+    cpu_cpuid(1, &eax, &ebx, &ecx, &edx);
+    return (edx & feature) != 0;
+}
+
+// Lets the kernel execute SSE instructions. XMM registers are not saved on
+// task switches, so only code that can't be preempted (i.e. the kernel with
+// interrupts off) may use them.
+void cpu_enable_sse() {
+    uint32_t cr0, cr4;
+    asm volatile("mov %%cr0, %0" : "=r"(cr0));
+    cr0 &= ~CR0_EM;
+    cr0 |= CR0_MP;
+    asm volatile("mov %0, %%cr0" ::"r"(cr0));
+
+    asm volatile("mov %%cr4, %0" : "=r"(cr4));
+    cr4 |= CR4_OSFXSR | CR4_OSXMMEXCPT;
+    asm volatile("mov %0, %%cr4" ::"r"(cr4));
+}
+
+// Entries of pages marked PAGE_GLOBAL stay in the tlb when cr3 changes.
+// Returns false if the cpu can't do that.
+bool cpu_enable_global_pages() {
+    if (!cpu_has_feature_edx(CPUID_FEAT_EDX_PGE)) {
+        return false;
+    }
+    uint32_t cr4;
+    asm volatile("mov %%cr4, %0" : "=r"(cr4));
+    cr4 |= CR4_PGE;
+    asm volatile("mov %0, %%cr4" ::"r"(cr4));
+    return true;
+}
+
+bool cpu_enable_large_pages() {
+    if (!cpu_has_feature_edx(CPUID_FEAT_EDX_PSE)) {
+        return false;
+    }
+    uint32_t cr4;
+    asm volatile("mov %%cr4, %0" : "=r"(cr4));
+    cr4 |= CR4_PSE;
+    asm volatile("mov %0, %%cr4" ::"r"(cr4));
+    return true;
+}
+
+void cpu_enable_write_protect() {
+    uint32_t cr0;
+    asm volatile("mov %%cr0, %0" : "=r"(cr0));
+    cr0 |= CR0_WP;
+    asm volatile("mov %0, %%cr0" ::"r"(cr0));
+}
+
+uint64_t cpu_read_tsc() {
+    uint32_t lo, hi;
+    asm volatile("rdtsc" : "=a"(lo), "=d"(hi));
+    return ((uint64_t)hi << 32) | lo;
+}
+
+// The address the last page fault was on
+uint32_t cpu_read_cr2() {
+    uint32_t cr2;
+    asm volatile("mov %%cr2, %0" : "=r"(cr2));
+    return cr2;
+}
+
+// Turns interrupts off, returns the eflags to hand back to cpu_irq_restore
+uint32_t cpu_irq_save() {
+    uint32_t flags;
+    asm volatile("pushfl; popl %0; cli" : "=r"(flags)::"memory");
+    return flags;
+}
+
+// Interrupts go back on only if they were on before cpu_irq_save, so saves
+// nest
+void cpu_irq_restore(uint32_t flags) {
+    if (flags & EFLAGS_IF) {
+        asm volatile("sti" ::: "memory");
+    }
+}
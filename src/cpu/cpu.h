@@ -0,0 +1,29 @@
+#ifndef CPU_H
+#define CPU_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// CPUID leaf 1 feature bits (edx)
+#define CPUID_FEAT_EDX_PSE (1 << 3)
+#define CPUID_FEAT_EDX_TSC (1 << 4)
+#define CPUID_FEAT_EDX_PGE (1 << 13)
+#define CPUID_FEAT_EDX_SSE2 (1 << 26)
+
+#define EFLAGS_IF (1 << 9)
+
+#define CR4_PSE (1 << 4) // 4 MB pages
+
+void cpu_cpuid(uint32_t leaf, uint32_t *eax, uint32_t *ebx, uint32_t *ecx,
+               uint32_t *edx);
+bool cpu_has_feature_edx(uint32_t feature);
+void cpu_enable_sse();
+bool cpu_enable_global_pages();
+bool cpu_enable_large_pages();
+void cpu_enable_write_protect();
+uint64_t cpu_read_tsc();
+uint32_t cpu_read_cr2();
+uint32_t cpu_irq_save();
+void cpu_irq_restore(uint32_t flags);
+
+#endif
@@ -0,0 +1,177 @@
+#include "lapic.h"
+#include "config.h"
+#include "cpu/cpu.h"
+#include "io/io.h"
+
+// Local APIC registers, offsets from the MMIO base
+#define LAPIC_REG_ID 0x020
+#define LAPIC_REG_TPR 0x080
+#define LAPIC_REG_EOI 0x0B0
+#define LAPIC_REG_SVR 0x0F0
+#define LAPIC_REG_ESR 0x280
+#define LAPIC_REG_ICR_LOW 0x300
+#define LAPIC_REG_ICR_HIGH 0x310
+#define LAPIC_REG_LVT_TIMER 0x320
+#define LAPIC_REG_LVT_LINT0 0x350
+#define LAPIC_REG_LVT_LINT1 0x360
+#define LAPIC_REG_LVT_ERROR 0x370
+#define LAPIC_REG_TIMER_INIT 0x380
+#define LAPIC_REG_TIMER_CURRENT 0x390
+#define LAPIC_REG_TIMER_DIVIDE 0x3E0
+
+#define LAPIC_SVR_ENABLE 0x100
+#define LAPIC_LVT_MASKED 0x10000
+#define LAPIC_LVT_NMI 0x400
+#define LAPIC_LVT_EXTINT 0x700
+#define LAPIC_TIMER_PERIODIC 0x20000
+#define LAPIC_TIMER_DIVIDE_16 0x3
+
+#define LAPIC_ICR_FIXED 0x000
+#define LAPIC_ICR_INIT 0x500
+#define LAPIC_ICR_STARTUP 0x600
+#define LAPIC_ICR_LEVEL_ASSERT 0x4000
+#define LAPIC_ICR_DELIVERY_PENDING 0x1000
+
+#define PIT_FREQUENCY 1193182
+#define PIT_CHANNEL0_DATA_PORT 0x40
+#define PIT_CHANNEL2_DATA_PORT 0x42
+#define PIT_COMMAND_PORT 0x43
+#define PIT_CHANNEL2_GATE_PORT 0x61
+#define PIT_CHANNEL2_GATE 0x01
+#define PIT_CHANNEL2_SPEAKER 0x02
+#define PIT_CHANNEL2_OUT 0x20
+#define PIT_MAX_DELAY_US 50000 // 16 bit counter, ~54ms max
+
+static volatile uint32_t *lapic = (uint32_t *)LAPIC_DEFAULT_BASE;
+
+// lapic timer ticks per LAPIC_TIMER_HZ period, measured once on the bsp
+static uint32_t lapic_timer_count = 0;
+// time stamp counter ticks per ms, measured along with lapic_timer_count
+static uint32_t tsc_rate_khz = 0;
+
+static uint32_t lapic_read(uint32_t reg) { return lapic[reg / 4]; }
+
+static void lapic_write(uint32_t reg, uint32_t value) {
+    lapic[reg / 4] = value;
+    (void)lapic_read(LAPIC_REG_ID); // wait for the write to land
+}
+
+void lapic_set_base(uint32_t base) { lapic = (uint32_t *)base; }
+
+// Busy waits on PIT channel 2 (the speaker channel, it doesn't raise an
+// interrupt) so it works before interrupts and on any cpu
+void pit_delay_us(uint32_t us) {
+    while (us > 0) {
+        uint32_t chunk = us > PIT_MAX_DELAY_US ? PIT_MAX_DELAY_US : us;
+        uint32_t count = (PIT_FREQUENCY / 1000) * chunk / 1000;
+        if (count == 0) {
+            count = 1;
+        }
+
+        uint8_t gate = port_io_input_byte(PIT_CHANNEL2_GATE_PORT);
+        gate &= ~(PIT_CHANNEL2_SPEAKER | PIT_CHANNEL2_GATE);
+        port_io_out_byte(PIT_CHANNEL2_GATE_PORT, gate);
+
+        // channel 2, lobyte/hibyte, mode 0 (interrupt on terminal count)
+        port_io_out_byte(PIT_COMMAND_PORT, 0xB0);
+        port_io_out_byte(PIT_CHANNEL2_DATA_PORT, count & 0xFF);
+        port_io_out_byte(PIT_CHANNEL2_DATA_PORT, (count >> 8) & 0xFF);
+
+        // a rising edge on the gate starts the count
+        port_io_out_byte(PIT_CHANNEL2_GATE_PORT, gate | PIT_CHANNEL2_GATE);
+        while ((port_io_input_byte(PIT_CHANNEL2_GATE_PORT) &
+                PIT_CHANNEL2_OUT) == 0) {
+        }
+        us -= chunk;
+    }
+}
+
+// Channel 0 (IRQ0) as a rate generator ticking mult times faster than the
+// ~18.2Hz the BIOS left it at
+void pit_timer_set_rate(uint32_t mult) {
+    uint32_t divisor = 0x10000 / (mult ? mult : 1);
+    // channel 0, lobyte/hibyte, mode 2 (rate generator), 0 means 0x10000
+    port_io_out_byte(PIT_COMMAND_PORT, 0x34);
+    port_io_out_byte(PIT_CHANNEL0_DATA_PORT, divisor & 0xFF);
+    port_io_out_byte(PIT_CHANNEL0_DATA_PORT, (divisor >> 8) & 0xFF);
+}
+
+void lapic_init(bool bsp) {
+    lapic_write(LAPIC_REG_SVR, LAPIC_SVR_ENABLE | LAPIC_SPURIOUS_VECTOR);
+    lapic_write(LAPIC_REG_TPR, 0);
+
+    if (bsp) {
+        // keep the PIC wired to the bsp (virtual wire mode)
+        lapic_write(LAPIC_REG_LVT_LINT0, LAPIC_LVT_EXTINT);
+    } else {
+        lapic_write(LAPIC_REG_LVT_LINT0, LAPIC_LVT_MASKED);
+    }
+    lapic_write(LAPIC_REG_LVT_LINT1, LAPIC_LVT_NMI);
+    lapic_write(LAPIC_REG_LVT_ERROR, LAPIC_LVT_MASKED);
+    lapic_write(LAPIC_REG_LVT_TIMER, LAPIC_LVT_MASKED);
+
+    // the error status register must be written before it is read
+    lapic_write(LAPIC_REG_ESR, 0);
+    lapic_read(LAPIC_REG_ESR);
+    lapic_eoi();
+}
+
+uint8_t lapic_id() { return lapic_read(LAPIC_REG_ID) >> 24; }
+
+void lapic_eoi() { lapic_write(LAPIC_REG_EOI, 0); }
+
+static void lapic_send_ipi(uint8_t apic_id, uint32_t icr_low) {
+    lapic_write(LAPIC_REG_ICR_HIGH, ((uint32_t)apic_id) << 24);
+    lapic_write(LAPIC_REG_ICR_LOW, icr_low);
+    while (lapic_read(LAPIC_REG_ICR_LOW) & LAPIC_ICR_DELIVERY_PENDING) {
+    }
+}
+
+void lapic_send_init(uint8_t apic_id) {
+    lapic_send_ipi(apic_id, LAPIC_ICR_INIT | LAPIC_ICR_LEVEL_ASSERT);
+}
+
+// vector is the physical page the cpu starts executing at in real mode
+void lapic_send_startup(uint8_t apic_id, uint8_t vector) {
+    lapic_send_ipi(apic_id, LAPIC_ICR_STARTUP | vector);
+}
+
+// Plain interrupt `vector` on another cpu
+void lapic_send_fixed(uint8_t apic_id, uint8_t vector) {
+    lapic_send_ipi(apic_id, LAPIC_ICR_FIXED | vector);
+}
+
+// Counts lapic timer ticks over 10ms of PIT time, all cpus share the bus
+// clock so the bsp measures for everybody
+void lapic_timer_calibrate() {
+    lapic_write(LAPIC_REG_TIMER_DIVIDE, LAPIC_TIMER_DIVIDE_16);
+    lapic_write(LAPIC_REG_LVT_TIMER, LAPIC_LVT_MASKED);
+    lapic_write(LAPIC_REG_TIMER_INIT, 0xFFFFFFFF);
+    uint64_t tsc_start = cpu_read_tsc();
+    pit_delay_us(10000);
+    uint32_t elapsed = 0xFFFFFFFF - lapic_read(LAPIC_REG_TIMER_CURRENT);
+    tsc_rate_khz = (uint32_t)(cpu_read_tsc() - tsc_start) / 10;
+    lapic_write(LAPIC_REG_TIMER_INIT, 0);
+
+    lapic_timer_count = elapsed * 100 / LAPIC_TIMER_HZ;
+    if (lapic_timer_count == 0) {
+        lapic_timer_count = 1;
+    }
+}
+
+// 0 until lapic_timer_calibrate ran
+uint32_t tsc_khz() { return tsc_rate_khz; }
+
+// Periodic LAPIC_TIMER_VECTOR interrupts at LAPIC_TIMER_HZ on this cpu
+void lapic_timer_start() {
+    lapic_write(LAPIC_REG_TIMER_DIVIDE, LAPIC_TIMER_DIVIDE_16);
+    lapic_write(LAPIC_REG_LVT_TIMER, LAPIC_TIMER_PERIODIC | LAPIC_TIMER_VECTOR);
+    lapic_write(LAPIC_REG_TIMER_INIT, lapic_timer_count);
+}
+
+// Makes this cpu's timer tick mult times LAPIC_TIMER_HZ, writing the initial
+// count restarts the period
+void lapic_timer_set_rate(uint32_t mult) {
+    uint32_t count = lapic_timer_count / (mult ? mult : 1);
+    lapic_write(LAPIC_REG_TIMER_INIT, count ? count : 1);
+}
@@ -0,0 +1,31 @@
+#ifndef LAPIC_H
+#define LAPIC_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define LAPIC_DEFAULT_BASE 0xFEE00000
+
+// interrupt vectors owned by the local apic
+#define LAPIC_TIMER_VECTOR 0x40
+#define TLB_SHOOTDOWN_VECTOR 0x41
+#define LAPIC_SPURIOUS_VECTOR 0xFF
+
+void lapic_set_base(uint32_t base);
+void lapic_init(bool bsp);
+uint8_t lapic_id();
+void lapic_eoi();
+
+void lapic_send_init(uint8_t apic_id);
+void lapic_send_startup(uint8_t apic_id, uint8_t vector);
+void lapic_send_fixed(uint8_t apic_id, uint8_t vector);
+
+void lapic_timer_calibrate();
+void lapic_timer_start();
+void lapic_timer_set_rate(uint32_t mult);
+uint32_t tsc_khz();
+
+void pit_delay_us(uint32_t us);
+void pit_timer_set_rate(uint32_t mult);
+
+#endif
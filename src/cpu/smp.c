@@ -0,0 +1,346 @@
+#include "smp.h"
+#include "config.h"
+#include "console/console.h"
+#include "cpu/cpu.h"
+#include "cpu/lapic.h"
+#include "cpu/spinlock.h"
+#include "idt/idt.h"
+#include "kernel.h"
+#include "memory/heap/kheap.h"
+#include "memory/memory.h"
+#include "memory/paging/paging.h"
+#include "memory/paging/tlb.h"
+#include "task/task.h"
+
+#define ACPI_MADT_TYPE_LAPIC 0
+#define ACPI_MADT_LAPIC_ENABLED 0x1
+
+#define MP_ENTRY_PROCESSOR 0
+#define MP_PROCESSOR_ENABLED 0x1
+#define MP_PROCESSOR_ENTRY_SIZE 20
+#define MP_OTHER_ENTRY_SIZE 8
+
+#define BIOS_EBDA_SEGMENT_PTR 0x40E
+#define BIOS_ROM_START 0xE0000
+#define BIOS_ROM_END 0x100000
+
+struct acpi_rsdp {
+    char signature[8]; // "RSD PTR "
+    uint8_t checksum;
+    char oem_id[6];
+    uint8_t revision;
+    uint32_t rsdt_addr;
+} __attribute__((packed));
+
+struct acpi_sdt_header {
+    char signature[4];
+    uint32_t length; // including the header
+    uint8_t revision;
+    uint8_t checksum;
+    char oem_id[6];
+    char oem_table_id[8];
+    uint32_t oem_revision;
+    uint32_t creator_id;
+    uint32_t creator_revision;
+} __attribute__((packed));
+
+// Multiple APIC Description Table, signature "APIC"
+struct acpi_madt {
+    struct acpi_sdt_header header;
+    uint32_t lapic_addr;
+    uint32_t flags;
+    // variable length entries follow
+} __attribute__((packed));
+
+struct acpi_madt_lapic {
+    uint8_t type;
+    uint8_t length;
+    uint8_t processor_id;
+    uint8_t apic_id;
+    uint32_t flags;
+} __attribute__((packed));
+
+// Intel MultiProcessor Specification floating pointer, signature "_MP_"
+struct mp_floating_pointer {
+    char signature[4];
+    uint32_t config_addr;
+    uint8_t length; // in 16 byte units
+    uint8_t spec_rev;
+    uint8_t checksum;
+    uint8_t features[5];
+} __attribute__((packed));
+
+struct mp_config_header {
+    char signature[4]; // "PCMP"
+    uint16_t length;
+    uint8_t spec_rev;
+    uint8_t checksum;
+    char oem_id[8];
+    char product_id[12];
+    uint32_t oem_table_addr;
+    uint16_t oem_table_size;
+    uint16_t entry_count;
+    uint32_t lapic_addr;
+    uint16_t extended_length;
+    uint8_t extended_checksum;
+    uint8_t reserved;
+} __attribute__((packed));
+
+struct mp_processor_entry {
+    uint8_t type;
+    uint8_t apic_id;
+    uint8_t apic_version;
+    uint8_t flags;
+    uint32_t signature;
+    uint32_t features;
+    uint32_t reserved[2];
+} __attribute__((packed));
+
+// trampoline.asm
+extern uint8_t ap_trampoline_start[];
+extern uint8_t ap_trampoline_end[];
+extern uint8_t ap_trampoline_stack[];
+extern uint8_t ap_trampoline_cr3[];
+extern uint8_t ap_trampoline_cr4[];
+extern uint8_t ap_trampoline_entry[];
+
+// where a trampoline variable lives in the copy the aps run
+#define TRAMPOLINE_VAR(sym)                                                    \
+    ((uint32_t *)(AP_TRAMPOLINE_ADDR + ((sym) - ap_trampoline_start)))
+
+static struct cpu cpus[N_CPU_MAX] = {
+    {.id = 0, .started = true, .kstack_top = (void *)BSP_KERNEL_STACK_TOP}};
+static int num_cpus = 1;
+
+// cpu index by local apic id, valid once lapic_ready is set
+static uint8_t apic_to_cpu[256];
+static bool lapic_ready = false;
+
+static struct spinlock kernel_big_lock = SPINLOCK_INIT("kernel");
+
+int smp_num_cpus() { return num_cpus; }
+
+// Slots from smp_num_cpus() on exist but are never started
+struct cpu *smp_get_cpu(int id) {
+    if (id < 0 || id >= N_CPU_MAX) {
+        return 0;
+    }
+    return &cpus[id];
+}
+
+int get_cpu_id() {
+    if (!lapic_ready) {
+        return 0;
+    }
+    return apic_to_cpu[lapic_id()];
+}
+
+struct cpu *cpu_current() { return &cpus[get_cpu_id()]; }
+
+// The holder may be waiting for us to flush our tlb
+void kernel_lock() { spin_lock_relax(&kernel_big_lock, tlb_poll); }
+
+void kernel_unlock() { spin_unlock(&kernel_big_lock); }
+
+bool kernel_lock_held() { return spin_lock_held(&kernel_big_lock); }
+
+// ---- cpu discovery ----
+
+static bool smp_checksum_ok(void *ptr, uint32_t len) {
+    uint8_t sum = 0;
+    for (uint32_t i = 0; i < len; i++) {
+        sum += ((uint8_t *)ptr)[i];
+    }
+    return sum == 0;
+}
+
+// Tables the bios leaves for us start on a 16 byte boundary
+static void *smp_scan(uint32_t start, uint32_t len, const char *signature,
+                      int signature_len, uint32_t checksum_len) {
+    for (uint32_t addr = start; addr + checksum_len <= start + len;
+         addr += 16) {
+        if (memcmp((void *)addr, signature, signature_len) == 0 &&
+            smp_checksum_ok((void *)addr, checksum_len)) {
+            return (void *)addr;
+        }
+    }
+    return 0;
+}
+
+// first KB of the EBDA, then the bios rom
+static void *smp_scan_bios(const char *signature, int signature_len,
+                           uint32_t checksum_len) {
+    uint32_t ebda = (*(uint16_t *)BIOS_EBDA_SEGMENT_PTR) << 4;
+    void *res = 0;
+    if (ebda) {
+        res = smp_scan(ebda, 1024, signature, signature_len, checksum_len);
+    }
+    if (!res) {
+        res = smp_scan(BIOS_ROM_START, BIOS_ROM_END - BIOS_ROM_START,
+                       signature, signature_len, checksum_len);
+    }
+    return res;
+}
+
+static void smp_add_cpu(uint8_t apic_id) {
+    if (apic_id == cpus[0].apic_id) {
+        return; // the bsp is always cpus[0]
+    }
+    if (num_cpus >= N_CPU_MAX) {
+        return;
+    }
+    struct cpu *cpu = &cpus[num_cpus];
+    cpu->id = num_cpus;
+    cpu->apic_id = apic_id;
+    num_cpus++;
+}
+
+static bool smp_detect_acpi() {
+    struct acpi_rsdp *rsdp =
+        smp_scan_bios("RSD PTR ", 8, sizeof(struct acpi_rsdp));
+    if (!rsdp) {
+        return false;
+    }
+    struct acpi_sdt_header *rsdt = (void *)rsdp->rsdt_addr;
+    if (memcmp(rsdt->signature, "RSDT", 4) != 0 ||
+        !smp_checksum_ok(rsdt, rsdt->length)) {
+        return false;
+    }
+
+    uint32_t *tables = (uint32_t *)(rsdt + 1);
+    int num_tables = (rsdt->length - sizeof(*rsdt)) / sizeof(uint32_t);
+    for (int i = 0; i < num_tables; i++) {
+        struct acpi_madt *madt = (void *)tables[i];
+        if (memcmp(madt->header.signature, "APIC", 4) != 0 ||
+            !smp_checksum_ok(madt, madt->header.length)) {
+            continue;
+        }
+
+        lapic_set_base(madt->lapic_addr);
+        cpus[0].apic_id = lapic_id();
+        uint8_t *entry = (uint8_t *)(madt + 1);
+        uint8_t *end = (uint8_t *)madt + madt->header.length;
+        while (entry < end && entry[1] != 0) {
+            struct acpi_madt_lapic *lapic_entry = (void *)entry;
+            if (lapic_entry->type == ACPI_MADT_TYPE_LAPIC &&
+                (lapic_entry->flags & ACPI_MADT_LAPIC_ENABLED)) {
+                smp_add_cpu(lapic_entry->apic_id);
+            }
+            entry += lapic_entry->length;
+        }
+        return true;
+    }
+    return false;
+}
+
+static bool smp_detect_mp() {
+    struct mp_floating_pointer *fp =
+        smp_scan_bios("_MP_", 4, sizeof(struct mp_floating_pointer));
+    if (!fp || !fp->config_addr) {
+        // no table or one of the spec's default configurations, which we
+        // don't bother with
+        return false;
+    }
+    struct mp_config_header *config = (void *)fp->config_addr;
+    if (memcmp(config->signature, "PCMP", 4) != 0 ||
+        !smp_checksum_ok(config, config->length)) {
+        return false;
+    }
+
+    lapic_set_base(config->lapic_addr);
+    cpus[0].apic_id = lapic_id();
+    uint8_t *entry = (uint8_t *)(config + 1);
+    for (int i = 0; i < config->entry_count; i++) {
+        if (entry[0] != MP_ENTRY_PROCESSOR) {
+            entry += MP_OTHER_ENTRY_SIZE;
+            continue;
+        }
+        struct mp_processor_entry *proc = (void *)entry;
+        if (proc->flags & MP_PROCESSOR_ENABLED) {
+            smp_add_cpu(proc->apic_id);
+        }
+        entry += MP_PROCESSOR_ENTRY_SIZE;
+    }
+    return true;
+}
+
+// ---- ap startup ----
+
+static void smp_ap_main() {
+    struct cpu *cpu = cpu_current();
+    gdt_reload();
+    tss_init(cpu);
+    idt_init_ap();
+    kpaging_init_ap();
+    memory_init_ap();
+    lapic_init(false);
+    lapic_timer_start();
+    cpu->started = true;
+
+    // idle until the scheduler hands us something
+    kernel_lock();
+    task_switch_and_run_any();
+}
+
+static void smp_start_ap(struct cpu *cpu) {
+    uint8_t *kstack = kmalloc(CPU_KERNEL_STACK_SIZE);
+    if (!kstack) {
+        return;
+    }
+    cpu->kstack_top = kstack + CPU_KERNEL_STACK_SIZE;
+    *TRAMPOLINE_VAR(ap_trampoline_stack) = (uint32_t)cpu->kstack_top;
+
+    // INIT, wait 10ms, then STARTUP (twice if the first one is missed)
+    lapic_send_init(cpu->apic_id);
+    pit_delay_us(10000);
+    for (int i = 0; i < 2 && !cpu->started; i++) {
+        lapic_send_startup(cpu->apic_id, AP_TRAMPOLINE_ADDR >> 12);
+        pit_delay_us(200);
+    }
+    for (int ms = 0; ms < 100 && !cpu->started; ms++) {
+        pit_delay_us(1000);
+    }
+}
+
+// Finds the other cpus through ACPI (or the older MP table) and starts them.
+// The bsp takes the big kernel lock here and keeps it until it first drops to
+// user mode, the aps wait for it before scheduling anything.
+void smp_init() {
+    spinlock_register(&kernel_big_lock);
+    kernel_lock();
+
+    if (!smp_detect_acpi() && !smp_detect_mp()) {
+        cpus[0].apic_id = lapic_id();
+    }
+    for (int i = 0; i < num_cpus; i++) {
+        apic_to_cpu[cpus[i].apic_id] = i;
+    }
+    lapic_ready = true;
+    lapic_init(true);
+    lapic_timer_calibrate();
+
+    memcpy((void *)AP_TRAMPOLINE_ADDR, ap_trampoline_start,
+           ap_trampoline_end - ap_trampoline_start);
+    *TRAMPOLINE_VAR(ap_trampoline_cr3) =
+        (uint32_t)paging_kernel_page_table()->cr3;
+    *TRAMPOLINE_VAR(ap_trampoline_cr4) = paging_large_pages() ? CR4_PSE : 0;
+    *TRAMPOLINE_VAR(ap_trampoline_entry) = (uint32_t)smp_ap_main;
+
+    int started = 1;
+    for (int i = 1; i < num_cpus; i++) {
+        smp_start_ap(&cpus[i]);
+        if (cpus[i].started) {
+            started++;
+        } else {
+            print("SMP: cpu ");
+            print_int(i);
+            println(" did not start");
+        }
+    }
+
+    print("SMP: ");
+    print_int(started);
+    print(" of ");
+    print_int(num_cpus);
+    println(" cpus running");
+}
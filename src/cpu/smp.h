@@ -0,0 +1,46 @@
+#ifndef SMP_H
+#define SMP_H
+
+#include "config.h"
+#include "task/sched.h"
+#include "task/tss.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+struct task;
+
+// Per cpu state, cpus[0] is the bootstrap processor (bsp) the kernel started
+// on, the others are application processors (aps) started by smp_init
+struct cpu {
+    int id; // index into the cpus array, what get_cpu_id() returns
+    uint8_t apic_id;
+    volatile bool started;
+
+    // task running on this cpu, 0 while idle
+    struct task *current_task;
+
+    // stack the cpu switches to when entering the kernel from user mode
+    void *kstack_top;
+    struct tss tss;
+
+    // ready tasks waiting for this cpu
+    struct run_queue rq;
+
+    // scheduler ticks, and the ones that found the cpu idle
+    uint32_t ticks;
+    uint32_t idle_ticks;
+};
+
+void smp_init();
+int smp_num_cpus();
+struct cpu *smp_get_cpu(int id);
+struct cpu *cpu_current();
+int get_cpu_id();
+
+// Big kernel lock: held by whichever cpu is running kernel code, except while
+// idling. Taken on every entry from user mode and dropped on the way back.
+void kernel_lock();
+void kernel_unlock();
+bool kernel_lock_held();
+
+#endif
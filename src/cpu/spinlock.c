@@ -0,0 +1,291 @@
+#include "spinlock.h"
+#include "config.h"
+#include "console/console.h"
+#include "cpu.h"
+#include "kernel.h"
+#include "smp.h"
+
+// every lock passed to spinlock_register, for the stats
+static struct spinlock *registered_locks = 0;
+
+void spinlock_register(struct spinlock *lock) {
+    lock->next_registered = registered_locks;
+    registered_locks = lock;
+}
+
+void spin_lock_init(struct spinlock *lock, const char *name) {
+    *lock = (struct spinlock)SPINLOCK_INIT(name);
+    spinlock_register(lock);
+}
+
+struct spinlock *spinlock_first_registered() { return registered_locks; }
+
+// ---- lockdep ----
+// Every lock gets a class the first time it is taken. Taking B while holding
+// A records the edge A -> B, if B can already reach A the two orders can
+// deadlock and we panic right away instead of some day under load.
+
+#define LOCKDEP_MAX_CLASSES 64
+#define LOCKDEP_MAX_HELD 16
+
+static struct spinlock *lockdep_class_lock[LOCKDEP_MAX_CLASSES];
+static int lockdep_num_classes = 0;
+// bit b of lockdep_after[a]: class b was taken while class a was held
+static uint64_t lockdep_after[LOCKDEP_MAX_CLASSES];
+
+static struct spinlock *lockdep_held[N_CPU_MAX][LOCKDEP_MAX_HELD];
+static int lockdep_num_held[N_CPU_MAX];
+
+// Class ids start at 1, 0 means too many locks and is not tracked
+static int lockdep_class(struct spinlock *lock) {
+    if (lock->lockdep_class == 0 &&
+        lockdep_num_classes < LOCKDEP_MAX_CLASSES) {
+        int id = __atomic_add_fetch(&lockdep_num_classes, 1, __ATOMIC_RELAXED);
+        if (id > LOCKDEP_MAX_CLASSES) {
+            return 0;
+        }
+        int expected = 0;
+        if (__atomic_compare_exchange_n(&lock->lockdep_class, &expected, id,
+                                        false, __ATOMIC_RELAXED,
+                                        __ATOMIC_RELAXED)) {
+            lockdep_class_lock[id - 1] = lock;
+        }
+    }
+    return lock->lockdep_class;
+}
+
+// Depth first over the edges, classes - 1 are the bit numbers
+static bool lockdep_reaches(int from, int to) {
+    uint64_t seen = 0;
+    uint64_t todo = 1ull << (from - 1);
+    while (todo) {
+        int c = 0;
+        while (!(todo & (1ull << c))) {
+            c++;
+        }
+        todo &= ~(1ull << c);
+        if (c == to - 1) {
+            return true;
+        }
+        seen |= 1ull << c;
+        todo |= __atomic_load_n(&lockdep_after[c], __ATOMIC_RELAXED) & ~seen;
+    }
+    return false;
+}
+
+static void lockdep_acquire(struct spinlock *lock) {
+    int cpu = get_cpu_id();
+    int class = lockdep_class(lock);
+    for (int i = 0; class && i < lockdep_num_held[cpu]; i++) {
+        int held = lockdep_held[cpu][i]->lockdep_class;
+        if (!held || held == class) {
+            continue;
+        }
+        if (lockdep_reaches(class, held)) {
+            print("lockdep: ");
+            print((char *)lock->name);
+            print(" taken while holding ");
+            println((char *)lockdep_held[cpu][i]->name);
+            panic("lockdep: lock order inversion");
+        }
+        __atomic_fetch_or(&lockdep_after[held - 1], 1ull << (class - 1),
+                          __ATOMIC_RELAXED);
+    }
+    if (lockdep_num_held[cpu] == LOCKDEP_MAX_HELD) {
+        panic("lockdep: too many locks held");
+    }
+    lockdep_held[cpu][lockdep_num_held[cpu]++] = lock;
+}
+
+// Locks are not always dropped in the reverse order they were taken
+static void lockdep_release(struct spinlock *lock) {
+    int cpu = get_cpu_id();
+    for (int i = lockdep_num_held[cpu] - 1; i >= 0; i--) {
+        if (lockdep_held[cpu][i] == lock) {
+            lockdep_held[cpu][i] = lockdep_held[cpu][--lockdep_num_held[cpu]];
+            return;
+        }
+    }
+}
+
+// ---- spinlocks ----
+
+// The holder is cleared before the lock is released, so only the holder can
+// ever see its own id here
+bool spin_lock_held(struct spinlock *lock) {
+    return lock->cpu == get_cpu_id();
+}
+
+// Like spin_lock, calling relax while waiting. For cpus that have to keep
+// answering requests from the holder while they spin with interrupts off.
+void spin_lock_relax(struct spinlock *lock, void (*relax)()) {
+    if (spin_lock_held(lock)) {
+        print((char *)lock->name);
+        panic(": spin_lock on a lock this cpu already holds");
+    }
+    if (LOCKDEP_ENABLED) {
+        lockdep_acquire(lock);
+    }
+
+    uint16_t ticket = __atomic_fetch_add(&lock->next, 1, __ATOMIC_RELAXED);
+    if (__atomic_load_n(&lock->owner, __ATOMIC_ACQUIRE) != ticket) {
+        uint64_t start = cpu_read_tsc();
+        while (__atomic_load_n(&lock->owner, __ATOMIC_ACQUIRE) != ticket) {
+            if (relax) {
+                relax();
+            }
+            asm volatile("pause");
+        }
+        lock->contended++;
+        lock->wait_cycles += cpu_read_tsc() - start;
+    }
+    lock->cpu = get_cpu_id();
+    lock->acquired++;
+}
+
+void spin_lock(struct spinlock *lock) { spin_lock_relax(lock, 0); }
+
+// Only takes the lock if nobody holds or waits for it
+bool spin_trylock(struct spinlock *lock) {
+    uint16_t ticket = __atomic_load_n(&lock->owner, __ATOMIC_ACQUIRE);
+    if (__atomic_load_n(&lock->next, __ATOMIC_RELAXED) != ticket) {
+        return false;
+    }
+    if (!__atomic_compare_exchange_n(&lock->next, &ticket, ticket + 1, false,
+                                     __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+        return false;
+    }
+    if (LOCKDEP_ENABLED) {
+        lockdep_acquire(lock);
+    }
+    lock->cpu = get_cpu_id();
+    lock->acquired++;
+    return true;
+}
+
+void spin_unlock(struct spinlock *lock) {
+    if (!spin_lock_held(lock)) {
+        print((char *)lock->name);
+        panic(": spin_unlock on a lock this cpu doesn't hold");
+    }
+    if (LOCKDEP_ENABLED) {
+        lockdep_release(lock);
+    }
+    lock->cpu = -1;
+    __atomic_store_n(&lock->owner, lock->owner + 1, __ATOMIC_RELEASE);
+}
+
+// For locks also taken from interrupt handlers: an interrupt taking the lock
+// on the cpu that holds it would spin forever
+uint32_t spin_lock_irqsave(struct spinlock *lock) {
+    uint32_t flags = cpu_irq_save();
+    spin_lock(lock);
+    return flags;
+}
+
+void spin_unlock_irqrestore(struct spinlock *lock, uint32_t flags) {
+    spin_unlock(lock);
+    cpu_irq_restore(flags);
+}
+
+// name, times taken, times it had to wait, total kcycles spent waiting
+void spinlock_print_stats() {
+    for (struct spinlock *lock = registered_locks; lock;
+         lock = lock->next_registered) {
+        print((char *)lock->name);
+        print(" acquired ");
+        print_int(lock->acquired);
+        print(" contended ");
+        print_int(lock->contended);
+        print(" wait_kcycles ");
+        print_int((int)(lock->wait_cycles >> 10));
+        print("\n");
+    }
+}
+
+// ---- reader writer locks ----
+
+void rwlock_init(struct rwlock *lock, const char *name) {
+    *lock = (struct rwlock)RWLOCK_INIT(name);
+}
+
+void read_lock(struct rwlock *lock) {
+    bool waited = false;
+    while (1) {
+        int32_t readers = __atomic_load_n(&lock->readers, __ATOMIC_RELAXED);
+        if (readers >= 0 && !lock->writers_waiting &&
+            __atomic_compare_exchange_n(&lock->readers, &readers, readers + 1,
+                                        false, __ATOMIC_ACQUIRE,
+                                        __ATOMIC_RELAXED)) {
+            break;
+        }
+        waited = true;
+        asm volatile("pause");
+    }
+    if (waited) {
+        __atomic_fetch_add(&lock->contended, 1, __ATOMIC_RELAXED);
+    }
+}
+
+void read_unlock(struct rwlock *lock) {
+    __atomic_fetch_sub(&lock->readers, 1, __ATOMIC_RELEASE);
+}
+
+void write_lock(struct rwlock *lock) {
+    __atomic_fetch_add(&lock->writers_waiting, 1, __ATOMIC_RELAXED);
+    int32_t unlocked = 0;
+    if (!__atomic_compare_exchange_n(&lock->readers, &unlocked, -1, false,
+                                     __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+        do {
+            asm volatile("pause");
+            unlocked = 0;
+        } while (!__atomic_compare_exchange_n(&lock->readers, &unlocked, -1,
+                                              false, __ATOMIC_ACQUIRE,
+                                              __ATOMIC_RELAXED));
+        lock->contended++;
+    }
+    __atomic_fetch_sub(&lock->writers_waiting, 1, __ATOMIC_RELAXED);
+}
+
+void write_unlock(struct rwlock *lock) {
+    __atomic_store_n(&lock->readers, 0, __ATOMIC_RELEASE);
+}
+
+// ----------------------- tests ------------------- //
+
+void spinlock_test() {
+    struct spinlock lock;
+    spin_lock_init(&lock, "test");
+    spin_lock(&lock);
+    if (!spin_lock_held(&lock) || spin_trylock(&lock)) {
+        panic("spinlock_test: lock not held");
+    }
+    spin_unlock(&lock);
+    if (spin_lock_held(&lock) || !spin_trylock(&lock)) {
+        panic("spinlock_test: lock not released");
+    }
+    spin_unlock(&lock);
+
+    uint32_t flags = spin_lock_irqsave(&lock);
+    spin_unlock_irqrestore(&lock, flags);
+    if (lock.acquired != 3 || lock.contended != 0) {
+        panic("spinlock_test: bad stats");
+    }
+    // the test lock lives on our stack, don't leave it in the list
+    registered_locks = lock.next_registered;
+
+    struct rwlock rw;
+    rwlock_init(&rw, "test");
+    read_lock(&rw);
+    read_lock(&rw);
+    if (rw.readers != 2) {
+        panic("spinlock_test: readers not counted");
+    }
+    read_unlock(&rw);
+    read_unlock(&rw);
+    write_lock(&rw);
+    if (rw.readers != -1) {
+        panic("spinlock_test: writer not exclusive");
+    }
+    write_unlock(&rw);
+}
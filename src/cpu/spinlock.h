@@ -0,0 +1,58 @@
+#ifndef SPINLOCK_H
+#define SPINLOCK_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Ticket lock, cpus get the lock in the order they asked for it. Not
+// recursive, and a holder must not sleep.
+struct spinlock {
+    volatile uint16_t next;  // ticket handed to the next cpu that asks
+    volatile uint16_t owner; // ticket being served
+    volatile int cpu;        // holder, -1 while free
+    const char *name;
+
+    // stats, only written by the holder
+    uint32_t acquired;
+    uint32_t contended; // acquisitions that had to wait
+    uint64_t wait_cycles;
+
+    int lockdep_class; // 0 until first taken, see LOCKDEP_ENABLED
+    struct spinlock *next_registered;
+};
+
+#define SPINLOCK_INIT(lock_name)                                               \
+    {.next = 0, .owner = 0, .cpu = -1, .name = (lock_name)}
+
+// Many readers or one writer. Waiting writers keep new readers out so they
+// can't be starved.
+struct rwlock {
+    volatile int32_t readers; // -1 while write locked
+    volatile uint32_t writers_waiting;
+    const char *name;
+    uint32_t contended;
+};
+
+#define RWLOCK_INIT(lock_name) {.readers = 0, .name = (lock_name)}
+
+void spin_lock_init(struct spinlock *lock, const char *name);
+void spinlock_register(struct spinlock *lock);
+void spin_lock(struct spinlock *lock);
+void spin_lock_relax(struct spinlock *lock, void (*relax)());
+bool spin_trylock(struct spinlock *lock);
+void spin_unlock(struct spinlock *lock);
+bool spin_lock_held(struct spinlock *lock);
+uint32_t spin_lock_irqsave(struct spinlock *lock);
+void spin_unlock_irqrestore(struct spinlock *lock, uint32_t flags);
+struct spinlock *spinlock_first_registered();
+void spinlock_print_stats();
+
+void rwlock_init(struct rwlock *lock, const char *name);
+void read_lock(struct rwlock *lock);
+void read_unlock(struct rwlock *lock);
+void write_lock(struct rwlock *lock);
+void write_unlock(struct rwlock *lock);
+
+void spinlock_test();
+
+#endif
@@ -0,0 +1,75 @@
+; Real mode entry point of the application processors. smp_init copies
+; everything between ap_trampoline_start and ap_trampoline_end to
+; AP_TRAMPOLINE_ADDR and points the startup IPI at it, so all addresses below
+; are computed relative to that copy instead of to where the kernel is linked.
+
+AP_TRAMPOLINE_ADDR equ 0x70000 ; must match config.h
+%define TRAMPOLINE(label) (label - ap_trampoline_start + AP_TRAMPOLINE_ADDR)
+
+CODE_SEG equ 0x08
+DATA_SEG equ 0x10
+
+section .asm
+
+global ap_trampoline_start, ap_trampoline_end
+global ap_trampoline_stack, ap_trampoline_cr3, ap_trampoline_cr4
+global ap_trampoline_entry
+
+[BITS 16]
+ap_trampoline_start:
+    cli
+    cld
+    ; cs:ip is AP_TRAMPOLINE_ADDR >> 4 : 0
+    mov ax, cs
+    mov ds, ax
+    lgdt [ap_gdt_descriptor - ap_trampoline_start]
+
+    mov eax, cr0
+    or eax, 1
+    mov cr0, eax
+    jmp dword CODE_SEG:TRAMPOLINE(ap_protected_mode)
+
+[BITS 32]
+ap_protected_mode:
+    mov ax, DATA_SEG
+    mov ds, ax
+    mov es, ax
+    mov fs, ax
+    mov gs, ax
+    mov ss, ax
+    mov esp, [TRAMPOLINE(ap_trampoline_stack)]
+
+    ; the bsp's page table may be made of 4 MB pages, pse has to be on
+    ; before paging is
+    mov eax, cr4
+    or eax, [TRAMPOLINE(ap_trampoline_cr4)]
+    mov cr4, eax
+
+    ; same kernel page table as the bsp
+    mov eax, [TRAMPOLINE(ap_trampoline_cr3)]
+    mov cr3, eax
+    mov eax, cr0
+    or eax, 0x80000000
+    mov cr0, eax
+
+    ; void smp_ap_main(), never returns
+    mov eax, [TRAMPOLINE(ap_trampoline_entry)]
+    call eax
+    jmp $
+
+; flat code and data segments with the same selectors as the kernel gdt, the
+; ap loads the real gdt once it is in C
+ap_gdt:
+    dq 0
+    dq 0x00CF9A000000FFFF ; code
+    dq 0x00CF92000000FFFF ; data
+ap_gdt_descriptor:
+    dw ap_gdt_descriptor - ap_gdt - 1
+    dd TRAMPOLINE(ap_gdt)
+
+; filled in by smp_init before each startup IPI
+ap_trampoline_stack: dd 0
+ap_trampoline_cr3: dd 0
+ap_trampoline_cr4: dd 0 ; bits to set
+ap_trampoline_entry: dd 0
+ap_trampoline_end:
@@ -1,9 +1,6 @@
 #ifndef KEYBOARD_H
 #define KEYBOARD_H
 
-#include "task/process.h"
-#include "task/task.h"
-
 #define KEYBOARD_STATE_CAPS_ON 1
 #define KEYBOARD_STATE_CAPS_OFF 0
 
@@ -16,10 +13,8 @@ struct keyboard {
 };
 
 void keyboard_init();
-void keyboard_push(char c, struct process *proc);
-char keyboard_pop(struct task *task);
 void keyboard_set_capslock(struct keyboard *keyboard, int state);
 void keyboard_toggle_capslock(struct keyboard *keyboard);
 int keyboard_get_capslock(struct keyboard *keyboard);
 
-#endif
\ No newline at end of file
+#endif
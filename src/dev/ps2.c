@@ -1,10 +1,11 @@
 #include "ps2.h"
 #include "console/console.h"
 #include "dev/keyboard.h"
+#include "dev/tty.h"
 #include "idt/idt.h"
 #include "io/io.h"
-#include "task/process.h"
 
+#include <stdbool.h>
 #include <stdint.h>
 
 #define ISR_KEYBOARD_INTERRUPT 0x21
@@ -16,6 +17,13 @@
 #define PS2_KEY_RELEASED 0x80
 
 #define PS2_KEYBOARD_CAPSLOCK 0x3A
+#define PS2_KEYBOARD_ALT 0x38
+#define PS2_KEYBOARD_F1 0x3B
+#define PS2_KEYBOARD_F10 0x44
+#define PS2_KEYBOARD_UP 0x48
+#define PS2_KEYBOARD_PAGE_UP 0x49
+#define PS2_KEYBOARD_DOWN 0x50
+#define PS2_KEYBOARD_PAGE_DOWN 0x51
 
 int ps2_init();
 
@@ -33,6 +41,8 @@ struct keyboard ps2_keyboard = {
     .init = ps2_init,
 };
 
+static bool alt_pressed = false;
+
 struct keyboard *get_ps2_keyboard() { return &ps2_keyboard; }
 
 uint8_t ps2_scancode_to_char(uint8_t scancode) {
@@ -48,13 +58,51 @@ uint8_t ps2_scancode_to_char(uint8_t scancode) {
     return c;
 }
 
+// Alt+Fn switches terminals, Alt+Up/Down and Alt+PgUp/PgDn scroll the
+// active terminal's view. Returns true if the key was consumed.
+static bool ps2_handle_console_keys(uint8_t scancode) {
+    if (!alt_pressed) {
+        return false;
+    }
+    if (scancode >= PS2_KEYBOARD_F1 && scancode <= PS2_KEYBOARD_F10) {
+        console_switch_terminal(scancode - PS2_KEYBOARD_F1);
+        return true;
+    }
+    switch (scancode) {
+    case PS2_KEYBOARD_UP:
+        console_scroll_view(1);
+        return true;
+    case PS2_KEYBOARD_DOWN:
+        console_scroll_view(-1);
+        return true;
+    case PS2_KEYBOARD_PAGE_UP:
+        console_scroll_view(VGA_HEIGHT);
+        return true;
+    case PS2_KEYBOARD_PAGE_DOWN:
+        console_scroll_view(-VGA_HEIGHT);
+        return true;
+    }
+    return false;
+}
+
 void keyboard_intr_handler(struct interrupt_frame *frame) {
     uint8_t scancode = port_io_input_byte(PS2_DATA_PORT);
     port_io_input_byte(PS2_DATA_PORT); // Ignore the second byte
 
+    if (scancode == (PS2_KEYBOARD_ALT | PS2_KEY_RELEASED)) {
+        alt_pressed = false;
+        goto out;
+    }
     if (scancode & PS2_KEY_RELEASED) {
         goto out;
     }
+    if (scancode == PS2_KEYBOARD_ALT) {
+        alt_pressed = true;
+        goto out;
+    }
+    if (ps2_handle_console_keys(scancode)) {
+        goto out;
+    }
     if (scancode == PS2_KEYBOARD_CAPSLOCK) {
         keyboard_toggle_capslock(&ps2_keyboard);
         // goto out;
@@ -63,7 +111,9 @@ void keyboard_intr_handler(struct interrupt_frame *frame) {
 
     uint8_t c = ps2_scancode_to_char(scancode);
     if (c != 0x00) {
-        keyboard_push(c, process_current());
+        // keys belong to the visible terminal's tty, not to the task that
+        // happened to be interrupted
+        tty_input(console_active_terminal(), c);
     }
 
 out:
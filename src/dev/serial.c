@@ -0,0 +1,235 @@
+#include "serial.h"
+#include "config.h"
+#include "console/console.h"
+#include "cpu/spinlock.h"
+#include "dev/tty.h"
+#include "idt/idt.h"
+#include "io/io.h"
+#include "kernel.h"
+#include "lib/ringbuf/ringbuf.h"
+
+#define ISR_SERIAL_INTERRUPT 0x24 // IRQ4
+
+#define COM1_PORT 0x3F8
+
+// 16550 registers, offsets from the base port
+#define UART_RBR 0 // receive buffer (read)
+#define UART_THR 0 // transmit holding (write)
+#define UART_DLL 0 // divisor latch low, while LCR_DLAB is set
+#define UART_IER 1
+#define UART_DLM 1 // divisor latch high, while LCR_DLAB is set
+#define UART_IIR 2 // interrupt identification (read)
+#define UART_FCR 2 // fifo control (write)
+#define UART_LCR 3
+#define UART_MCR 4
+#define UART_LSR 5
+
+#define UART_IER_RX 0x01 // received data available
+#define UART_IER_TX 0x02 // transmit holding register empty
+
+#define UART_FCR_ENABLE 0x01
+#define UART_FCR_CLEAR_RX 0x02
+#define UART_FCR_CLEAR_TX 0x04
+#define UART_FCR_TRIGGER_14 0xC0
+
+#define UART_LCR_8N1 0x03
+#define UART_LCR_DLAB 0x80
+
+#define UART_MCR_DTR 0x01
+#define UART_MCR_RTS 0x02
+#define UART_MCR_OUT1 0x04
+#define UART_MCR_OUT2 0x08 // gates the interrupt line to the PIC
+#define UART_MCR_LOOPBACK 0x10
+
+#define UART_LSR_DATA_READY 0x01
+#define UART_LSR_THR_EMPTY 0x20
+
+#define UART_CLOCK 115200
+#define UART_FIFO_SIZE 16
+
+static bool present = false;
+static bool irq_ready = false;
+// bytes of serial_write calls thrown away because the ring was full
+static uint32_t dropped = 0;
+
+// Several cpus write and the transmit interrupt drains, the ring itself only
+// knows one producer and one consumer
+static struct spinlock serial_lock;
+static struct ringbuf tx;
+static uint8_t tx_buf[SERIAL_TX_BUFFER_SIZE];
+
+static uint8_t uart_in(int reg) { return port_io_input_byte(COM1_PORT + reg); }
+
+static void uart_out(int reg, uint8_t value) {
+    port_io_out_byte(COM1_PORT + reg, value);
+}
+
+// Refills the FIFO if the uart is done with the last batch, the transmit
+// interrupt is only left on while there is something left to send.
+// serial_lock must be held.
+static void serial_tx_fill() {
+    if (!(uart_in(UART_LSR) & UART_LSR_THR_EMPTY)) {
+        return;
+    }
+    uint8_t c;
+    for (int i = 0; i < UART_FIFO_SIZE && ringbuf_pop(&tx, &c); i++) {
+        uart_out(UART_THR, c);
+    }
+    if (irq_ready) {
+        uart_out(UART_IER, ringbuf_count(&tx) ? UART_IER_RX | UART_IER_TX
+                                              : UART_IER_RX);
+    }
+}
+
+// Terminals on the other end of the line want "\r\n" and need the erased
+// character blanked out
+static int serial_translate(char c, char *out) {
+    if (c == '\n') {
+        out[0] = '\r';
+        out[1] = '\n';
+        return 2;
+    }
+    if (c == 0x08) {
+        out[0] = 0x08;
+        out[1] = ' ';
+        out[2] = 0x08;
+        return 3;
+    }
+    out[0] = c;
+    return 1;
+}
+
+// Queues buf without waiting, returns the number of bytes of buf that were
+// queued. The rest is dropped when the line can't keep up.
+int serial_write(const char *buf, int len) {
+    if (!present) {
+        return 0;
+    }
+    char chunk[64];
+    int done = 0;
+    uint32_t flags = spin_lock_irqsave(&serial_lock);
+    while (done < len) {
+        int n = 0;
+        int used = 0;
+        while (done + used < len && n <= (int)sizeof(chunk) - 3) {
+            n += serial_translate(buf[done + used], chunk + n);
+            used++;
+        }
+        if (ringbuf_free_space(&tx) < (uint32_t)n) {
+            dropped += len - done;
+            break;
+        }
+        ringbuf_write(&tx, (uint8_t *)chunk, n);
+        done += used;
+    }
+    serial_tx_fill();
+    spin_unlock_irqrestore(&serial_lock, flags);
+    return done;
+}
+
+static void serial_console_sink(const char *buf, int len) {
+    serial_write(buf, len);
+}
+
+// Sends whatever is queued by polling, for panic where no interrupt will
+// ever come. Doesn't take the lock, the cpu may have died holding it.
+void serial_flush() {
+    if (!present) {
+        return;
+    }
+    uint8_t c;
+    while (ringbuf_pop(&tx, &c)) {
+        while (!(uart_in(UART_LSR) & UART_LSR_THR_EMPTY)) {
+        }
+        uart_out(UART_THR, c);
+    }
+}
+
+bool serial_present() { return present; }
+
+uint32_t serial_dropped() { return dropped; }
+
+// The typed byte goes to the terminal's tty like a key would, DEL is what
+// most terminals send for backspace
+static char serial_translate_input(uint8_t c) {
+    if (c == 0x7F) {
+        return 0x08;
+    }
+    return c;
+}
+
+static void serial_intr_handler(struct interrupt_frame *frame) {
+    uart_in(UART_IIR); // clears a pending transmit interrupt
+
+    uint32_t flags = spin_lock_irqsave(&serial_lock);
+    serial_tx_fill();
+    spin_unlock_irqrestore(&serial_lock, flags);
+
+    // the tty echoes through serial_write, so not under the lock
+    while (uart_in(UART_LSR) & UART_LSR_DATA_READY) {
+        tty_input(SERIAL_TERMINAL, serial_translate_input(uart_in(UART_RBR)));
+    }
+
+    port_io_out_byte(MASTER_PIC_PORT, MASTER_PIC_INTR_ACK);
+}
+
+// Right after console_init so the whole log makes it out. Until
+// serial_init_irq, queued output only moves when a later write finds the
+// FIFO empty.
+void serial_init() {
+    if (!SERIAL_ENABLED) {
+        return;
+    }
+    spin_lock_init(&serial_lock, "serial");
+    ringbuf_init(&tx, tx_buf, sizeof(tx_buf));
+
+    uint16_t divisor = UART_CLOCK / SERIAL_BAUD;
+    uart_out(UART_IER, 0);
+    uart_out(UART_LCR, UART_LCR_DLAB);
+    uart_out(UART_DLL, divisor & 0xFF);
+    uart_out(UART_DLM, divisor >> 8);
+    uart_out(UART_LCR, UART_LCR_8N1);
+    uart_out(UART_FCR, UART_FCR_ENABLE | UART_FCR_CLEAR_RX |
+                           UART_FCR_CLEAR_TX | UART_FCR_TRIGGER_14);
+
+    // a byte sent in loopback mode must come back, there is no uart if it
+    // doesn't (reads of a missing port return 0xFF)
+    uart_out(UART_MCR, UART_MCR_LOOPBACK | UART_MCR_RTS | UART_MCR_OUT1 |
+                           UART_MCR_OUT2);
+    uart_out(UART_THR, 0xAE);
+    if (uart_in(UART_RBR) != 0xAE) {
+        return;
+    }
+    uart_out(UART_MCR, UART_MCR_DTR | UART_MCR_RTS | UART_MCR_OUT2);
+
+    present = true;
+    console_set_sink(SERIAL_TERMINAL, serial_console_sink);
+}
+
+// After idt_init, IRQ4 only reaches the bootstrap cpu
+void serial_init_irq() {
+    if (!present) {
+        return;
+    }
+    idt_register_interrupt_call_back(ISR_SERIAL_INTERRUPT,
+                                     serial_intr_handler);
+    uint32_t flags = spin_lock_irqsave(&serial_lock);
+    irq_ready = true;
+    serial_tx_fill();
+    spin_unlock_irqrestore(&serial_lock, flags);
+}
+
+// ----------------------- tests ------------------- //
+
+void serial_test() {
+    if (!present) {
+        return;
+    }
+    // "\n" and backspace grow on the way out, the line is still queued whole
+    uint32_t before = dropped;
+    char line[] = "serial_test\b\n";
+    int n = serial_write(line, sizeof(line) - 1);
+    if (n != sizeof(line) - 1 || dropped != before) {
+        panic("serial_test: line not queued");
+    }
+}
@@ -0,0 +1,22 @@
+#ifndef SERIAL_H
+#define SERIAL_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// 16550 UART on COM1. Writes never wait for the line: bytes go into a ring
+// that the transmit interrupt empties into the uart's 16 byte FIFO, bytes
+// that don't fit are dropped (and counted). Output of SERIAL_TERMINAL is
+// copied to it and bytes received are typed into that terminal's tty, so
+// `qemu -serial stdio` is a second console with the whole kernel log.
+
+void serial_init();
+void serial_init_irq();
+bool serial_present();
+int serial_write(const char *buf, int len);
+void serial_flush();
+uint32_t serial_dropped();
+
+void serial_test();
+
+#endif
@@ -0,0 +1,149 @@
+#include "tty.h"
+#include "console/console.h"
+#include "memory/memory.h"
+#include "status.h"
+#include "task/process.h"
+#include "task/task.h"
+
+static struct tty ttys[NUM_TERMINALS];
+
+void tty_init() {
+    memset(ttys, 0, sizeof(ttys));
+    for (int i = 0; i < NUM_TERMINALS; i++) {
+        ttys[i].index = i;
+        ttys[i].fg_pid = -1;
+        // programs that want every key switch to raw themselves
+        ttys[i].mode = TTY_MODE_CANONICAL;
+        ringbuf_init(&ttys[i].input, ttys[i].input_buf,
+                     sizeof(ttys[i].input_buf));
+    }
+}
+
+struct tty *tty_get(int index) {
+    if (index < 0 || index >= NUM_TERMINALS) {
+        return 0;
+    }
+    return &ttys[index];
+}
+
+// Only the foreground process ever sleeps on its tty (see syscall_tty_read),
+// so a key wakes up at most one task and costs nothing for everybody else
+static void tty_wakeup_reader(struct tty *tty) {
+    struct process *proc = get_proc_by_pid(tty->fg_pid);
+    if (proc && proc->task) {
+        task_wakeup(proc->task, tty);
+    }
+}
+
+// A line is queued whole or not at all, a reader must never see half a line
+// glued to the next one
+static void tty_commit_line(struct tty *tty) {
+    tty->line[tty->line_len++] = '\n';
+    if (ringbuf_free_space(&tty->input) < tty->line_len) {
+        tty->lines_dropped++;
+    } else {
+        ringbuf_write(&tty->input, (uint8_t *)tty->line, tty->line_len);
+    }
+    tty->line_len = 0;
+}
+
+static void tty_canonical_input(struct tty *tty, char c) {
+    switch (c) {
+    case 0x0d: // ENTER
+    case '\n':
+        terminal_print_char(tty->index, '\n');
+        tty_commit_line(tty);
+        tty_wakeup_reader(tty);
+        break;
+
+    case 0x08: // BACKSPACE
+        if (tty->line_len > 0) {
+            tty->line_len--;
+            terminal_print_char(tty->index, 0x08);
+        }
+        break;
+
+    default:
+        if (tty->line_len < TTY_LINE_MAX - 1) {
+            tty->line[tty->line_len++] = c;
+            terminal_print_char(tty->index, c);
+        }
+        break;
+    }
+}
+
+// Called from the keyboard interrupt with a key typed on terminal `index`
+void tty_input(int index, char c) {
+    struct tty *tty = tty_get(index);
+    if (!tty || c == 0x00) {
+        return;
+    }
+    if (tty->mode == TTY_MODE_CANONICAL) {
+        tty_canonical_input(tty, c);
+        return;
+    }
+    if (ringbuf_push(&tty->input, c)) {
+        tty_wakeup_reader(tty);
+    }
+}
+
+// Non blocking, returns 0x00 if nothing is queued
+char tty_getc(struct tty *tty) {
+    uint8_t c;
+    if (!ringbuf_pop(&tty->input, &c)) {
+        return 0x00;
+    }
+    return c;
+}
+
+// Copies up to len queued characters to out, in canonical mode stops after the
+// end of a line. Returns the number of characters copied, 0 if nothing is
+// queued yet.
+int tty_read(struct tty *tty, char *out, int len) {
+    if (tty->mode == TTY_MODE_RAW) {
+        return ringbuf_read(&tty->input, (uint8_t *)out, len);
+    }
+    int n = 0;
+    uint8_t c;
+    while (n < len && ringbuf_pop(&tty->input, &c)) {
+        out[n++] = c;
+        if (c == '\n') {
+            break;
+        }
+    }
+    return n;
+}
+
+int tty_set_mode(struct tty *tty, int mode) {
+    if (mode != TTY_MODE_RAW && mode != TTY_MODE_CANONICAL) {
+        return -STATUS_INVALID_ARG;
+    }
+    if (mode != tty->mode) {
+        // a half typed line is dropped when switching modes, and so are keys
+        // queued raw: they were never echoed or edited and aren't a line
+        tty->line_len = 0;
+        tty->mode = mode;
+        uint8_t c;
+        while (mode == TTY_MODE_CANONICAL && ringbuf_pop(&tty->input, &c)) {
+        }
+    }
+    return STATUS_OK;
+}
+
+int tty_get_foreground(int index) {
+    struct tty *tty = tty_get(index);
+    if (!tty) {
+        return -1;
+    }
+    return tty->fg_pid;
+}
+
+void tty_set_foreground(int index, int pid) {
+    struct tty *tty = tty_get(index);
+    if (!tty) {
+        return;
+    }
+    tty->fg_pid = pid;
+    // the new owner may already be waiting on input that is queued
+    tty_wakeup_reader(tty);
+}
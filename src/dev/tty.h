@@ -0,0 +1,45 @@
+#ifndef TTY_H
+#define TTY_H
+
+#include "config.h"
+#include "lib/ringbuf/ringbuf.h"
+#include <stdint.h>
+
+// Input side of the virtual terminals. Keys typed on the visible terminal are
+// queued in its tty, which hands them to the terminal's foreground process.
+// Output still goes straight to the console (terminal_printn & co).
+
+enum {
+    TTY_MODE_RAW,       // every key is queued as soon as it is typed
+    TTY_MODE_CANONICAL, // keys are echoed and edited in the kernel, only
+                        // complete lines are queued. The default.
+};
+
+struct tty {
+    // same as the index of the terminal it echoes to
+    int index;
+    int fg_pid;
+    int mode;
+
+    // characters ready to be read, filled by the keyboard interrupt and
+    // drained by syscalls without masking interrupts
+    struct ringbuf input;
+    uint8_t input_buf[TTY_INPUT_BUFFER_SIZE];
+    // whole lines thrown away in canonical mode because input was full
+    uint32_t lines_dropped;
+
+    // line being edited in canonical mode
+    char line[TTY_LINE_MAX];
+    int line_len;
+};
+
+void tty_init();
+struct tty *tty_get(int index);
+void tty_input(int index, char c);
+int tty_read(struct tty *tty, char *out, int len);
+char tty_getc(struct tty *tty);
+int tty_set_mode(struct tty *tty, int mode);
+int tty_get_foreground(int index);
+void tty_set_foreground(int index, int pid);
+
+#endif
@@ -0,0 +1,415 @@
+#include "bcache.h"
+#include "config.h"
+#include "console/console.h"
+#include "cpu/cpu.h"
+#include "cpu/lapic.h"
+#include "kernel.h"
+#include "memory/heap/kheap.h"
+#include "memory/memory.h"
+#include "status.h"
+#include <stdbool.h>
+
+#define BCACHE_VALID 0x1 // holds its sector
+#define BCACHE_DIRTY 0x2 // newer than the disk
+
+struct bcache_buf {
+    struct disk *disk;
+    uint32_t lba;
+    uint32_t flags;
+    struct bcache_buf *hash_next;
+    // most recently used at the head, the tail is the next to go
+    struct bcache_buf *lru_prev;
+    struct bcache_buf *lru_next;
+    uint8_t *data;
+};
+
+static struct bcache_buf *bcache_bufs;
+static struct bcache_buf *bcache_hash[BCACHE_HASH_BUCKETS];
+static struct bcache_buf *lru_head = 0;
+static struct bcache_buf *lru_tail = 0;
+// the dirty buffers of a write back in lba order, and the sectors of one of
+// its disk writes
+static struct bcache_buf **bcache_sorted;
+static uint8_t *bcache_batch;
+// what a miss reads, before it goes into buffers
+static uint8_t *bcache_ahead;
+// tsc of the write that dirtied the oldest dirty buffer, 0 when none is
+static uint64_t oldest_dirty = 0;
+
+struct bcache_stats bcache_stats;
+
+static void bcache_lru_remove(struct bcache_buf *buf) {
+    if (buf->lru_prev) {
+        buf->lru_prev->lru_next = buf->lru_next;
+    } else {
+        lru_head = buf->lru_next;
+    }
+    if (buf->lru_next) {
+        buf->lru_next->lru_prev = buf->lru_prev;
+    } else {
+        lru_tail = buf->lru_prev;
+    }
+}
+
+static void bcache_lru_push_head(struct bcache_buf *buf) {
+    buf->lru_prev = 0;
+    buf->lru_next = lru_head;
+    if (lru_head) {
+        lru_head->lru_prev = buf;
+    } else {
+        lru_tail = buf;
+    }
+    lru_head = buf;
+}
+
+static void bcache_lru_push_tail(struct bcache_buf *buf) {
+    buf->lru_next = 0;
+    buf->lru_prev = lru_tail;
+    if (lru_tail) {
+        lru_tail->lru_next = buf;
+    } else {
+        lru_head = buf;
+    }
+    lru_tail = buf;
+}
+
+int bcache_init() {
+    bcache_bufs = kzalloc(BCACHE_BUFFERS * sizeof(struct bcache_buf));
+    uint8_t *data = kmalloc(BCACHE_BUFFERS * DISK_SECTOR_SIZE);
+    bcache_sorted = kmalloc(BCACHE_BUFFERS * sizeof(struct bcache_buf *));
+    bcache_batch = kmalloc(BCACHE_WRITE_BATCH * DISK_SECTOR_SIZE);
+    bcache_ahead = kmalloc(BCACHE_READ_AHEAD * DISK_SECTOR_SIZE);
+    if (!bcache_bufs || !data || !bcache_sorted || !bcache_batch ||
+        !bcache_ahead) {
+        return -STATUS_NOT_ENOUGH_MEM;
+    }
+
+    for (int i = 0; i < BCACHE_BUFFERS; i++) {
+        bcache_bufs[i].data = data + i * DISK_SECTOR_SIZE;
+        bcache_lru_push_tail(&bcache_bufs[i]);
+    }
+    bcache_stats.buffers = BCACHE_BUFFERS;
+    return STATUS_OK;
+}
+
+static uint32_t bcache_bucket(struct disk *disk, uint32_t lba) {
+    return (lba ^ ((uint32_t)disk->id << 16)) % BCACHE_HASH_BUCKETS;
+}
+
+static struct bcache_buf *bcache_lookup(struct disk *disk, uint32_t lba) {
+    struct bcache_buf *buf = bcache_hash[bcache_bucket(disk, lba)];
+    while (buf && (buf->disk != disk || buf->lba != lba)) {
+        buf = buf->hash_next;
+    }
+    return buf;
+}
+
+static void bcache_install(struct bcache_buf *buf, struct disk *disk,
+                           uint32_t lba) {
+    uint32_t bucket = bcache_bucket(disk, lba);
+    buf->disk = disk;
+    buf->lba = lba;
+    buf->flags = BCACHE_VALID;
+    buf->hash_next = bcache_hash[bucket];
+    bcache_hash[bucket] = buf;
+}
+
+// Empties the least recently used buffer for another sector and makes it the
+// most recently used. A dirty one takes all the dirty sectors of its disk to
+// the disk with it.
+static int bcache_evict(struct bcache_buf **out) {
+    struct bcache_buf *buf = lru_tail;
+    if (buf->flags & BCACHE_DIRTY) {
+        int res = bcache_sync(buf->disk);
+        if (res < 0) {
+            return res;
+        }
+    }
+    if (buf->flags & BCACHE_VALID) {
+        struct bcache_buf **link =
+            &bcache_hash[bcache_bucket(buf->disk, buf->lba)];
+        while (*link != buf) {
+            link = &(*link)->hash_next;
+        }
+        *link = buf->hash_next;
+    }
+    buf->flags = 0;
+    bcache_lru_remove(buf);
+    bcache_lru_push_head(buf);
+    *out = buf;
+    return STATUS_OK;
+}
+
+// Reads lba into buf, and in the same disk read the sectors after it up to
+// BCACHE_READ_AHEAD or the first one cached already, which may be newer than
+// the disk. Those get buffers of their own.
+static int bcache_read_ahead(struct disk *disk, uint32_t lba,
+                             struct bcache_buf *buf) {
+    int count = BCACHE_READ_AHEAD;
+    if (disk->sectors && lba + count > disk->sectors) {
+        count = lba < disk->sectors ? disk->sectors - lba : 1;
+    }
+    for (int i = 1; i < count; i++) {
+        if (bcache_lookup(disk, lba + i)) {
+            count = i;
+            break;
+        }
+    }
+
+    int res = disk_read_sectors(disk, lba, count, bcache_ahead);
+    if (res < 0 && count > 1) {
+        // maybe only the sectors after it are unreadable
+        count = 1;
+        res = disk_read_sectors(disk, lba, count, bcache_ahead);
+    }
+    if (res < 0) {
+        return res;
+    }
+    memcpy(buf->data, bcache_ahead, DISK_SECTOR_SIZE);
+
+    for (int i = 1; i < count; i++) {
+        struct bcache_buf *ahead;
+        if (bcache_evict(&ahead) < 0) {
+            break;
+        }
+        memcpy(ahead->data, bcache_ahead + i * DISK_SECTOR_SIZE,
+               DISK_SECTOR_SIZE);
+        bcache_install(ahead, disk, lba + i);
+    }
+    return STATUS_OK;
+}
+
+// The buffer of the sector, read from the disk unless the caller overwrites
+// all of it (whole)
+static int bcache_get(struct disk *disk, uint32_t lba, bool whole,
+                      struct bcache_buf **out) {
+    struct bcache_buf *buf = bcache_lookup(disk, lba);
+    if (buf) {
+        bcache_stats.hits++;
+        bcache_lru_remove(buf);
+        bcache_lru_push_head(buf);
+        *out = buf;
+        return STATUS_OK;
+    }
+
+    int res = bcache_evict(&buf);
+    if (res < 0) {
+        return res;
+    }
+    if (!whole) {
+        bcache_stats.misses++;
+        res = bcache_read_ahead(disk, lba, buf);
+        if (res < 0) {
+            // empty, the first to be used again
+            bcache_lru_remove(buf);
+            bcache_lru_push_tail(buf);
+            return res;
+        }
+    }
+    bcache_install(buf, disk, lba);
+    *out = buf;
+    return STATUS_OK;
+}
+
+// Copies size bytes at offset of sector lba out, offset + size at most a
+// sector
+int bcache_read(struct disk *disk, uint32_t lba, uint32_t offset, void *out,
+                uint32_t size) {
+    if (offset + size > DISK_SECTOR_SIZE) {
+        return -STATUS_INVALID_ARG;
+    }
+    struct bcache_buf *buf;
+    int res = bcache_get(disk, lba, false, &buf);
+    if (res < 0) {
+        return res;
+    }
+    memcpy(out, buf->data + offset, size);
+    return STATUS_OK;
+}
+
+// Copies size bytes to offset of sector lba, the disk gets them later. Errors
+// writing dirty sectors back meanwhile show up on the next bcache_sync.
+int bcache_write(struct disk *disk, uint32_t lba, uint32_t offset,
+                 const void *in, uint32_t size) {
+    if (offset + size > DISK_SECTOR_SIZE) {
+        return -STATUS_INVALID_ARG;
+    }
+    struct bcache_buf *buf;
+    int res = bcache_get(disk, lba, size == DISK_SECTOR_SIZE, &buf);
+    if (res < 0) {
+        return res;
+    }
+    memcpy(buf->data + offset, in, size);
+    if (!(buf->flags & BCACHE_DIRTY)) {
+        buf->flags |= BCACHE_DIRTY;
+        bcache_stats.dirty++;
+        if (!oldest_dirty) {
+            oldest_dirty = cpu_read_tsc();
+        }
+    }
+
+    if (bcache_stats.dirty >= BCACHE_DIRTY_MAX) {
+        bcache_sync(0);
+    } else {
+        bcache_sync_expired();
+    }
+    return STATUS_OK;
+}
+
+static bool bcache_before(struct bcache_buf *a, struct bcache_buf *b) {
+    return a->disk->id < b->disk->id ||
+           (a->disk->id == b->disk->id && a->lba < b->lba);
+}
+
+// Writes the dirty sectors of disk, of every disk if 0, back in lba order, a
+// run of consecutive ones (up to BCACHE_WRITE_BATCH) in one disk write
+int bcache_sync(struct disk *disk) {
+    int n = 0;
+    for (int i = 0; i < BCACHE_BUFFERS; i++) {
+        struct bcache_buf *buf = &bcache_bufs[i];
+        if (!(buf->flags & BCACHE_DIRTY) || (disk && buf->disk != disk)) {
+            continue;
+        }
+        int j = n++;
+        while (j > 0 && bcache_before(buf, bcache_sorted[j - 1])) {
+            bcache_sorted[j] = bcache_sorted[j - 1];
+            j--;
+        }
+        bcache_sorted[j] = buf;
+    }
+
+    int res = STATUS_OK;
+    for (int i = 0; i < n;) {
+        struct bcache_buf *first = bcache_sorted[i];
+        int run = 1;
+        while (i + run < n && run < BCACHE_WRITE_BATCH &&
+               bcache_sorted[i + run]->disk == first->disk &&
+               bcache_sorted[i + run]->lba == first->lba + run) {
+            run++;
+        }
+
+        uint8_t *data = first->data;
+        if (run > 1) {
+            for (int j = 0; j < run; j++) {
+                memcpy(bcache_batch + j * DISK_SECTOR_SIZE,
+                       bcache_sorted[i + j]->data, DISK_SECTOR_SIZE);
+            }
+            data = bcache_batch;
+        }
+        res = disk_write_sectors(first->disk, first->lba, run, data);
+        if (res < 0) {
+            break;
+        }
+
+        for (int j = 0; j < run; j++) {
+            bcache_sorted[i + j]->flags &= ~BCACHE_DIRTY;
+        }
+        bcache_stats.dirty -= run;
+        bcache_stats.written += run;
+        bcache_stats.writes++;
+        i += run;
+    }
+
+    bcache_stats.syncs++;
+    if (!bcache_stats.dirty) {
+        oldest_dirty = 0;
+    }
+    return res;
+}
+
+// Writes everything back once a sector has been dirty for BCACHE_FLUSH_MS
+int bcache_sync_expired() {
+    if (!oldest_dirty ||
+        cpu_read_tsc() - oldest_dirty < (uint64_t)BCACHE_FLUSH_MS * tsc_khz()) {
+        return STATUS_OK;
+    }
+    return bcache_sync(0);
+}
+
+// ---- tests ----
+
+// Works on the last sectors of the boot disk, what they held goes back after
+void bcache_test() {
+    struct disk *disk = get_disk(0);
+    uint32_t lba = disk->sectors ? disk->sectors - 4 : 4 * BCACHE_BUFFERS;
+    uint8_t *orig = kmalloc(4 * DISK_SECTOR_SIZE);
+    uint8_t *expected = kmalloc(4 * DISK_SECTOR_SIZE);
+    uint8_t *raw = kmalloc(4 * DISK_SECTOR_SIZE);
+    uint8_t buf[DISK_SECTOR_SIZE];
+    if (!orig || !expected || !raw) {
+        panic("bcache_test: out of memory");
+    }
+
+    if (bcache_sync(0) < 0 || disk_read_sectors(disk, lba, 4, orig) < 0) {
+        panic("bcache_test: disk error");
+    }
+    memcpy(expected, orig, 4 * DISK_SECTOR_SIZE);
+
+    // part of the first sector, all of the second and the fourth
+    uint32_t disk_writes = disk->stats.writes;
+    uint32_t written = bcache_stats.written;
+    memset(expected + 100, 0x5A, 10);
+    memset(expected + DISK_SECTOR_SIZE, 0xA5, DISK_SECTOR_SIZE);
+    memset(expected + 3 * DISK_SECTOR_SIZE, 0x3C, DISK_SECTOR_SIZE);
+    if (bcache_write(disk, lba, 100, expected + 100, 10) < 0 ||
+        bcache_write(disk, lba + 1, 0, expected + DISK_SECTOR_SIZE,
+                     DISK_SECTOR_SIZE) < 0 ||
+        bcache_write(disk, lba + 3, 0, expected + 3 * DISK_SECTOR_SIZE,
+                     DISK_SECTOR_SIZE) < 0) {
+        panic("bcache_test: write failed");
+    }
+    if (bcache_stats.dirty != 3 || disk->stats.writes != disk_writes) {
+        panic("bcache_test: writes not held back");
+    }
+    for (int i = 0; i < 4; i++) {
+        if (bcache_read(disk, lba + i, 0, buf, DISK_SECTOR_SIZE) < 0 ||
+            memcmp(buf, expected + i * DISK_SECTOR_SIZE, DISK_SECTOR_SIZE)) {
+            panic("bcache_test: read doesn't see the write");
+        }
+    }
+    if (bcache_read(disk, lba, 500, buf, 20) != -STATUS_INVALID_ARG) {
+        panic("bcache_test: read past the sector");
+    }
+
+    // two runs, two disk writes
+    if (bcache_sync(disk) < 0 || bcache_stats.dirty != 0) {
+        panic("bcache_test: sync failed");
+    }
+    if (disk->stats.writes != disk_writes + 2 ||
+        bcache_stats.written != written + 3) {
+        panic("bcache_test: sync not batched");
+    }
+    disk_read_sectors(disk, lba, 4, raw);
+    if (memcmp(raw, expected, 4 * DISK_SECTOR_SIZE)) {
+        panic("bcache_test: disk doesn't have the writes");
+    }
+
+    // a dirty sector pushed out by reads of others gets written first
+    expected[0] ^= 0xFF;
+    bcache_write(disk, lba, 0, expected, 1);
+    uint32_t first = lba - 2 * BCACHE_BUFFERS - 4;
+    for (uint32_t i = 0; i < 2 * BCACHE_BUFFERS && bcache_stats.dirty; i++) {
+        if (bcache_read(disk, first + i, 0, buf, 1) < 0) {
+            panic("bcache_test: read failed");
+        }
+    }
+    if (bcache_stats.dirty != 0) {
+        panic("bcache_test: evicted sector not written");
+    }
+    disk_read_sectors(disk, lba, 1, raw);
+    if (raw[0] != expected[0]) {
+        panic("bcache_test: evicted sector lost");
+    }
+
+    for (int i = 0; i < 4; i++) {
+        bcache_write(disk, lba + i, 0, orig + i * DISK_SECTOR_SIZE,
+                     DISK_SECTOR_SIZE);
+    }
+    if (bcache_sync(disk) < 0) {
+        panic("bcache_test: restoring failed");
+    }
+    kfree(orig);
+    kfree(expected);
+    kfree(raw);
+    println("bcache test passed");
+}
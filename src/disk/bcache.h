@@ -0,0 +1,37 @@
+#ifndef BCACHE_H
+#define BCACHE_H
+
+#include "disk.h"
+#include <stdint.h>
+
+// Write back cache of disk sectors, what the file systems read and write
+// through (see streamer.h). A miss reads BCACHE_READ_AHEAD sectors at once. A
+// write only changes the cached sector, dirty sectors go to the disk sorted,
+// a run of consecutive ones in a single write: when their buffer is needed
+// for another sector, once BCACHE_DIRTY_MAX are dirty, when one has been
+// dirty for BCACHE_FLUSH_MS (looked at on writes and by idle cpus) and on
+// bcache_sync (fsync). Callers hold the big kernel lock.
+
+struct bcache_stats {
+    uint32_t buffers; // sectors the cache can hold
+    uint32_t dirty;   // cached sectors newer than the disk
+    uint32_t hits;
+    uint32_t misses;  // reads that had to go to the disk
+    uint32_t written; // dirty sectors written back
+    uint32_t writes;  // disk writes that took them
+    uint32_t syncs;   // write backs, whatever started them
+};
+
+extern struct bcache_stats bcache_stats;
+
+int bcache_init();
+int bcache_read(struct disk *disk, uint32_t lba, uint32_t offset, void *out,
+                uint32_t size);
+int bcache_write(struct disk *disk, uint32_t lba, uint32_t offset,
+                 const void *in, uint32_t size);
+int bcache_sync(struct disk *disk);
+int bcache_sync_expired();
+
+void bcache_test();
+
+#endif
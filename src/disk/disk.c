@@ -1,52 +1,214 @@
 #include "disk.h"
 #include "config.h"
 #include "console/console.h"
+#include "cpu/cpu.h"
 #include "io/io.h"
 #include "memory/memory.h"
 #include "status.h"
+#include "trace/trace.h"
+#include <stdbool.h>
+
+// status register bits and commands of the primary ata bus (ports 0x1F0-7)
+#define ATA_STATUS_ERR 0x01
+#define ATA_STATUS_DRQ 0x08
+#define ATA_STATUS_BSY 0x80
+#define ATA_CMD_READ 0x20
+#define ATA_CMD_WRITE 0x30
+#define ATA_CMD_CACHE_FLUSH 0xE7
+#define ATA_CMD_IDENTIFY 0xEC
+
+#define DISK_PROBE_POLLS 100000 // status reads before a drive counts as absent
 
 struct disk disk;
+// the primary slave, there when qemu got a -hdb. Without a file system on
+// it, it is the swap disk (see swap.c).
+static struct disk slave_disk;
+static bool slave_present;
+// no sectors behind it, procfs makes its files up when they are read
+static struct disk proc_disk;
+// no sectors either, the tmpfs files are in the kernel heap
+static struct disk tmp_disk;
+
+static int selected_drive = -1;
+
+// Points the bus at the drive and sets up a command on count sectors from
+// lba. A drive newly selected needs 400ns to answer, 4 status reads.
+static void disk_command(int ata_drive, int lba, int count, uint8_t command) {
+    port_io_out_byte(0x1F6, 0xE0 | (ata_drive << 4) | ((lba >> 24) & 0x0F));
+    if (ata_drive != selected_drive) {
+        for (int i = 0; i < 4; i++) {
+            port_io_input_byte(0x1F7);
+        }
+        selected_drive = ata_drive;
+    }
+    port_io_out_byte(0x1F2, count);
+    port_io_out_byte(0x1F3, (unsigned char)(lba & 0xFF));
+    port_io_out_byte(0x1F4, (unsigned char)(lba >> 8));
+    port_io_out_byte(0x1F5, (unsigned char)(lba >> 16));
+    port_io_out_byte(0x1F7, command);
+}
+
+// Polls until the drive has a sector to move or reports an error
+static int disk_wait_drq() {
+    uint8_t status;
+    do {
+        status = port_io_input_byte(0x1F7);
+    } while ((status & ATA_STATUS_BSY) ||
+             !(status & (ATA_STATUS_DRQ | ATA_STATUS_ERR)));
+    return (status & ATA_STATUS_ERR) ? -STATUS_IO_ERROR : STATUS_OK;
+}
+
+// Number of sectors of the ata disk at ata_drive (IDENTIFY DEVICE), 0 if
+// there is none. Gives up after a while, an empty bus may never answer.
+static uint32_t disk_identify(int ata_drive) {
+    disk_command(ata_drive, 0, 0, ATA_CMD_IDENTIFY);
+    uint8_t status = port_io_input_byte(0x1F7);
+    if (status == 0 || status == 0xFF) {
+        return 0;
+    }
+    for (int i = 0; i < DISK_PROBE_POLLS && (status & ATA_STATUS_BSY); i++) {
+        status = port_io_input_byte(0x1F7);
+    }
+    // atapi and sata devices put their signature here
+    if ((status & ATA_STATUS_BSY) || port_io_input_byte(0x1F4) ||
+        port_io_input_byte(0x1F5)) {
+        return 0;
+    }
+    for (int i = 0;
+         i < DISK_PROBE_POLLS && !(status & (ATA_STATUS_DRQ | ATA_STATUS_ERR));
+         i++) {
+        status = port_io_input_byte(0x1F7);
+    }
+    if (!(status & ATA_STATUS_DRQ) || (status & ATA_STATUS_ERR)) {
+        return 0;
+    }
+    uint16_t id[DISK_SECTOR_SIZE / 2];
+    for (int i = 0; i < DISK_SECTOR_SIZE / 2; i++) {
+        id[i] = port_io_input_word(0x1F0);
+    }
+    // words 60 and 61, the sectors lba28 can reach
+    return id[60] | ((uint32_t)id[61] << 16);
+}
 
 void disk_init() {
     memset(&disk, 0, sizeof(struct disk));
     disk.type = DISK_TYPE_REAL;
     disk.sector_size = DISK_SECTOR_SIZE;
-    disk.fs = fs_resolve(&disk);
     disk.id = 0;
+    // FAT16 only counts the clusters that fit on the disk
+    disk.sectors = disk_identify(0);
+    disk.fs = fs_resolve(&disk);
+
+    memset(&slave_disk, 0, sizeof(struct disk));
+    slave_disk.type = DISK_TYPE_REAL;
+    slave_disk.sector_size = DISK_SECTOR_SIZE;
+    slave_disk.id = 1;
+    slave_disk.ata_drive = 1;
+    slave_disk.sectors = disk_identify(1);
+    slave_present = slave_disk.sectors > 0;
+    if (slave_present) {
+        slave_disk.fs = fs_resolve(&slave_disk);
+    }
+
+    memset(&proc_disk, 0, sizeof(struct disk));
+    proc_disk.type = DISK_TYPE_VIRTUAL;
+    proc_disk.id = PROCFS_DRIVE;
+    proc_disk.fs = fs_resolve(&proc_disk);
+
+    memset(&tmp_disk, 0, sizeof(struct disk));
+    tmp_disk.type = DISK_TYPE_VIRTUAL;
+    tmp_disk.id = TMPFS_DRIVE;
+    tmp_disk.fs = fs_resolve(&tmp_disk);
 }
 
 struct disk *get_disk(int index) {
+    if (index == PROCFS_DRIVE) {
+        return &proc_disk;
+    }
+    if (index == TMPFS_DRIVE) {
+        return &tmp_disk;
+    }
+    if (index == 1 && slave_present) {
+        return &slave_disk;
+    }
     if (index != 0) {
-        print("ERROR: non zero disk index not supported yet\n");
+        print("ERROR: no disk with that index\n");
         return NULL;
     }
     return &disk;
 }
 
+// the ata disks, indexes 0 up to this
+int disk_count() { return slave_present ? 2 : 1; }
+
+static bool disk_is_ata(struct disk *idisk) {
+    return idisk == &disk || (idisk == &slave_disk && slave_present);
+}
+
 int disk_read_sectors(struct disk *idisk, int start_lba, int count,
                       void *buffer) {
-    if (idisk != &disk) {
-        print("ERROR: non zero disk index not supported yet\n");
+    if (!disk_is_ata(idisk)) {
+        print("ERROR: no disk with that index\n");
         return -STATUS_IO_ERROR;
     }
 
-    port_io_out_byte(0x1F6, (start_lba >> 24) | 0xE0);
-    port_io_out_byte(0x1F2, count);
-    port_io_out_byte(0x1F3, (unsigned char)(start_lba & 0xFF));
-    port_io_out_byte(0x1F4, (unsigned char)(start_lba >> 8));
-    port_io_out_byte(0x1F5, (unsigned char)(start_lba >> 16));
-    port_io_out_byte(0x1F7, 0x20);
+    trace(TRACE_DISK_READ, count, start_lba);
+    uint64_t start = cpu_read_tsc();
+    disk_command(idisk->ata_drive, start_lba, count, ATA_CMD_READ);
 
     unsigned short *ptr = (unsigned short *)buffer;
 
     // poll
+    int res = STATUS_OK;
     for (int i = 0; i < count; i++) {
-        while (!(port_io_input_byte(0x1F7) & 0x08)) {
+        res = disk_wait_drq();
+        if (res < 0) {
+            break;
         }
         for (int i = 0; i < DISK_SECTOR_SIZE / 2; i++) {
             *ptr++ = port_io_input_word(0x1F0);
         }
     }
+    trace(TRACE_DISK_READ_DONE, count, start_lba);
+    idisk->stats.reads++;
+    idisk->stats.sectors_read += count;
+    idisk->stats.read_cycles += cpu_read_tsc() - start;
+
+    return res;
+}
+
+// Writes count (at most 256) sectors from buffer at start_lba, and waits
+// until the drive has them on the disk rather than in its cache
+int disk_write_sectors(struct disk *idisk, int start_lba, int count,
+                       const void *buffer) {
+    if (!disk_is_ata(idisk)) {
+        print("ERROR: no disk with that index\n");
+        return -STATUS_IO_ERROR;
+    }
+
+    trace(TRACE_DISK_WRITE, count, start_lba);
+    uint64_t start = cpu_read_tsc();
+    disk_command(idisk->ata_drive, start_lba, count, ATA_CMD_WRITE);
+
+    const unsigned short *ptr = (const unsigned short *)buffer;
+    int res = STATUS_OK;
+    for (int i = 0; i < count; i++) {
+        res = disk_wait_drq();
+        if (res < 0) {
+            goto out;
+        }
+        for (int i = 0; i < DISK_SECTOR_SIZE / 2; i++) {
+            port_io_out_word(0x1F0, *ptr++);
+        }
+    }
+    port_io_out_byte(0x1F7, ATA_CMD_CACHE_FLUSH);
+    while (port_io_input_byte(0x1F7) & ATA_STATUS_BSY) {
+    }
 
-    return 0;
-}
\ No newline at end of file
+out:
+    trace(TRACE_DISK_WRITE_DONE, count, start_lba);
+    idisk->stats.writes++;
+    idisk->stats.sectors_written += count;
+    idisk->stats.write_cycles += cpu_read_tsc() - start;
+    return res;
+}
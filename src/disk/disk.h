@@ -2,6 +2,7 @@
 #define DISK_H
 
 #include "fs/file.h"
+#include <stdint.h>
 
 // ATA Disk driver interface for the kernel
 
@@ -10,17 +11,34 @@ typedef unsigned int DISK_TYPE;
 #define DISK_TYPE_REAL 0    // REAL PHYSICAL DISK
 #define DISK_TYPE_VIRTUAL 1 // VIRTUAL DISK (VFS)
 
+// counted by disk_read_sectors and disk_write_sectors, see procfs diskstats
+struct disk_stats {
+    uint32_t reads; // disk_read_sectors calls
+    uint32_t sectors_read;
+    uint64_t read_cycles; // tsc cycles spent waiting for the drive
+    uint32_t writes;      // disk_write_sectors calls
+    uint32_t sectors_written;
+    uint64_t write_cycles; // including the cache flush
+};
+
 struct disk {
     int id;
     DISK_TYPE type;
     int sector_size;
     struct file_system *fs;
     void *fs_private;
+    struct disk_stats stats;
+    // real disks: 0 master, 1 slave of the primary ata bus
+    int ata_drive;
+    uint32_t sectors; // as the drive reports, 0 if not asked
 };
 
 void disk_init();
 struct disk *get_disk(int index);
+int disk_count();
 int disk_read_sectors(struct disk *idisk, int start_lba, int count,
                       void *buffer);
+int disk_write_sectors(struct disk *idisk, int start_lba, int count,
+                       const void *buffer);
 
 #endif
\ No newline at end of file
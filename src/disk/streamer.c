@@ -1,9 +1,15 @@
 #include "streamer.h"
+#include "bcache.h"
 #include "console/console.h"
+#include "kernel.h"
+#include "memory/heap/kcache.h"
 #include "memory/heap/kheap.h"
 #include "memory/memory.h"
 #include "status.h"
 
+static struct kcache disk_stream_cache =
+    KCACHE_INIT("disk_stream", sizeof(struct disk_stream));
+
 struct disk_stream *disk_stream_new(int disk_id) {
 
     struct disk *disk = get_disk(disk_id);
@@ -11,7 +17,10 @@ struct disk_stream *disk_stream_new(int disk_id) {
         return NULL;
     }
 
-    struct disk_stream *stream = kzalloc(sizeof(struct disk_stream));
+    struct disk_stream *stream = kcache_zalloc(&disk_stream_cache);
+    if (!stream) {
+        return NULL;
+    }
     stream->disk = disk;
     stream->byte_offset = 0;
     return stream;
@@ -22,36 +31,52 @@ int disk_stream_seek(struct disk_stream *stream, size_t pos) {
     return 0;
 }
 
-int disk_stream_read(struct disk_stream *stream, void *out_buf, size_t size) {
+// Reads and writes go through the buffer cache (bcache.h) a sector at a time
 
+int disk_stream_read(struct disk_stream *stream, void *out_buf, size_t size) {
     struct disk *disk = stream->disk;
-    char *buf = kzalloc(disk->sector_size);
-    size_t end = stream->byte_offset + size;
-
-    int ret = 0;
-
-    while (stream->byte_offset < end) {
+    while (size > 0) {
         size_t lba = stream->byte_offset / disk->sector_size;
         size_t lba_offset = stream->byte_offset % disk->sector_size;
-        int to_copy = end - stream->byte_offset;
-        if (lba_offset + to_copy > disk->sector_size) {
-            to_copy = disk->sector_size - lba_offset;
+        size_t to_copy = disk->sector_size - lba_offset;
+        if (to_copy > size) {
+            to_copy = size;
         }
-        ret = disk_read_sectors(disk, lba, 1, buf);
-        if (ret != 0) {
-            goto out;
+        int res = bcache_read(disk, lba, lba_offset, out_buf, to_copy);
+        if (res != 0) {
+            return res;
         }
-        memcpy(out_buf, buf + lba_offset, to_copy);
         out_buf += to_copy;
+        size -= to_copy;
         stream->byte_offset += to_copy;
     }
+    return 0;
+}
 
-out:
-    kfree(buf);
-    return ret;
+int disk_stream_write(struct disk_stream *stream, const void *in_buf,
+                      size_t size) {
+    struct disk *disk = stream->disk;
+    while (size > 0) {
+        size_t lba = stream->byte_offset / disk->sector_size;
+        size_t lba_offset = stream->byte_offset % disk->sector_size;
+        size_t to_copy = disk->sector_size - lba_offset;
+        if (to_copy > size) {
+            to_copy = size;
+        }
+        int res = bcache_write(disk, lba, lba_offset, in_buf, to_copy);
+        if (res != 0) {
+            return res;
+        }
+        in_buf += to_copy;
+        size -= to_copy;
+        stream->byte_offset += to_copy;
+    }
+    return 0;
 }
 
-void disk_stream_close(struct disk_stream *stream) { kfree(stream); }
+void disk_stream_close(struct disk_stream *stream) {
+    kcache_free(&disk_stream_cache, stream);
+}
 
 // ------- tests ------------ //
 
@@ -63,40 +88,34 @@ void disk_streamer_test() {
     disk_stream_read(stream, buf, 1);
 
     if (buf[0] != expected[0]) {
-        println("error: invalid stream read at 0");
-        return;
+        panic("disk_streamer_test: invalid stream read at 0");
     }
 
     disk_stream_read(stream, buf, 1);
 
     if (buf[0] != expected[1]) {
-        println("error: invalid stream read at 1");
-        return;
+        panic("disk_streamer_test: invalid stream read at 1");
     }
 
     disk_stream_read(stream, buf, 10);
 
     if (memcmp(&buf[0], &expected[2], 10) != 0) {
-        println("error: invalid stream read at 2 of 10");
-        return;
+        panic("disk_streamer_test: invalid stream read at 2 of 10");
     }
 
     disk_stream_read(stream, buf, 1000);
 
     if (memcmp(&buf[0], &expected[12], 1000) != 0) {
-        println("error: invalid stream read at 12 of 1000");
-        return;
+        panic("disk_streamer_test: invalid stream read at 12 of 1000");
     }
 
     disk_stream_seek(stream, 505);
     disk_stream_read(stream, buf, 1000);
 
     if (memcmp(&buf[0], &expected[505], 1000) != 0) {
-        println("error: invalid stream read at 505 of 1000");
-        return;
+        panic("disk_streamer_test: invalid stream read at 505 of 1000");
     }
 
     kfree(buf);
     disk_stream_close(stream);
-    print("disk stream tests passed");
 }
\ No newline at end of file
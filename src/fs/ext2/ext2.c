@@ -0,0 +1,1636 @@
+#include "ext2.h"
+#include "config.h"
+#include "console/console.h"
+#include "disk/bcache.h"
+#include "disk/disk.h"
+#include "disk/streamer.h"
+#include "fs/file.h"
+#include "kernel.h"
+#include "lib/string/string.h"
+#include "macros.h"
+#include "memory/heap/kheap.h"
+#include "memory/memory.h"
+#include "status.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+#define EXT2_SUPERBLOCK_POS 1024
+#define EXT2_MAGIC 0xEF53
+#define EXT2_ROOT_INO 2
+#define EXT2_GOOD_OLD_FIRST_INO 11
+#define EXT2_GOOD_OLD_INODE_SIZE 128
+#define EXT2_MAX_LOG_BLOCK_SIZE 2 // 4 KB
+#define EXT2_NAME_LEN 255
+
+// i_block: 12 direct blocks, then a single, double and triple indirect one
+#define EXT2_NDIR_BLOCKS 12
+#define EXT2_IND_BLOCK 12
+#define EXT2_DIND_BLOCK 13
+#define EXT2_TIND_BLOCK 14
+#define EXT2_N_BLOCKS 15
+
+#define EXT2_FEATURE_COMPAT_HAS_JOURNAL 0x0004
+#define EXT2_FEATURE_INCOMPAT_FILETYPE 0x0002
+#define EXT2_FEATURE_RO_COMPAT_SPARSE_SUPER 0x0001
+#define EXT2_FEATURE_RO_COMPAT_LARGE_FILE 0x0002
+#define EXT2_RO_COMPAT_KNOWN                                                   \
+    (EXT2_FEATURE_RO_COMPAT_SPARSE_SUPER | EXT2_FEATURE_RO_COMPAT_LARGE_FILE)
+
+// i_mode
+#define EXT2_S_IFMT 0xF000
+#define EXT2_S_IFREG 0x8000
+#define EXT2_S_IFDIR 0x4000
+#define EXT2_S_IWUGO 0x0092 // anybody may write
+#define EXT2_DEFAULT_MODE 0644
+
+// i_flags
+#define EXT2_INDEX_FL 0x1000 // directory with a hash tree index (dir_index)
+
+// file type of a dir entry
+#define EXT2_FT_REG_FILE 1
+
+struct ext2_superblock {
+    uint32_t inodes_count;
+    uint32_t blocks_count;
+    uint32_t r_blocks_count;
+    uint32_t free_blocks_count;
+    uint32_t free_inodes_count;
+    uint32_t first_data_block;
+    uint32_t log_block_size; // 1024 << this
+    uint32_t log_frag_size;
+    uint32_t blocks_per_group;
+    uint32_t frags_per_group;
+    uint32_t inodes_per_group;
+    uint32_t mtime;
+    uint32_t wtime;
+    uint16_t mnt_count;
+    uint16_t max_mnt_count;
+    uint16_t magic;
+    uint16_t state;
+    uint16_t errors;
+    uint16_t minor_rev_level;
+    uint32_t lastcheck;
+    uint32_t checkinterval;
+    uint32_t creator_os;
+    uint32_t rev_level;
+    uint16_t def_resuid;
+    uint16_t def_resgid;
+    // revision 1 only
+    uint32_t first_ino;
+    uint16_t inode_size;
+    uint16_t block_group_nr;
+    uint32_t feature_compat;
+    uint32_t feature_incompat;
+    uint32_t feature_ro_compat;
+} __attribute__((packed));
+
+struct ext2_group_desc {
+    uint32_t block_bitmap;
+    uint32_t inode_bitmap;
+    uint32_t inode_table;
+    uint16_t free_blocks_count;
+    uint16_t free_inodes_count;
+    uint16_t used_dirs_count;
+    uint16_t pad;
+    uint8_t reserved[12];
+} __attribute__((packed));
+
+struct ext2_inode {
+    uint16_t mode;
+    uint16_t uid;
+    uint32_t size;
+    uint32_t atime;
+    uint32_t ctime;
+    uint32_t mtime;
+    uint32_t dtime;
+    uint16_t gid;
+    uint16_t links_count;
+    uint32_t blocks; // 512 byte units, the indirect blocks too
+    uint32_t flags;
+    uint32_t osd1;
+    uint32_t block[EXT2_N_BLOCKS];
+    uint32_t generation;
+    uint32_t file_acl;
+    uint32_t size_high; // of regular files, dir_acl in revision 0
+    uint32_t faddr;
+    uint8_t osd2[12];
+} __attribute__((packed));
+
+struct ext2_dir_entry {
+    uint32_t inode; // 0 for an unused entry
+    uint16_t rec_len;
+    uint8_t name_len;
+    uint8_t file_type; // high byte of name_len without the filetype feature
+    // the name follows, not 0 terminated
+} __attribute__((packed));
+
+// the bytes an entry with a name of len takes, 4 byte aligned
+#define EXT2_DIR_REC_LEN(len)                                                  \
+    ((sizeof(struct ext2_dir_entry) + (len) + 3) & ~3)
+
+// --start -- internal use only
+
+// An inode open at least once, shared by the descriptors open on it and the
+// lookups in it while it's a directory
+struct ext2_node {
+    struct disk *disk;
+    uint32_t ino;
+    struct ext2_inode inode; // written back whenever it changes
+    int refs;
+    uint32_t last_block; // where allocating for it looks first
+    // the indirect blocks last looked at, one of each level, so the next
+    // block of the file finds its pointer without going to the disk
+    struct {
+        uint32_t block;
+        uint32_t *ptrs;
+    } ind[3];
+    struct ext2_node *next;
+};
+
+struct ext2_file_descriptor {
+    struct ext2_node *node;
+    FILE_MODE mode;
+    uint32_t pos;
+};
+
+// A name in a hashed directory
+struct ext2_dir_name {
+    uint32_t ino;
+    uint32_t pos; // of its entry in the directory
+    struct ext2_dir_name *next;
+    uint8_t len;
+    char name[]; // not 0 terminated
+};
+
+struct ext2_dir_cache {
+    uint32_t ino;
+    struct ext2_dir_name *buckets[EXT2_DIR_HASH_BUCKETS];
+    struct ext2_dir_cache *next;
+};
+
+struct ext2_private {
+    struct ext2_superblock sb;
+    struct ext2_group_desc *groups; // all of the descriptor table
+    uint32_t num_groups;
+    uint32_t block_size;
+    uint32_t inode_size;
+    uint32_t first_ino;
+    uint32_t gdt_block; // where the descriptor table starts
+    bool filetype;      // dir entries have the file type
+    bool read_only;     // features we don't know could break on a write
+
+    struct disk_stream *stream;
+    uint8_t *zeroes; // a block of them
+    // the bitmap block last read, allocations mostly look at the same one
+    uint8_t *bitmap;
+    uint32_t bitmap_block;
+
+    struct ext2_node *nodes;
+    struct ext2_dir_cache *dirs; // the most recently used first
+};
+
+// --end  -- internal use only
+
+int ext2_resolve(struct disk *disk);
+void *ext2_open(struct disk *disk, struct path_part *path, FILE_MODE mode);
+int ext2_seek(void *private, uint32_t offset, FILE_SEEK_MODE seek_mode);
+int ext2_read(struct disk *disk, void *descriptor, uint32_t size,
+              uint32_t nmembs, char *out_ptr);
+int ext2_write(struct disk *disk, void *descriptor, uint32_t size,
+               uint32_t nmembs, const char *in_ptr);
+int ext2_stat(struct disk *disk, void *private, struct file_stat *stat);
+int ext2_close(void *private);
+int ext2_unlink(struct disk *disk, struct path_part *path);
+int ext2_truncate(struct disk *disk, void *private, uint32_t size);
+int ext2_sync(struct disk *disk, void *private);
+
+struct file_system ext2_fs = {
+    .resolve = ext2_resolve,
+    .open = ext2_open,
+    .read = ext2_read,
+    .write = ext2_write,
+    .seek = ext2_seek,
+    .stat = ext2_stat,
+    .close = ext2_close,
+    .unlink = ext2_unlink,
+    .truncate = ext2_truncate,
+    .sync = ext2_sync,
+};
+
+struct file_system *ext2_init() {
+    strncpy(ext2_fs.name, "EXT2", 10);
+    return &ext2_fs;
+}
+
+// ---- blocks ----
+
+static int ext2_read_block(struct disk *disk, uint32_t block, uint32_t offset,
+                           void *out, uint32_t size) {
+    struct ext2_private *private = disk->fs_private;
+    int res = disk_stream_seek(private->stream,
+                               block * private->block_size + offset);
+    if (res < 0) {
+        return res;
+    }
+    return disk_stream_read(private->stream, out, size);
+}
+
+static int ext2_write_block(struct disk *disk, uint32_t block,
+                            uint32_t offset, const void *in, uint32_t size) {
+    struct ext2_private *private = disk->fs_private;
+    int res = disk_stream_seek(private->stream,
+                               block * private->block_size + offset);
+    if (res < 0) {
+        return res;
+    }
+    return disk_stream_write(private->stream, in, size);
+}
+
+static int ext2_write_super(struct disk *disk) {
+    struct ext2_private *private = disk->fs_private;
+    int res = disk_stream_seek(private->stream, EXT2_SUPERBLOCK_POS);
+    if (res < 0) {
+        return res;
+    }
+    return disk_stream_write(private->stream, &private->sb,
+                             sizeof(private->sb));
+}
+
+static int ext2_write_group(struct disk *disk, uint32_t group) {
+    struct ext2_private *private = disk->fs_private;
+    return ext2_write_block(disk, private->gdt_block,
+                            group * sizeof(struct ext2_group_desc),
+                            &private->groups[group],
+                            sizeof(struct ext2_group_desc));
+}
+
+// ---- bitmaps ----
+
+static int ext2_load_bitmap(struct disk *disk, uint32_t block) {
+    struct ext2_private *private = disk->fs_private;
+    if (private->bitmap_block == block) {
+        return STATUS_OK;
+    }
+    int res = ext2_read_block(disk, block, 0, private->bitmap,
+                              private->block_size);
+    private->bitmap_block = res < 0 ? 0 : block;
+    return res;
+}
+
+// first clear bit from start up to end, -1 if there is none
+static int ext2_bitmap_find(uint8_t *bitmap, uint32_t start, uint32_t end) {
+    for (uint32_t bit = start; bit < end;) {
+        if (bit % 8 == 0 && bitmap[bit / 8] == 0xFF) {
+            bit += 8;
+            continue;
+        }
+        if (!(bitmap[bit / 8] & (1 << (bit % 8)))) {
+            return bit;
+        }
+        bit++;
+    }
+    return -1;
+}
+
+static int ext2_bitmap_mark(struct disk *disk, uint32_t bit, bool used) {
+    struct ext2_private *private = disk->fs_private;
+    uint8_t *byte = &private->bitmap[bit / 8];
+    if (used) {
+        *byte |= 1 << (bit % 8);
+    } else {
+        *byte &= ~(1 << (bit % 8));
+    }
+    return ext2_write_block(disk, private->bitmap_block, bit / 8, byte, 1);
+}
+
+// blocks (or inodes) of a group, the last group may be short of blocks
+static uint32_t ext2_group_bits(struct ext2_private *private, uint32_t group,
+                                bool inodes) {
+    if (inodes) {
+        return private->sb.inodes_per_group;
+    }
+    uint32_t left = private->sb.blocks_count - private->sb.first_data_block -
+                    group * private->sb.blocks_per_group;
+    return left < private->sb.blocks_per_group ? left
+                                               : private->sb.blocks_per_group;
+}
+
+static uint32_t ext2_group_free(struct ext2_private *private, uint32_t group,
+                                bool inodes) {
+    struct ext2_group_desc *desc = &private->groups[group];
+    return inodes ? desc->free_inodes_count : desc->free_blocks_count;
+}
+
+// Counts delta more free blocks (or inodes) in the group and the superblock,
+// and writes both
+static int ext2_count_free(struct disk *disk, uint32_t group, bool inodes,
+                           int delta) {
+    struct ext2_private *private = disk->fs_private;
+    struct ext2_group_desc *desc = &private->groups[group];
+    if (inodes) {
+        desc->free_inodes_count += delta;
+        private->sb.free_inodes_count += delta;
+    } else {
+        desc->free_blocks_count += delta;
+        private->sb.free_blocks_count += delta;
+    }
+    int res = ext2_write_group(disk, group);
+    if (res == STATUS_OK) {
+        res = ext2_write_super(disk);
+    }
+    return res;
+}
+
+// Takes a free block (or inode) from the group's bitmap, searching from bit
+// start on, then the groups after it and at last the start of the group.
+// Returns its index counted from the first group's first.
+static int ext2_alloc_bit(struct disk *disk, bool inodes, uint32_t group,
+                          uint32_t start) {
+    struct ext2_private *private = disk->fs_private;
+    if (!(inodes ? private->sb.free_inodes_count
+                 : private->sb.free_blocks_count)) {
+        return -STATUS_DISK_FULL;
+    }
+
+    for (uint32_t n = 0; n <= private->num_groups; n++) {
+        uint32_t g = (group + n) % private->num_groups;
+        struct ext2_group_desc *desc = &private->groups[g];
+        uint32_t from = n == 0 ? start : 0;
+        uint32_t to = n == private->num_groups
+                          ? start
+                          : ext2_group_bits(private, g, inodes);
+        if (!ext2_group_free(private, g, inodes) || from >= to) {
+            continue;
+        }
+
+        int res = ext2_load_bitmap(disk, inodes ? desc->inode_bitmap
+                                                : desc->block_bitmap);
+        if (res < 0) {
+            return res;
+        }
+        int bit = ext2_bitmap_find(private->bitmap, from, to);
+        if (bit < 0) {
+            continue;
+        }
+        res = ext2_bitmap_mark(disk, bit, true);
+        if (res == STATUS_OK) {
+            res = ext2_count_free(disk, g, inodes, -1);
+        }
+        if (res < 0) {
+            return res;
+        }
+        uint32_t per_group = inodes ? private->sb.inodes_per_group
+                                    : private->sb.blocks_per_group;
+        return g * per_group + bit;
+    }
+    return -STATUS_DISK_FULL;
+}
+
+static int ext2_free_bit(struct disk *disk, bool inodes, uint32_t index) {
+    struct ext2_private *private = disk->fs_private;
+    uint32_t per_group = inodes ? private->sb.inodes_per_group
+                                : private->sb.blocks_per_group;
+    uint32_t g = index / per_group;
+    uint32_t bit = index % per_group;
+    struct ext2_group_desc *desc = &private->groups[g];
+
+    int res = ext2_load_bitmap(disk, inodes ? desc->inode_bitmap
+                                            : desc->block_bitmap);
+    if (res < 0) {
+        return res;
+    }
+    if (!(private->bitmap[bit / 8] & (1 << (bit % 8)))) {
+        // free already, something points at it twice
+        return -STATUS_IO_ERROR;
+    }
+    res = ext2_bitmap_mark(disk, bit, false);
+    if (res < 0) {
+        return res;
+    }
+    return ext2_count_free(disk, g, inodes, 1);
+}
+
+static bool ext2_is_data_block(struct ext2_private *private, uint32_t block) {
+    return block >= private->sb.first_data_block &&
+           block < private->sb.blocks_count;
+}
+
+static int ext2_free_block(struct disk *disk, uint32_t block) {
+    struct ext2_private *private = disk->fs_private;
+    if (!ext2_is_data_block(private, block)) {
+        return -STATUS_IO_ERROR;
+    }
+    return ext2_free_bit(disk, false, block - private->sb.first_data_block);
+}
+
+// ---- inodes ----
+
+static uint32_t ext2_inode_group(struct ext2_private *private, uint32_t ino) {
+    return (ino - 1) / private->sb.inodes_per_group;
+}
+
+static int ext2_inode_pos(struct disk *disk, uint32_t ino, uint32_t *block,
+                          uint32_t *offset) {
+    struct ext2_private *private = disk->fs_private;
+    if (ino < 1 || ino > private->sb.inodes_count) {
+        return -STATUS_IO_ERROR;
+    }
+    uint32_t index = (ino - 1) % private->sb.inodes_per_group;
+    uint32_t pos = index * private->inode_size;
+    *block = private->groups[ext2_inode_group(private, ino)].inode_table +
+             pos / private->block_size;
+    *offset = pos % private->block_size;
+    return STATUS_OK;
+}
+
+static int ext2_read_inode(struct disk *disk, uint32_t ino,
+                           struct ext2_inode *inode) {
+    uint32_t block;
+    uint32_t offset;
+    int res = ext2_inode_pos(disk, ino, &block, &offset);
+    if (res < 0) {
+        return res;
+    }
+    return ext2_read_block(disk, block, offset, inode, sizeof(*inode));
+}
+
+static int ext2_write_inode(struct disk *disk, uint32_t ino,
+                            struct ext2_inode *inode) {
+    uint32_t block;
+    uint32_t offset;
+    int res = ext2_inode_pos(disk, ino, &block, &offset);
+    if (res < 0) {
+        return res;
+    }
+    return ext2_write_block(disk, block, offset, inode, sizeof(*inode));
+}
+
+static bool ext2_is_dir(struct ext2_inode *inode) {
+    return (inode->mode & EXT2_S_IFMT) == EXT2_S_IFDIR;
+}
+
+static bool ext2_is_file(struct ext2_inode *inode) {
+    return (inode->mode & EXT2_S_IFMT) == EXT2_S_IFREG;
+}
+
+static int ext2_get_node(struct disk *disk, uint32_t ino,
+                         struct ext2_node **out) {
+    struct ext2_private *private = disk->fs_private;
+    for (struct ext2_node *node = private->nodes; node; node = node->next) {
+        if (node->ino == ino) {
+            node->refs++;
+            *out = node;
+            return STATUS_OK;
+        }
+    }
+
+    struct ext2_node *node = kzalloc(sizeof(struct ext2_node));
+    if (!node) {
+        return -STATUS_NOT_ENOUGH_MEM;
+    }
+    int res = ext2_read_inode(disk, ino, &node->inode);
+    if (res < 0) {
+        kfree(node);
+        return res;
+    }
+    node->disk = disk;
+    node->ino = ino;
+    node->refs = 1;
+    node->next = private->nodes;
+    private->nodes = node;
+    *out = node;
+    return STATUS_OK;
+}
+
+static void ext2_put_node(struct ext2_node *node) {
+    if (--node->refs > 0) {
+        return;
+    }
+    struct ext2_private *private = node->disk->fs_private;
+    struct ext2_node **link = &private->nodes;
+    while (*link != node) {
+        link = &(*link)->next;
+    }
+    *link = node->next;
+    for (int i = 0; i < 3; i++) {
+        if (node->ind[i].ptrs) {
+            kfree(node->ind[i].ptrs);
+        }
+    }
+    kfree(node);
+}
+
+static void ext2_forget_indirect(struct ext2_node *node) {
+    for (int i = 0; i < 3; i++) {
+        node->ind[i].block = 0;
+    }
+    node->last_block = 0;
+}
+
+// ---- file blocks ----
+
+static int ext2_load_indirect(struct ext2_node *node, int level,
+                              uint32_t block) {
+    struct ext2_private *private = node->disk->fs_private;
+    if (node->ind[level].block == block) {
+        return STATUS_OK;
+    }
+    if (!node->ind[level].ptrs) {
+        node->ind[level].ptrs = kmalloc(private->block_size);
+        if (!node->ind[level].ptrs) {
+            return -STATUS_NOT_ENOUGH_MEM;
+        }
+    }
+    int res = ext2_read_block(node->disk, block, 0, node->ind[level].ptrs,
+                              private->block_size);
+    node->ind[level].block = res < 0 ? 0 : block;
+    return res;
+}
+
+// A zeroed block for the node, near the one it got last or in the group of
+// its inode
+static int ext2_alloc_block(struct ext2_node *node) {
+    struct disk *disk = node->disk;
+    struct ext2_private *private = disk->fs_private;
+    uint32_t goal = node->last_block + 1;
+    if (!node->last_block || !ext2_is_data_block(private, goal)) {
+        goal = private->sb.first_data_block +
+               ext2_inode_group(private, node->ino) *
+                   private->sb.blocks_per_group;
+    }
+    goal -= private->sb.first_data_block;
+
+    int res = ext2_alloc_bit(disk, false, goal / private->sb.blocks_per_group,
+                             goal % private->sb.blocks_per_group);
+    if (res < 0) {
+        return res;
+    }
+    uint32_t block = res + private->sb.first_data_block;
+    res = ext2_write_block(disk, block, 0, private->zeroes,
+                           private->block_size);
+    if (res < 0) {
+        ext2_free_block(disk, block);
+        return res;
+    }
+    node->inode.blocks += private->block_size / DISK_SECTOR_SIZE;
+    node->last_block = block;
+    return block;
+}
+
+// The disk block with block index of the node, 0 for a hole. Writes
+// (allocate) fill the hole with a zeroed block, and the indirect blocks on
+// the way. The caller writes the inode back.
+static int ext2_bmap(struct ext2_node *node, uint32_t index, bool allocate,
+                     uint32_t *out) {
+    struct ext2_private *private = node->disk->fs_private;
+    uint32_t ptrs = private->block_size / sizeof(uint32_t);
+    uint32_t path[3];
+    int depth = 0;
+    int slot = index;
+
+    if (index >= EXT2_NDIR_BLOCKS) {
+        index -= EXT2_NDIR_BLOCKS;
+        if (index < ptrs) {
+            slot = EXT2_IND_BLOCK;
+            depth = 1;
+            path[0] = index;
+        } else if ((index -= ptrs) < ptrs * ptrs) {
+            slot = EXT2_DIND_BLOCK;
+            depth = 2;
+            path[0] = index / ptrs;
+            path[1] = index % ptrs;
+        } else {
+            index -= ptrs * ptrs;
+            if (index / ptrs / ptrs >= ptrs) {
+                return -STATUS_INVALID_ARG;
+            }
+            slot = EXT2_TIND_BLOCK;
+            depth = 3;
+            path[0] = index / ptrs / ptrs;
+            path[1] = index / ptrs % ptrs;
+            path[2] = index % ptrs;
+        }
+    }
+
+    *out = 0;
+    uint32_t block = node->inode.block[slot];
+    if (!block) {
+        if (!allocate) {
+            return STATUS_OK;
+        }
+        int res = ext2_alloc_block(node);
+        if (res < 0) {
+            return res;
+        }
+        block = res;
+        node->inode.block[slot] = block;
+    }
+
+    for (int level = 0; level < depth; level++) {
+        if (!ext2_is_data_block(private, block)) {
+            return -STATUS_IO_ERROR;
+        }
+        int res = ext2_load_indirect(node, level, block);
+        if (res < 0) {
+            return res;
+        }
+        uint32_t next = node->ind[level].ptrs[path[level]];
+        if (!next) {
+            if (!allocate) {
+                return STATUS_OK;
+            }
+            res = ext2_alloc_block(node);
+            if (res < 0) {
+                return res;
+            }
+            next = res;
+            node->ind[level].ptrs[path[level]] = next;
+            res = ext2_write_block(node->disk, block,
+                                   path[level] * sizeof(uint32_t), &next,
+                                   sizeof(next));
+            if (res < 0) {
+                return res;
+            }
+        }
+        block = next;
+    }
+
+    if (!ext2_is_data_block(private, block)) {
+        return -STATUS_IO_ERROR;
+    }
+    node->last_block = block;
+    *out = block;
+    return STATUS_OK;
+}
+
+// Frees what the tree under *block maps from file block first on (counted
+// from the tree's start), and its indirect blocks left empty. depth is 0 for
+// a data block, span the file blocks the tree maps.
+static int ext2_free_tree(struct ext2_node *node, uint32_t *block, int depth,
+                          uint32_t span, uint32_t first) {
+    struct ext2_private *private = node->disk->fs_private;
+    if (!*block || first >= span) {
+        return STATUS_OK;
+    }
+
+    int res = STATUS_OK;
+    if (depth > 0) {
+        uint32_t ptrs = private->block_size / sizeof(uint32_t);
+        uint32_t *children = kmalloc(private->block_size);
+        if (!children) {
+            return -STATUS_NOT_ENOUGH_MEM;
+        }
+        res = ext2_read_block(node->disk, *block, 0, children,
+                              private->block_size);
+        uint32_t child_span = span / ptrs;
+        bool changed = false;
+        for (uint32_t i = first / child_span; res == STATUS_OK && i < ptrs;
+             i++) {
+            uint32_t child_first =
+                i * child_span < first ? first - i * child_span : 0;
+            uint32_t old = children[i];
+            res = ext2_free_tree(node, &children[i], depth - 1, child_span,
+                                 child_first);
+            changed |= children[i] != old;
+        }
+        if (res == STATUS_OK && first > 0 && changed) {
+            res = ext2_write_block(node->disk, *block, 0, children,
+                                   private->block_size);
+        }
+        kfree(children);
+    }
+
+    if (res == STATUS_OK && first == 0) {
+        res = ext2_free_block(node->disk, *block);
+        if (res == STATUS_OK) {
+            node->inode.blocks -= private->block_size / DISK_SECTOR_SIZE;
+            *block = 0;
+        }
+    }
+    return res;
+}
+
+// Frees the blocks of the node from block index keep on
+static int ext2_free_blocks(struct ext2_node *node, uint32_t keep) {
+    struct ext2_private *private = node->disk->fs_private;
+    uint32_t ptrs = private->block_size / sizeof(uint32_t);
+    uint32_t first = keep;
+    uint32_t span = 1;
+    int depth = 0;
+    int res = STATUS_OK;
+
+    for (int i = 0; res == STATUS_OK && i < EXT2_N_BLOCKS; i++) {
+        if (i >= EXT2_IND_BLOCK) {
+            // the next tree maps what is past the last one
+            first = first > span ? first - span : 0;
+            span = i == EXT2_IND_BLOCK ? ptrs : span * ptrs;
+            depth++;
+        } else if (i > 0) {
+            first = first > 0 ? first - 1 : 0;
+        }
+        uint32_t block = node->inode.block[i];
+        res = ext2_free_tree(node, &block, depth, span, first);
+        node->inode.block[i] = block;
+    }
+    // the cached indirect blocks may be free now
+    ext2_forget_indirect(node);
+    return res;
+}
+
+// ---- directories ----
+
+// Reads the entry at byte pos of the directory, and its name (0 terminated,
+// EXT2_NAME_LEN + 1 bytes) if name isn't 0
+static int ext2_dir_read(struct ext2_node *dir, uint32_t pos,
+                         struct ext2_dir_entry *entry, char *name) {
+    struct ext2_private *private = dir->disk->fs_private;
+    uint32_t offset = pos % private->block_size;
+    uint32_t block;
+    int res = ext2_bmap(dir, pos / private->block_size, false, &block);
+    if (res < 0) {
+        return res;
+    }
+    if (!block) {
+        // directories have no holes
+        return -STATUS_IO_ERROR;
+    }
+    res = ext2_read_block(dir->disk, block, offset, entry, sizeof(*entry));
+    if (res < 0) {
+        return res;
+    }
+    if (entry->rec_len < sizeof(*entry) || entry->rec_len % 4 ||
+        offset + entry->rec_len > private->block_size ||
+        EXT2_DIR_REC_LEN(entry->name_len) > entry->rec_len) {
+        return -STATUS_IO_ERROR;
+    }
+    if (name) {
+        res = ext2_read_block(dir->disk, block, offset + sizeof(*entry), name,
+                              entry->name_len);
+        name[entry->name_len] = '\0';
+    }
+    return res;
+}
+
+static int ext2_dir_write(struct ext2_node *dir, uint32_t pos,
+                          struct ext2_dir_entry *entry, const char *name) {
+    struct ext2_private *private = dir->disk->fs_private;
+    uint32_t offset = pos % private->block_size;
+    uint32_t block;
+    int res = ext2_bmap(dir, pos / private->block_size, false, &block);
+    if (res == STATUS_OK && !block) {
+        res = -STATUS_IO_ERROR;
+    }
+    if (res == STATUS_OK) {
+        res = ext2_write_block(dir->disk, block, offset, entry, sizeof(*entry));
+    }
+    if (res == STATUS_OK && name) {
+        res = ext2_write_block(dir->disk, block, offset + sizeof(*entry), name,
+                               entry->name_len);
+    }
+    return res;
+}
+
+static uint32_t ext2_name_hash(const char *name, uint32_t len) {
+    uint32_t hash = 2166136261u;
+    for (uint32_t i = 0; i < len; i++) {
+        hash = (hash ^ (uint8_t)name[i]) * 16777619u;
+    }
+    return hash % EXT2_DIR_HASH_BUCKETS;
+}
+
+static struct ext2_dir_name **ext2_dir_find(struct ext2_dir_cache *cache,
+                                            const char *name) {
+    uint32_t len = strlen(name);
+    struct ext2_dir_name **link = &cache->buckets[ext2_name_hash(name, len)];
+    while (*link &&
+           ((*link)->len != len || memcmp((*link)->name, name, len) != 0)) {
+        link = &(*link)->next;
+    }
+    return link;
+}
+
+static int ext2_dir_add(struct ext2_dir_cache *cache, const char *name,
+                        uint32_t ino, uint32_t pos) {
+    uint32_t len = strlen(name);
+    struct ext2_dir_name *entry = kmalloc(sizeof(struct ext2_dir_name) + len);
+    if (!entry) {
+        return -STATUS_NOT_ENOUGH_MEM;
+    }
+    entry->ino = ino;
+    entry->pos = pos;
+    entry->len = len;
+    memcpy(entry->name, name, len);
+    struct ext2_dir_name **bucket = &cache->buckets[ext2_name_hash(name, len)];
+    entry->next = *bucket;
+    *bucket = entry;
+    return STATUS_OK;
+}
+
+static void ext2_dir_free(struct ext2_dir_cache *cache) {
+    for (int i = 0; i < EXT2_DIR_HASH_BUCKETS; i++) {
+        struct ext2_dir_name *entry = cache->buckets[i];
+        while (entry) {
+            struct ext2_dir_name *next = entry->next;
+            kfree(entry);
+            entry = next;
+        }
+    }
+    kfree(cache);
+}
+
+static struct ext2_dir_cache *ext2_dir_cached(struct disk *disk,
+                                              uint32_t ino) {
+    struct ext2_private *private = disk->fs_private;
+    for (struct ext2_dir_cache *cache = private->dirs; cache;
+         cache = cache->next) {
+        if (cache->ino == ino) {
+            return cache;
+        }
+    }
+    return 0;
+}
+
+// The names of the directory hashed, read from the disk unless they were
+// recently. Keeps up to EXT2_DIR_CACHE_DIRS directories.
+static int ext2_dir_hash(struct ext2_node *dir, struct ext2_dir_cache **out) {
+    struct ext2_private *private = dir->disk->fs_private;
+    struct ext2_dir_cache **link = &private->dirs;
+    int n = 0;
+    while (*link && (*link)->ino != dir->ino) {
+        link = &(*link)->next;
+        n++;
+    }
+    struct ext2_dir_cache *cache = *link;
+    if (cache) {
+        // to the front
+        *link = cache->next;
+        cache->next = private->dirs;
+        private->dirs = cache;
+        *out = cache;
+        return STATUS_OK;
+    }
+
+    cache = kzalloc(sizeof(struct ext2_dir_cache));
+    char *name = kmalloc(EXT2_NAME_LEN + 1);
+    if (!cache || !name) {
+        if (cache) {
+            kfree(cache);
+        }
+        if (name) {
+            kfree(name);
+        }
+        return -STATUS_NOT_ENOUGH_MEM;
+    }
+    cache->ino = dir->ino;
+    int res = STATUS_OK;
+    struct ext2_dir_entry entry;
+    for (uint32_t pos = 0; res == STATUS_OK && pos < dir->inode.size;
+         pos += entry.rec_len) {
+        res = ext2_dir_read(dir, pos, &entry, name);
+        if (res == STATUS_OK && entry.inode) {
+            res = ext2_dir_add(cache, name, entry.inode, pos);
+        }
+    }
+    kfree(name);
+    if (res < 0) {
+        ext2_dir_free(cache);
+        return res;
+    }
+
+    cache->next = private->dirs;
+    private->dirs = cache;
+    if (n + 1 > EXT2_DIR_CACHE_DIRS) {
+        // drop the least recently used
+        link = &private->dirs;
+        while ((*link)->next) {
+            link = &(*link)->next;
+        }
+        ext2_dir_free(*link);
+        *link = 0;
+    }
+    *out = cache;
+    return STATUS_OK;
+}
+
+// Looks name up in the directory dir_ino, gives its inode and where its
+// entry is. -STATUS_BAD_FILE_PATH if it isn't there.
+static int ext2_lookup(struct disk *disk, uint32_t dir_ino, const char *name,
+                       uint32_t *ino, uint32_t *pos) {
+    struct ext2_node *dir;
+    int res = ext2_get_node(disk, dir_ino, &dir);
+    if (res < 0) {
+        return res;
+    }
+    struct ext2_dir_cache *cache;
+    if (!ext2_is_dir(&dir->inode)) {
+        res = -STATUS_BAD_FILE_PATH;
+    } else {
+        res = ext2_dir_hash(dir, &cache);
+    }
+    if (res == STATUS_OK) {
+        struct ext2_dir_name *entry = *ext2_dir_find(cache, name);
+        if (entry) {
+            *ino = entry->ino;
+            *pos = entry->pos;
+        } else {
+            res = -STATUS_BAD_FILE_PATH;
+        }
+    }
+    ext2_put_node(dir);
+    return res;
+}
+
+// Walks the directories of path up to its last part, which it returns. The
+// directory that holds (or would hold) that one goes to dir_ino.
+static struct path_part *ext2_walk_dirs(struct disk *disk,
+                                        struct path_part *path,
+                                        uint32_t *dir_ino) {
+    *dir_ino = EXT2_ROOT_INO;
+    while (path->next) {
+        uint32_t pos;
+        if (ext2_lookup(disk, *dir_ino, path->name, dir_ino, &pos) < 0) {
+            return 0;
+        }
+        path = path->next;
+    }
+    if (!path->name || path->name[0] == '\0') {
+        return 0;
+    }
+    return path;
+}
+
+// Adds an entry for ino called name to the directory, in the slack of an
+// entry or a new block at its end
+static int ext2_dir_insert(struct ext2_node *dir, const char *name,
+                           uint32_t ino) {
+    struct ext2_private *private = dir->disk->fs_private;
+    uint32_t len = strlen(name);
+    uint32_t need = EXT2_DIR_REC_LEN(len);
+
+    struct ext2_dir_entry entry;
+    uint32_t pos = 0;
+    uint32_t rec_len = 0;
+    for (; pos < dir->inode.size; pos += entry.rec_len) {
+        int res = ext2_dir_read(dir, pos, &entry, 0);
+        if (res < 0) {
+            return res;
+        }
+        uint32_t used = entry.inode ? EXT2_DIR_REC_LEN(entry.name_len) : 0;
+        if (entry.rec_len >= used + need) {
+            rec_len = entry.rec_len - used;
+            if (used) {
+                entry.rec_len = used;
+                res = ext2_dir_write(dir, pos, &entry, 0);
+                if (res < 0) {
+                    return res;
+                }
+            }
+            pos += used;
+            break;
+        }
+    }
+
+    int res = STATUS_OK;
+    if (!rec_len) {
+        // full, one more block
+        uint32_t block;
+        pos = dir->inode.size;
+        rec_len = private->block_size;
+        res = ext2_bmap(dir, pos / private->block_size, true, &block);
+        if (res == STATUS_OK) {
+            dir->inode.size += private->block_size;
+        }
+    }
+    // the hash tree index wouldn't know the new name
+    dir->inode.flags &= ~EXT2_INDEX_FL;
+    int ires = ext2_write_inode(dir->disk, dir->ino, &dir->inode);
+    if (res < 0 || ires < 0) {
+        return res < 0 ? res : ires;
+    }
+
+    entry.inode = ino;
+    entry.rec_len = rec_len;
+    entry.name_len = len;
+    entry.file_type = private->filetype ? EXT2_FT_REG_FILE : 0;
+    res = ext2_dir_write(dir, pos, &entry, name);
+    if (res < 0) {
+        return res;
+    }
+
+    struct ext2_dir_cache *cache = ext2_dir_cached(dir->disk, dir->ino);
+    if (cache && ext2_dir_add(cache, name, ino, pos) < 0) {
+        // can't keep it complete, forget it
+        struct ext2_dir_cache **link = &private->dirs;
+        while (*link != cache) {
+            link = &(*link)->next;
+        }
+        *link = cache->next;
+        ext2_dir_free(cache);
+    }
+    return STATUS_OK;
+}
+
+// Removes the entry at pos, merged into the one before it in its block
+static int ext2_dir_remove(struct ext2_node *dir, uint32_t pos,
+                           const char *name) {
+    struct ext2_private *private = dir->disk->fs_private;
+    struct ext2_dir_entry entry;
+    struct ext2_dir_entry prev;
+    uint32_t prev_pos = 0;
+    bool has_prev = false;
+    uint32_t at = pos - pos % private->block_size;
+    int res = STATUS_OK;
+    for (; res == STATUS_OK && at < pos; at += prev.rec_len) {
+        res = ext2_dir_read(dir, at, &prev, 0);
+        prev_pos = at;
+        has_prev = true;
+    }
+    if (res == STATUS_OK && at != pos) {
+        res = -STATUS_IO_ERROR;
+    }
+    if (res == STATUS_OK) {
+        res = ext2_dir_read(dir, pos, &entry, 0);
+    }
+    if (res < 0) {
+        return res;
+    }
+
+    if (has_prev) {
+        prev.rec_len += entry.rec_len;
+        res = ext2_dir_write(dir, prev_pos, &prev, 0);
+    } else {
+        entry.inode = 0;
+        res = ext2_dir_write(dir, pos, &entry, 0);
+    }
+
+    struct ext2_dir_cache *cache = ext2_dir_cached(dir->disk, dir->ino);
+    if (cache) {
+        struct ext2_dir_name **link = ext2_dir_find(cache, name);
+        struct ext2_dir_name *gone = *link;
+        if (gone) {
+            *link = gone->next;
+            kfree(gone);
+        }
+    }
+    return res;
+}
+
+// A new empty file called name in the directory dir_ino, its inode in the
+// same group
+static int ext2_create(struct disk *disk, uint32_t dir_ino, const char *name,
+                       uint32_t *ino) {
+    struct ext2_private *private = disk->fs_private;
+    uint32_t len = strlen(name);
+    if (len > EXT2_NAME_LEN || strncmp(name, ".", 2) == 0 ||
+        strncmp(name, "..", 3) == 0) {
+        return -STATUS_BAD_FILE_PATH;
+    }
+
+    struct ext2_node *dir;
+    int res = ext2_get_node(disk, dir_ino, &dir);
+    if (res < 0) {
+        return res;
+    }
+    res = ext2_alloc_bit(disk, true, ext2_inode_group(private, dir_ino), 0);
+    if (res < 0) {
+        goto out;
+    }
+    *ino = res + 1;
+
+    // the part past the classic inode too, it may hold anything
+    uint32_t block;
+    uint32_t offset;
+    struct ext2_inode inode;
+    memset(&inode, 0, sizeof(inode));
+    inode.mode = EXT2_S_IFREG | EXT2_DEFAULT_MODE;
+    inode.links_count = 1;
+    res = ext2_inode_pos(disk, *ino, &block, &offset);
+    if (res == STATUS_OK) {
+        res = ext2_write_block(disk, block, offset, private->zeroes,
+                               private->inode_size);
+    }
+    if (res == STATUS_OK) {
+        res = ext2_write_inode(disk, *ino, &inode);
+    }
+    if (res == STATUS_OK) {
+        res = ext2_dir_insert(dir, name, *ino);
+    }
+    if (res < 0) {
+        ext2_free_bit(disk, true, *ino - 1);
+    }
+
+out:
+    ext2_put_node(dir);
+    return res;
+}
+
+// ---- resolve ----
+
+static void ext2_free_private(struct ext2_private *private) {
+    if (private->stream) {
+        disk_stream_close(private->stream);
+    }
+    if (private->groups) {
+        kfree(private->groups);
+    }
+    if (private->zeroes) {
+        kfree(private->zeroes);
+    }
+    if (private->bitmap) {
+        kfree(private->bitmap);
+    }
+    kfree(private);
+}
+
+// Checks the superblock is one we can use, and works out the layout
+static int ext2_load_super(struct disk *disk, struct ext2_private *private) {
+    struct ext2_superblock *sb = &private->sb;
+    if (sb->log_block_size > EXT2_MAX_LOG_BLOCK_SIZE ||
+        !sb->blocks_per_group || !sb->inodes_per_group ||
+        sb->blocks_count <= sb->first_data_block) {
+        return -STATUS_IO_ERROR;
+    }
+    private->block_size = 1024 << sb->log_block_size;
+    private->inode_size = EXT2_GOOD_OLD_INODE_SIZE;
+    private->first_ino = EXT2_GOOD_OLD_FIRST_INO;
+    if (sb->rev_level > 0) {
+        private->inode_size = sb->inode_size;
+        private->first_ino = sb->first_ino;
+        if (sb->feature_incompat & ~EXT2_FEATURE_INCOMPAT_FILETYPE) {
+            // ext4 extents, a journal to replay...
+            println("EXT2: unsupported features");
+            return -STATUS_NOT_IMPLEMENTED;
+        }
+        private->filetype =
+            sb->feature_incompat & EXT2_FEATURE_INCOMPAT_FILETYPE;
+        private->read_only =
+            (sb->feature_ro_compat & ~EXT2_RO_COMPAT_KNOWN) ||
+            (sb->feature_compat & EXT2_FEATURE_COMPAT_HAS_JOURNAL);
+    }
+    if (private->inode_size < EXT2_GOOD_OLD_INODE_SIZE ||
+        private->inode_size > private->block_size ||
+        (uint64_t)sb->blocks_count * private->block_size > 0xFFFFFFFF) {
+        // stream positions are 32 bit
+        return -STATUS_NOT_IMPLEMENTED;
+    }
+
+    private->num_groups =
+        (sb->blocks_count - sb->first_data_block + sb->blocks_per_group - 1) /
+        sb->blocks_per_group;
+    private->gdt_block = sb->first_data_block + 1;
+    return STATUS_OK;
+}
+
+int ext2_resolve(struct disk *disk) {
+    int res = 0;
+    struct ext2_private *private = kzalloc(sizeof(struct ext2_private));
+    if (!private) {
+        return -STATUS_NOT_ENOUGH_MEM;
+    }
+    disk->fs_private = private;
+    disk->fs = &ext2_fs;
+
+    private->stream = disk_stream_new(disk->id);
+    if (!private->stream) {
+        res = -STATUS_NOT_ENOUGH_MEM;
+        goto out;
+    }
+    res = disk_stream_seek(private->stream, EXT2_SUPERBLOCK_POS);
+    if (res == STATUS_OK) {
+        res = disk_stream_read(private->stream, &private->sb,
+                               sizeof(private->sb));
+    }
+    if (res != STATUS_OK) {
+        goto out;
+    }
+    if (private->sb.magic != EXT2_MAGIC) {
+        res = 1; // - for error, 0 for true, > 0 for false
+        goto out;
+    }
+
+    res = ext2_load_super(disk, private);
+    if (res != STATUS_OK) {
+        goto out;
+    }
+    uint32_t gdt_size = private->num_groups * sizeof(struct ext2_group_desc);
+    private->groups = kmalloc(gdt_size);
+    private->zeroes = kzalloc(private->block_size);
+    private->bitmap = kmalloc(private->block_size);
+    if (!private->groups || !private->zeroes || !private->bitmap) {
+        res = -STATUS_NOT_ENOUGH_MEM;
+        goto out;
+    }
+    res = ext2_read_block(disk, private->gdt_block, 0, private->groups,
+                          gdt_size);
+
+out:
+    if (res != 0) {
+        ext2_free_private(private);
+        disk->fs_private = 0;
+        disk->fs = 0;
+    }
+    if (res == 0) {
+        println(private->read_only ? "EXT2: resolved, read only"
+                                   : "EXT2: resolved");
+    }
+    return res;
+}
+
+// ---- files ----
+
+// Reads or writes len bytes at the position of fd, a block at a time. Holes
+// read as zeroes.
+static int ext2_file_io(struct ext2_file_descriptor *fd, char *buf,
+                        uint32_t len, bool write) {
+    struct ext2_node *node = fd->node;
+    struct ext2_private *private = node->disk->fs_private;
+
+    while (len > 0) {
+        uint32_t offset = fd->pos % private->block_size;
+        uint32_t n = private->block_size - offset;
+        if (n > len) {
+            n = len;
+        }
+        uint32_t block;
+        int res = ext2_bmap(node, fd->pos / private->block_size, write, &block);
+        if (res == STATUS_OK) {
+            if (!block) {
+                memset(buf, 0, n);
+            } else if (write) {
+                res = ext2_write_block(node->disk, block, offset, buf, n);
+            } else {
+                res = ext2_read_block(node->disk, block, offset, buf, n);
+            }
+        }
+        if (res != STATUS_OK) {
+            return res;
+        }
+
+        buf += n;
+        len -= n;
+        fd->pos += n;
+        if (write && fd->pos > node->inode.size) {
+            node->inode.size = fd->pos;
+        }
+    }
+    return STATUS_OK;
+}
+
+// Cuts the file down to size, or grows it with a hole
+static int ext2_truncate_node(struct ext2_node *node, uint32_t size) {
+    struct ext2_private *private = node->disk->fs_private;
+    int res = STATUS_OK;
+    if (size < node->inode.size) {
+        uint32_t keep =
+            (size + private->block_size - 1) / private->block_size;
+        res = ext2_free_blocks(node, keep);
+
+        // what is left of the last block reads as zeroes if it grows again
+        uint32_t offset = size % private->block_size;
+        uint32_t block = 0;
+        if (res == STATUS_OK && offset) {
+            res = ext2_bmap(node, size / private->block_size, false, &block);
+        }
+        if (res == STATUS_OK && block) {
+            res = ext2_write_block(node->disk, block, offset, private->zeroes,
+                                   private->block_size - offset);
+        }
+    }
+    node->inode.size = size;
+    int wres = ext2_write_inode(node->disk, node->ino, &node->inode);
+    return res != STATUS_OK ? res : wres;
+}
+
+void *ext2_open(struct disk *disk, struct path_part *path, FILE_MODE mode) {
+    struct ext2_private *private = disk->fs_private;
+    uint32_t dir_ino;
+    struct path_part *last = ext2_walk_dirs(disk, path, &dir_ino);
+    if (!last) {
+        return ERROR(-STATUS_BAD_FILE_PATH);
+    }
+
+    uint32_t ino;
+    uint32_t pos;
+    int res = ext2_lookup(disk, dir_ino, last->name, &ino, &pos);
+    if (res == -STATUS_BAD_FILE_PATH && mode != FILE_READ) {
+        res = private->read_only ? -STATUS_NOT_IMPLEMENTED
+                                 : ext2_create(disk, dir_ino, last->name, &ino);
+    }
+    if (res < 0) {
+        return ERROR(res);
+    }
+
+    struct ext2_node *node;
+    res = ext2_get_node(disk, ino, &node);
+    if (res < 0) {
+        return ERROR(res);
+    }
+    struct ext2_inode *inode = &node->inode;
+    if ((!ext2_is_file(inode) && !ext2_is_dir(inode)) ||
+        (ext2_is_file(inode) && inode->size_high)) {
+        // links, devices, files of 4 GB and more
+        res = -STATUS_INVALID_ARG;
+    } else if (mode != FILE_READ && private->read_only) {
+        res = -STATUS_NOT_IMPLEMENTED;
+    } else if (mode != FILE_READ &&
+               (ext2_is_dir(inode) || !(inode->mode & EXT2_S_IWUGO))) {
+        res = -STATUS_INVALID_ARG;
+    }
+
+    struct ext2_file_descriptor *fd = 0;
+    if (res == STATUS_OK) {
+        fd = kzalloc(sizeof(struct ext2_file_descriptor));
+        if (!fd) {
+            res = -STATUS_NOT_ENOUGH_MEM;
+        }
+    }
+    if (res == STATUS_OK && mode == FILE_WRITE && inode->size > 0) {
+        res = ext2_truncate_node(node, 0);
+    }
+    if (res < 0) {
+        if (fd) {
+            kfree(fd);
+        }
+        ext2_put_node(node);
+        return ERROR(res);
+    }
+    fd->node = node;
+    fd->mode = mode;
+    fd->pos = 0;
+    return fd;
+}
+
+int ext2_read(struct disk *disk, void *descriptor, uint32_t size,
+              uint32_t nmembs, char *out_ptr) {
+    struct ext2_file_descriptor *fd = descriptor;
+    nmembs = file_read_count(fd->pos, fd->node->inode.size, size, nmembs);
+
+    int res = ext2_file_io(fd, out_ptr, size * nmembs, false);
+    if (res < 0) {
+        return res;
+    }
+    return nmembs;
+}
+
+int ext2_write(struct disk *disk, void *descriptor, uint32_t size,
+               uint32_t nmembs, const char *in_ptr) {
+    struct ext2_file_descriptor *fd = descriptor;
+    struct ext2_node *node = fd->node;
+    uint32_t len;
+    int res = file_write_start(fd->mode, node->inode.size, size, nmembs,
+                               &fd->pos, &len);
+    if (res < 0) {
+        return res;
+    }
+
+    uint32_t start = fd->pos;
+    res = ext2_file_io(fd, (char *)in_ptr, len, true);
+    // also after a failed write, the inode has to have the blocks taken
+    int wres = ext2_write_inode(disk, node->ino, &node->inode);
+
+    uint32_t written = (fd->pos - start) / size;
+    if (res < 0 && !written) {
+        return res;
+    }
+    if (wres < 0) {
+        return wres;
+    }
+    return written;
+}
+
+int ext2_seek(void *private, uint32_t offset, FILE_SEEK_MODE seek_mode) {
+    struct ext2_file_descriptor *fd = private;
+    return file_seek(&fd->pos, fd->node->inode.size, offset, seek_mode);
+}
+
+int ext2_stat(struct disk *disk, void *private, struct file_stat *stat) {
+    struct ext2_file_descriptor *fd = private;
+    struct ext2_inode *inode = &fd->node->inode;
+    struct ext2_private *fs_private = disk->fs_private;
+    if (ext2_is_dir(inode)) {
+        return -STATUS_INVALID_ARG;
+    }
+    stat->file_size = inode->size;
+    stat->flags = 0;
+    if (!(inode->mode & EXT2_S_IWUGO) || fs_private->read_only) {
+        stat->flags |= FILE_STAT_READ_ONLY;
+    }
+    return 0;
+}
+
+int ext2_truncate(struct disk *disk, void *private, uint32_t size) {
+    struct ext2_file_descriptor *fd = private;
+    if (fd->mode == FILE_READ) {
+        return -STATUS_INVALID_ARG;
+    }
+    int res = ext2_truncate_node(fd->node, size);
+    if (fd->pos > size) {
+        fd->pos = size;
+    }
+    return res;
+}
+
+// Inodes, bitmaps and directories are written on every change, only the
+// buffer cache holds anything back
+int ext2_sync(struct disk *disk, void *private) { return bcache_sync(disk); }
+
+int ext2_close(void *private) {
+    struct ext2_file_descriptor *fd = private;
+    ext2_put_node(fd->node);
+    kfree(fd);
+    return 0;
+}
+
+// Removes a name of a file, the file too once it was the last one. Not while
+// it's open (-STATUS_FILE_BUSY). Directories stay.
+int ext2_unlink(struct disk *disk, struct path_part *path) {
+    struct ext2_private *private = disk->fs_private;
+    if (private->read_only) {
+        return -STATUS_NOT_IMPLEMENTED;
+    }
+    uint32_t dir_ino;
+    struct path_part *last = ext2_walk_dirs(disk, path, &dir_ino);
+    if (!last) {
+        return -STATUS_BAD_FILE_PATH;
+    }
+    uint32_t ino;
+    uint32_t pos;
+    int res = ext2_lookup(disk, dir_ino, last->name, &ino, &pos);
+    if (res < 0) {
+        return res;
+    }
+    for (struct ext2_node *node = private->nodes; node; node = node->next) {
+        if (node->ino == ino) {
+            return -STATUS_FILE_BUSY;
+        }
+    }
+
+    struct ext2_node *node;
+    res = ext2_get_node(disk, ino, &node);
+    if (res < 0) {
+        return res;
+    }
+    if (!ext2_is_file(&node->inode) || node->inode.file_acl ||
+        !node->inode.links_count) {
+        // extended attribute blocks are shared, we don't count their users
+        res = -STATUS_INVALID_ARG;
+        goto out;
+    }
+
+    struct ext2_node *dir;
+    res = ext2_get_node(disk, dir_ino, &dir);
+    if (res < 0) {
+        goto out;
+    }
+    res = ext2_dir_remove(dir, pos, last->name);
+    ext2_put_node(dir);
+    if (res < 0) {
+        goto out;
+    }
+
+    if (--node->inode.links_count == 0) {
+        res = ext2_free_blocks(node, 0);
+        node->inode.size = 0;
+        // no clock, the last time a system with one wrote the volume. Below
+        // inodes_count it would read as the next inode of the orphan list.
+        node->inode.dtime = private->sb.wtime > private->sb.inodes_count
+                                ? private->sb.wtime
+                                : private->sb.inodes_count;
+        if (res == STATUS_OK) {
+            res = ext2_free_bit(disk, true, ino - 1);
+        }
+    }
+    int wres = ext2_write_inode(disk, ino, &node->inode);
+    if (res == STATUS_OK) {
+        res = wres;
+    }
+
+out:
+    ext2_put_node(node);
+    return res;
+}
+
+// ---- tests ----
+
+static struct disk *ext2_test_disk() {
+    for (int i = 0; i < disk_count(); i++) {
+        struct disk *disk = get_disk(i);
+        if (disk->fs == &ext2_fs) {
+            return disk;
+        }
+    }
+    return 0;
+}
+
+// The file semantics on the first ext2 disk, then a file through the
+// indirect blocks and names found through the hash. What was free is again
+// after.
+void ext2_test() {
+    struct disk *disk = ext2_test_disk();
+    if (!disk) {
+        println("ext2 test passed, no ext2 disk");
+        return;
+    }
+    struct ext2_private *private = disk->fs_private;
+    if (private->read_only) {
+        println("ext2 test passed, read only");
+        return;
+    }
+    uint32_t bs = private->block_size;
+    uint32_t ptrs = bs / sizeof(uint32_t);
+    char path[] = "0:/ext2test.tmp";
+    path[0] = '0' + disk->id;
+    kfunlink(path);
+    uint32_t free_blocks = private->sb.free_blocks_count;
+    uint32_t free_inodes = private->sb.free_inodes_count;
+
+    fs_test_files(disk->id, 3 * bs + 100);
+    if (private->sb.free_blocks_count != free_blocks ||
+        private->sb.free_inodes_count != free_inodes) {
+        panic("ext2_test: blocks or inodes leaked");
+    }
+
+    // through the direct blocks into the single indirect ones
+    uint32_t len = (EXT2_NDIR_BLOCKS + 4) * bs + 100;
+    char *check = kmalloc(len);
+    if (!check) {
+        panic("ext2_test: out of memory");
+    }
+    memset(check, 'e', len);
+    int fd = kfopen(path, "w");
+    if (!fd || kfwrite(check, 1, len, fd) != len) {
+        panic("ext2_test: write failed");
+    }
+    kfclose(fd);
+    // the data blocks and one indirect block
+    if (private->sb.free_blocks_count !=
+            free_blocks - (EXT2_NDIR_BLOCKS + 5) - 1 ||
+        private->sb.free_inodes_count != free_inodes - 1) {
+        panic("ext2_test: wrong blocks taken");
+    }
+
+    // a hole up to the double indirect blocks, then a few bytes there
+    fd = kfopen(path, "r");
+    int afd = kfopen(path, "a");
+    uint32_t far = (EXT2_NDIR_BLOCKS + ptrs + 1) * bs;
+    if (!fd || !afd || kftruncate(afd, far) < 0 ||
+        kfwrite("xyz", 3, 1, afd) != 1) {
+        panic("ext2_test: append past a hole failed");
+    }
+    if (kfseek(fd, len, FILE_SEEK_SET) < 0 || kfread(check, bs, 1, fd) != 1) {
+        panic("ext2_test: hole not readable");
+    }
+    for (uint32_t i = 0; i < bs; i++) {
+        if (check[i]) {
+            panic("ext2_test: hole not zeroes");
+        }
+    }
+    if (kfseek(fd, -3, FILE_SEEK_END) < 0 || kfread(check, 3, 1, fd) != 1 ||
+        memcmp(check, "xyz", 3)) {
+        panic("ext2_test: appended data not there");
+    }
+    kfclose(fd);
+    if (kftruncate(afd, 10) < 0 ||
+        private->sb.free_blocks_count != free_blocks - 1) {
+        panic("ext2_test: truncate failed");
+    }
+    kfclose(afd);
+    if (kfunlink(path) < 0) {
+        panic("ext2_test: unlink failed");
+    }
+
+    // names found through the hash, gone once removed
+    char name[] = "0:/ext2t00.tmp";
+    name[0] = '0' + disk->id;
+    for (int i = 0; i < 40; i++) {
+        name[8] = '0' + i / 10;
+        name[9] = '0' + i % 10;
+        fd = kfopen(name, "w");
+        if (!fd || kfwrite(name, sizeof(name), 1, fd) != 1) {
+            panic("ext2_test: create failed");
+        }
+        kfclose(fd);
+    }
+    for (int i = 39; i >= 0; i--) {
+        name[8] = '0' + i / 10;
+        name[9] = '0' + i % 10;
+        fd = kfopen(name, "r");
+        if (!fd || kfread(check, sizeof(name), 1, fd) != 1 ||
+            memcmp(check, name, sizeof(name))) {
+            panic("ext2_test: lookup failed");
+        }
+        kfclose(fd);
+        if (kfunlink(name) < 0 || kfopen(name, "r")) {
+            panic("ext2_test: removing failed");
+        }
+    }
+
+    if (private->sb.free_blocks_count != free_blocks ||
+        private->sb.free_inodes_count != free_inodes) {
+        panic("ext2_test: blocks or inodes leaked");
+    }
+    bcache_sync(disk);
+
+    kfree(check);
+    println("ext2 test passed");
+}
@@ -0,0 +1,20 @@
+#ifndef EXT2_H
+#define EXT2_H
+
+#include "fs/file.h"
+
+// ext2 revisions 0 and 1, block sizes of 1 to 4 KB, volumes of up to 4 GB.
+// Files can be read, created, written, truncated and removed, in existing
+// directories. Volumes with features it doesn't know (ext3's journal, ext4)
+// are only read, or not at all if reading needs them.
+//
+// Blocks are allocated near the last one of the file, or in the group of its
+// inode. A new file's inode goes in the group of its directory. The names of
+// the directories used last are kept hashed in memory
+// (EXT2_DIR_CACHE_DIRS), so a lookup doesn't read the whole directory.
+
+struct file_system *ext2_init();
+
+void ext2_test();
+
+#endif
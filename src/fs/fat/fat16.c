@@ -1,24 +1,29 @@
 #include "fat16.h"
 #include "console/console.h"
+#include "disk/bcache.h"
 #include "disk/streamer.h"
 #include "fs/file.h"
+#include "kernel.h"
 #include "lib/string/string.h"
 #include "macros.h"
 #include "memory/heap/kheap.h"
 #include "memory/memory.h"
 #include "status.h"
+#include <stdbool.h>
 #include <stdint.h>
 
 #define FAT16_SIGNATURE 0x29
 #define FAT16_ENTRY_SIZE 0x02
-#define FAT16_BAD_SEC 0xFF7
-#define FAT16_UNUSED 0x00
 
-typedef unsigned int FAT16_ITEM_TYPE;
-// --start -- for internal use only
-#define FAT16_ITEM_TYPE_DIR 0
-#define FAT16_ITEM_TYPE_FILE 1
-// --end   -- for internal use only
+// FAT entries
+#define FAT16_FREE_CLUSTER 0x0000
+#define FAT16_BAD_CLUSTER 0xFFF7
+#define FAT16_END_OF_CHAIN 0xFFF8 // this and up
+#define FAT16_FIRST_CLUSTER 2     // the first one of the data area
+
+// first byte of a dir entry name
+#define FAT16_ENTRY_END 0x00 // neither this nor the ones after it are used
+#define FAT16_ENTRY_DELETED 0xE5
 
 // FAT dir entry attribs
 
@@ -30,9 +35,11 @@ typedef unsigned int FAT16_ITEM_TYPE;
 #define FAT16_ATTR_ARCHIVED 0x20
 #define FAT16_FILE_DEVICE 0x40
 #define FAT16_FILE_RESERVED 0x80
+#define FAT16_ATTR_LONG_NAME 0x0F // a part of a long name, not a file
 
 #define FAT16_MAX_FILE_NAME 8
 #define FAT16_MAX_EXT_NAME 3
+#define FAT16_SHORT_NAME (FAT16_MAX_FILE_NAME + FAT16_MAX_EXT_NAME)
 
 struct fat16_header_extended {
     uint8_t drive_number;
@@ -84,57 +91,79 @@ struct fat16_dir_entry {
     uint32_t file_size;
 } __attribute((packed));
 
-// --start -- internal use only
 
-struct fat16_dir {
-    struct fat16_dir_entry *dir_entries;
-    int total_entries;
-    int dir_start_sector_pos;
-    int dir_end_sector_pos;
-};
+// --start -- internal use only
 
-struct fat16_item {
-    union fat16 {
-        struct fat16_dir_entry *dir_entry;
-        struct fat16_dir *dir;
-    } item;
-    FAT16_ITEM_TYPE item_type;
+// A file open at least once, shared by the descriptors open on it
+struct fat16_node {
+    struct disk *disk;
+    struct fat16_dir_entry entry; // written back whenever it changes
+    uint32_t entry_pos;           // byte position of the entry on the disk
+    int refs;
+    // the cluster last looked up and its index in the chain, so going on
+    // from there doesn't walk the chain from its start again
+    uint32_t cluster;
+    uint32_t cluster_index;
+    struct fat16_node *next;
 };
 
 struct fat16_file_descriptor {
-    struct fat16_item *item;
+    struct fat16_node *node;
+    FILE_MODE mode;
     uint32_t pos;
 };
 
 struct fat16_private {
     struct fat16_h header;
-    struct fat16_dir root_dir;
+
+    // where the parts of the volume start, in sectors
+    uint32_t fat_start;
+    uint32_t root_dir_start;
+    uint32_t data_start;
+    uint32_t cluster_bytes;
+    // clusters of the data area, numbered from FAT16_FIRST_CLUSTER
+    uint32_t total_clusters;
+    // a bit per cluster, set if it's in use, built from the FAT on resolve
+    uint32_t *used_clusters;
+    uint32_t free_clusters;
+    uint32_t next_free; // where the search for a free cluster starts
 
     // streamer for reading / writing to clusters
     struct disk_stream *cluster_stream;
     // streamer for reading / writing to file allocation table
-    struct disk_stream *fat16_read_stream;
+    struct disk_stream *fat16_stream;
     // for reading / writing a directory
     struct disk_stream *dir_stream;
 };
 
 // --end  -- internal use only
 
+static struct fat16_node *fat16_nodes = 0;
+
 int fat16_resolve(struct disk *disk);
 void *fat16_open(struct disk *disk, struct path_part *path, FILE_MODE mode);
 int fat16_seek(void *private, uint32_t offset, FILE_SEEK_MODE seek_mode);
 int fat16_read(struct disk *disk, void *descriptor, uint32_t size,
                uint32_t nmembs, char *out_ptr);
+int fat16_write(struct disk *disk, void *descriptor, uint32_t size,
+                uint32_t nmembs, const char *in_ptr);
 int fat16_stat(struct disk *disk, void *private, struct file_stat *stat);
 int fat16_close(void *private);
+int fat16_unlink(struct disk *disk, struct path_part *path);
+int fat16_truncate(struct disk *disk, void *private, uint32_t size);
+int fat16_sync(struct disk *disk, void *private);
 
 struct file_system fat16_fs = {
     .resolve = fat16_resolve,
     .open = fat16_open,
     .read = fat16_read,
+    .write = fat16_write,
     .seek = fat16_seek,
     .stat = fat16_stat,
     .close = fat16_close,
+    .unlink = fat16_unlink,
+    .truncate = fat16_truncate,
+    .sync = fat16_sync,
 };
 
 struct file_system *fat16_init() {
@@ -147,443 +176,727 @@ static void fat16_init_private(struct disk *disk,
     memset(fat_private, 0, sizeof(struct fat16_private));
 
     fat_private->cluster_stream = disk_stream_new(disk->id);
-    fat_private->fat16_read_stream = disk_stream_new(disk->id);
+    fat_private->fat16_stream = disk_stream_new(disk->id);
     fat_private->dir_stream = disk_stream_new(disk->id);
 }
 
-static int fat16_get_total_items_in_dir(struct disk *disk,
-                                        uint32_t dir_start_sector) {
-    struct fat16_dir_entry entry;
-    int res = 0;
-    int cnt = 0;
-    struct fat16_private *fat_private = disk->fs_private;
-    struct disk_stream *stream = fat_private->dir_stream;
-
-    res = disk_stream_seek(stream, dir_start_sector * disk->sector_size);
-    if (res != STATUS_OK) {
-        goto out;
+static void fat16_free_private(struct fat16_private *fat_private) {
+    if (fat_private->cluster_stream) {
+        disk_stream_close(fat_private->cluster_stream);
     }
-
-    while (1) {
-        res = disk_stream_read(stream, &entry, sizeof(entry));
-        if (res != STATUS_OK) {
-            goto out;
-        }
-        if (entry.filename[0] == 0x00) {
-            // null entry represents end of entries
-            break;
-        }
-
-        if (entry.filename[0] == 0xE5) {
-            // unused entry
-            continue;
-        }
-
-        cnt++;
+    if (fat_private->fat16_stream) {
+        disk_stream_close(fat_private->fat16_stream);
     }
-
-    res = cnt;
-out:
-    return res;
+    if (fat_private->dir_stream) {
+        disk_stream_close(fat_private->dir_stream);
+    }
+    if (fat_private->used_clusters) {
+        kfree(fat_private->used_clusters);
+    }
+    kfree(fat_private);
 }
 
-static int fat16_load_root_dir(struct disk *disk,
-                               struct fat16_private *fat_private) {
-    int res = 0;
-    struct fat16_header *primary_header = &fat_private->header.primary_header;
-    int root_dir_start_sec =
-        primary_header->fat_copies * primary_header->sectors_per_fat +
-        primary_header->reserved_sectors;
-
-    int root_dir_entries = primary_header->root_dir_entries;
-    int root_dir_size = (root_dir_entries * sizeof(struct fat16_dir_entry));
-    int total_root_sectors =
-        (root_dir_size + disk->sector_size - 1) / disk->sector_size;
+// ---- file allocation table ----
 
-    int total_items = fat16_get_total_items_in_dir(disk, root_dir_start_sec);
+static bool fat16_is_data_cluster(struct fat16_private *private,
+                                  uint32_t cluster) {
+    return cluster >= FAT16_FIRST_CLUSTER &&
+           cluster < private->total_clusters + FAT16_FIRST_CLUSTER;
+}
 
-    if (total_items < 0) {
-        res = total_items;
-        goto out;
-    }
+static uint32_t fat16_cluster_pos(struct disk *disk, uint32_t cluster) {
+    struct fat16_private *private = disk->fs_private;
+    uint32_t sector =
+        private->data_start + (cluster - FAT16_FIRST_CLUSTER) *
+                                  private->header.primary_header
+                                      .sectors_per_cluster;
+    return sector * disk->sector_size;
+}
 
-    struct fat16_dir_entry *dir_entries = kzalloc(root_dir_size);
-    if (!dir_entries) {
-        res = -STATUS_NOT_ENOUGH_MEM;
-        goto out;
+static int fat16_get_fat_entry(struct disk *disk, uint32_t cluster) {
+    struct fat16_private *private = disk->fs_private;
+    struct disk_stream *stream = private->fat16_stream;
+    int res = disk_stream_seek(stream, private->fat_start * disk->sector_size +
+                                           cluster * FAT16_ENTRY_SIZE);
+    if (res < 0) {
+        return res;
     }
-
-    struct disk_stream *stream = fat_private->dir_stream;
-    res = disk_stream_seek(stream, root_dir_start_sec * disk->sector_size);
-    if (res != STATUS_OK) {
-        kfree(dir_entries);
-        goto out;
+    uint16_t entry = 0;
+    res = disk_stream_read(stream, &entry, sizeof(entry));
+    if (res < 0) {
+        return res;
     }
+    return entry;
+}
 
-    res = disk_stream_read(stream, dir_entries, root_dir_size);
-    if (res != STATUS_OK) {
-        kfree(dir_entries);
-        goto out;
+// Sets the entry in every copy of the FAT
+static int fat16_set_fat_entry(struct disk *disk, uint32_t cluster,
+                               uint16_t value) {
+    struct fat16_private *private = disk->fs_private;
+    struct fat16_header *header = &private->header.primary_header;
+    struct disk_stream *stream = private->fat16_stream;
+    for (int i = 0; i < header->fat_copies; i++) {
+        uint32_t fat_start = private->fat_start + i * header->sectors_per_fat;
+        int res = disk_stream_seek(stream, fat_start * disk->sector_size +
+                                               cluster * FAT16_ENTRY_SIZE);
+        if (res < 0) {
+            return res;
+        }
+        res = disk_stream_write(stream, &value, sizeof(value));
+        if (res < 0) {
+            return res;
+        }
     }
-
-    fat_private->root_dir.dir_entries = dir_entries;
-    fat_private->root_dir.total_entries = total_items;
-    fat_private->root_dir.dir_start_sector_pos = root_dir_start_sec;
-    fat_private->root_dir.dir_end_sector_pos =
-        root_dir_start_sec + total_root_sectors;
-
-out:
-    return res;
+    return STATUS_OK;
 }
 
-int fat16_resolve(struct disk *disk) {
-    int res = 0;
-    struct fat16_private *fat_private = kzalloc(sizeof(struct fat16_private));
-    fat16_init_private(disk, fat_private);
-    disk->fs_private = fat_private;
-    disk->fs = &fat16_fs;
+static bool fat16_cluster_used(struct fat16_private *private,
+                               uint32_t cluster) {
+    return private->used_clusters[cluster / 32] & (1u << (cluster % 32));
+}
 
-    struct disk_stream *stream = disk_stream_new(disk->id);
-    if (!stream) {
-        res = -STATUS_NOT_ENOUGH_MEM;
-        goto out;
+static void fat16_mark_cluster(struct fat16_private *private, uint32_t cluster,
+                               bool used) {
+    if (used) {
+        private->used_clusters[cluster / 32] |= 1u << (cluster % 32);
+    } else {
+        private->used_clusters[cluster / 32] &= ~(1u << (cluster % 32));
     }
+}
 
-    res = disk_stream_read(stream, &fat_private->header,
-                           sizeof(fat_private->header));
-    if (res != STATUS_OK) {
-        goto out;
+// Fills the bitmap of clusters in use from the first FAT
+static int fat16_load_used_clusters(struct disk *disk) {
+    struct fat16_private *private = disk->fs_private;
+    uint32_t end = private->total_clusters + FAT16_FIRST_CLUSTER;
+    private->used_clusters = kzalloc((end + 31) / 32 * sizeof(uint32_t));
+    if (!private->used_clusters) {
+        return -STATUS_NOT_ENOUGH_MEM;
     }
 
-    if (fat_private->header.shared.extended_header.signature !=
-        FAT16_SIGNATURE) {
-        res = 1; // - for error, 0 for true, > 0 for false
-        goto out;
+    uint16_t entries[DISK_SECTOR_SIZE / FAT16_ENTRY_SIZE];
+    uint32_t per_sector = disk->sector_size / FAT16_ENTRY_SIZE;
+    struct disk_stream *stream = private->fat16_stream;
+    int res = disk_stream_seek(stream, private->fat_start * disk->sector_size);
+    if (res < 0) {
+        return res;
     }
-
-    if (fat16_load_root_dir(disk, fat_private) != STATUS_OK) {
-        res = -STATUS_IO_ERROR;
-        println("FAT16: failed to load root dir");
-        goto out;
+    for (uint32_t cluster = 0; cluster < end; cluster += per_sector) {
+        res = disk_stream_read(stream, entries, disk->sector_size);
+        if (res < 0) {
+            return res;
+        }
+        for (uint32_t i = 0; i < per_sector && cluster + i < end; i++) {
+            // the first two hold the media type, never free
+            if (entries[i] != FAT16_FREE_CLUSTER ||
+                cluster + i < FAT16_FIRST_CLUSTER) {
+                fat16_mark_cluster(private, cluster + i, true);
+            } else {
+                private->free_clusters++;
+            }
+        }
     }
+    private->next_free = FAT16_FIRST_CLUSTER;
+    return STATUS_OK;
+}
 
-    res = 0;
+// Takes a free cluster and ends the chain with it, the chain that ends at
+// prev or a new one if prev is 0. Returns the cluster.
+static int fat16_alloc_cluster(struct disk *disk, uint32_t prev) {
+    struct fat16_private *private = disk->fs_private;
+    if (!private->free_clusters) {
+        return -STATUS_DISK_FULL;
+    }
 
-out:
-    if (stream) {
-        disk_stream_close(stream);
+    uint32_t end = private->total_clusters + FAT16_FIRST_CLUSTER;
+    uint32_t cluster = private->next_free;
+    for (uint32_t n = 0; n < private->total_clusters; n++, cluster++) {
+        if (cluster >= end) {
+            cluster = FAT16_FIRST_CLUSTER;
+        }
+        if (!fat16_cluster_used(private, cluster)) {
+            break;
+        }
+    }
+    if (fat16_cluster_used(private, cluster)) {
+        // the count is off, the bitmap knows better
+        private->free_clusters = 0;
+        return -STATUS_DISK_FULL;
     }
+
+    int res = fat16_set_fat_entry(disk, cluster, FAT16_END_OF_CHAIN);
     if (res < 0) {
-        kfree(fat_private);
-        disk->fs_private = 0;
-        disk->fs = 0;
+        return res;
     }
-    if (res == 0) {
-        println("FAT16: resolved");
+    if (prev) {
+        res = fat16_set_fat_entry(disk, prev, cluster);
+        if (res < 0) {
+            fat16_set_fat_entry(disk, cluster, FAT16_FREE_CLUSTER);
+            return res;
+        }
+    }
+    fat16_mark_cluster(private, cluster, true);
+    private->free_clusters--;
+    private->next_free = cluster + 1;
+    return cluster;
+}
+
+// Frees the chain from cluster on
+static int fat16_free_chain(struct disk *disk, uint32_t cluster) {
+    struct fat16_private *private = disk->fs_private;
+    // a cluster already free means a broken chain, don't follow it further
+    while (fat16_is_data_cluster(private, cluster) &&
+           fat16_cluster_used(private, cluster)) {
+        int next = fat16_get_fat_entry(disk, cluster);
+        if (next < 0) {
+            return next;
+        }
+        int res = fat16_set_fat_entry(disk, cluster, FAT16_FREE_CLUSTER);
+        if (res < 0) {
+            return res;
+        }
+        fat16_mark_cluster(private, cluster, false);
+        private->free_clusters++;
+        if (cluster < private->next_free) {
+            private->next_free = cluster;
+        }
+        cluster = next;
+    }
+    return STATUS_OK;
+}
+
+// Writes zeroes over the cluster, a directory has to start out empty
+static int fat16_zero_cluster(struct disk *disk, uint32_t cluster) {
+    struct fat16_private *private = disk->fs_private;
+    char zeroes[DISK_SECTOR_SIZE];
+    memset(zeroes, 0, sizeof(zeroes));
+    struct disk_stream *stream = private->cluster_stream;
+    int res = disk_stream_seek(stream, fat16_cluster_pos(disk, cluster));
+    for (uint32_t i = 0; res >= 0 && i < private->cluster_bytes;
+         i += sizeof(zeroes)) {
+        res = disk_stream_write(stream, zeroes, sizeof(zeroes));
     }
     return res;
 }
 
-static void fat16_filename_to_proper_str(char **out, const char *in,
-                                         int max_len) {
-    int i = 0;
-    char *out_str = *out;
-    while (in[i] != ' ' && in[i] != '\0' && i < max_len) {
-        out_str[i] = in[i];
-        i++;
+// ---- directories ----
+
+static uint32_t fat16_get_first_cluster(struct fat16_dir_entry *entry) {
+    if (entry->high_16_bits_first_cluster != 0) {
+        print("Warning non zero high 16 cluster bits in fat16..");
     }
-    out_str[i] = '\0';
-    *out += i;
+    return (entry->high_16_bits_first_cluster << 16) |
+           entry->low_16_bits_first_cluster;
 }
 
-static void fat16_get_full_relative_filename(struct fat16_dir_entry *entry,
-                                             char *out, int max_len) {
-    memset(out, 0x00, max_len);
-    char *out_tmp = out;
-    fat16_filename_to_proper_str(&out_tmp, (const char *)entry->filename,
-                                 FAT16_MAX_FILE_NAME);
-    if (entry->ext[0] != ' ' && entry->ext[0] != '\0') {
-        *out_tmp = '.';
-        out_tmp++;
-        fat16_filename_to_proper_str(&out_tmp, (const char *)entry->ext,
-                                     FAT16_MAX_EXT_NAME);
+static void fat16_set_first_cluster(struct fat16_dir_entry *entry,
+                                    uint32_t cluster) {
+    entry->high_16_bits_first_cluster = 0;
+    entry->low_16_bits_first_cluster = cluster;
+}
+
+static bool fat16_is_name_char(char c) {
+    if ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') ||
+        (c >= '0' && c <= '9')) {
+        return true;
     }
+    const char *allowed = "!#$%&'()-@^_`{}~";
+    for (int i = 0; allowed[i]; i++) {
+        if (c == allowed[i]) {
+            return true;
+        }
+    }
+    return false;
 }
 
-static int fat16_cluster_to_sector(struct fat16_private *private,
-                                   uint32_t cluster) {
-    return private->root_dir.dir_end_sector_pos +
-           (cluster - 2) * private->header.primary_header.sectors_per_cluster;
+// "hello.txt" as the name of a dir entry, "HELLO   TXT". Long names aren't
+// supported, -STATUS_BAD_FILE_PATH for anything that isn't an 8.3 name.
+static int fat16_short_name(const char *name, uint8_t *out) {
+    memset(out, ' ', FAT16_SHORT_NAME);
+    int len = 0;
+    int max = FAT16_MAX_FILE_NAME;
+    for (int i = 0; name[i]; i++) {
+        char c = name[i];
+        if (c == '.' && max == FAT16_MAX_FILE_NAME && len > 0) {
+            // the extension goes after the padded name
+            len = FAT16_MAX_FILE_NAME;
+            max = FAT16_SHORT_NAME;
+            continue;
+        }
+        if (len >= max || !fat16_is_name_char(c)) {
+            return -STATUS_BAD_FILE_PATH;
+        }
+        out[len++] = c >= 'a' && c <= 'z' ? c - 'a' + 'A' : c;
+    }
+    return len > 0 ? STATUS_OK : -STATUS_BAD_FILE_PATH;
 }
 
-static int fat16_get_fat_entry(struct disk *disk, int cluster_num) {
-    int res = -1;
+// Byte position of entry index of the directory at dir_cluster (0 for the
+// root directory), 0 past its end
+static uint32_t fat16_dir_entry_pos(struct disk *disk, uint32_t dir_cluster,
+                                    uint32_t index) {
     struct fat16_private *private = disk->fs_private;
-    struct disk_stream *stream = private->fat16_read_stream;
-    if (!stream) {
-        goto out;
+    uint32_t entry_size = sizeof(struct fat16_dir_entry);
+    if (!dir_cluster) {
+        if (index >= private->header.primary_header.root_dir_entries) {
+            return 0;
+        }
+        return private->root_dir_start * disk->sector_size +
+               index * entry_size;
     }
-    uint32_t fat_table_byte_pos =
-        private->header.primary_header.reserved_sectors * disk->sector_size;
-    res = disk_stream_seek(stream,
-                           fat_table_byte_pos + cluster_num * FAT16_ENTRY_SIZE);
-    if (res < 0) {
-        goto out;
+
+    uint32_t per_cluster = private->cluster_bytes / entry_size;
+    uint32_t cluster = dir_cluster;
+    for (uint32_t i = index / per_cluster; i > 0; i--) {
+        int next = fat16_get_fat_entry(disk, cluster);
+        if (next < 0 || !fat16_is_data_cluster(private, next)) {
+            return 0;
+        }
+        cluster = next;
     }
-    uint32_t result = 0;
-    res = disk_stream_read(stream, &result, sizeof(result));
+    return fat16_cluster_pos(disk, cluster) +
+           (index % per_cluster) * entry_size;
+}
+
+static int fat16_read_entry(struct disk *disk, uint32_t pos,
+                            struct fat16_dir_entry *entry) {
+    struct fat16_private *private = disk->fs_private;
+    int res = disk_stream_seek(private->dir_stream, pos);
     if (res < 0) {
-        goto out;
+        return res;
     }
-    res = result;
-out:
-    return res;
+    return disk_stream_read(private->dir_stream, entry, sizeof(*entry));
 }
 
-static int fat16_get_cluster_at_byte_offset_from_start(struct disk *disk,
-                                                       int starting_cluster,
-                                                       int offset) {
-    int res = 0;
+static int fat16_write_entry(struct disk *disk, uint32_t pos,
+                             struct fat16_dir_entry *entry) {
     struct fat16_private *private = disk->fs_private;
-    int bytes_per_cluster =
-        private->header.primary_header.sectors_per_cluster * disk->sector_size;
-    int num_clusters = (offset + 1 + bytes_per_cluster - 1) / bytes_per_cluster;
-    int last_cluster = starting_cluster + num_clusters - 1;
-    int curr_cluster = starting_cluster;
-
-    for (int next_cluster_i = starting_cluster + 1;
-         next_cluster_i <= last_cluster; next_cluster_i++) {
-        int entry = fat16_get_fat_entry(disk, curr_cluster);
-        if (entry == 0xFF8 || entry == 0xFFF || entry < 0) {
-            // no more clusters according to the table
-            res = -STATUS_IO_ERROR;
-            goto out;
-        }
-        if (entry == FAT16_BAD_SEC) {
-            res = -STATUS_IO_ERROR;
-            goto out;
-        }
-        if (entry == 0xFF0 || entry == 0xFF6) {
-            // reserved
-            res = -STATUS_IO_ERROR;
-            goto out;
-        }
-        if (entry == 0x00) {
-            // corrupted
-            res = -STATUS_IO_ERROR;
-            goto out;
-        }
-        curr_cluster = entry;
-    }
-    res = curr_cluster;
-out:
-    return res;
+    int res = disk_stream_seek(private->dir_stream, pos);
+    if (res < 0) {
+        return res;
+    }
+    return disk_stream_write(private->dir_stream, entry, sizeof(*entry));
 }
 
-static int fat16_read_file_data_from_cluster(struct disk *disk,
-                                             int starting_cluster, int offset,
-                                             int total_bytes, void *out) {
-    struct fat16_private *fs_private = disk->fs_private;
-
-    struct disk_stream *stream = fs_private->cluster_stream;
-
-    int res = 0;
-
-    int bytes_per_cluster =
-        fs_private->header.primary_header.sectors_per_cluster *
-        disk->sector_size;
-
-    while (total_bytes > 0) {
-        int curr_cluster = fat16_get_cluster_at_byte_offset_from_start(
-            disk, starting_cluster, offset);
-
-        int offset_from_curr_cluster = offset % bytes_per_cluster;
+// Looks name up in the directory at dir_cluster, fills entry, its position
+// on the disk and its index in the directory. -STATUS_BAD_FILE_PATH if it
+// isn't there.
+static int fat16_find_entry(struct disk *disk, uint32_t dir_cluster,
+                            const char *name, struct fat16_dir_entry *entry,
+                            uint32_t *pos, uint32_t *index) {
+    uint8_t short_name[FAT16_SHORT_NAME];
+    if (fat16_short_name(name, short_name) < 0) {
+        return -STATUS_BAD_FILE_PATH;
+    }
 
-        int curr_sector = fat16_cluster_to_sector(fs_private, curr_cluster);
+    for (uint32_t i = 0;; i++) {
+        uint32_t entry_pos = fat16_dir_entry_pos(disk, dir_cluster, i);
+        if (!entry_pos) {
+            break;
+        }
+        int res = fat16_read_entry(disk, entry_pos, entry);
+        if (res < 0) {
+            return res;
+        }
+        if (entry->filename[0] == FAT16_ENTRY_END) {
+            break;
+        }
+        // long name parts have the volume label bit too
+        if (entry->filename[0] == FAT16_ENTRY_DELETED ||
+            (entry->attribs & FAT16_ATTR_VOLUME_LABEL)) {
+            continue;
+        }
+        if (memcmp(entry, short_name, FAT16_SHORT_NAME) == 0) {
+            *pos = entry_pos;
+            if (index) {
+                *index = i;
+            }
+            return STATUS_OK;
+        }
+    }
+    return -STATUS_BAD_FILE_PATH;
+}
 
-        int curr_byte_pos =
-            (curr_sector * disk->sector_size) + offset_from_curr_cluster;
+// Walks the directories of path up to its last part, which it returns. The
+// directory that holds (or would hold) that one goes to dir_cluster, 0 for
+// the root directory.
+static struct path_part *fat16_walk_dirs(struct disk *disk,
+                                         struct path_part *path,
+                                         uint32_t *dir_cluster) {
+    *dir_cluster = 0;
+    while (path->next) {
+        struct fat16_dir_entry entry;
+        uint32_t pos;
+        if (fat16_find_entry(disk, *dir_cluster, path->name, &entry, &pos,
+                             0) < 0 ||
+            !(entry.attribs & FAT16_ATTR_SUB_DIRECTORY)) {
+            return 0;
+        }
+        *dir_cluster = fat16_get_first_cluster(&entry);
+        path = path->next;
+    }
+    // open("0:/a/b/") not allowed
+    if (!path->name || path->name[0] == '\0') {
+        return 0;
+    }
+    return path;
+}
 
-        int total_to_read_bytes =
-            total_bytes > bytes_per_cluster ? bytes_per_cluster : total_bytes;
+// Adds an empty file called name to the directory at dir_cluster, in the
+// first unused entry or a new cluster at the end of a subdirectory
+static int fat16_create_entry(struct disk *disk, uint32_t dir_cluster,
+                              const char *name, struct fat16_dir_entry *entry,
+                              uint32_t *pos) {
+    memset(entry, 0, sizeof(*entry));
+    // the name and the extension are the first 11 bytes of the entry
+    int res = fat16_short_name(name, (uint8_t *)entry);
+    if (res < 0) {
+        return res;
+    }
+    entry->attribs = FAT16_ATTR_ARCHIVED;
 
-        res = disk_stream_seek(stream, curr_byte_pos);
-        if (res != STATUS_OK) {
-            goto out;
+    uint32_t entry_pos = 0;
+    uint32_t last_cluster = dir_cluster;
+    for (uint32_t i = 0;; i++) {
+        entry_pos = fat16_dir_entry_pos(disk, dir_cluster, i);
+        if (!entry_pos) {
+            break;
         }
-        res = disk_stream_read(stream, out, total_to_read_bytes);
-        if (res != STATUS_OK) {
-            goto out;
+        struct fat16_dir_entry slot;
+        res = fat16_read_entry(disk, entry_pos, &slot);
+        if (res < 0) {
+            return res;
+        }
+        if (slot.filename[0] == FAT16_ENTRY_END ||
+            slot.filename[0] == FAT16_ENTRY_DELETED) {
+            break;
         }
+    }
 
-        out += total_to_read_bytes;
-        offset += total_to_read_bytes;
-        total_bytes -= total_to_read_bytes;
+    if (!entry_pos) {
+        // full, the root directory can't grow
+        if (!dir_cluster) {
+            return -STATUS_DISK_FULL;
+        }
+        while (1) {
+            int next = fat16_get_fat_entry(disk, last_cluster);
+            if (next < 0) {
+                return next;
+            }
+            if (!fat16_is_data_cluster(disk->fs_private, next)) {
+                break;
+            }
+            last_cluster = next;
+        }
+        int cluster = fat16_alloc_cluster(disk, last_cluster);
+        if (cluster < 0) {
+            return cluster;
+        }
+        res = fat16_zero_cluster(disk, cluster);
+        if (res < 0) {
+            return res;
+        }
+        entry_pos = fat16_cluster_pos(disk, cluster);
     }
 
-out:
-    return res;
+    *pos = entry_pos;
+    return fat16_write_entry(disk, entry_pos, entry);
 }
 
-static uint32_t fat16_get_first_cluster(struct fat16_dir_entry *entry) {
-    if (entry->high_16_bits_first_cluster != 0) {
-        print("Warning non zero high 16 cluster bits in fat16..");
-    }
-    return (entry->high_16_bits_first_cluster << 16) |
-           entry->low_16_bits_first_cluster;
-}
+// ---- resolve ----
 
-static void fat16_free_dir(struct fat16_dir *dir) {
-    if (!dir) {
-        return;
-    }
-    if (dir->dir_entries) {
-        kfree(dir->dir_entries);
+// Where the FAT, the root directory and the data start, and how many
+// clusters there are. Images are often smaller than the volume their header
+// describes, clusters past the end of the disk don't count.
+static int fat16_load_layout(struct disk *disk,
+                             struct fat16_private *fat_private) {
+    struct fat16_header *header = &fat_private->header.primary_header;
+    if (header->bytes_per_sector != disk->sector_size ||
+        !header->sectors_per_cluster || !header->fat_copies) {
+        return -STATUS_IO_ERROR;
     }
-    kfree(dir);
-}
 
-static void fat16_free_item(struct fat16_item *item) {
-    if (!item) {
-        return;
+    uint32_t root_dir_size =
+        header->root_dir_entries * sizeof(struct fat16_dir_entry);
+    fat_private->fat_start = header->reserved_sectors;
+    fat_private->root_dir_start =
+        fat_private->fat_start + header->fat_copies * header->sectors_per_fat;
+    fat_private->data_start =
+        fat_private->root_dir_start +
+        (root_dir_size + disk->sector_size - 1) / disk->sector_size;
+    fat_private->cluster_bytes =
+        header->sectors_per_cluster * disk->sector_size;
+
+    uint32_t sectors =
+        header->total_sectors ? header->total_sectors : header->sectors_big;
+    if (disk->sectors && disk->sectors < sectors) {
+        sectors = disk->sectors;
     }
-    if (item->item_type == FAT16_ITEM_TYPE_DIR) {
-        fat16_free_dir(item->item.dir);
-    } else if (item->item_type == FAT16_ITEM_TYPE_FILE) {
-        if (item->item.dir_entry) {
-            kfree(item->item.dir_entry);
-        }
+    uint32_t clusters = 0;
+    if (sectors > fat_private->data_start) {
+        clusters =
+            (sectors - fat_private->data_start) / header->sectors_per_cluster;
+    }
+    uint32_t fat_entries =
+        header->sectors_per_fat * disk->sector_size / FAT16_ENTRY_SIZE;
+    if (clusters > fat_entries - FAT16_FIRST_CLUSTER) {
+        clusters = fat_entries - FAT16_FIRST_CLUSTER;
     }
-    kfree(item);
+    fat_private->total_clusters = clusters;
+    return STATUS_OK;
 }
 
-static struct fat16_dir *fat16_load_fat_dir(struct disk *disk,
-                                            struct fat16_dir_entry *entry) {
+int fat16_resolve(struct disk *disk) {
     int res = 0;
-    struct fat16_private *fat_private = disk->fs_private;
-    struct fat16_dir *dir = kzalloc(sizeof(struct fat16_dir));
-    if (!dir) {
+    struct fat16_private *fat_private = kzalloc(sizeof(struct fat16_private));
+    if (!fat_private) {
+        return -STATUS_NOT_ENOUGH_MEM;
+    }
+    fat16_init_private(disk, fat_private);
+    disk->fs_private = fat_private;
+    disk->fs = &fat16_fs;
+
+    struct disk_stream *stream = fat_private->dir_stream;
+    if (!stream || !fat_private->cluster_stream ||
+        !fat_private->fat16_stream) {
         res = -STATUS_NOT_ENOUGH_MEM;
         goto out;
     }
 
-    uint32_t cluster = fat16_get_first_cluster(entry);
-    uint32_t cluster_start_sector =
-        fat16_cluster_to_sector(fat_private, cluster);
-
-    // TODO: FIXME: fat16_get_total_items_in_dir only reads contingously from
-    // disk without tranversing the linked list of clusters
-    int total_items = fat16_get_total_items_in_dir(disk, cluster_start_sector);
-    dir->total_entries = total_items;
+    res = disk_stream_read(stream, &fat_private->header,
+                           sizeof(fat_private->header));
+    if (res != STATUS_OK) {
+        goto out;
+    }
 
-    int dir_size = total_items * sizeof(struct fat16_dir_entry);
-    dir->dir_entries = kzalloc(dir_size);
-    if (!dir->dir_entries) {
-        res = -STATUS_NOT_ENOUGH_MEM;
+    if (fat_private->header.shared.extended_header.signature !=
+        FAT16_SIGNATURE) {
+        res = 1; // - for error, 0 for true, > 0 for false
         goto out;
     }
 
-    res = fat16_read_file_data_from_cluster(disk, cluster, 0x00, dir_size,
-                                            dir->dir_entries);
+    res = fat16_load_layout(disk, fat_private);
+    if (res == STATUS_OK) {
+        res = fat16_load_used_clusters(disk);
+    }
     if (res != STATUS_OK) {
-        res = -1;
+        println("FAT16: failed to load the FAT");
         goto out;
     }
 
+    res = 0;
+
 out:
-    if (res < 0) {
-        if (dir && dir->dir_entries) {
-            kfree(dir->dir_entries);
+    if (res != 0) {
+        fat16_free_private(fat_private);
+        disk->fs_private = 0;
+        disk->fs = 0;
+    }
+    if (res == 0) {
+        println("FAT16: resolved");
+    }
+    return res;
+}
+
+// ---- files ----
+
+// The cluster that holds byte offset of the file. Writes (allocate) grow the
+// chain up to it, otherwise 0 if the chain ends before.
+static int fat16_file_cluster(struct fat16_node *node, uint32_t offset,
+                              bool allocate) {
+    struct disk *disk = node->disk;
+    struct fat16_private *private = disk->fs_private;
+    uint32_t index = offset / private->cluster_bytes;
+
+    uint32_t cluster = fat16_get_first_cluster(&node->entry);
+    uint32_t i = 0;
+    if (node->cluster && node->cluster_index <= index) {
+        cluster = node->cluster;
+        i = node->cluster_index;
+    }
+    if (!cluster) {
+        if (!allocate) {
+            return 0;
         }
-        if (dir) {
-            kfree(dir);
+        int res = fat16_alloc_cluster(disk, 0);
+        if (res < 0) {
+            return res;
         }
-        dir = 0;
+        cluster = res;
+        fat16_set_first_cluster(&node->entry, cluster);
     }
-    return dir;
-}
 
-static struct fat16_dir_entry *
-fat16_clone_dir_entry(struct fat16_dir_entry *entry) {
-    struct fat16_dir_entry *f_item = kzalloc(sizeof(struct fat16_dir_entry));
-    if (!f_item) {
-        return 0;
+    for (; i < index; i++) {
+        int next = fat16_get_fat_entry(disk, cluster);
+        if (next < 0) {
+            return next;
+        }
+        if (next >= FAT16_END_OF_CHAIN) {
+            if (!allocate) {
+                return 0;
+            }
+            next = fat16_alloc_cluster(disk, cluster);
+            if (next < 0) {
+                return next;
+            }
+        } else if (!fat16_is_data_cluster(private, next)) {
+            // free, bad or reserved in the middle of a chain
+            return -STATUS_IO_ERROR;
+        }
+        cluster = next;
     }
-    memcpy(f_item, entry, sizeof(struct fat16_dir_entry));
-    return f_item;
+
+    node->cluster = cluster;
+    node->cluster_index = index;
+    return cluster;
 }
 
-static struct fat16_item *
-fat16_new_fat_item_from_dir_entry(struct disk *disk,
-                                  struct fat16_dir_entry *entry) {
-    struct fat16_item *f_item = kzalloc(sizeof(struct fat16_item));
-    if (!f_item) {
-        return 0;
+// Reads or writes len bytes at the position of fd, a cluster at a time
+static int fat16_file_io(struct fat16_file_descriptor *fd, char *buf,
+                         uint32_t len, bool write) {
+    struct fat16_node *node = fd->node;
+    struct fat16_private *private = node->disk->fs_private;
+    struct disk_stream *stream = private->cluster_stream;
+
+    while (len > 0) {
+        int cluster = fat16_file_cluster(node, fd->pos, write);
+        if (cluster <= 0) {
+            // a chain shorter than the file
+            return cluster < 0 ? cluster : -STATUS_IO_ERROR;
+        }
+        uint32_t offset = fd->pos % private->cluster_bytes;
+        uint32_t n = private->cluster_bytes - offset;
+        if (n > len) {
+            n = len;
+        }
+
+        int res = disk_stream_seek(
+            stream, fat16_cluster_pos(node->disk, cluster) + offset);
+        if (res == STATUS_OK) {
+            res = write ? disk_stream_write(stream, buf, n)
+                        : disk_stream_read(stream, buf, n);
+        }
+        if (res != STATUS_OK) {
+            return res;
+        }
+
+        buf += n;
+        len -= n;
+        fd->pos += n;
+        if (write && fd->pos > node->entry.file_size) {
+            node->entry.file_size = fd->pos;
+        }
     }
+    return STATUS_OK;
+}
 
-    if (entry->attribs & FAT16_ATTR_SUB_DIRECTORY) {
-        f_item->item.dir = fat16_load_fat_dir(disk, entry);
-        f_item->item_type = FAT16_ITEM_TYPE_DIR;
+// Cuts the file down to size, or grows it with zeroes
+static int fat16_truncate_node(struct fat16_file_descriptor *fd,
+                               uint32_t size) {
+    struct fat16_node *node = fd->node;
+    struct disk *disk = node->disk;
+    struct fat16_private *private = disk->fs_private;
+    int res = STATUS_OK;
+
+    if (size > node->entry.file_size) {
+        char zeroes[DISK_SECTOR_SIZE];
+        memset(zeroes, 0, sizeof(zeroes));
+        uint32_t pos = fd->pos;
+        fd->pos = node->entry.file_size;
+        while (res == STATUS_OK && fd->pos < size) {
+            uint32_t n = size - fd->pos;
+            if (n > sizeof(zeroes)) {
+                n = sizeof(zeroes);
+            }
+            res = fat16_file_io(fd, zeroes, n, true);
+        }
+        fd->pos = pos;
     } else {
-        f_item->item.dir_entry = fat16_clone_dir_entry(entry);
-        f_item->item_type = FAT16_ITEM_TYPE_FILE;
+        uint32_t first = fat16_get_first_cluster(&node->entry);
+        uint32_t keep =
+            (size + private->cluster_bytes - 1) / private->cluster_bytes;
+        if (!keep) {
+            res = fat16_free_chain(disk, first);
+            fat16_set_first_cluster(&node->entry, 0);
+        } else {
+            int last =
+                fat16_file_cluster(node, (keep - 1) * private->cluster_bytes,
+                                   false);
+            int next = last > 0 ? fat16_get_fat_entry(disk, last) : last;
+            if (next >= 0 && last > 0) {
+                res = fat16_set_fat_entry(disk, last, FAT16_END_OF_CHAIN);
+                if (res == STATUS_OK) {
+                    res = fat16_free_chain(disk, next);
+                }
+            } else if (next < 0) {
+                res = next;
+            }
+        }
+        // may be one of the clusters just freed
+        node->cluster = 0;
+        node->entry.file_size = size;
     }
-    return f_item;
-}
 
-static struct fat16_item *
-fat16_find_item_in_dir_by_name(struct disk *disk, struct fat16_dir *dir,
-                               const char *file_name) {
-    struct fat16_item *f_item = 0;
-    char tmp_filename[FS_MAX_PATH_LEN];
-    for (int i = 0; i < dir->total_entries; i++) {
-        fat16_get_full_relative_filename(&dir->dir_entries[i], tmp_filename,
-                                         sizeof(tmp_filename));
+    node->entry.attribs |= FAT16_ATTR_ARCHIVED;
+    int wres = fat16_write_entry(disk, node->entry_pos, &node->entry);
+    return res != STATUS_OK ? res : wres;
+}
 
-        if (istrncmp(tmp_filename, file_name, sizeof(tmp_filename)) == 0) {
-            f_item =
-                fat16_new_fat_item_from_dir_entry(disk, &dir->dir_entries[i]);
-            break;
+static struct fat16_node *fat16_get_node(struct disk *disk,
+                                         struct fat16_dir_entry *entry,
+                                         uint32_t entry_pos) {
+    for (struct fat16_node *node = fat16_nodes; node; node = node->next) {
+        if (node->disk == disk && node->entry_pos == entry_pos) {
+            node->refs++;
+            return node;
         }
     }
-    return f_item;
+
+    struct fat16_node *node = kzalloc(sizeof(struct fat16_node));
+    if (!node) {
+        return 0;
+    }
+    node->disk = disk;
+    node->entry = *entry;
+    node->entry_pos = entry_pos;
+    node->refs = 1;
+    node->next = fat16_nodes;
+    fat16_nodes = node;
+    return node;
 }
 
-static struct fat16_item *fat16_get_dir_entry(struct disk *disk,
-                                              struct path_part *path) {
-    struct fat16_private *fat_private = disk->fs_private;
-    struct fat16_item *curr_item = fat16_find_item_in_dir_by_name(
-        disk, &fat_private->root_dir, path->name);
-    if (!curr_item) {
-        goto out;
+static void fat16_put_node(struct fat16_node *node) {
+    if (--node->refs > 0) {
+        return;
     }
-    while (path->next) {
-        if (curr_item->item_type != FAT16_ITEM_TYPE_DIR) {
-            fat16_free_item(curr_item);
-            curr_item = 0;
-            break;
-        }
-        path = path->next;
-        if (!path->name || path->name[0] == '\0') {
-            // empty namr in dir ?
-            // open("0:/a/b/") not allowed
-            fat16_free_item(curr_item);
-            curr_item = 0;
-            break;
-        }
-        struct fat16_item *next_item = fat16_find_item_in_dir_by_name(
-            disk, curr_item->item.dir, path->name);
-        fat16_free_item(curr_item);
-        curr_item = next_item;
+    struct fat16_node **link = &fat16_nodes;
+    while (*link != node) {
+        link = &(*link)->next;
     }
-
-out:
-    return curr_item;
+    *link = node->next;
+    kfree(node);
 }
 
 void *fat16_open(struct disk *disk, struct path_part *path, FILE_MODE mode) {
-    if (mode != FILE_READ) {
-        return ERROR(-STATUS_INVALID_ARG);
+    uint32_t dir_cluster;
+    struct path_part *last = fat16_walk_dirs(disk, path, &dir_cluster);
+    if (!last) {
+        return ERROR(-STATUS_BAD_FILE_PATH);
+    }
+
+    struct fat16_dir_entry entry;
+    uint32_t entry_pos;
+    int res = fat16_find_entry(disk, dir_cluster, last->name, &entry,
+                               &entry_pos, 0);
+    if (res == -STATUS_BAD_FILE_PATH && mode != FILE_READ) {
+        res = fat16_create_entry(disk, dir_cluster, last->name, &entry,
+                                 &entry_pos);
+    } else if (res == STATUS_OK && mode != FILE_READ &&
+               (entry.attribs &
+                (FAT16_ATTR_READ_ONLY | FAT16_ATTR_SUB_DIRECTORY))) {
+        res = -STATUS_INVALID_ARG;
+    }
+    if (res < 0) {
+        return ERROR(res);
     }
 
     struct fat16_file_descriptor *fd =
@@ -591,90 +904,74 @@ void *fat16_open(struct disk *disk, struct path_part *path, FILE_MODE mode) {
     if (!fd) {
         return ERROR(-STATUS_NOT_ENOUGH_MEM);
     }
-
-    fd->pos = 0;
-
-    fd->item = fat16_get_dir_entry(disk, path);
-    if (!fd->item) {
+    fd->node = fat16_get_node(disk, &entry, entry_pos);
+    if (!fd->node) {
         kfree(fd);
-        return ERROR(-STATUS_IO_ERROR);
+        return ERROR(-STATUS_NOT_ENOUGH_MEM);
     }
+    fd->mode = mode;
+    fd->pos = 0;
 
+    if (mode == FILE_WRITE && fd->node->entry.file_size > 0) {
+        res = fat16_truncate_node(fd, 0);
+        if (res < 0) {
+            fat16_close(fd);
+            return ERROR(res);
+        }
+    }
     return fd;
 }
 
 int fat16_read(struct disk *disk, void *descriptor, uint32_t size,
                uint32_t nmembs, char *out_ptr) {
-
-    int res = 0;
     struct fat16_file_descriptor *fd = descriptor;
-    struct fat16_dir_entry *entry = fd->item->item.dir_entry;
-    int offset = fd->pos;
+    nmembs = file_read_count(fd->pos, fd->node->entry.file_size, size, nmembs);
 
-    for (int i = 0; i < nmembs; i++) {
-        res = fat16_read_file_data_from_cluster(
-            disk, fat16_get_first_cluster(entry), offset, size, out_ptr);
-        if (ISERR(res)) {
-            goto out;
-        }
-        out_ptr += size;
-        offset += size;
+    int res = fat16_file_io(fd, out_ptr, size * nmembs, false);
+    if (res < 0) {
+        return res;
     }
-    fd->pos = offset;
-    res = nmembs;
-out:
-    return res;
+    return nmembs;
 }
 
-int fat16_seek(void *private, uint32_t offset, FILE_SEEK_MODE seek_mode) {
-    int res = 0;
-
-    struct fat16_file_descriptor *fd = private;
-    struct fat16_item *item = fd->item;
-
-    if (item->item_type != FAT16_ITEM_TYPE_FILE) {
-        return -STATUS_INVALID_ARG;
+int fat16_write(struct disk *disk, void *descriptor, uint32_t size,
+                uint32_t nmembs, const char *in_ptr) {
+    struct fat16_file_descriptor *fd = descriptor;
+    struct fat16_node *node = fd->node;
+    uint32_t len;
+    int res = file_write_start(fd->mode, node->entry.file_size, size, nmembs,
+                               &fd->pos, &len);
+    if (res < 0) {
+        return res;
     }
 
-    struct fat16_dir_entry *entry = item->item.dir_entry;
+    uint32_t start = fd->pos;
+    res = fat16_file_io(fd, (char *)in_ptr, len, true);
+    // also after a failed write, the entry has to match the clusters taken
+    node->entry.attribs |= FAT16_ATTR_ARCHIVED;
+    int wres = fat16_write_entry(disk, node->entry_pos, &node->entry);
 
-    if (offset >= entry->file_size) {
-        return -STATUS_IO_ERROR;
+    uint32_t written = (fd->pos - start) / size;
+    if (res < 0 && !written) {
+        return res;
     }
-
-    switch (seek_mode) {
-
-    case FILE_SEEK_SET:
-        fd->pos = offset;
-        break;
-
-    case FILE_SEEK_END:
-        res = -STATUS_NOT_IMPLEMENTED;
-        break;
-
-    case FILE_SEEK_CUR:
-        if (offset + fd->pos >= entry->file_size) {
-            res = -STATUS_INVALID_ARG;
-        } else {
-            fd->pos += offset;
-        }
-        break;
-
-    default:
-        res = -STATUS_INVALID_ARG;
-        break;
+    if (wres < 0) {
+        return wres;
     }
+    return written;
+}
 
-    return res;
+int fat16_seek(void *private, uint32_t offset, FILE_SEEK_MODE seek_mode) {
+    struct fat16_file_descriptor *fd = private;
+    return file_seek(&fd->pos, fd->node->entry.file_size, offset, seek_mode);
 }
 
 int fat16_stat(struct disk *disk, void *private, struct file_stat *stat) {
     struct fat16_file_descriptor *fd = private;
-    struct fat16_item *item = fd->item;
-    if (item->item_type != FAT16_ITEM_TYPE_FILE) {
+    struct fat16_dir_entry *entry = &fd->node->entry;
+    if (entry->attribs & FAT16_ATTR_SUB_DIRECTORY) {
         return -STATUS_INVALID_ARG;
     }
-    struct fat16_dir_entry *entry = item->item.dir_entry;
     stat->file_size = entry->file_size;
     stat->flags = 0;
     if (entry->attribs & FAT16_ATTR_READ_ONLY) {
@@ -683,16 +980,117 @@ int fat16_stat(struct disk *disk, void *private, struct file_stat *stat) {
     return 0;
 }
 
-static void fat16_fd_free(struct fat16_file_descriptor *fd) {
-    if (fd) {
-        fat16_free_item(fd->item);
-        kfree(fd);
+int fat16_truncate(struct disk *disk, void *private, uint32_t size) {
+    struct fat16_file_descriptor *fd = private;
+    if (fd->mode == FILE_READ) {
+        return -STATUS_INVALID_ARG;
+    }
+    int res = fat16_truncate_node(fd, size);
+    if (fd->pos > size) {
+        fd->pos = size;
     }
+    return res;
 }
 
+// The entry and the FAT are written on every change, only the buffer cache
+// holds anything back
+int fat16_sync(struct disk *disk, void *private) { return bcache_sync(disk); }
+
 int fat16_close(void *private) {
     struct fat16_file_descriptor *fd = private;
-    fat16_fd_free(fd);
-
+    fat16_put_node(fd->node);
+    kfree(fd);
     return 0;
-}
\ No newline at end of file
+}
+
+// Removes a file, not while it's open (-STATUS_FILE_BUSY). Directories stay.
+int fat16_unlink(struct disk *disk, struct path_part *path) {
+    uint32_t dir_cluster;
+    struct path_part *last = fat16_walk_dirs(disk, path, &dir_cluster);
+    if (!last) {
+        return -STATUS_BAD_FILE_PATH;
+    }
+    struct fat16_dir_entry entry;
+    uint32_t entry_pos;
+    uint32_t index;
+    int res = fat16_find_entry(disk, dir_cluster, last->name, &entry,
+                               &entry_pos, &index);
+    if (res < 0) {
+        return res;
+    }
+    if (entry.attribs & (FAT16_ATTR_READ_ONLY | FAT16_ATTR_SUB_DIRECTORY)) {
+        return -STATUS_INVALID_ARG;
+    }
+    for (struct fat16_node *node = fat16_nodes; node; node = node->next) {
+        if (node->disk == disk && node->entry_pos == entry_pos) {
+            return -STATUS_FILE_BUSY;
+        }
+    }
+
+    res = fat16_free_chain(disk, fat16_get_first_cluster(&entry));
+    if (res < 0) {
+        return res;
+    }
+    entry.filename[0] = FAT16_ENTRY_DELETED;
+    res = fat16_write_entry(disk, entry_pos, &entry);
+
+    // and the parts of its long name, in the entries right before it
+    while (res == STATUS_OK && index-- > 0) {
+        uint32_t pos = fat16_dir_entry_pos(disk, dir_cluster, index);
+        if (!pos || fat16_read_entry(disk, pos, &entry) < 0 ||
+            entry.attribs != FAT16_ATTR_LONG_NAME ||
+            entry.filename[0] == FAT16_ENTRY_DELETED) {
+            break;
+        }
+        entry.filename[0] = FAT16_ENTRY_DELETED;
+        res = fat16_write_entry(disk, pos, &entry);
+    }
+    return res;
+}
+
+// ---- tests ----
+
+static void fat16_test_check_fats(struct disk *disk) {
+    struct fat16_private *private = disk->fs_private;
+    struct fat16_header *header = &private->header.primary_header;
+    struct disk_stream *stream = private->fat16_stream;
+    char first[DISK_SECTOR_SIZE];
+    char copy[DISK_SECTOR_SIZE];
+    for (int i = 0; i < header->sectors_per_fat; i++) {
+        for (int c = 1; c < header->fat_copies; c++) {
+            disk_stream_seek(stream,
+                             (private->fat_start + i) * disk->sector_size);
+            disk_stream_read(stream, first, sizeof(first));
+            disk_stream_seek(stream, (private->fat_start + i +
+                                      c * header->sectors_per_fat) *
+                                         disk->sector_size);
+            disk_stream_read(stream, copy, sizeof(copy));
+            if (memcmp(first, copy, sizeof(first))) {
+                panic("fat16_test: FAT copies differ");
+            }
+        }
+    }
+}
+
+// The file semantics on the boot disk, then that the clusters taken are free
+// again and the FAT copies match
+void fat16_test() {
+    struct disk *disk = get_disk(0);
+    if (!disk || disk->fs != &fat16_fs) {
+        println("fat16 test passed, no FAT16 disk");
+        return;
+    }
+    struct fat16_private *private = disk->fs_private;
+    uint32_t free_clusters = private->free_clusters;
+    // a cluster and a bit
+    fs_test_files(disk->id, private->cluster_bytes + 1000);
+    if (private->free_clusters != free_clusters) {
+        panic("fat16_test: clusters leaked");
+    }
+    if (kfopen("0:/not a name.txt", "w")) {
+        panic("fat16_test: created a bad path");
+    }
+    fat16_test_check_fats(disk);
+    bcache_sync(disk);
+    println("fat16 test passed");
+}
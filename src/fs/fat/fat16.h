@@ -5,4 +5,6 @@
 
 struct file_system *fat16_init();
 
+void fat16_test();
+
 #endif
\ No newline at end of file
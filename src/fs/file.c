@@ -1,18 +1,30 @@
 #include "file.h"
 #include "config.h"
 #include "console/console.h"
+#include "cpu/spinlock.h"
+#include "disk/bcache.h"
 #include "disk/disk.h"
+#include "ext2/ext2.h"
 #include "fat/fat16.h"
+#include "procfs/procfs.h"
+#include "tmpfs/tmpfs.h"
 #include "fs/file.h"
+#include "kernel.h"
 #include "lib/string/string.h"
 #include "macros.h"
+#include "memory/heap/kcache.h"
 #include "memory/heap/kheap.h"
+#include "memory/memory.h"
 #include "status.h"
 #include "utils.h"
 // Path: src/fs/file.c
 
 struct file_system *filesystems[MAX_FILESYSTEMS];
 struct file_descriptor *file_descriptors[MAX_FILE_DESCRIPTORS];
+// slots of file_descriptors, not the descriptors themselves
+static struct spinlock fd_table_lock;
+static struct kcache fd_cache =
+    KCACHE_INIT("file_descriptor", sizeof(struct file_descriptor));
 
 static struct file_system **get_free_filesystem() {
     for (int i = 0; i < MAX_FILESYSTEMS; i++) {
@@ -34,8 +46,15 @@ void fs_insert_filesystem(struct file_system *fs) {
     *free_fs = fs;
 }
 
-// load the fs from the kernel boot image sector
-static void kfs_load() { fs_insert_filesystem(fat16_init()); }
+// load the fs from the kernel boot image sector. procfs and tmpfs go first,
+// they only take their own virtual disks, FAT16 would try to read their
+// sectors.
+static void kfs_load() {
+    fs_insert_filesystem(procfs_init());
+    fs_insert_filesystem(tmpfs_init());
+    fs_insert_filesystem(fat16_init());
+    fs_insert_filesystem(ext2_init());
+}
 
 void fs_init() {
     for (int i = 0; i < MAX_FILESYSTEMS; i++) {
@@ -44,14 +63,16 @@ void fs_init() {
     for (int i = 0; i < MAX_FILE_DESCRIPTORS; i++) {
         file_descriptors[i] = 0;
     }
+    spin_lock_init(&fd_table_lock, "fd_table");
     kfs_load();
 }
 
 static int new_file_descriptor(struct file_descriptor **fd_out) {
     int res = -STATUS_NOT_ENOUGH_MEM;
+    spin_lock(&fd_table_lock);
     for (int i = 0; i < MAX_FILE_DESCRIPTORS; i++) {
         if (file_descriptors[i] == 0) {
-            file_descriptors[i] = kzalloc(sizeof(struct file_descriptor));
+            file_descriptors[i] = kcache_zalloc(&fd_cache);
             if (file_descriptors[i] == 0) {
                 res = -STATUS_NOT_ENOUGH_MEM;
                 break;
@@ -62,6 +83,7 @@ static int new_file_descriptor(struct file_descriptor **fd_out) {
             break;
         }
     }
+    spin_unlock(&fd_table_lock);
     return res;
 }
 
@@ -76,8 +98,10 @@ static void free_file_descriptor(int fd) {
     if (fd <= 0 || fd >= MAX_FILE_DESCRIPTORS) {
         return;
     }
-    kfree(file_descriptors[fd - 1]);
+    spin_lock(&fd_table_lock);
+    kcache_free(&fd_cache, file_descriptors[fd - 1]);
     file_descriptors[fd - 1] = 0;
+    spin_unlock(&fd_table_lock);
 }
 
 struct file_system *fs_resolve(struct disk *disk) {
@@ -201,6 +225,23 @@ out:
     return res;
 }
 
+int kfwrite(const void *ptr, uint32_t size, uint32_t nmembs, int fd) {
+    if (size == 0 || nmembs == 0) {
+        return -STATUS_INVALID_ARG;
+    }
+    struct file_descriptor *file_descriptor = get_file_descriptor(fd);
+    if (!file_descriptor) {
+        return -STATUS_INVALID_ARG;
+    }
+    if (!file_descriptor->fs->write) {
+        return -STATUS_NOT_IMPLEMENTED;
+    }
+
+    return file_descriptor->fs->write(file_descriptor->disk,
+                                      file_descriptor->private_data, size,
+                                      nmembs, (const char *)ptr);
+}
+
 int kfstat(int fd, struct file_stat *stat) {
     struct file_descriptor *file_descriptor = get_file_descriptor(fd);
     if (!file_descriptor) {
@@ -211,6 +252,35 @@ int kfstat(int fd, struct file_stat *stat) {
                                      file_descriptor->private_data, stat);
 }
 
+// cuts the file down to size bytes, or grows it with zeroes
+int kftruncate(int fd, uint32_t size) {
+    struct file_descriptor *file_descriptor = get_file_descriptor(fd);
+    if (!file_descriptor) {
+        return -STATUS_INVALID_ARG;
+    }
+    if (!file_descriptor->fs->truncate) {
+        return -STATUS_NOT_IMPLEMENTED;
+    }
+
+    return file_descriptor->fs->truncate(file_descriptor->disk,
+                                         file_descriptor->private_data, size);
+}
+
+// returns once what was written to the file is on the disk
+int kfsync(int fd) {
+    struct file_descriptor *file_descriptor = get_file_descriptor(fd);
+    if (!file_descriptor) {
+        return -STATUS_INVALID_ARG;
+    }
+    if (!file_descriptor->fs->sync) {
+        // nothing held back
+        return STATUS_OK;
+    }
+
+    return file_descriptor->fs->sync(file_descriptor->disk,
+                                     file_descriptor->private_data);
+}
+
 int kfclose(int fd) {
     struct file_descriptor *file_descriptor = get_file_descriptor(fd);
     if (!file_descriptor) {
@@ -223,6 +293,90 @@ int kfclose(int fd) {
     return res;
 }
 
+int kfunlink(const char *filename) {
+    int res = 0;
+    struct path_t *root_path = parse_path(filename);
+    if (!root_path || root_path->root->name[0] == '\0') {
+        res = -STATUS_BAD_FILE_PATH;
+        goto out;
+    }
+
+    struct disk *disk = get_disk(root_path->drive_no);
+    if (!disk) {
+        res = -STATUS_BAD_FILE_PATH;
+        goto out;
+    }
+    if (!disk->fs) {
+        res = -STATUS_IO_ERROR;
+        goto out;
+    }
+    if (!disk->fs->unlink) {
+        res = -STATUS_NOT_IMPLEMENTED;
+        goto out;
+    }
+
+    res = disk->fs->unlink(disk, root_path->root);
+
+out:
+    if (root_path) {
+        free_path(root_path);
+    }
+    return res;
+}
+
+// ---- helpers for the file systems, which only do the I/O of their blocks ----
+
+// How many of nmembs whole items of size are left to read at pos
+uint32_t file_read_count(uint32_t pos, uint32_t file_size, uint32_t size,
+                         uint32_t nmembs) {
+    uint32_t left = pos < file_size ? file_size - pos : 0;
+    return nmembs < left / size ? nmembs : left / size;
+}
+
+// Where a write of nmembs items of size goes: at *pos, or at the end of the
+// file in "a" mode. Sets *pos there and *len to the bytes, fails for files
+// opened "r" and writes that would go past 4 GB.
+int file_write_start(FILE_MODE mode, uint32_t file_size, uint32_t size,
+                     uint32_t nmembs, uint32_t *pos, uint32_t *len) {
+    if (mode == FILE_READ) {
+        return -STATUS_INVALID_ARG;
+    }
+    if (mode == FILE_APPEND) {
+        *pos = file_size;
+    }
+    *len = size * nmembs;
+    if (*len / size != nmembs || *pos + *len < *pos) {
+        return -STATUS_INVALID_ARG;
+    }
+    return STATUS_OK;
+}
+
+// Moves *pos, not past the end of the file
+int file_seek(uint32_t *pos, uint32_t file_size, uint32_t offset,
+              FILE_SEEK_MODE seek_mode) {
+    uint32_t to;
+    // offset is an int really, negative ones wrap around to the right place
+    switch (seek_mode) {
+    case FILE_SEEK_SET:
+        to = offset;
+        break;
+    case FILE_SEEK_CUR:
+        to = *pos + offset;
+        break;
+    case FILE_SEEK_END:
+        to = file_size + offset;
+        break;
+    default:
+        return -STATUS_INVALID_ARG;
+    }
+
+    if (to > file_size) {
+        return -STATUS_INVALID_ARG;
+    }
+    *pos = to;
+    return STATUS_OK;
+}
+
 // ----------- tests ------------- //
 
 void fs_test() {
@@ -271,4 +425,100 @@ void fs_test() {
     } else {
         println("failed to open hello.txt");
     }
-}
\ No newline at end of file
+}
+static void fs_test_fail(const char *path, char *msg) {
+    print((char *)path);
+    print(": ");
+    panic(msg);
+}
+
+// Writes len bytes to a file on drive, reads them back, appends, truncates and
+// removes it, what every file system that can write has to do the same. The
+// drivers' own tests check what it took from the disk around it.
+void fs_test_files(int drive, uint32_t len) {
+    char *data = kmalloc(len);
+    char *check = kmalloc(len);
+    if (!data || !check) {
+        panic("fs_test_files: out of memory");
+    }
+    for (uint32_t i = 0; i < len; i++) {
+        data[i] = i * 7 + i / 256;
+    }
+
+    char path[] = "0:/fstest.tmp";
+    path[0] = '0' + drive;
+    kfunlink(path);
+    int fd = kfopen(path, "w");
+    if (!fd || kfwrite(data, 1, len, fd) != len) {
+        fs_test_fail(path, "fs_test_files: write failed");
+    }
+    // nothing else writes while the tests run
+    if (kfsync(fd) < 0 || bcache_stats.dirty) {
+        fs_test_fail(path, "fs_test_files: sync left dirty sectors");
+    }
+    kfclose(fd);
+
+    struct file_stat stat;
+    fd = kfopen(path, "r");
+    if (!fd || kfstat(fd, &stat) < 0 || stat.file_size != len) {
+        fs_test_fail(path, "fs_test_files: wrong size");
+    }
+    if (kfread(check, len, 1, fd) != 1 || memcmp(check, data, len)) {
+        fs_test_fail(path, "fs_test_files: read back differs");
+    }
+    if (kfread(check, 1, 1, fd) != 0) {
+        fs_test_fail(path, "fs_test_files: read past the end");
+    }
+    if (kfwrite(data, 1, 1, fd) >= 0) {
+        fs_test_fail(path, "fs_test_files: wrote to a file open for reading");
+    }
+    if (kfunlink(path) != -STATUS_FILE_BUSY) {
+        fs_test_fail(path, "fs_test_files: removed an open file");
+    }
+
+    // the reader sees what another descriptor appends
+    int afd = kfopen(path, "a");
+    if (!afd || kfwrite("xyz", 3, 1, afd) != 1) {
+        fs_test_fail(path, "fs_test_files: append failed");
+    }
+    if (kfseek(fd, -3, FILE_SEEK_END) < 0 || kfread(check, 3, 1, fd) != 1 ||
+        memcmp(check, "xyz", 3)) {
+        fs_test_fail(path, "fs_test_files: appended data not there");
+    }
+    kfclose(fd);
+
+    if (kftruncate(afd, 10) < 0 || kfstat(afd, &stat) < 0 ||
+        stat.file_size != 10) {
+        fs_test_fail(path, "fs_test_files: truncate failed");
+    }
+    if (kftruncate(afd, 20) < 0) {
+        fs_test_fail(path, "fs_test_files: growing failed");
+    }
+    kfclose(afd);
+    fd = kfopen(path, "r");
+    if (!fd || kfread(check, 20, 1, fd) != 1 || memcmp(check, data, 10)) {
+        fs_test_fail(path, "fs_test_files: truncated data differs");
+    }
+    for (int i = 10; i < 20; i++) {
+        if (check[i]) {
+            fs_test_fail(path, "fs_test_files: grown file not zeroed");
+        }
+    }
+    kfclose(fd);
+
+    if (kfunlink(path) < 0 || kfopen(path, "r")) {
+        fs_test_fail(path, "fs_test_files: unlink failed");
+    }
+    char bad[] = "0:/no/such.dir";
+    bad[0] = '0' + drive;
+    if (kfopen(bad, "w")) {
+        fs_test_fail(path, "fs_test_files: created a file in no directory");
+    }
+    bad[3] = '\0';
+    if (kfunlink(bad) >= 0) {
+        fs_test_fail(path, "fs_test_files: removed the root");
+    }
+
+    kfree(data);
+    kfree(check);
+}
@@ -32,14 +32,23 @@ struct file_stat {
     uint32_t file_size;
 };
 
+// "r" opens a file or directory that is there. "w" and "a" create the file if
+// it isn't, "w" empties it if it is and "a" writes at its end.
 typedef void *(*FS_OPEN_FUNCTION)(struct disk *disk, struct path_part *path,
                                   FILE_MODE mode);
 typedef int (*FS_RESOLVE_FUNCTION)(
     struct disk *disk); // returns 0 if the disk is formmated for the fs.
 
+// Reads whole items up to the end of the file, returns how many
 typedef int (*FS_READ_FUNCTION)(struct disk *disk, void *private_data,
                                 uint32_t size, uint32_t nmembs, char *out);
 
+// Writes at the position of the file, or at its end in "a" mode. Returns the
+// whole items written, short of nmembs if the disk got full.
+typedef int (*FS_WRITE_FUNCTION)(struct disk *disk, void *private_data,
+                                 uint32_t size, uint32_t nmembs,
+                                 const char *in);
+
 typedef int (*FS_SEEK_FUNCTION)(void *private, uint32_t,
                                 FILE_SEEK_MODE seek_mode);
 
@@ -48,14 +57,27 @@ typedef int (*FS_STAT_FUNCTION)(struct disk *disk, void *private,
 
 typedef int (*FS_CLOSE_FUNCTION)(void *private);
 
+typedef int (*FS_UNLINK_FUNCTION)(struct disk *disk, struct path_part *path);
+
+typedef int (*FS_TRUNCATE_FUNCTION)(struct disk *disk, void *private,
+                                    uint32_t size);
+
+// writes what the file system holds back for the file to the disk
+typedef int (*FS_SYNC_FUNCTION)(struct disk *disk, void *private);
+
+// write, unlink, truncate and sync are 0 on read only file systems
 struct file_system {
     char name[20];
     FS_OPEN_FUNCTION open;
     FS_READ_FUNCTION read;
+    FS_WRITE_FUNCTION write;
     FS_SEEK_FUNCTION seek;
     FS_RESOLVE_FUNCTION resolve;
     FS_STAT_FUNCTION stat;
     FS_CLOSE_FUNCTION close;
+    FS_UNLINK_FUNCTION unlink;
+    FS_TRUNCATE_FUNCTION truncate;
+    FS_SYNC_FUNCTION sync;
 };
 
 struct file_descriptor {
@@ -68,13 +90,26 @@ struct file_descriptor {
 void fs_init();
 int kfopen(const char *filename, const char *mode_str);
 int kfread(void *ptr, uint32_t size, uint32_t nmembs, int fd);
+int kfwrite(const void *ptr, uint32_t size, uint32_t nmembs, int fd);
 int kfseek(int fd, int offset, FILE_SEEK_MODE whence);
 int kfstat(int fd, struct file_stat *stat);
+int kftruncate(int fd, uint32_t size);
+int kfsync(int fd);
 int kfclose(int fd);
+int kfunlink(const char *filename);
 
 void fs_insert_filesystem(struct file_system *fs);
 struct file_system *fs_resolve(struct disk *disk);
 
+// for the file systems, from the size and position of a file
+uint32_t file_read_count(uint32_t pos, uint32_t file_size, uint32_t size,
+                         uint32_t nmembs);
+int file_write_start(FILE_MODE mode, uint32_t file_size, uint32_t size,
+                     uint32_t nmembs, uint32_t *pos, uint32_t *len);
+int file_seek(uint32_t *pos, uint32_t file_size, uint32_t offset,
+              FILE_SEEK_MODE seek_mode);
+
 void fs_test();
+void fs_test_files(int drive, uint32_t len);
 
 #endif
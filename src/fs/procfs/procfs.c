@@ -0,0 +1,603 @@
+#include "procfs.h"
+#include "config.h"
+#include "console/console.h"
+#include "cpu/lapic.h"
+#include "cpu/smp.h"
+#include "disk/bcache.h"
+#include "disk/disk.h"
+#include "fs/tmpfs/tmpfs.h"
+#include "kernel.h"
+#include "lib/string/string.h"
+#include "macros.h"
+#include "memory/e820/e820.h"
+#include "memory/heap/kcache.h"
+#include "memory/heap/kheap.h"
+#include "memory/heap/zpool.h"
+#include "memory/memory.h"
+#include "memory/paging/paging.h"
+#include "memory/swap/swap.h"
+#include "status.h"
+#include "task/process.h"
+#include "task/sched.h"
+#include "task/task.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+#define PROCFS_LABEL_WIDTH 16
+
+// text of a file while it is generated, whatever doesn't fit is cut off
+struct procfs_buf {
+    char *data;
+    uint32_t len;
+    uint32_t cap;
+    uint32_t line; // where the current line starts
+};
+
+typedef void (*PROCFS_GENERATE)(struct procfs_buf *buf, struct process *proc);
+
+struct procfs_file {
+    char *name;
+    bool per_pid; // lives in the <pid> directories
+    PROCFS_GENERATE generate;
+};
+
+struct procfs_descriptor {
+    struct procfs_file *file;
+    int pid;
+    // generated on the first read, seek or stat
+    char *data;
+    uint32_t len;
+    uint32_t pos;
+};
+
+int procfs_resolve(struct disk *disk);
+void *procfs_open(struct disk *disk, struct path_part *path, FILE_MODE mode);
+int procfs_seek(void *private, uint32_t offset, FILE_SEEK_MODE seek_mode);
+int procfs_read(struct disk *disk, void *private, uint32_t size,
+                uint32_t nmembs, char *out_ptr);
+int procfs_stat(struct disk *disk, void *private, struct file_stat *stat);
+int procfs_close(void *private);
+
+struct file_system procfs_fs = {
+    .resolve = procfs_resolve,
+    .open = procfs_open,
+    .read = procfs_read,
+    .seek = procfs_seek,
+    .stat = procfs_stat,
+    .close = procfs_close,
+};
+
+struct file_system *procfs_init() {
+    strncpy(procfs_fs.name, "procfs", 10);
+    return &procfs_fs;
+}
+
+// ---- text ----
+
+static void procfs_putc(struct procfs_buf *buf, char c) {
+    if (buf->len >= buf->cap) {
+        return;
+    }
+    buf->data[buf->len++] = c;
+    if (c == '\n') {
+        buf->line = buf->len;
+    }
+}
+
+static void procfs_puts(struct procfs_buf *buf, const char *str) {
+    while (*str) {
+        procfs_putc(buf, *str++);
+    }
+}
+
+// spaces up to column col of the current line, at least one
+static void procfs_pad(struct procfs_buf *buf, uint32_t col) {
+    do {
+        procfs_putc(buf, ' ');
+    } while (buf->len - buf->line < col && buf->len < buf->cap);
+}
+
+static void procfs_put_uint(struct procfs_buf *buf, uint32_t value) {
+    char digits[10];
+    int n = 0;
+    do {
+        digits[n++] = '0' + value % 10;
+        value /= 10;
+    } while (value);
+    while (n > 0) {
+        procfs_putc(buf, digits[--n]);
+    }
+}
+
+// value / 10 (in place) and value % 10 with 32 bit divisions only, there is
+// no libgcc for the 64 bit ones
+static uint32_t procfs_div10(uint64_t *value) {
+    uint32_t hi = *value >> 32;
+    uint32_t lo = (uint32_t)*value;
+    uint32_t q_hi = hi / 10;
+    uint32_t mid = ((hi % 10) << 16) | (lo >> 16);
+    uint32_t q_mid = mid / 10;
+    uint32_t low = ((mid % 10) << 16) | (lo & 0xFFFF);
+    *value = ((uint64_t)q_hi << 32) | (q_mid << 16) | (low / 10);
+    return low % 10;
+}
+
+static void procfs_put_u64(struct procfs_buf *buf, uint64_t value) {
+    char digits[20];
+    int n = 0;
+    do {
+        digits[n++] = '0' + procfs_div10(&value);
+    } while (value);
+    while (n > 0) {
+        procfs_putc(buf, digits[--n]);
+    }
+}
+
+// str right aligned to end at column col of the current line
+static void procfs_put_col(struct procfs_buf *buf, const char *str,
+                           uint32_t col) {
+    uint32_t len = strlen(str);
+    procfs_pad(buf, col > len ? col - len : 0);
+    procfs_puts(buf, str);
+}
+
+static void procfs_put_uint_col(struct procfs_buf *buf, uint32_t value,
+                                uint32_t col) {
+    uint32_t digits = 1;
+    for (uint32_t v = value; v >= 10; v /= 10) {
+        digits++;
+    }
+    procfs_pad(buf, col > digits ? col - digits : 0);
+    procfs_put_uint(buf, value);
+}
+
+static void procfs_put_hex(struct procfs_buf *buf, uint32_t value) {
+    static const char hex[] = "0123456789abcdef";
+    for (int shift = 28; shift >= 0; shift -= 4) {
+        procfs_putc(buf, hex[(value >> shift) & 0xF]);
+    }
+}
+
+// "name:" padded to the value column
+static void procfs_put_label(struct procfs_buf *buf, const char *name) {
+    procfs_puts(buf, name);
+    procfs_putc(buf, ':');
+    procfs_pad(buf, PROCFS_LABEL_WIDTH);
+}
+
+static void procfs_put_field(struct procfs_buf *buf, const char *name,
+                             uint32_t value, const char *unit) {
+    procfs_put_label(buf, name);
+    procfs_put_uint(buf, value);
+    procfs_puts(buf, unit);
+    procfs_putc(buf, '\n');
+}
+
+// part * 100 / whole, without overflowing 32 bits for large counts
+static uint32_t procfs_percent(uint32_t part, uint32_t whole) {
+    while (whole > 0xFFFFFF) {
+        part >>= 1;
+        whole >>= 1;
+    }
+    return whole ? part * 100 / whole : 0;
+}
+
+// ---- files ----
+
+static void procfs_meminfo(struct procfs_buf *buf, struct process *proc) {
+    uint32_t total = kheap_num_blocks();
+    uint32_t free = kheap_num_free_blocks();
+    uint32_t kb_per_block = KHEAP_BLOCK_SIZE / 1024;
+    procfs_put_field(buf, "HeapTotal", total * kb_per_block, " kB");
+    procfs_put_field(buf, "HeapUsed", (total - free) * kb_per_block, " kB");
+    procfs_put_field(buf, "HeapFree", free * kb_per_block, " kB");
+    procfs_put_field(buf, "HeapBlocks", total, "");
+    procfs_put_field(buf, "HeapFreeBlocks", free, "");
+    // all the ram the bios reports, 0 if it gave no map
+    procfs_put_field(buf, "MemTotal", (uint32_t)(e820_usable_bytes() >> 10),
+                     " kB");
+    // the pool's pages count as used above
+    procfs_put_field(buf, "ZeroPool", zpool_stats.pages * kb_per_block, " kB");
+    procfs_put_field(buf, "ZeroPoolHits", zpool_stats.hits, "");
+    procfs_put_field(buf, "ZeroPoolMisses", zpool_stats.misses, "");
+    procfs_put_field(buf, "ZeroFaults", zpool_stats.zero_faults, "");
+    procfs_put_field(buf, "SwapTotal", swap_stats.slots * kb_per_block, " kB");
+    procfs_put_field(buf, "SwapFree",
+                     (swap_stats.slots - swap_stats.used) * kb_per_block, " kB");
+    procfs_put_field(buf, "SwapOuts", swap_stats.outs, "");
+    procfs_put_field(buf, "SwapIns", swap_stats.ins, "");
+    procfs_put_field(buf, "SwapScanned", swap_stats.scanned, "");
+    // sectors in the buffer cache, not on the disk yet
+    uint32_t sectors_per_kb = 1024 / DISK_SECTOR_SIZE;
+    procfs_put_field(buf, "Buffers", bcache_stats.buffers / sectors_per_kb,
+                     " kB");
+    procfs_put_field(buf, "Dirty", bcache_stats.dirty / sectors_per_kb, " kB");
+    procfs_put_field(buf, "BufferHits", bcache_stats.hits, "");
+    procfs_put_field(buf, "BufferMisses", bcache_stats.misses, "");
+    procfs_put_field(buf, "BufferSyncs", bcache_stats.syncs, "");
+    procfs_put_field(buf, "BufferWrites", bcache_stats.writes, "");
+    procfs_put_field(buf, "BufferWritten", bcache_stats.written, "");
+    // file data on the tmpfs drive
+    procfs_put_field(buf, "Tmpfs", tmpfs_stats.pages * kb_per_block, " kB");
+    procfs_put_field(buf, "TmpfsFiles", tmpfs_stats.files, "");
+}
+
+// hit% is the allocations a cpu's magazines could serve without the slab
+static void procfs_caches(struct procfs_buf *buf, struct process *proc) {
+    const char *columns[] = {"size", "allocs", "frees", "slab", "trades",
+                             "hit%"};
+    procfs_puts(buf, "name");
+    for (int i = 0; i < 6; i++) {
+        procfs_put_col(buf, columns[i], 24 + 10 * i);
+    }
+    procfs_putc(buf, '\n');
+    for (struct kcache *cache = kcache_next(0); cache;
+         cache = kcache_next(cache)) {
+        uint32_t allocs = 0;
+        uint32_t frees = 0;
+        for (int i = 0; i < N_CPU_MAX; i++) {
+            allocs += cache->cpus[i].allocs;
+            frees += cache->cpus[i].frees;
+        }
+        uint32_t values[] = {cache->obj_size,
+                             allocs,
+                             frees,
+                             cache->slab_allocs,
+                             cache->depot_trades,
+                             procfs_percent(allocs - cache->slab_allocs,
+                                            allocs)};
+        procfs_puts(buf, cache->name);
+        for (int i = 0; i < 6; i++) {
+            procfs_put_uint_col(buf, values[i], 24 + 10 * i);
+        }
+        procfs_putc(buf, '\n');
+    }
+}
+
+// wait_cycles is the time spent polling the drive, reading and writing
+static void procfs_diskstats(struct procfs_buf *buf, struct process *proc) {
+    procfs_puts(buf, "disk");
+    procfs_put_col(buf, "reads", 14);
+    procfs_put_col(buf, "sectors", 24);
+    procfs_put_col(buf, "writes", 34);
+    procfs_put_col(buf, "written", 44);
+    procfs_puts(buf, "  wait_cycles\n");
+    for (int i = 0; i < disk_count(); i++) {
+        struct disk *disk = get_disk(i);
+        procfs_put_uint(buf, disk->id);
+        procfs_put_uint_col(buf, disk->stats.reads, 14);
+        procfs_put_uint_col(buf, disk->stats.sectors_read, 24);
+        procfs_put_uint_col(buf, disk->stats.writes, 34);
+        procfs_put_uint_col(buf, disk->stats.sectors_written, 44);
+        procfs_pad(buf, 46);
+        procfs_put_u64(buf, disk->stats.read_cycles + disk->stats.write_cycles);
+        procfs_putc(buf, '\n');
+    }
+}
+
+// queued is the length of the run queue, stolen the tasks taken from other
+// cpus' queues and hot the ones left there for being cache hot
+static void procfs_cpu_stat(struct procfs_buf *buf, struct process *proc) {
+    const char *columns[] = {"ticks", "idle", "queued", "stolen", "hot"};
+    procfs_puts(buf, "cpu");
+    for (int i = 0; i < 5; i++) {
+        procfs_put_col(buf, columns[i], 14 + 10 * i);
+    }
+    procfs_putc(buf, '\n');
+    for (int i = 0; i < smp_num_cpus(); i++) {
+        struct cpu *cpu = smp_get_cpu(i);
+        uint32_t values[] = {cpu->ticks, cpu->idle_ticks, cpu->rq.len,
+                             cpu->rq.stolen, cpu->rq.hot_skipped};
+        procfs_put_uint(buf, i);
+        for (int j = 0; j < 5; j++) {
+            procfs_put_uint_col(buf, values[j], 14 + 10 * j);
+        }
+        procfs_putc(buf, '\n');
+    }
+    int procs = 0;
+    for (int pid = 0; pid < MAX_PROCS; pid++) {
+        if (get_proc_by_pid(pid)) {
+            procs++;
+        }
+    }
+    procfs_put_field(buf, "procs", procs, "");
+    procfs_put_field(buf, "tsc_khz", tsc_khz(), "");
+}
+
+static const char *procfs_state(struct process *proc) {
+    if (proc->status == PROC_CREATING) {
+        return "creating";
+    }
+    if (proc->status == PROC_ZOMBIE) {
+        return "zombie";
+    }
+    switch (proc->task->state) {
+    case TASK_RUNNING:
+        return "running";
+    case TASK_BLOCKED:
+        return "blocked";
+    case TASK_READY:
+        return "ready";
+    }
+    return "dead";
+}
+
+static void procfs_pid_status(struct procfs_buf *buf, struct process *proc) {
+    procfs_put_label(buf, "Name");
+    procfs_puts(buf, proc->program_file);
+    procfs_putc(buf, '\n');
+    procfs_put_field(buf, "Pid", proc->pid, "");
+    procfs_put_field(buf, "PPid", proc->parent_pid, "");
+    procfs_put_label(buf, "State");
+    procfs_puts(buf, procfs_state(proc));
+    procfs_putc(buf, '\n');
+    if (proc->status == PROC_ZOMBIE) {
+        procfs_put_label(buf, "ExitStatus");
+        if (proc->exit_status < 0) {
+            procfs_putc(buf, '-');
+        }
+        procfs_put_uint(buf, proc->exit_status < 0 ? -proc->exit_status
+                                                   : proc->exit_status);
+        procfs_putc(buf, '\n');
+    }
+    procfs_put_field(buf, "Terminal", proc->terminal, "");
+    if (proc->task) {
+        procfs_put_field(buf, "Cpu", proc->task->cpu, "");
+    }
+}
+
+static void procfs_put_map(struct procfs_buf *buf, uint32_t start,
+                           uint32_t end, bool write, bool exec,
+                           const char *name) {
+    procfs_put_hex(buf, start);
+    procfs_putc(buf, '-');
+    procfs_put_hex(buf, end);
+    procfs_putc(buf, ' ');
+    procfs_putc(buf, 'r');
+    procfs_putc(buf, write ? 'w' : '-');
+    procfs_putc(buf, exec ? 'x' : '-');
+    procfs_putc(buf, ' ');
+    procfs_puts(buf, name);
+    procfs_putc(buf, '\n');
+}
+
+static void procfs_pid_maps(struct procfs_buf *buf, struct process *proc) {
+    // a zombie's memory is gone already
+    if (proc->status == PROC_ZOMBIE || !proc->task) {
+        return;
+    }
+    for (struct vma *vma = vma_first(&proc->vmas); vma; vma = vma_next(vma)) {
+        char *name = "[mmap]";
+        if (vma->type == VMA_IMAGE) {
+            name = proc->program_file;
+        } else if (vma->type == VMA_HEAP) {
+            name = "[heap]";
+        } else if (vma->type == VMA_STACK) {
+            name = "[stack]";
+        }
+        procfs_put_map(buf, vma->start, vma->end, vma->prot & VMA_WRITE,
+                       vma->prot & VMA_EXEC, name);
+    }
+}
+
+static void procfs_pid_stat(struct procfs_buf *buf, struct process *proc) {
+    uint32_t syscalls = 0;
+    for (int i = 0; i < NUM_SYS_CALLS; i++) {
+        syscalls += proc->syscalls[i];
+    }
+    procfs_put_field(buf, "Ticks", proc->ticks, "");
+    procfs_put_field(buf, "PageFaults", proc->page_faults, "");
+    procfs_put_field(buf, "Syscalls", syscalls, "");
+    for (int i = 0; i < NUM_SYS_CALLS; i++) {
+        if (proc->syscalls[i] == 0) {
+            continue;
+        }
+        procfs_puts(buf, "Syscall");
+        procfs_put_uint(buf, i);
+        procfs_putc(buf, ':');
+        procfs_pad(buf, PROCFS_LABEL_WIDTH);
+        procfs_put_uint(buf, proc->syscalls[i]);
+        procfs_putc(buf, '\n');
+    }
+}
+
+static struct procfs_file procfs_files[] = {
+    {"meminfo", false, procfs_meminfo},
+    {"caches", false, procfs_caches},
+    {"diskstats", false, procfs_diskstats},
+    {"stat", false, procfs_cpu_stat},
+    {"status", true, procfs_pid_status},
+    {"maps", true, procfs_pid_maps},
+    {"stat", true, procfs_pid_stat},
+};
+
+// ---- file system ----
+
+int procfs_resolve(struct disk *disk) {
+    // - for error, 0 for true, > 0 for false
+    return disk->type == DISK_TYPE_VIRTUAL && disk->id == PROCFS_DRIVE ? 0 : 1;
+}
+
+static struct procfs_file *procfs_find(const char *name, bool per_pid) {
+    for (int i = 0; i < sizeof(procfs_files) / sizeof(procfs_files[0]); i++) {
+        struct procfs_file *file = &procfs_files[i];
+        if (file->per_pid == per_pid &&
+            strncmp(file->name, name, FS_MAX_PATH_LEN) == 0) {
+            return file;
+        }
+    }
+    return 0;
+}
+
+// the pid of a "<pid>" or "self" directory, -1 if name isn't one
+static int procfs_parse_pid(const char *name) {
+    if (strncmp(name, "self", 5) == 0) {
+        struct process *proc = process_current();
+        return proc ? proc->pid : -1;
+    }
+    if (!is_digit(name[0])) {
+        return -1;
+    }
+    int pid = 0;
+    for (; *name; name++) {
+        if (!is_digit(*name) || pid >= MAX_PROCS) {
+            return -1;
+        }
+        pid = pid * 10 + (*name - '0');
+    }
+    return pid;
+}
+
+void *procfs_open(struct disk *disk, struct path_part *path, FILE_MODE mode) {
+    if (mode != FILE_READ) {
+        return ERROR(-STATUS_INVALID_ARG);
+    }
+
+    struct procfs_file *file = 0;
+    int pid = -1;
+    if (!path->next) {
+        file = procfs_find(path->name, false);
+    } else if (!path->next->next) {
+        pid = procfs_parse_pid(path->name);
+        if (pid >= 0 && get_proc_by_pid(pid)) {
+            file = procfs_find(path->next->name, true);
+        }
+    }
+    if (!file) {
+        return ERROR(-STATUS_BAD_FILE_PATH);
+    }
+
+    struct procfs_descriptor *fd = kzalloc(sizeof(struct procfs_descriptor));
+    if (!fd) {
+        return ERROR(-STATUS_NOT_ENOUGH_MEM);
+    }
+    fd->file = file;
+    fd->pid = pid;
+    return fd;
+}
+
+static int procfs_generate(struct procfs_descriptor *fd) {
+    if (fd->data) {
+        return STATUS_OK;
+    }
+    struct process *proc = 0;
+    if (fd->file->per_pid) {
+        // may have been reaped since the open
+        proc = get_proc_by_pid(fd->pid);
+        if (!proc) {
+            return -STATUS_IO_ERROR;
+        }
+    }
+    struct procfs_buf buf = {
+        .data = kmalloc(PROCFS_FILE_MAX), .cap = PROCFS_FILE_MAX};
+    if (!buf.data) {
+        return -STATUS_NOT_ENOUGH_MEM;
+    }
+    fd->file->generate(&buf, proc);
+    fd->data = buf.data;
+    fd->len = buf.len;
+    return STATUS_OK;
+}
+
+int procfs_read(struct disk *disk, void *private, uint32_t size,
+                uint32_t nmembs, char *out_ptr) {
+    struct procfs_descriptor *fd = private;
+    int res = procfs_generate(fd);
+    if (res != STATUS_OK) {
+        return res;
+    }
+    nmembs = file_read_count(fd->pos, fd->len, size, nmembs);
+    memcpy(out_ptr, fd->data + fd->pos, size * nmembs);
+    fd->pos += size * nmembs;
+    return nmembs;
+}
+
+int procfs_seek(void *private, uint32_t offset, FILE_SEEK_MODE seek_mode) {
+    struct procfs_descriptor *fd = private;
+    int res = procfs_generate(fd);
+    if (res != STATUS_OK) {
+        return res;
+    }
+
+    return file_seek(&fd->pos, fd->len, offset, seek_mode);
+}
+
+int procfs_stat(struct disk *disk, void *private, struct file_stat *stat) {
+    struct procfs_descriptor *fd = private;
+    int res = procfs_generate(fd);
+    if (res != STATUS_OK) {
+        return res;
+    }
+    stat->file_size = fd->len;
+    stat->flags = FILE_STAT_READ_ONLY;
+    return STATUS_OK;
+}
+
+int procfs_close(void *private) {
+    struct procfs_descriptor *fd = private;
+    if (fd->data) {
+        kfree(fd->data);
+    }
+    kfree(fd);
+    return STATUS_OK;
+}
+
+// ----------------------- tests ------------------- //
+
+// reads the whole file into buf (size bytes), returns its length
+static int procfs_test_read(const char *path, char *buf, int size) {
+    int fd = kfopen(path, "r");
+    if (fd <= 0) {
+        panic("procfs_test: open failed");
+    }
+    struct file_stat stat;
+    if (kfstat(fd, &stat) != STATUS_OK || stat.file_size == 0 ||
+        stat.file_size >= size) {
+        panic("procfs_test: bad file size");
+    }
+    memset(buf, 0, size);
+    if (kfread(buf, stat.file_size, 1, fd) != 1 ||
+        kfread(buf, 1, 1, fd) != 0) {
+        panic("procfs_test: read didn't stop at the end");
+    }
+    kfclose(fd);
+    return stat.file_size;
+}
+
+void procfs_test() {
+    static char buf[PROCFS_FILE_MAX];
+    procfs_test_read("9:/meminfo", buf, sizeof(buf));
+    if (strncmp(buf, "HeapTotal:", 10) != 0) {
+        panic("procfs_test: meminfo doesn't start with HeapTotal");
+    }
+    procfs_test_read("9:/stat", buf, sizeof(buf));
+    procfs_test_read("9:/diskstats", buf, sizeof(buf));
+
+    // parse_path allocates its parts from a kcache, so it is listed
+    int len = procfs_test_read("9:/caches", buf, sizeof(buf));
+    bool found = false;
+    for (int i = 0; i < len; i++) {
+        if ((i == 0 || buf[i - 1] == '\n') &&
+            strncmp(buf + i, "path_part ", 10) == 0) {
+            found = true;
+        }
+    }
+    if (!found) {
+        panic("procfs_test: path_part missing from caches");
+    }
+
+    uint64_t value = 12345678901234ULL;
+    if (procfs_div10(&value) != 4 || value != 1234567890123ULL) {
+        panic("procfs_test: procfs_div10");
+    }
+
+    // no such file, not a pid, too deep
+    const char *bad[] = {"9:/nope", "9:/x1/status", "9:/meminfo/status",
+                         "9:/0/status/x"};
+    for (int i = 0; i < sizeof(bad) / sizeof(bad[0]); i++) {
+        int fd = kfopen(bad[i], "r");
+        if (fd > 0) {
+            panic("procfs_test: opened a file that doesn't exist");
+        }
+    }
+}
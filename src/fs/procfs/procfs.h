@@ -0,0 +1,26 @@
+#ifndef PROCFS_H
+#define PROCFS_H
+
+#include "fs/file.h"
+
+// Read only files with what the kernel knows about itself, on drive
+// PROCFS_DRIVE. The text of a file is generated on its first read (or stat)
+// and stays the same until it is closed.
+//
+//   9:/meminfo            kernel heap blocks in use and free, zeroed pages,
+//                         swap, buffer cache, tmpfs
+//   9:/caches             kcache allocations and how many hit a magazine
+//   9:/diskstats          reads, writes, sectors and cycles waited per disk
+//   9:/stat               scheduler ticks per cpu, how many found it idle,
+//                         number of processes, tsc rate
+//   9:/<pid>/status       name, parent, state, terminal, cpu
+//   9:/<pid>/maps         mapped user memory
+//   9:/<pid>/stat         ticks, page faults and syscalls by number
+//
+// "self" instead of a pid is the process doing the reading.
+
+struct file_system *procfs_init();
+
+void procfs_test();
+
+#endif
@@ -0,0 +1,702 @@
+#include "tmpfs.h"
+#include "config.h"
+#include "console/console.h"
+#include "disk/disk.h"
+#include "fs/file.h"
+#include "kernel.h"
+#include "lib/string/string.h"
+#include "macros.h"
+#include "memory/heap/kcache.h"
+#include "memory/heap/kheap.h"
+#include "memory/memory.h"
+#include "status.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+#define TMPFS_PAGE_SIZE KHEAP_BLOCK_SIZE
+#define TMPFS_NAME_MAX 59
+// page pointers a file's page table grows by, a heap block of them
+#define TMPFS_SLOTS_STEP (KHEAP_BLOCK_SIZE / sizeof(char *))
+
+// newc cpio: a header of "070701" (or "070702") and 13 fields of 8 hex
+// digits, the name (0 terminated), then the data. Name and data are padded
+// to 4 bytes. The last entry is TRAILER!!!.
+#define CPIO_HEADER_SIZE 110
+#define CPIO_FIELD_MODE 1
+#define CPIO_FIELD_FILESIZE 6
+#define CPIO_FIELD_NAMESIZE 11
+#define CPIO_NUM_FIELDS 13
+#define CPIO_S_IFMT 0170000
+#define CPIO_S_IFDIR 0040000
+#define CPIO_S_IFREG 0100000
+#define CPIO_TRAILER "TRAILER!!!"
+#define CPIO_ALIGN(pos) (((pos) + 3) & ~3)
+
+// --start -- internal use only
+
+struct tmpfs_node {
+    struct tmpfs_node *parent;
+    struct tmpfs_node *children; // directories only
+    struct tmpfs_node *next;     // in the parent's children
+    bool is_dir;
+    int refs; // descriptors open on it
+    uint32_t size;
+    // a page per TMPFS_PAGE_SIZE of the file, 0 for a hole
+    char **pages;
+    uint32_t num_slots;
+    char name[TMPFS_NAME_MAX + 1];
+};
+
+struct tmpfs_file_descriptor {
+    struct tmpfs_node *node;
+    FILE_MODE mode;
+    uint32_t pos;
+};
+
+// --end  -- internal use only
+
+struct tmpfs_stats tmpfs_stats;
+
+static struct tmpfs_node tmpfs_root = {.is_dir = true};
+static struct kcache node_cache =
+    KCACHE_INIT("tmpfs_node", sizeof(struct tmpfs_node));
+static struct kcache fd_cache =
+    KCACHE_INIT("tmpfs_fd", sizeof(struct tmpfs_file_descriptor));
+
+int tmpfs_resolve(struct disk *disk);
+void *tmpfs_open(struct disk *disk, struct path_part *path, FILE_MODE mode);
+int tmpfs_seek(void *private, uint32_t offset, FILE_SEEK_MODE seek_mode);
+int tmpfs_read(struct disk *disk, void *descriptor, uint32_t size,
+               uint32_t nmembs, char *out_ptr);
+int tmpfs_write(struct disk *disk, void *descriptor, uint32_t size,
+                uint32_t nmembs, const char *in_ptr);
+int tmpfs_stat(struct disk *disk, void *private, struct file_stat *stat);
+int tmpfs_close(void *private);
+int tmpfs_unlink(struct disk *disk, struct path_part *path);
+int tmpfs_truncate(struct disk *disk, void *private, uint32_t size);
+
+// nothing is held back, there's no sync
+struct file_system tmpfs_fs = {
+    .resolve = tmpfs_resolve,
+    .open = tmpfs_open,
+    .read = tmpfs_read,
+    .write = tmpfs_write,
+    .seek = tmpfs_seek,
+    .stat = tmpfs_stat,
+    .close = tmpfs_close,
+    .unlink = tmpfs_unlink,
+    .truncate = tmpfs_truncate,
+};
+
+struct file_system *tmpfs_init() {
+    strncpy(tmpfs_fs.name, "tmpfs", 10);
+    return &tmpfs_fs;
+}
+
+// ---- nodes ----
+
+// name in dir, "." and ".." too, 0 if it isn't there
+static struct tmpfs_node *tmpfs_lookup(struct tmpfs_node *dir,
+                                       const char *name) {
+    if (strncmp(name, ".", 2) == 0) {
+        return dir;
+    }
+    if (strncmp(name, "..", 3) == 0) {
+        return dir->parent ? dir->parent : dir;
+    }
+    for (struct tmpfs_node *node = dir->children; node; node = node->next) {
+        if (strncmp(node->name, name, TMPFS_NAME_MAX + 1) == 0) {
+            return node;
+        }
+    }
+    return 0;
+}
+
+static int tmpfs_new(struct tmpfs_node *dir, const char *name, bool is_dir,
+                     struct tmpfs_node **out) {
+    int len = strnlen(name, TMPFS_NAME_MAX + 1);
+    if (len == 0 || len > TMPFS_NAME_MAX) {
+        return -STATUS_BAD_FILE_PATH;
+    }
+    struct tmpfs_node *node = kcache_zalloc(&node_cache);
+    if (!node) {
+        return -STATUS_NOT_ENOUGH_MEM;
+    }
+    memcpy(node->name, name, len);
+    node->is_dir = is_dir;
+    node->parent = dir;
+    node->next = dir->children;
+    dir->children = node;
+    tmpfs_stats.files++;
+    *out = node;
+    return STATUS_OK;
+}
+
+// The directory the last part of path is in, 0 if one on the way isn't there
+static struct path_part *tmpfs_walk_dirs(struct path_part *path,
+                                         struct tmpfs_node **dir_out) {
+    struct tmpfs_node *dir = &tmpfs_root;
+    for (; path->next; path = path->next) {
+        dir = tmpfs_lookup(dir, path->name);
+        if (!dir || !dir->is_dir) {
+            return 0;
+        }
+    }
+    *dir_out = dir;
+    return path;
+}
+
+// Gives back the pages from index keep on, and the page table with them if
+// that's all of them
+static void tmpfs_free_pages(struct tmpfs_node *node, uint32_t keep) {
+    for (uint32_t i = keep; i < node->num_slots; i++) {
+        if (node->pages[i]) {
+            kfree(node->pages[i]);
+            node->pages[i] = 0;
+            tmpfs_stats.pages--;
+        }
+    }
+    if (keep == 0 && node->pages) {
+        kfree(node->pages);
+        node->pages = 0;
+        node->num_slots = 0;
+    }
+}
+
+// Takes an empty node (no children) out of its directory and frees it
+static void tmpfs_remove(struct tmpfs_node *node) {
+    struct tmpfs_node **link = &node->parent->children;
+    while (*link != node) {
+        link = &(*link)->next;
+    }
+    *link = node->next;
+    tmpfs_free_pages(node, 0);
+    kcache_free(&node_cache, node);
+    tmpfs_stats.files--;
+}
+
+// The page at index of the file, 0 for a hole. With allocate a hole gets a
+// zeroed page.
+static int tmpfs_page(struct tmpfs_node *node, uint32_t index, bool allocate,
+                      char **page) {
+    *page = index < node->num_slots ? node->pages[index] : 0;
+    if (*page || !allocate) {
+        return STATUS_OK;
+    }
+    if (tmpfs_stats.pages >= TMPFS_MAX_PAGES) {
+        return -STATUS_DISK_FULL;
+    }
+
+    if (index >= node->num_slots) {
+        uint32_t slots = (index / TMPFS_SLOTS_STEP + 1) * TMPFS_SLOTS_STEP;
+        char **pages = kzalloc(slots * sizeof(char *));
+        if (!pages) {
+            return -STATUS_NOT_ENOUGH_MEM;
+        }
+        if (node->pages) {
+            memcpy(pages, node->pages, node->num_slots * sizeof(char *));
+            kfree(node->pages);
+        }
+        node->pages = pages;
+        node->num_slots = slots;
+    }
+    *page = kzalloc(TMPFS_PAGE_SIZE);
+    if (!*page) {
+        return -STATUS_NOT_ENOUGH_MEM;
+    }
+    node->pages[index] = *page;
+    tmpfs_stats.pages++;
+    return STATUS_OK;
+}
+
+// ---- files ----
+
+// Reads or writes len bytes at the position of fd, a page at a time. Holes
+// read as zeroes.
+static int tmpfs_file_io(struct tmpfs_file_descriptor *fd, char *buf,
+                         uint32_t len, bool write) {
+    struct tmpfs_node *node = fd->node;
+    while (len > 0) {
+        uint32_t offset = fd->pos % TMPFS_PAGE_SIZE;
+        uint32_t n = TMPFS_PAGE_SIZE - offset;
+        if (n > len) {
+            n = len;
+        }
+        char *page;
+        int res = tmpfs_page(node, fd->pos / TMPFS_PAGE_SIZE, write, &page);
+        if (res != STATUS_OK) {
+            return res;
+        }
+        if (write) {
+            memcpy(page + offset, buf, n);
+        } else if (page) {
+            memcpy(buf, page + offset, n);
+        } else {
+            memset(buf, 0, n);
+        }
+
+        buf += n;
+        len -= n;
+        fd->pos += n;
+        if (write && fd->pos > node->size) {
+            node->size = fd->pos;
+        }
+    }
+    return STATUS_OK;
+}
+
+// Cuts the file down to size, or grows it with a hole
+static void tmpfs_truncate_node(struct tmpfs_node *node, uint32_t size) {
+    if (size < node->size) {
+        uint32_t offset = size % TMPFS_PAGE_SIZE;
+        uint32_t index = size / TMPFS_PAGE_SIZE;
+        tmpfs_free_pages(node, offset ? index + 1 : index);
+        // what is left of the last page reads as zeroes if it grows again
+        if (offset && index < node->num_slots && node->pages[index]) {
+            memset(node->pages[index] + offset, 0, TMPFS_PAGE_SIZE - offset);
+        }
+    }
+    node->size = size;
+}
+
+int tmpfs_resolve(struct disk *disk) {
+    // - for error, 0 for true, > 0 for false
+    if (disk->type != DISK_TYPE_VIRTUAL || disk->id != TMPFS_DRIVE) {
+        return 1;
+    }
+    disk->fs_private = &tmpfs_root;
+    return 0;
+}
+
+void *tmpfs_open(struct disk *disk, struct path_part *path, FILE_MODE mode) {
+    struct tmpfs_node *dir;
+    struct path_part *last = tmpfs_walk_dirs(path, &dir);
+    if (!last) {
+        return ERROR(-STATUS_BAD_FILE_PATH);
+    }
+
+    int res = STATUS_OK;
+    struct tmpfs_node *node = tmpfs_lookup(dir, last->name);
+    if (!node) {
+        res = mode == FILE_READ ? -STATUS_BAD_FILE_PATH
+                                : tmpfs_new(dir, last->name, false, &node);
+    } else if (mode != FILE_READ && node->is_dir) {
+        res = -STATUS_INVALID_ARG;
+    }
+    if (res < 0) {
+        return ERROR(res);
+    }
+
+    struct tmpfs_file_descriptor *fd = kcache_zalloc(&fd_cache);
+    if (!fd) {
+        return ERROR(-STATUS_NOT_ENOUGH_MEM);
+    }
+    if (mode == FILE_WRITE) {
+        tmpfs_truncate_node(node, 0);
+    }
+    node->refs++;
+    fd->node = node;
+    fd->mode = mode;
+    fd->pos = 0;
+    return fd;
+}
+
+int tmpfs_read(struct disk *disk, void *descriptor, uint32_t size,
+               uint32_t nmembs, char *out_ptr) {
+    struct tmpfs_file_descriptor *fd = descriptor;
+    nmembs = file_read_count(fd->pos, fd->node->size, size, nmembs);
+
+    int res = tmpfs_file_io(fd, out_ptr, size * nmembs, false);
+    if (res < 0) {
+        return res;
+    }
+    return nmembs;
+}
+
+// Short of nmembs once TMPFS_MAX_PAGES are taken
+int tmpfs_write(struct disk *disk, void *descriptor, uint32_t size,
+                uint32_t nmembs, const char *in_ptr) {
+    struct tmpfs_file_descriptor *fd = descriptor;
+    uint32_t len;
+    int res = file_write_start(fd->mode, fd->node->size, size, nmembs,
+                               &fd->pos, &len);
+    if (res < 0) {
+        return res;
+    }
+
+    uint32_t start = fd->pos;
+    res = tmpfs_file_io(fd, (char *)in_ptr, len, true);
+    uint32_t written = (fd->pos - start) / size;
+    if (res < 0 && !written) {
+        return res;
+    }
+    return written;
+}
+
+int tmpfs_seek(void *private, uint32_t offset, FILE_SEEK_MODE seek_mode) {
+    struct tmpfs_file_descriptor *fd = private;
+    return file_seek(&fd->pos, fd->node->size, offset, seek_mode);
+}
+
+int tmpfs_stat(struct disk *disk, void *private, struct file_stat *stat) {
+    struct tmpfs_file_descriptor *fd = private;
+    if (fd->node->is_dir) {
+        return -STATUS_INVALID_ARG;
+    }
+    stat->file_size = fd->node->size;
+    stat->flags = 0;
+    return 0;
+}
+
+int tmpfs_truncate(struct disk *disk, void *private, uint32_t size) {
+    struct tmpfs_file_descriptor *fd = private;
+    if (fd->mode == FILE_READ) {
+        return -STATUS_INVALID_ARG;
+    }
+    tmpfs_truncate_node(fd->node, size);
+    if (fd->pos > size) {
+        fd->pos = size;
+    }
+    return STATUS_OK;
+}
+
+int tmpfs_close(void *private) {
+    struct tmpfs_file_descriptor *fd = private;
+    fd->node->refs--;
+    kcache_free(&fd_cache, fd);
+    return 0;
+}
+
+// Removes a file, not while it's open (-STATUS_FILE_BUSY). Directories stay.
+int tmpfs_unlink(struct disk *disk, struct path_part *path) {
+    struct tmpfs_node *dir;
+    struct path_part *last = tmpfs_walk_dirs(path, &dir);
+    if (!last) {
+        return -STATUS_BAD_FILE_PATH;
+    }
+    struct tmpfs_node *node = tmpfs_lookup(dir, last->name);
+    if (!node) {
+        return -STATUS_BAD_FILE_PATH;
+    }
+    if (node->refs) {
+        return -STATUS_FILE_BUSY;
+    }
+    if (node->is_dir) {
+        return -STATUS_INVALID_ARG;
+    }
+    tmpfs_remove(node);
+    return STATUS_OK;
+}
+
+// ---- initramfs ----
+
+// field of a cpio header, false if it isn't hex
+static bool tmpfs_cpio_field(const char *header, int field, uint32_t *out) {
+    const char *digits = header + 6 + field * 8;
+    uint32_t value = 0;
+    for (int i = 0; i < 8; i++) {
+        char c = to_lower(digits[i]);
+        if (is_digit(c)) {
+            value = (value << 4) | (c - '0');
+        } else if (c >= 'a' && c <= 'f') {
+            value = (value << 4) | (c - 'a' + 10);
+        } else {
+            return false;
+        }
+    }
+    *out = value;
+    return true;
+}
+
+// Puts a directory, or a file with size bytes of data, at path (len bytes,
+// "/" separated) along with the directories on the way. A file that is
+// there already is replaced.
+static int tmpfs_unpack_entry(const char *path, uint32_t len, bool is_dir,
+                              const char *data, uint32_t size) {
+    char name[TMPFS_NAME_MAX + 1];
+    struct tmpfs_node *node = &tmpfs_root;
+    uint32_t pos = 0;
+    while (len > 0 && path[len - 1] == '/') {
+        len--;
+    }
+
+    while (pos < len) {
+        while (pos < len && path[pos] == '/') {
+            pos++;
+        }
+        uint32_t start = pos;
+        while (pos < len && path[pos] != '/') {
+            pos++;
+        }
+        if (pos - start > TMPFS_NAME_MAX) {
+            return -STATUS_BAD_FILE_PATH;
+        }
+        memcpy(name, path + start, pos - start);
+        name[pos - start] = '\0';
+
+        struct tmpfs_node *dir = node;
+        bool make_dir = pos < len || is_dir;
+        node = tmpfs_lookup(dir, name);
+        if (!node) {
+            int res = tmpfs_new(dir, name, make_dir, &node);
+            if (res < 0) {
+                return res;
+            }
+        }
+        if (node->is_dir != make_dir) {
+            return -STATUS_INVALID_ARG;
+        }
+    }
+    // "/" alone is the root, not a file
+    if (node->is_dir != is_dir) {
+        return -STATUS_INVALID_ARG;
+    }
+    if (is_dir) {
+        return STATUS_OK;
+    }
+
+    struct tmpfs_file_descriptor fd = {.node = node, .mode = FILE_WRITE};
+    tmpfs_truncate_node(node, 0);
+    return tmpfs_file_io(&fd, (char *)data, size, true);
+}
+
+// Puts the directories and files of a newc cpio archive in the tmpfs,
+// returns how many or -error. Links and devices are skipped.
+int tmpfs_unpack(const char *archive, uint32_t len) {
+    int count = 0;
+    uint32_t pos = 0;
+    while (true) {
+        if (len - pos < CPIO_HEADER_SIZE) {
+            return -STATUS_INVALID_ARG;
+        }
+        const char *header = archive + pos;
+        uint32_t mode;
+        uint32_t size;
+        uint32_t name_size;
+        if ((memcmp(header, "070701", 6) && memcmp(header, "070702", 6)) ||
+            !tmpfs_cpio_field(header, CPIO_FIELD_MODE, &mode) ||
+            !tmpfs_cpio_field(header, CPIO_FIELD_FILESIZE, &size) ||
+            !tmpfs_cpio_field(header, CPIO_FIELD_NAMESIZE, &name_size)) {
+            return -STATUS_INVALID_ARG;
+        }
+
+        // the name's size counts its 0
+        uint32_t name_pos = pos + CPIO_HEADER_SIZE;
+        if (name_size == 0 || name_size > len - name_pos) {
+            return -STATUS_INVALID_ARG;
+        }
+        const char *name = archive + name_pos;
+        uint32_t data_pos = CPIO_ALIGN(name_pos + name_size);
+        if (data_pos > len || size > len - data_pos) {
+            return -STATUS_INVALID_ARG;
+        }
+        if (name_size == sizeof(CPIO_TRAILER) &&
+            memcmp(name, CPIO_TRAILER, name_size) == 0) {
+            break;
+        }
+
+        uint32_t kind = mode & CPIO_S_IFMT;
+        if (kind == CPIO_S_IFDIR || kind == CPIO_S_IFREG) {
+            int res = tmpfs_unpack_entry(name, name_size - 1,
+                                         kind == CPIO_S_IFDIR,
+                                         archive + data_pos, size);
+            if (res < 0) {
+                return res;
+            }
+            count++;
+        }
+
+        pos = CPIO_ALIGN(data_pos + size);
+        if (pos > len) {
+            pos = len;
+        }
+    }
+    return count;
+}
+
+// Reads the archive at path (INITRAMFS_FILE) into the tmpfs, once at boot.
+// Without one the programs are loaded from the disk.
+int tmpfs_load_initramfs(const char *path) {
+    int fd = kfopen(path, "r");
+    if (!fd) {
+        print("initramfs: no ");
+        print((char *)path);
+        println(", programs load from the disk");
+        return -STATUS_BAD_FILE_PATH;
+    }
+
+    char *archive = 0;
+    struct file_stat stat;
+    int res = kfstat(fd, &stat);
+    if (res < 0) {
+        goto out;
+    }
+    if (stat.file_size < CPIO_HEADER_SIZE) {
+        res = -STATUS_INVALID_ARG;
+        goto out;
+    }
+    archive = kmalloc(stat.file_size);
+    if (!archive) {
+        res = -STATUS_NOT_ENOUGH_MEM;
+        goto out;
+    }
+    if (kfread(archive, stat.file_size, 1, fd) != 1) {
+        res = -STATUS_IO_ERROR;
+        goto out;
+    }
+    res = tmpfs_unpack(archive, stat.file_size);
+
+out:
+    if (archive) {
+        kfree(archive);
+    }
+    kfclose(fd);
+    if (res < 0) {
+        print("initramfs: ");
+        print((char *)path);
+        print(" not unpacked, error ");
+        print_int(res);
+        println("");
+    }
+    return res;
+}
+
+// ---- tests ----
+
+// Appends an entry to a newc archive at pos, returns where the next one goes
+static uint32_t tmpfs_test_cpio(char *archive, uint32_t pos, const char *name,
+                                uint32_t mode, const char *data,
+                                uint32_t size) {
+    uint32_t name_size = strlen(name) + 1;
+    uint32_t fields[CPIO_NUM_FIELDS] = {0};
+    fields[CPIO_FIELD_MODE] = mode;
+    fields[CPIO_FIELD_FILESIZE] = size;
+    fields[CPIO_FIELD_NAMESIZE] = name_size;
+
+    memcpy(archive + pos, "070701", 6);
+    for (int f = 0; f < CPIO_NUM_FIELDS; f++) {
+        for (int d = 0; d < 8; d++) {
+            archive[pos + 6 + f * 8 + d] =
+                "0123456789abcdef"[(fields[f] >> (28 - 4 * d)) & 0xF];
+        }
+    }
+    pos += CPIO_HEADER_SIZE;
+    memcpy(archive + pos, name, name_size);
+    pos = CPIO_ALIGN(pos + name_size);
+    memcpy(archive + pos, data, size);
+    return CPIO_ALIGN(pos + size);
+}
+
+static void tmpfs_test_files() {
+    uint32_t pages = tmpfs_stats.pages;
+    uint32_t files = tmpfs_stats.files;
+    // into a fourth page
+    fs_test_files(TMPFS_DRIVE, 3 * TMPFS_PAGE_SIZE + 100);
+    if (tmpfs_stats.pages != pages || tmpfs_stats.files != files) {
+        panic("tmpfs_test: pages or files leaked");
+    }
+
+    // a hole of pages never taken, then a few bytes after it
+    char *check = kmalloc(TMPFS_PAGE_SIZE);
+    char path[] = "8:/tmpfstest.tmp";
+    path[0] = '0' + TMPFS_DRIVE;
+    int fd = kfopen(path, "a");
+    uint32_t far = 5000 * TMPFS_PAGE_SIZE;
+    if (!check || !fd || kftruncate(fd, far) < 0 ||
+        kfwrite("xyz", 3, 1, fd) != 1 || tmpfs_stats.pages != pages + 1) {
+        panic("tmpfs_test: append past a hole failed");
+    }
+    kfclose(fd);
+    fd = kfopen(path, "r");
+    if (!fd || kfseek(fd, far - TMPFS_PAGE_SIZE, FILE_SEEK_SET) < 0 ||
+        kfread(check, TMPFS_PAGE_SIZE, 1, fd) != 1) {
+        panic("tmpfs_test: hole not readable");
+    }
+    for (uint32_t i = 0; i < TMPFS_PAGE_SIZE; i++) {
+        if (check[i]) {
+            panic("tmpfs_test: hole not zeroes");
+        }
+    }
+    kfclose(fd);
+    if (kfunlink(path) < 0 || tmpfs_stats.pages != pages ||
+        tmpfs_stats.files != files) {
+        panic("tmpfs_test: pages or files leaked");
+    }
+    kfree(check);
+}
+
+static void tmpfs_test_unpack() {
+    uint32_t pages = tmpfs_stats.pages;
+    uint32_t files = tmpfs_stats.files;
+    char *archive = kzalloc(4 * TMPFS_PAGE_SIZE);
+    char *big = kmalloc(TMPFS_PAGE_SIZE + 1);
+    char check[8];
+    if (!archive || !big) {
+        panic("tmpfs_test: out of memory");
+    }
+    memset(big, 'b', TMPFS_PAGE_SIZE + 1);
+
+    uint32_t len = 0;
+    len = tmpfs_test_cpio(archive, len, ".", CPIO_S_IFDIR | 0755, 0, 0);
+    len = tmpfs_test_cpio(archive, len, "./tmpfst", CPIO_S_IFDIR | 0755, 0, 0);
+    len = tmpfs_test_cpio(archive, len, "./tmpfst/a", CPIO_S_IFREG | 0644,
+                          "hello", 5);
+    // the directory on the way comes with it
+    len = tmpfs_test_cpio(archive, len, "tmpfst/sub/big", CPIO_S_IFREG | 0644,
+                          big, TMPFS_PAGE_SIZE + 1);
+    len = tmpfs_test_cpio(archive, len, "tmpfst/link", 0120777, "a", 1);
+    uint32_t trailer = len;
+    len = tmpfs_test_cpio(archive, len, CPIO_TRAILER, 0, 0, 0);
+
+    if (tmpfs_unpack(archive, len) != 4 ||
+        tmpfs_stats.files != files + 4 || tmpfs_stats.pages != pages + 3) {
+        panic("tmpfs_test: unpack failed");
+    }
+    char a[] = "8:/tmpfst/sub/../a";
+    a[0] = '0' + TMPFS_DRIVE;
+    int fd = kfopen(a, "r");
+    if (!fd || kfread(check, 5, 1, fd) != 1 || memcmp(check, "hello", 5) ||
+        kfread(check, 1, 1, fd) != 0) {
+        panic("tmpfs_test: unpacked file differs");
+    }
+    kfclose(fd);
+    char link[] = "8:/tmpfst/link";
+    link[0] = '0' + TMPFS_DRIVE;
+    if (kfopen(link, "r")) {
+        panic("tmpfs_test: unpacked a link");
+    }
+    char sub[] = "8:/tmpfst/sub";
+    sub[0] = '0' + TMPFS_DRIVE;
+    if (kfopen(sub, "w") || kfunlink(sub) != -STATUS_INVALID_ARG) {
+        panic("tmpfs_test: wrote a directory");
+    }
+
+    // no trailer, or a broken header
+    if (tmpfs_unpack(archive, trailer) >= 0) {
+        panic("tmpfs_test: unpacked a cut archive");
+    }
+    archive[0] = 'x';
+    if (tmpfs_unpack(archive, len) >= 0) {
+        panic("tmpfs_test: unpacked a broken archive");
+    }
+
+    struct tmpfs_node *dir = tmpfs_lookup(&tmpfs_root, "tmpfst");
+    struct tmpfs_node *subdir = tmpfs_lookup(dir, "sub");
+    tmpfs_remove(tmpfs_lookup(subdir, "big"));
+    tmpfs_remove(subdir);
+    tmpfs_remove(tmpfs_lookup(dir, "a"));
+    tmpfs_remove(dir);
+    if (tmpfs_stats.pages != pages || tmpfs_stats.files != files) {
+        panic("tmpfs_test: pages or files leaked");
+    }
+    kfree(archive);
+    kfree(big);
+}
+
+// The file semantics and holes on the tmpfs drive, and unpacks an archive
+// made up here
+void tmpfs_test() {
+    tmpfs_test_files();
+    tmpfs_test_unpack();
+    println("tmpfs test passed");
+}
@@ -0,0 +1,29 @@
+#ifndef TMPFS_H
+#define TMPFS_H
+
+#include "fs/file.h"
+#include <stdint.h>
+
+// Files in kernel memory on drive TMPFS_DRIVE, gone at reboot. Files can be
+// created, written, truncated and removed like on the disks, in directories
+// of the archive. At boot it gets what the initramfs archive (INITRAMFS_FILE,
+// `cpio -H newc`) holds, the shell and the programs, so they start without
+// reading the disk.
+//
+// File data is kept in pages (KHEAP_BLOCK_SIZE), at most TMPFS_MAX_PAGES of
+// them for all files. Pages never written are holes that read as zeroes.
+
+struct tmpfs_stats {
+    uint32_t pages; // of file data
+    uint32_t files; // and directories
+};
+
+extern struct tmpfs_stats tmpfs_stats;
+
+struct file_system *tmpfs_init();
+int tmpfs_unpack(const char *archive, uint32_t len);
+int tmpfs_load_initramfs(const char *path);
+
+void tmpfs_test();
+
+#endif
@@ -1,11 +1,16 @@
 #include "utils.h"
 #include "config.h"
 #include "console/console.h"
+#include "kernel.h"
 #include "lib/string/string.h"
+#include "memory/heap/kcache.h"
 #include "memory/heap/kheap.h"
 #include "memory/memory.h"
 #include "status.h"
 
+static struct kcache path_part_cache =
+    KCACHE_INIT("path_part", sizeof(struct path_part));
+
 static bool is_path_valid(const char *path) {
     int len = strnlen(path, FS_MAX_PATH_LEN);
     return len >= 3 && is_digit(path[0]) && path[1] == ':' && path[2] == '/';
@@ -24,7 +29,7 @@ struct path_t *parse_path(const char *path_str) {
 
     struct path_t *path = kzalloc(sizeof(struct path_t));
 
-    struct path_part *root = kzalloc(sizeof(struct path_part));
+    struct path_part *root = kcache_zalloc(&path_part_cache);
 
     path->drive_no = drive_no;
     path->root = root;
@@ -35,7 +40,7 @@ struct path_t *parse_path(const char *path_str) {
     for (int i = 3; i < len; i++) {
         if (path_str_copy[i] == '/') {
             path_str_copy[i] = '\0';
-            struct path_part *part = kzalloc(sizeof(struct path_part));
+            struct path_part *part = kcache_zalloc(&path_part_cache);
             part->name = &path_str_copy[i + 1];
             part->next = NULL;
             root->next = part;
@@ -51,7 +56,7 @@ void free_path(struct path_t *path) {
     struct path_part *part = path->root;
     while (part != NULL) {
         struct path_part *next = part->next;
-        kfree(part);
+        kcache_free(&path_part_cache, part);
         part = next;
     }
     kfree(path);
@@ -60,78 +65,57 @@ void free_path(struct path_t *path) {
 // -----  tests ------------- //
 
 void test_parse_path() {
-    print("\n at start: ");
-    print_int(kheap_num_free_blocks());
-    println("");
     struct path_t *path = parse_path("0:/");
     if (path == NULL) {
-        print("path is NULL");
-        return;
+        panic("test_parse_path: path is NULL");
     }
     if (path->drive_no != 0) {
-        print("drive_no is not 0");
-        return;
+        panic("test_parse_path: drive_no is not 0");
     }
     if (path->root->name[0] != '\0') {
-        print("root name is not empty");
-        return;
+        panic("test_parse_path: root name is not empty");
     }
     if (path->root->next != NULL) {
-        print("root next is not NULL");
-        return;
+        panic("test_parse_path: root next is not NULL");
     }
     free_path(path);
 
     path = parse_path("0:/a");
     if (path == NULL) {
-        print("path is NULL");
-        return;
+        panic("test_parse_path: path is NULL");
     }
     if (path->drive_no != 0) {
-        print("drive_no is not 0");
-        return;
+        panic("test_parse_path: drive_no is not 0");
     }
     if (memcmp(path->root->name, "a", 1) != 0) {
-        print("root name is not a");
-        return;
+        panic("test_parse_path: root name is not a");
     }
     if (path->root->next != NULL) {
-        print("root next is not NULL");
-        return;
+        panic("test_parse_path: root next is not NULL");
     }
     free_path(path);
 
     path = parse_path("0:/a/bd/c");
     if (path == NULL) {
-        print("path is NULL");
-        return;
+        panic("test_parse_path: path is NULL");
     }
     if (path->drive_no != 0) {
-        print("drive_no is not 0");
-        return;
+        panic("test_parse_path: drive_no is not 0");
     }
     if (memcmp(path->root->name, "a", 1) != 0) {
-        print("root name is not a");
-        return;
+        panic("test_parse_path: root name is not a");
     }
     if (memcmp(path->root->next->name, "bd", 2) != 0) {
-        print("root next name is not bd");
-        return;
+        panic("test_parse_path: root next name is not bd");
     }
     if (memcmp(path->root->next->next->name, "c", 1) != 0) {
-        print("root next next name is not c");
-        return;
+        panic("test_parse_path: root next next name is not c");
     }
     if (path->root->next->next->next != NULL) {
-        print("root next next next is not NULL");
-        return;
+        panic("test_parse_path: root next next next is not NULL");
     }
 
     free_path(path);
-    print("\n at end: ");
-    print_int(kheap_num_free_blocks());
-    println("");
-    print("test_parse_path passed");
 }
 
 void test_fs_utils() { test_parse_path(); }
\ No newline at end of file
@@ -36,6 +36,8 @@ int80h:
     ; uint32_t flags
     ; uint32_t sp;
     ; uint32_t ss;
+    ; no error code, keeps the frame the same as the exceptions'
+    push dword 0
     ; Pushes the general purpose registers to the stack
     pushad
     
@@ -48,13 +50,15 @@ int80h:
     ; EAX holds our command lets push it to the stack for isr80h_handler
     push eax
     call intr_80h_handler
-
-    mov dword[tmp_res], eax
     add esp, 8
 
+    ; return value goes in the saved eax (pushad frame: edi esi ebp esp ebx
+    ; edx ecx eax), it is on this cpu's stack so no other cpu can touch it
+    mov [esp+28], eax
+
     ; Restore general purpose registers for user land
     popad
-    mov eax, [tmp_res]
+    add esp, 4 ; pop the error code
     iretd
 
 
@@ -68,6 +72,11 @@ int80h:
         ; uint32_t flags
         ; uint32_t sp;
         ; uint32_t ss;
+        ; uint32_t error_code, only some exceptions have one, a 0 stands in
+        ; for it on the rest so the frame is always the same
+        %if %1 != 8 && (%1 < 10 || %1 > 14) && %1 != 17 && %1 != 21 && %1 != 29 && %1 != 30
+        push dword 0
+        %endif
         ; Pushes the general purpose registers to the stack
         pushad
         ; Interrupt frame end
@@ -76,6 +85,7 @@ int80h:
         call interrupt_handler
         add esp, 8
         popad
+        add esp, 4 ; pop the error code
         iret
 %endmacro
 
@@ -110,7 +120,6 @@ test_div0:
 
 
 section .data
-tmp_res: dd 0
 
 
 %macro interrupt_array_entry 1
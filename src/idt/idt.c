@@ -1,12 +1,19 @@
 #include "idt.h"
 #include "config.h"
 #include "console/console.h"
+#include "cpu/cpu.h"
+#include "cpu/lapic.h"
+#include "cpu/smp.h"
 #include "io/io.h"
 #include "kernel.h"
 #include "memory/memory.h"
+#include "memory/paging/tlb.h"
+#include "memory/swap/swap.h"
 #include "status.h"
 #include "task/process.h"
 #include "task/task.h"
+#include "trace/prof.h"
+#include "trace/trace.h"
 
 // https://www.felixcloutier.com/x86/iret:iretd:iretq
 
@@ -26,41 +33,113 @@ extern void disable_interrupts();
 struct idt_entry idt[NUM_INTERRUPTS];
 struct idt_ptr idtp;
 
-volatile int cli_count;
-
-void pop_cli() {
-    if (cli_count <= 0) {
-        println("error pop cli with count already <= 0");
-    } else {
-        cli_count--;
-        disable_interrupts();
+// Kills the process that caused it, there is none on an idle cpu
+void idt_handle_exception(struct interrupt_frame *frame) {
+    if (!task_current()) {
+        panic("Exception with no task running");
     }
+    task_save_current_state(frame);
+    process_exit(task_current()->proc, -STATUS_PROC_EXCEPTION);
+    task_switch_and_run_any();
 }
 
-void push_cli() {
-    if (cli_count < 0) {
-        println("error push cli with count < 0");
+// page fault error code bits
+#define PAGE_FAULT_PRESENT 0x1 // a protection violation, else no page there
+#define PAGE_FAULT_WRITE 0x2
+#define PAGE_FAULT_USER 0x4
+
+// A page on the swap disk is read back in (swap_in) and a write to a page
+// still mapping the zero page gets it a page of its own (paging_fault_zero),
+// for accesses the kernel does for a syscall too (with cr0.wp). Every other
+// fault is a bad access: says what it was and kills the process like any
+// other exception. A fault with no task to blame (an idle cpu) or one of the
+// kernel in its own memory is a kernel bug, it panics.
+static void idt_handle_page_fault(struct interrupt_frame *frame) {
+    uint32_t addr = cpu_read_cr2();
+    struct task *task = task_current();
+    struct vma *vma = task ? vma_find(&task->proc->vmas, addr) : 0;
+    if (vma || (task && (frame->error_code & PAGE_FAULT_USER))) {
+        task->proc->page_faults++;
+    }
+    int res = -STATUS_INVALID_ARG;
+    if (vma && !(frame->error_code & PAGE_FAULT_PRESENT)) {
+        res = swap_in(&task->page_table, addr, vma_page_flags(vma->prot));
+    } else if (vma && (vma->prot & VMA_WRITE) &&
+               (frame->error_code & PAGE_FAULT_WRITE)) {
+        res = paging_fault_zero(&task->page_table, addr,
+                                vma_page_flags(vma->prot));
+    }
+    if (res == STATUS_OK) {
+        return;
+    }
+
+    print("[OS Warning] page fault at ");
+    print_int(addr);
+    print(frame->error_code & PAGE_FAULT_WRITE ? " on a write" : " on a read");
+    if (!task || (!(frame->error_code & PAGE_FAULT_USER) && !vma &&
+                  addr < KHEAP_SAFE_BOUNDARY)) {
+        println(" in the kernel");
+        panic("Kernel page fault");
+    }
+    if (!(frame->error_code & PAGE_FAULT_USER)) {
+        // a bad user pointer a syscall was given
+        println(" in the kernel, at a user address");
     } else {
-        cli_count++;
-        if (cli_count == 1)
-            enable_interrupts();
+        if (!vma) {
+            println(", nothing mapped there");
+        } else if (res == -STATUS_NOT_ENOUGH_MEM) {
+            println(", out of memory");
+        } else if (res == -STATUS_IO_ERROR) {
+            println(", swap disk error");
+        } else if (frame->error_code & PAGE_FAULT_PRESENT) {
+            println(", not allowed by the mapping");
+        } else {
+            println(", page missing in a mapping");
+        }
     }
+    idt_handle_exception(frame);
 }
 
-void idt_handle_exception(struct interrupt_frame *frame) {
-    task_save_current_state(frame);
-    process_exit(task_current()->proc, -STATUS_PROC_EXCEPTION);
-    task_switch_and_run_any();
+static void idt_ack_pic() {
+    port_io_out_byte(MASTER_PIC_PORT, MASTER_PIC_INTR_ACK);
 }
 
-void idt_handle_clock(struct interrupt_frame *frame) {
+static void idt_handle_tick(struct interrupt_frame *frame, void (*ack)()) {
+    if (!prof_tick(frame)) {
+        // profiling tick in between two scheduler ticks
+        ack();
+        return;
+    }
+    struct cpu *cpu = cpu_current();
+    cpu->ticks++;
+    if ((frame->cs & 0x3) == 0) {
+        cpu->idle_ticks++;
+        // interrupted the kernel idling in task_switch_and_run_any, there is
+        // no user state to save and it picks the next task by itself
+        ack();
+        return;
+    }
+    task_current()->proc->ticks++;
     task_save_current_state(frame);
     // ack the clock
-    port_io_out_byte(MASTER_PIC_PORT, MASTER_PIC_INTR_ACK);
+    ack();
     // run next task
     task_switch_to_next_and_run();
 }
 
+// PIT, only ever delivered to the bootstrap cpu
+void idt_handle_clock(struct interrupt_frame *frame) {
+    idt_handle_tick(frame, idt_ack_pic);
+}
+
+// local apic timer of the other cpus
+void idt_handle_lapic_timer(struct interrupt_frame *frame) {
+    idt_handle_tick(frame, lapic_eoi);
+}
+
+// must not be acked
+void idt_handle_spurious(struct interrupt_frame *frame) {}
+
 int idt_register_interrupt_call_back(int interrupt_no,
                                      INTERRUPT_CALL_BACK call_back) {
     if (interrupt_no < 0 || interrupt_no >= NUM_INTERRUPTS || !call_back) {
@@ -74,8 +153,20 @@ void interrupt_handler(int interrupt_no, struct interrupt_frame *frame) {
 
     // kernel_va_switch(); not needed kernel is already mapped
 
-    if (interrupt_no == 0xE) {
-        println("[OS Warning] page fault.. maybe a bug in code");
+    trace(TRACE_IRQ_ENTER, interrupt_no, frame->eip);
+
+    // the cpu asking holds the big kernel lock and waits for us
+    if (interrupt_no == TLB_SHOOTDOWN_VECTOR) {
+        tlb_handle_shootdown();
+        trace(TRACE_IRQ_EXIT, interrupt_no, 0);
+        return;
+    }
+
+    // Coming from user mode or the idle loop. Exceptions in the kernel
+    // itself arrive with the lock already held.
+    bool locked = !kernel_lock_held();
+    if (locked) {
+        kernel_lock();
     }
 
     if (interrupt_call_backs[interrupt_no] != 0) {
@@ -91,6 +182,11 @@ void interrupt_handler(int interrupt_no, struct interrupt_frame *frame) {
     // to another task port_io_out_byte(MASTER_PIC_PORT, MASTER_PIC_INTR_ACK);
 
     // task_page(); // not needed as we are not switching to kernel page table
+
+    trace(TRACE_IRQ_EXIT, interrupt_no, 0);
+    if (locked) {
+        kernel_unlock();
+    }
 }
 
 static SYSCALL_HANDLER sys_calls[NUM_SYS_CALLS];
@@ -132,13 +228,20 @@ void *intr_80h_handler(int command, struct interrupt_frame *frame) {
     // NOTE: kernel_va_switch changed to not load kernel's cr3 for now
     // kernel_va_switch();
 
+    kernel_lock();
     task_save_current_state(frame);
+    trace(TRACE_SYSCALL_ENTER, command, task_current()->proc->pid);
+    if (command >= 0 && command < NUM_SYS_CALLS) {
+        task_current()->proc->syscalls[command]++;
+    }
 
     res = syscall_handle_command(command, frame);
+    trace(TRACE_SYSCALL_EXIT, command, (uint32_t)res);
 
     // Get back to the user land pages
     // task_page();
 
+    kernel_unlock();
     return res;
 }
 
@@ -168,8 +271,6 @@ void idt_init() {
     idtp.limit = sizeof(idt) - 1;
     idtp.base = (uint32_t)&idt;
 
-    cli_count = 0;
-
     for (int i = 0; i < NUM_INTERRUPTS; i++) {
         idt_set(i, interrupt_handler_asm_wrappers[i]);
     }
@@ -180,12 +281,20 @@ void idt_init() {
     for (int i = 0; i < 0x20; i++) {
         idt_register_interrupt_call_back(i, idt_handle_exception);
     }
+    idt_register_interrupt_call_back(0xE, idt_handle_page_fault);
 
     idt_register_interrupt_call_back(0x20, idt_handle_clock);
+    idt_register_interrupt_call_back(LAPIC_TIMER_VECTOR,
+                                     idt_handle_lapic_timer);
+    idt_register_interrupt_call_back(LAPIC_SPURIOUS_VECTOR,
+                                     idt_handle_spurious);
 
     idt_load(&idtp);
 }
 
+// The other cpus share the table built by idt_init
+void idt_init_ap() { idt_load(&idtp); }
+
 // --------- TESTS ------------- //
 
 extern void test_int0();
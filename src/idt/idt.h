@@ -28,6 +28,7 @@ struct interrupt_frame {
     uint32_t edx;
     uint32_t ecx;
     uint32_t eax;
+    uint32_t error_code; // pushed by the cpu for some exceptions, else 0
     uint32_t eip;
     uint32_t cs;
     uint32_t eflags;
@@ -42,6 +43,7 @@ void syscall_register_command(int command_num, SYSCALL_HANDLER hanlder);
 
 void idt_test();
 void idt_init();
+void idt_init_ap();
 int idt_register_interrupt_call_back(int interrupt_no,
                                      INTERRUPT_CALL_BACK call_back);
 void external_interrupts_test();
@@ -6,7 +6,9 @@
 static bool no_page_sharing = true;
 static bool kernel_mapped_in_user_va = true;
 static bool interrupt_handler_cli_always = true;
-static bool single_cpu = true;
+// the aps are started, but only one cpu at a time runs kernel code
+static bool single_cpu = false;
+static bool kernel_big_lock = true;
 static bool kernel_uses_less_than_128mb_phy_adders = true;
 static bool single_task_per_process = true;
 static bool kmalloc_returns_page_aligned_memory = true;
@@ -41,6 +43,12 @@ static void assert_interrupt_handler_cli_always() {
     }
 }
 
+static void assert_kernel_big_lock() {
+    if (!kernel_big_lock) {
+        panic("Using big kernel lock invariant");
+    }
+}
+
 static void assert_single_cpu() {
     if (!single_cpu) {
         panic("Using single cpu invariant");
@@ -1,6 +1,6 @@
 [BITS 32]
 global _start, kernel_registers
-extern kernel_main
+extern kernel_main, __bss_start, __bss_end
 
 CODE_SEG equ 0x08
 DATA_SEG equ 0x10
@@ -35,6 +35,16 @@ _start:
 
     ; End Remap master PIC
 
+    ; .bss isn't in kernel.bin, zero it before any C runs
+    mov edi, __bss_start
+    mov ecx, __bss_end
+    sub ecx, edi
+    add ecx, 3
+    shr ecx, 2
+    xor eax, eax
+    cld
+    rep stosd
+
     call kernel_main
     jmp $
 
@@ -1,55 +1,87 @@
 #include "kernel.h"
+#include "bench/bench.h"
 #include "config.h"
 #include "console/console.h"
+#include "cpu/smp.h"
 #include "dev/keyboard.h"
+#include "dev/serial.h"
+#include "dev/tty.h"
+#include "disk/bcache.h"
 #include "disk/disk.h"
 #include "disk/streamer.h"
+#include "fs/ext2/ext2.h"
+#include "fs/fat/fat16.h"
 #include "fs/file.h"
+#include "fs/procfs/procfs.h"
+#include "fs/tmpfs/tmpfs.h"
 #include "gdt/gdt.h"
 #include "idt/idt.h"
 #include "io/io.h"
+#include "lib/rbtree/rbtree.h"
+#include "lib/ringbuf/ringbuf.h"
+#include "memory/e820/e820.h"
 #include "memory/heap/kheap.h"
+#include "memory/heap/zpool.h"
 #include "memory/memory.h"
 #include "memory/paging/paging.h"
+#include "memory/swap/swap.h"
+#include "memory/vma/vma.h"
 #include "status.h"
 #include "syscall/syscall.h"
 #include "task/process.h"
 #include "task/tss.h"
+#include "trace/prof.h"
+#include "trace/trace.h"
 
 #include <stddef.h>
 #include <stdint.h>
 
 void panic(char *msg) {
     println(msg);
+    serial_flush();
+    if (KERNEL_BENCH) {
+        bench_exit(1);
+    }
     while (1) {
     };
 }
 
-struct tss tss;
+#define GDT_FIRST_TSS 5
+
 struct gdt gdt_real[TOTAL_GDT_SEGS];
 struct gdt_structured gdt_structured[TOTAL_GDT_SEGS] = {
-    {.base = 0x00, .limit = 0x00, .type = 0x00},         // NULL
-    {.base = 0x00, .limit = 0xFFFFFFFF, .type = 0x9a},   // Kernel code  segment
-    {.base = 0x00, .limit = 0xFFFFFFFF, .type = 0x92},   // Kernel data segment
-    {.base = 0x00, .limit = 0xFFFFFFFF, .type = 0xf8},   // User code segment
-    {.base = 0x00, .limit = 0xFFFFFFFF, .type = 0xf2},   // User data segment
-    {.base = 0x00, .limit = sizeof(tss), .type = 0xE9}}; // TSS
-
-void tss_init() {
-    memset(&tss, 0x00, sizeof(tss));
-    tss.esp0 = 0x600000;
-    tss.ss0 = KERNEL_DATA_SEGMENT;
-    tss_load(0x28);
+    {.base = 0x00, .limit = 0x00, .type = 0x00},       // NULL
+    {.base = 0x00, .limit = 0xFFFFFFFF, .type = 0x9a}, // Kernel code  segment
+    {.base = 0x00, .limit = 0xFFFFFFFF, .type = 0x92}, // Kernel data segment
+    {.base = 0x00, .limit = 0xFFFFFFFF, .type = 0xf8}, // User code segment
+    {.base = 0x00, .limit = 0xFFFFFFFF, .type = 0xf2}, // User data segment
+    // TSS of every cpu, filled in by gdt_init
+};
+
+// Every cpu has its own TSS so it enters the kernel on its own stack
+void tss_init(struct cpu *cpu) {
+    memset(&cpu->tss, 0x00, sizeof(cpu->tss));
+    cpu->tss.esp0 = (uint32_t)cpu->kstack_top;
+    cpu->tss.ss0 = KERNEL_DATA_SEGMENT;
+    tss_load((GDT_FIRST_TSS + cpu->id) * sizeof(struct gdt));
 }
 
 void gdt_init() {
-    // Set the addr of tss, which couldn't be set at compile time
-    gdt_structured[TOTAL_GDT_SEGS - 1].base = (uint32_t)&tss;
+    // Set the addr of the tss, which couldn't be set at compile time
+    for (int i = 0; i < N_CPU_MAX; i++) {
+        struct gdt_structured *entry = &gdt_structured[GDT_FIRST_TSS + i];
+        entry->base = (uint32_t)&smp_get_cpu(i)->tss;
+        entry->limit = sizeof(struct tss);
+        entry->type = 0xE9;
+    }
     memset(gdt_real, 0x00, sizeof(gdt_real));
     gdt_structured_to_gdt(gdt_real, gdt_structured, TOTAL_GDT_SEGS);
     gdt_load(gdt_real, sizeof(gdt_real));
 }
 
+// For the other cpus, the gdt is shared
+void gdt_reload() { gdt_load(gdt_real, sizeof(gdt_real)); }
+
 void kernel_registers();
 
 // Switches to kernel privlidged segments
@@ -60,32 +92,74 @@ void kernel_va_switch() {
     // mapped paging_load_kernel_page_table();
 }
 
+// one shell per virtual terminal, each owning its terminal. They run from
+// the initramfs, or from the boot disk if it has no shell.
+static void load_shells() {
+    // also the arguments, "\0" joined
+    char path[] = "0:/shell\0Amogos\0Shell\0";
+    path[0] = '0' + TMPFS_DRIVE;
+    int fd = kfopen(path, "r");
+    if (fd) {
+        kfclose(fd);
+    } else {
+        path[0] = '0';
+    }
+
+    for (int term = 0; term < NUM_TERMINALS; term++) {
+        struct process *proc = 0;
+        int res = process_new(path, &proc);
+        if (res != STATUS_OK) {
+            print("Err code: ");
+            print_int(res);
+            panic("\nFailed to load shell");
+        }
+
+        process_set_parent_pid(proc, proc->pid);
+        process_set_terminal(proc, term);
+        process_add_arguments(proc, 3, sizeof(path) - 1, path);
+        tty_set_foreground(term, proc->pid);
+    }
+}
+
 void kernel_main() {
 
     console_init();
+    serial_init();
+    memory_init();
     gdt_init();
-    tss_init();
-    kheap_init();
+    tss_init(smp_get_cpu(0));
+    e820_init();
+    if (kheap_init() < 0) {
+        panic("Failed to create the kernel heap");
+    }
+    zpool_init();
     kpaging_init();
     fs_init();
+    if (bcache_init() < 0) {
+        panic("Failed to create the buffer cache");
+    }
     disk_init();
+    // the shell and the programs start from memory from here on
+    tmpfs_load_initramfs(INITRAMFS_FILE);
+    swap_init();
     idt_init();
     procs_init();
+    tty_init();
     keyboard_init();
+    serial_init_irq();
     register_syscalls();
-
-    println("Loading first proc..");
-
-    struct process *proc = 0;
-    int res = process_new("0:/shell", &proc);
-    if (res != STATUS_OK) {
-        print("Err code: ");
-        print_int(res);
-        panic("\nFailed to load shell");
+    smp_init();
+    trace_init();
+    prof_init();
+
+    if (KERNEL_BENCH) {
+        // tests and benchmarks, the user part of it is the only process
+        bench_run();
+    } else {
+        println("Loading shells..");
+        load_shells();
     }
 
-    process_add_arguments(proc, 3, 22, "0:/shell\0Amogos\0Shell\0");
-
     println("Loading success! Starting first proc..");
 
     task_run_init_task();
@@ -98,11 +172,30 @@ void kernel_main() {
     // disk_streamer_test();
     // test_fs_utils();
     // test_paging_set();
+    // e820_test();
     // kheap_test();
+    // kcache_test();
+    // zpool_test();
+    // swap_test();
+    // bcache_test();
+    // memory_test();
+    // paging_test();
+    // vma_test();
+    // memory_bench();
+    // ringbuf_test();
+    // rbtree_test();
+    // serial_test();
+    // spinlock_test();
+    // trace_test();
+    // prof_test();
     // console_test();
     // idt_test();
     // io_test();
     // fs_test();
+    // fat16_test();
+    // ext2_test();
+    // tmpfs_test();
+    // procfs_test();
 
     // interrupts disabled on here
     // external_interrupts_test:
@@ -5,4 +5,8 @@ void kernel_main();
 void panic(char *msg);
 void kernel_va_switch();
 
+struct cpu;
+void gdt_reload();
+void tss_init(struct cpu *cpu);
+
 #endif
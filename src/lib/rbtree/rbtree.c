@@ -0,0 +1,327 @@
+#include "rbtree.h"
+#include "console/console.h"
+#include "kernel.h"
+
+// Missing children are 0 and count as black
+
+static bool rb_is_red(struct rb_node *node) { return node && node->red; }
+
+// replaces old with new in old's parent (or the root)
+static void rb_replace_child(struct rb_root *root, struct rb_node *old,
+                             struct rb_node *new) {
+    struct rb_node *parent = old->parent;
+    if (!parent) {
+        root->node = new;
+    } else if (parent->left == old) {
+        parent->left = new;
+    } else {
+        parent->right = new;
+    }
+    if (new) {
+        new->parent = parent;
+    }
+}
+
+// x with right child y becomes y's left child, y's old left child b moves
+// over to x:  x(a, y(b, c))  ->  y(x(a, b), c)
+static void rb_rotate_left(struct rb_root *root, struct rb_node *x) {
+    struct rb_node *y = x->right;
+    x->right = y->left;
+    if (y->left) {
+        y->left->parent = x;
+    }
+    rb_replace_child(root, x, y);
+    y->left = x;
+    x->parent = y;
+}
+
+static void rb_rotate_right(struct rb_root *root, struct rb_node *x) {
+    struct rb_node *y = x->left;
+    x->left = y->right;
+    if (y->right) {
+        y->right->parent = x;
+    }
+    rb_replace_child(root, x, y);
+    y->right = x;
+    x->parent = y;
+}
+
+void rb_link(struct rb_node *node, struct rb_node *parent,
+             struct rb_node **link) {
+    node->parent = parent;
+    node->left = 0;
+    node->right = 0;
+    node->red = true;
+    *link = node;
+}
+
+// node was just linked as a red leaf, the only rule it can break is a red
+// parent
+void rb_insert(struct rb_root *root, struct rb_node *node) {
+    struct rb_node *parent;
+    while ((parent = node->parent) && parent->red) {
+        // a red parent is never the root, so there is a grandparent
+        struct rb_node *gparent = parent->parent;
+        bool left = parent == gparent->left;
+        struct rb_node *uncle = left ? gparent->right : gparent->left;
+        if (rb_is_red(uncle)) {
+            // push the grandparent's black down, go on from it
+            parent->red = false;
+            uncle->red = false;
+            gparent->red = true;
+            node = gparent;
+            continue;
+        }
+        // node on the inside: rotate it to the outside first
+        if (left && node == parent->right) {
+            rb_rotate_left(root, parent);
+            node = parent;
+            parent = node->parent;
+        } else if (!left && node == parent->left) {
+            rb_rotate_right(root, parent);
+            node = parent;
+            parent = node->parent;
+        }
+        parent->red = false;
+        gparent->red = true;
+        if (left) {
+            rb_rotate_right(root, gparent);
+        } else {
+            rb_rotate_left(root, gparent);
+        }
+    }
+    root->node->red = false;
+}
+
+// x (maybe 0, child of parent) has one black less on its paths than its
+// sibling
+static void rb_erase_fixup(struct rb_root *root, struct rb_node *x,
+                           struct rb_node *parent) {
+    while (x != root->node && !rb_is_red(x)) {
+        bool left = x == parent->left;
+        struct rb_node *sibling = left ? parent->right : parent->left;
+        if (sibling->red) {
+            // make the sibling black, the parent red
+            sibling->red = false;
+            parent->red = true;
+            if (left) {
+                rb_rotate_left(root, parent);
+                sibling = parent->right;
+            } else {
+                rb_rotate_right(root, parent);
+                sibling = parent->left;
+            }
+        }
+        if (!rb_is_red(sibling->left) && !rb_is_red(sibling->right)) {
+            // take a black off the sibling too, the parent is short now
+            sibling->red = true;
+            x = parent;
+            parent = x->parent;
+            continue;
+        }
+        // the sibling's far child must be red
+        if (left && !rb_is_red(sibling->right)) {
+            sibling->left->red = false;
+            sibling->red = true;
+            rb_rotate_right(root, sibling);
+            sibling = parent->right;
+        } else if (!left && !rb_is_red(sibling->left)) {
+            sibling->right->red = false;
+            sibling->red = true;
+            rb_rotate_left(root, sibling);
+            sibling = parent->left;
+        }
+        sibling->red = parent->red;
+        parent->red = false;
+        if (left) {
+            sibling->right->red = false;
+            rb_rotate_left(root, parent);
+        } else {
+            sibling->left->red = false;
+            rb_rotate_right(root, parent);
+        }
+        x = root->node;
+        break;
+    }
+    if (x) {
+        x->red = false;
+    }
+}
+
+void rb_erase(struct rb_root *root, struct rb_node *node) {
+    struct rb_node *x;
+    struct rb_node *parent;
+    bool removed_red;
+
+    if (!node->left || !node->right) {
+        x = node->left ? node->left : node->right;
+        parent = node->parent;
+        removed_red = node->red;
+        rb_replace_child(root, node, x);
+    } else {
+        // the successor takes node's place and color, what breaks is where
+        // the successor was
+        struct rb_node *succ = node->right;
+        while (succ->left) {
+            succ = succ->left;
+        }
+        x = succ->right;
+        removed_red = succ->red;
+        if (succ->parent == node) {
+            parent = succ;
+        } else {
+            parent = succ->parent;
+            rb_replace_child(root, succ, x);
+            succ->right = node->right;
+            succ->right->parent = succ;
+        }
+        rb_replace_child(root, node, succ);
+        succ->left = node->left;
+        succ->left->parent = succ;
+        succ->red = node->red;
+    }
+
+    if (!removed_red) {
+        rb_erase_fixup(root, x, parent);
+    }
+}
+
+struct rb_node *rb_first(struct rb_root *root) {
+    struct rb_node *node = root->node;
+    while (node && node->left) {
+        node = node->left;
+    }
+    return node;
+}
+
+struct rb_node *rb_last(struct rb_root *root) {
+    struct rb_node *node = root->node;
+    while (node && node->right) {
+        node = node->right;
+    }
+    return node;
+}
+
+struct rb_node *rb_next(struct rb_node *node) {
+    if (node->right) {
+        node = node->right;
+        while (node->left) {
+            node = node->left;
+        }
+        return node;
+    }
+    while (node->parent && node == node->parent->right) {
+        node = node->parent;
+    }
+    return node->parent;
+}
+
+struct rb_node *rb_prev(struct rb_node *node) {
+    if (node->left) {
+        node = node->left;
+        while (node->right) {
+            node = node->right;
+        }
+        return node;
+    }
+    while (node->parent && node == node->parent->left) {
+        node = node->parent;
+    }
+    return node->parent;
+}
+
+// ---- tests ----
+
+#define RBTREE_TEST_NODES 200
+
+struct rbtree_test_item {
+    struct rb_node node;
+    int key;
+};
+
+// black nodes on every path down from node, panics if the rules are broken
+static int rbtree_check(struct rb_node *node) {
+    if (!node) {
+        return 1;
+    }
+    if (node->red && (rb_is_red(node->left) || rb_is_red(node->right))) {
+        panic("rbtree_test: red node with a red child");
+    }
+    if ((node->left && node->left->parent != node) ||
+        (node->right && node->right->parent != node)) {
+        panic("rbtree_test: broken parent link");
+    }
+    int left = rbtree_check(node->left);
+    if (left != rbtree_check(node->right)) {
+        panic("rbtree_test: paths with different black heights");
+    }
+    return left + !node->red;
+}
+
+static void rbtree_test_insert(struct rb_root *root,
+                               struct rbtree_test_item *item) {
+    struct rb_node **link = &root->node;
+    struct rb_node *parent = 0;
+    while (*link) {
+        parent = *link;
+        if (item->key < rb_entry(parent, struct rbtree_test_item, node)->key) {
+            link = &parent->left;
+        } else {
+            link = &parent->right;
+        }
+    }
+    rb_link(&item->node, parent, link);
+    rb_insert(root, &item->node);
+}
+
+// keys must come out sorted and count of them
+static void rbtree_test_walk(struct rb_root *root, int count) {
+    if (root->node && (root->node->red || root->node->parent)) {
+        panic("rbtree_test: bad root");
+    }
+    rbtree_check(root->node);
+    int n = 0;
+    int last = -1;
+    for (struct rb_node *node = rb_first(root); node; node = rb_next(node)) {
+        int key = rb_entry(node, struct rbtree_test_item, node)->key;
+        if (key <= last) {
+            panic("rbtree_test: keys out of order");
+        }
+        last = key;
+        n++;
+    }
+    if (n != count) {
+        panic("rbtree_test: lost nodes");
+    }
+}
+
+void rbtree_test() {
+    static struct rbtree_test_item items[RBTREE_TEST_NODES];
+    struct rb_root root = {0};
+
+    // a permutation of the keys, so inserts hit every rotation case
+    for (int i = 0; i < RBTREE_TEST_NODES; i++) {
+        items[i].key = (i * 37) % RBTREE_TEST_NODES;
+        rbtree_test_insert(&root, &items[i]);
+        rbtree_test_walk(&root, i + 1);
+    }
+    if (rb_entry(rb_last(&root), struct rbtree_test_item, node)->key !=
+        RBTREE_TEST_NODES - 1) {
+        panic("rbtree_test: rb_last isn't the largest key");
+    }
+
+    // every other one, then the rest from the other end
+    int count = RBTREE_TEST_NODES;
+    for (int i = 0; i < RBTREE_TEST_NODES; i += 2) {
+        rb_erase(&root, &items[i].node);
+        rbtree_test_walk(&root, --count);
+    }
+    for (int i = RBTREE_TEST_NODES - 1; i > 0; i -= 2) {
+        rb_erase(&root, &items[i].node);
+        rbtree_test_walk(&root, --count);
+    }
+    if (root.node) {
+        panic("rbtree_test: tree not empty");
+    }
+    println("rbtree test passed");
+}
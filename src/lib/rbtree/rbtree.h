@@ -0,0 +1,48 @@
+#ifndef RBTREE_H
+#define RBTREE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// Intrusive red-black tree (CLRS chapter 13). A node lives inside the object
+// it orders, the owner does the descent to find where a new node goes (it is
+// the only one that knows the keys), links it there and calls rb_insert to
+// rebalance:
+//
+//   struct rb_node **link = &root->node, *parent = 0;
+//   while (*link) {
+//       parent = *link;
+//       link = key < rb_entry(parent, struct x, node)->key ? &parent->left
+//                                                          : &parent->right;
+//   }
+//   rb_link(&x->node, parent, link);
+//   rb_insert(root, &x->node);
+
+struct rb_node {
+    struct rb_node *parent;
+    struct rb_node *left;
+    struct rb_node *right;
+    bool red;
+};
+
+struct rb_root {
+    struct rb_node *node;
+};
+
+#define rb_entry(ptr, type, member)                                            \
+    ((type *)((char *)(ptr) - offsetof(type, member)))
+
+void rb_link(struct rb_node *node, struct rb_node *parent,
+             struct rb_node **link);
+void rb_insert(struct rb_root *root, struct rb_node *node);
+void rb_erase(struct rb_root *root, struct rb_node *node);
+
+// in order walk, 0 past the ends
+struct rb_node *rb_first(struct rb_root *root);
+struct rb_node *rb_last(struct rb_root *root);
+struct rb_node *rb_next(struct rb_node *node);
+struct rb_node *rb_prev(struct rb_node *node);
+
+void rbtree_test();
+
+#endif
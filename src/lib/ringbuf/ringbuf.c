@@ -0,0 +1,151 @@
+#include "ringbuf.h"
+#include "console/console.h"
+#include "status.h"
+
+// x86 doesn't reorder loads with loads or stores with stores, acquire and
+// release only stop the compiler from moving the data accesses across the
+// index update, they compile to plain movs
+static uint32_t ringbuf_load_acquire(uint32_t *idx) {
+    return __atomic_load_n(idx, __ATOMIC_ACQUIRE);
+}
+
+static void ringbuf_store_release(uint32_t *idx, uint32_t value) {
+    __atomic_store_n(idx, value, __ATOMIC_RELEASE);
+}
+
+int ringbuf_init(struct ringbuf *rb, uint8_t *buf, uint32_t size) {
+    if (!buf || size == 0 || (size & (size - 1)) != 0) {
+        return -STATUS_INVALID_ARG;
+    }
+    rb->buf = buf;
+    rb->mask = size - 1;
+    rb->head = 0;
+    rb->tail = 0;
+    rb->dropped = 0;
+    return STATUS_OK;
+}
+
+// ---- producer ----
+
+uint32_t ringbuf_free_space(struct ringbuf *rb) {
+    uint32_t head = ringbuf_load_acquire(&rb->head);
+    return rb->mask + 1 - (rb->tail - head);
+}
+
+// Returns false (and counts the byte as dropped) if the ring is full
+bool ringbuf_push(struct ringbuf *rb, uint8_t c) {
+    uint32_t tail = rb->tail;
+    if (tail - ringbuf_load_acquire(&rb->head) > rb->mask) {
+        rb->dropped++;
+        return false;
+    }
+    rb->buf[tail & rb->mask] = c;
+    // publish the byte before the consumer can see the new tail
+    ringbuf_store_release(&rb->tail, tail + 1);
+    return true;
+}
+
+// Queues as much of src as fits, the rest is counted as dropped. Returns the
+// number of bytes queued.
+uint32_t ringbuf_write(struct ringbuf *rb, const uint8_t *src, uint32_t len) {
+    uint32_t tail = rb->tail;
+    uint32_t space = rb->mask + 1 - (tail - ringbuf_load_acquire(&rb->head));
+    uint32_t n = len < space ? len : space;
+    for (uint32_t i = 0; i < n; i++) {
+        rb->buf[(tail + i) & rb->mask] = src[i];
+    }
+    rb->dropped += len - n;
+    ringbuf_store_release(&rb->tail, tail + n);
+    return n;
+}
+
+// ---- consumer ----
+
+uint32_t ringbuf_count(struct ringbuf *rb) {
+    return ringbuf_load_acquire(&rb->tail) - rb->head;
+}
+
+// Returns false if the ring is empty
+bool ringbuf_pop(struct ringbuf *rb, uint8_t *out) {
+    uint32_t head = rb->head;
+    if (ringbuf_load_acquire(&rb->tail) == head) {
+        return false;
+    }
+    *out = rb->buf[head & rb->mask];
+    // the slot may be reused by the producer as soon as head moves past it
+    ringbuf_store_release(&rb->head, head + 1);
+    return true;
+}
+
+uint32_t ringbuf_read(struct ringbuf *rb, uint8_t *dst, uint32_t len) {
+    uint32_t head = rb->head;
+    uint32_t avail = ringbuf_load_acquire(&rb->tail) - head;
+    uint32_t n = len < avail ? len : avail;
+    for (uint32_t i = 0; i < n; i++) {
+        dst[i] = rb->buf[(head + i) & rb->mask];
+    }
+    ringbuf_store_release(&rb->head, head + n);
+    return n;
+}
+
+uint32_t ringbuf_dropped(struct ringbuf *rb) {
+    return __atomic_load_n(&rb->dropped, __ATOMIC_RELAXED);
+}
+
+// ---- tests ----
+
+void ringbuf_test() {
+    uint8_t storage[8];
+    struct ringbuf rb;
+
+    if (ringbuf_init(&rb, storage, 6) != -STATUS_INVALID_ARG) {
+        println("error: ringbuf accepted a non power of two size");
+        return;
+    }
+    ringbuf_init(&rb, storage, sizeof(storage));
+
+    uint8_t c;
+    if (ringbuf_pop(&rb, &c)) {
+        println("error: ringbuf pop from an empty ring");
+        return;
+    }
+
+    for (int i = 0; i < 8; i++) {
+        ringbuf_push(&rb, 'a' + i);
+    }
+    if (ringbuf_push(&rb, 'x') || ringbuf_dropped(&rb) != 1) {
+        println("error: ringbuf overflow not accounted");
+        return;
+    }
+
+    // make head and tail wrap around the storage
+    for (int round = 0; round < 20; round++) {
+        for (int i = 0; i < 3; i++) {
+            if (!ringbuf_pop(&rb, &c)) {
+                println("error: ringbuf lost a byte");
+                return;
+            }
+        }
+        if (ringbuf_write(&rb, (uint8_t *)"xyz", 3) != 3) {
+            println("error: ringbuf write into free space failed");
+            return;
+        }
+    }
+    if (ringbuf_count(&rb) != 8 || ringbuf_free_space(&rb) != 0) {
+        println("error: ringbuf count is off");
+        return;
+    }
+
+    uint8_t out[8];
+    if (ringbuf_read(&rb, out, sizeof(out)) != 8 || out[7] != 'z') {
+        println("error: ringbuf read returned the wrong bytes");
+        return;
+    }
+    if (ringbuf_write(&rb, (uint8_t *)"0123456789", 10) != 8 ||
+        ringbuf_dropped(&rb) != 3) {
+        println("error: ringbuf partial write not accounted");
+        return;
+    }
+
+    println("ringbuf test passed");
+}
@@ -0,0 +1,39 @@
+#ifndef RINGBUF_H
+#define RINGBUF_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Lock free single producer / single consumer byte queue.
+//
+// head and tail run freely and wrap at 2^32, the slot is `index & mask`, so
+// the size must be a power of two and `tail - head` is always the number of
+// queued bytes. Only the producer writes tail and dropped, only the consumer
+// writes head, so an IRQ handler can push while a syscall pops without either
+// side disabling interrupts (or, later, without a lock between two cpus).
+struct ringbuf {
+    uint8_t *buf;
+    uint32_t mask;
+    uint32_t head; // next slot to read, owned by the consumer
+    uint32_t tail; // next slot to write, owned by the producer
+    // bytes the producer had to throw away because the ring was full
+    uint32_t dropped;
+};
+
+int ringbuf_init(struct ringbuf *rb, uint8_t *buf, uint32_t size);
+
+// producer side
+bool ringbuf_push(struct ringbuf *rb, uint8_t c);
+uint32_t ringbuf_write(struct ringbuf *rb, const uint8_t *src, uint32_t len);
+uint32_t ringbuf_free_space(struct ringbuf *rb);
+
+// consumer side
+bool ringbuf_pop(struct ringbuf *rb, uint8_t *out);
+uint32_t ringbuf_read(struct ringbuf *rb, uint8_t *dst, uint32_t len);
+uint32_t ringbuf_count(struct ringbuf *rb);
+
+uint32_t ringbuf_dropped(struct ringbuf *rb);
+
+void ringbuf_test();
+
+#endif
@@ -0,0 +1,128 @@
+#include "e820.h"
+#include "config.h"
+#include "console/console.h"
+#include "kernel.h"
+#include <stdbool.h>
+
+static struct e820_entry e820_map[E820_MAX_ENTRIES];
+static int e820_count = 0;
+
+void e820_init() {
+    uint32_t count = *(uint32_t *)E820_MAP_ADDR;
+    struct e820_entry *entries = (struct e820_entry *)(E820_MAP_ADDR + 4);
+    if (count > E820_MAX_ENTRIES) {
+        count = E820_MAX_ENTRIES;
+    }
+
+    e820_count = 0;
+    for (uint32_t i = 0; i < count; i++) {
+        if (!(entries[i].acpi & E820_ACPI_VALID) || !entries[i].length) {
+            continue;
+        }
+        e820_map[e820_count++] = entries[i];
+    }
+}
+
+// 0 when the bios gave no map
+int e820_num_entries() { return e820_count; }
+
+struct e820_entry *e820_entry(int i) {
+    if (i < 0 || i >= e820_count) {
+        return 0;
+    }
+    return &e820_map[i];
+}
+
+// All the ram the bios reports, also what the kernel can't reach
+uint64_t e820_usable_bytes() {
+    uint64_t total = 0;
+    for (int i = 0; i < e820_count; i++) {
+        if (e820_map[i].type == E820_USABLE) {
+            total += e820_map[i].length;
+        }
+    }
+    return total;
+}
+
+// End of the ram that runs on from addr without a gap, at most limit. addr
+// itself if there's no ram at addr. Usable entries touching or overlapping
+// each other count as one run, any other entry inside it cuts it short.
+uint32_t e820_usable_end(uint32_t addr, uint32_t limit) {
+    uint64_t end = addr;
+    bool grew = true;
+    while (grew && end < limit) {
+        grew = false;
+        for (int i = 0; i < e820_count; i++) {
+            struct e820_entry *e = &e820_map[i];
+            if (e->type == E820_USABLE && e->base <= end &&
+                e->base + e->length > end) {
+                end = e->base + e->length;
+                grew = true;
+            }
+        }
+    }
+
+    for (int i = 0; i < e820_count; i++) {
+        struct e820_entry *e = &e820_map[i];
+        if (e->type != E820_USABLE && e->base < end &&
+            e->base + e->length > addr) {
+            end = e->base > addr ? e->base : addr;
+        }
+    }
+    return end < limit ? (uint32_t)end : limit;
+}
+
+// ---- tests ----
+
+void e820_test() {
+    // the map of the machine, put back when done
+    struct e820_entry saved[E820_MAX_ENTRIES];
+    int saved_count = e820_count;
+    for (int i = 0; i < e820_count; i++) {
+        saved[i] = e820_map[i];
+    }
+
+    // out of order and touching, with a reserved hole at 48 MB inside a
+    // usable entry and memory above 4 GB
+    struct e820_entry test_map[] = {
+        {0x1000000, 0x2800000, E820_USABLE, 1},
+        {0x0, 0x9FC00, E820_USABLE, 1},
+        {0x100000, 0xF00000, E820_USABLE, 1},
+        {0x3000000, 0x10000, 2, 1},
+        {0x3010000, 0x4000000, E820_USABLE, 1},
+        {0x100000000ULL, 0x40000000, E820_USABLE, 1},
+    };
+    e820_count = sizeof(test_map) / sizeof(test_map[0]);
+    for (int i = 0; i < e820_count; i++) {
+        e820_map[i] = test_map[i];
+    }
+
+    if (e820_usable_end(0x200000, 0x8000000) != 0x3000000) {
+        panic("e820_test: run not merged or not cut at the hole");
+    }
+    if (e820_usable_end(0x3000000, 0x8000000) != 0x3000000) {
+        panic("e820_test: reserved memory usable");
+    }
+    if (e820_usable_end(0x3010000, 0x8000000) != 0x7010000) {
+        panic("e820_test: hole before the run cuts it");
+    }
+    if (e820_usable_end(0x3100000, 0x5000000) != 0x5000000) {
+        panic("e820_test: limit ignored");
+    }
+    if (e820_usable_end(0x80000000, 0x90000000) != 0x80000000) {
+        panic("e820_test: memory where there is none");
+    }
+    if (e820_usable_bytes() !=
+        0x2800000ULL + 0x9FC00 + 0xF00000 + 0x4000000 + 0x40000000) {
+        panic("e820_test: wrong usable total");
+    }
+    if (e820_entry(e820_count) || e820_entry(0) != &e820_map[0]) {
+        panic("e820_test: entry bounds");
+    }
+
+    e820_count = saved_count;
+    for (int i = 0; i < e820_count; i++) {
+        e820_map[i] = saved[i];
+    }
+    println("e820 test passed");
+}
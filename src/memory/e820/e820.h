@@ -0,0 +1,29 @@
+#ifndef E820_H
+#define E820_H
+
+#include <stdint.h>
+
+// The physical memory map from the bios (int 0x15, eax 0xE820), asked for by
+// boot.asm in real mode and left at E820_MAP_ADDR: a dword count, then the
+// entries. e820_init copies it out before that memory gets reused. The heap
+// is sized from it (kheap_init).
+
+#define E820_USABLE 1 // ram, everything else (reserved, acpi, bad) is not
+#define E820_ACPI_VALID 0x1 // attributes bit 0, clear means ignore the entry
+
+struct e820_entry {
+    uint64_t base;
+    uint64_t length;
+    uint32_t type;
+    uint32_t acpi; // acpi 3 extended attributes
+} __attribute__((packed));
+
+void e820_init();
+int e820_num_entries();
+struct e820_entry *e820_entry(int i);
+uint64_t e820_usable_bytes();
+uint32_t e820_usable_end(uint32_t addr, uint32_t limit);
+
+void e820_test();
+
+#endif
@@ -0,0 +1,240 @@
+#include "kcache.h"
+#include "cpu/cpu.h"
+#include "cpu/smp.h"
+#include "kernel.h"
+#include "kheap.h"
+#include "memory/memory.h"
+
+// Magazines themselves come from a plain free list of kmalloc pages
+static struct spinlock magazine_lock = SPINLOCK_INIT("kcache_magazines");
+static struct kcache_magazine *free_magazines = 0;
+
+// Caches are static and never go away, they are listed on their first
+// allocation. Only ever pushed at the head, readers don't need the lock.
+static struct spinlock kcache_list_lock = SPINLOCK_INIT("kcache_list");
+static struct kcache *kcaches = 0;
+
+static size_t kcache_obj_size(struct kcache *cache) {
+    size_t size = cache->obj_size < sizeof(void *) ? sizeof(void *)
+                                                   : cache->obj_size;
+    return (size + 7) & ~7;
+}
+
+// Splits a fresh kmalloc page into objects of size bytes, pushed on *list
+static int kcache_carve_page(void **list, size_t size) {
+    uint8_t *page = kmalloc(KHEAP_BLOCK_SIZE);
+    if (!page) {
+        return -1;
+    }
+    for (size_t off = 0; off + size <= KHEAP_BLOCK_SIZE; off += size) {
+        *(void **)(page + off) = *list;
+        *list = page + off;
+    }
+    return 0;
+}
+
+static struct kcache_magazine *kcache_magazine_new() {
+    spin_lock(&magazine_lock);
+    if (!free_magazines &&
+        kcache_carve_page((void **)&free_magazines,
+                          sizeof(struct kcache_magazine)) < 0) {
+        spin_unlock(&magazine_lock);
+        return 0;
+    }
+    struct kcache_magazine *mag = free_magazines;
+    free_magazines = *(struct kcache_magazine **)mag;
+    spin_unlock(&magazine_lock);
+
+    mag->rounds = 0;
+    mag->next = 0;
+    return mag;
+}
+
+// ---- slab layer, caller holds depot_lock ----
+
+static void kcache_list_add(struct kcache *cache) {
+    spin_lock(&kcache_list_lock);
+    cache->next = kcaches;
+    kcaches = cache;
+    spin_unlock(&kcache_list_lock);
+}
+
+static void *kcache_slab_alloc(struct kcache *cache) {
+    size_t size = kcache_obj_size(cache);
+    // the first allocation of a cache always ends up here
+    if (cache->slab_allocs++ == 0) {
+        kcache_list_add(cache);
+    }
+    if (size >= KHEAP_BLOCK_SIZE) {
+        return kmalloc(size);
+    }
+    if (!cache->slab_free && kcache_carve_page(&cache->slab_free, size) < 0) {
+        return 0;
+    }
+    void *obj = cache->slab_free;
+    cache->slab_free = *(void **)obj;
+    return obj;
+}
+
+static void kcache_slab_free(struct kcache *cache, void *obj) {
+    if (kcache_obj_size(cache) >= KHEAP_BLOCK_SIZE) {
+        kfree(obj);
+        return;
+    }
+    *(void **)obj = cache->slab_free;
+    cache->slab_free = obj;
+}
+
+// ---- magazine layer ----
+
+static void kcache_swap(struct kcache_cpu *cc) {
+    struct kcache_magazine *tmp = cc->loaded;
+    cc->loaded = cc->previous;
+    cc->previous = tmp;
+}
+
+void *kcache_alloc(struct kcache *cache) {
+    void *obj;
+    uint32_t flags = cpu_irq_save();
+    struct kcache_cpu *cc = &cache->cpus[get_cpu_id()];
+    cc->allocs++;
+
+    if (cc->loaded && cc->loaded->rounds > 0) {
+        goto pop;
+    }
+    if (cc->previous && cc->previous->rounds > 0) {
+        kcache_swap(cc);
+        goto pop;
+    }
+
+    // both empty, trade the previous one for a full one from the depot
+    spin_lock(&cache->depot_lock);
+    struct kcache_magazine *full = cache->full;
+    if (full) {
+        cache->full = full->next;
+        cache->num_full--;
+        if (cc->previous) {
+            cc->previous->next = cache->empty;
+            cache->empty = cc->previous;
+        }
+        cc->previous = cc->loaded;
+        cc->loaded = full;
+        cache->depot_trades++;
+        spin_unlock(&cache->depot_lock);
+        goto pop;
+    }
+    obj = kcache_slab_alloc(cache);
+    spin_unlock(&cache->depot_lock);
+    cpu_irq_restore(flags);
+    return obj;
+
+pop:
+    obj = cc->loaded->objs[--cc->loaded->rounds];
+    cpu_irq_restore(flags);
+    return obj;
+}
+
+void *kcache_zalloc(struct kcache *cache) {
+    void *obj = kcache_alloc(cache);
+    if (obj) {
+        memset(obj, 0, cache->obj_size);
+    }
+    return obj;
+}
+
+void kcache_free(struct kcache *cache, void *obj) {
+    uint32_t flags = cpu_irq_save();
+    struct kcache_cpu *cc = &cache->cpus[get_cpu_id()];
+    cc->frees++;
+
+    if (cc->loaded && cc->loaded->rounds < KCACHE_MAGAZINE_ROUNDS) {
+        goto push;
+    }
+    if (cc->previous && cc->previous->rounds == 0) {
+        kcache_swap(cc);
+        goto push;
+    }
+
+    // both full (or missing), hand the previous one to the depot and load an
+    // empty one. A depot that already holds enough full magazines gets its
+    // rounds back in the slab instead.
+    spin_lock(&cache->depot_lock);
+    struct kcache_magazine *empty = cache->empty;
+    if (empty) {
+        cache->empty = empty->next;
+    } else {
+        empty = kcache_magazine_new();
+    }
+    if (!empty) {
+        kcache_slab_free(cache, obj);
+        spin_unlock(&cache->depot_lock);
+        cpu_irq_restore(flags);
+        return;
+    }
+    if (cc->previous) {
+        struct kcache_magazine *mag = cc->previous;
+        if (cache->num_full < KCACHE_DEPOT_MAX_FULL) {
+            mag->next = cache->full;
+            cache->full = mag;
+            cache->num_full++;
+        } else {
+            while (mag->rounds > 0) {
+                kcache_slab_free(cache, mag->objs[--mag->rounds]);
+            }
+            mag->next = cache->empty;
+            cache->empty = mag;
+        }
+    }
+    cc->previous = cc->loaded;
+    cc->loaded = empty;
+    cache->depot_trades++;
+    spin_unlock(&cache->depot_lock);
+
+push:
+    cc->loaded->objs[cc->loaded->rounds++] = obj;
+    cpu_irq_restore(flags);
+}
+
+// The cache listed after cache, the first one for 0, 0 after the last
+struct kcache *kcache_next(struct kcache *cache) {
+    return cache ? cache->next : kcaches;
+}
+
+// ----------------------- tests ------------------- //
+
+void kcache_test() {
+    static struct kcache cache = KCACHE_INIT("test", 24);
+    enum { N = KCACHE_MAGAZINE_ROUNDS * (KCACHE_DEPOT_MAX_FULL + 4) };
+    static void *objs[N];
+
+    for (int i = 0; i < N; i++) {
+        objs[i] = kcache_zalloc(&cache);
+        if (!objs[i]) {
+            panic("kcache_test: out of memory");
+        }
+        *(int *)objs[i] = i;
+    }
+    for (int i = 0; i < N; i++) {
+        if (*(int *)objs[i] != i) {
+            panic("kcache_test: objects overlap");
+        }
+        kcache_free(&cache, objs[i]);
+    }
+    if (cache.num_full != KCACHE_DEPOT_MAX_FULL) {
+        panic("kcache_test: depot not filled up to its limit");
+    }
+
+    // everything freed comes back, the most recently freed first
+    uint32_t slab_allocs = cache.slab_allocs;
+    void *last = objs[N - 1];
+    if (kcache_alloc(&cache) != last) {
+        panic("kcache_test: not lifo");
+    }
+    for (int i = 1; i < (KCACHE_DEPOT_MAX_FULL + 2) * KCACHE_MAGAZINE_ROUNDS;
+         i++) {
+        kcache_alloc(&cache);
+    }
+    if (cache.slab_allocs != slab_allocs) {
+        panic("kcache_test: freed objects were not reused");
+    }
+}
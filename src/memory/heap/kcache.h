@@ -0,0 +1,64 @@
+#ifndef KCACHE_H
+#define KCACHE_H
+
+#include "config.h"
+#include "cpu/spinlock.h"
+#include <stddef.h>
+#include <stdint.h>
+
+// Object caches in front of kmalloc for the hot fixed size kernel objects,
+// after Bonwick's magazines (Usenix 2001). Every cpu keeps two magazines
+// (stacks of free objects) and allocates and frees from them without taking
+// any lock. Only when both are empty (or full) does it trade a whole magazine
+// with the depot, which is shared and locked. Objects are carved out of
+// kmalloc pages, and don't go back to kmalloc, except for objects of a page
+// or more.
+
+struct kcache_magazine {
+    int rounds; // number of objects in objs
+    struct kcache_magazine *next;
+    void *objs[KCACHE_MAGAZINE_ROUNDS];
+};
+
+// Only ever touched by its own cpu with interrupts off, in a line of its own
+struct kcache_cpu {
+    struct kcache_magazine *loaded;
+    struct kcache_magazine *previous;
+    uint32_t allocs;
+    uint32_t frees;
+} __attribute__((aligned(64)));
+
+struct kcache {
+    const char *name;
+    size_t obj_size;
+
+    struct kcache_cpu cpus[N_CPU_MAX];
+
+    // everything below is under depot_lock
+    struct spinlock depot_lock;
+    struct kcache_magazine *full;
+    struct kcache_magazine *empty;
+    int num_full;
+    // free objects not in any magazine, linked through their first word
+    void *slab_free;
+
+    // stats
+    uint32_t depot_trades; // magazines swapped with the depot
+    uint32_t slab_allocs;  // objects that missed every magazine
+
+    // every cache that ever allocated, see kcache_next
+    struct kcache *next;
+};
+
+#define KCACHE_INIT(cache_name, size)                                          \
+    {.name = (cache_name), .obj_size = (size),                                 \
+     .depot_lock = SPINLOCK_INIT(cache_name)}
+
+void *kcache_alloc(struct kcache *cache);
+void *kcache_zalloc(struct kcache *cache);
+void kcache_free(struct kcache *cache, void *obj);
+struct kcache *kcache_next(struct kcache *cache);
+
+void kcache_test();
+
+#endif
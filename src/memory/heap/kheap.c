@@ -1,7 +1,12 @@
 #include "kheap.h"
 #include "console/console.h"
+#include "cpu/spinlock.h"
+#include "kernel.h"
+#include "memory/e820/e820.h"
 #include "memory/memory.h"
 #include "status.h"
+#include "trace/trace.h"
+#include "zpool.h"
 
 #include <stdbool.h>
 
@@ -51,14 +56,32 @@ static int kheap_create(struct KHEAP *kheap, void *kheap_physical_start_addr,
 
 static struct KHEAP kheap;
 static struct KHEAP_ENTRY_TABLE kheap_entry_table;
+// the block table, taken with interrupts off so any context can allocate
+static struct spinlock kheap_lock;
 
 int kheap_init() {
-    size_t total_table_entries = KERNEL_HEAP_SIZE_BYTES / KHEAP_BLOCK_SIZE;
-    kheap_entry_table.entries = (KHEAP_BLOCK_TABLE_ENTRY *)KHEAP_TABLE_ADDR;
+    spin_lock_init(&kheap_lock, "kheap");
+    // kernel memory is identity mapped below KHEAP_SAFE_BOUNDARY, ram past
+    // that the heap can't use
+    size_t end = KHEAP_ADDR + KERNEL_HEAP_SIZE_BYTES;
+    if (e820_num_entries() > 0) {
+        end = e820_usable_end(KHEAP_ADDR, KHEAP_SAFE_BOUNDARY);
+    }
+    end &= ~(KHEAP_BLOCK_SIZE - 1);
+    if (end < KHEAP_ADDR + KHEAP_MIN_SIZE) {
+        print("kheap: not enough memory\n");
+        return -STATUS_NOT_ENOUGH_MEM;
+    }
 
-    kheap_entry_table.num_entries = total_table_entries;
+    // table_blocks * KHEAP_BLOCK_SIZE >= blocks - table_blocks
+    size_t blocks = (end - KHEAP_ADDR) / KHEAP_BLOCK_SIZE;
+    size_t table_blocks = (blocks + KHEAP_BLOCK_SIZE) / (KHEAP_BLOCK_SIZE + 1);
+    size_t total_table_entries = blocks - table_blocks;
 
-    void *kheap_end = (void *)((size_t)KHEAP_ADDR + KERNEL_HEAP_SIZE_BYTES);
+    void *kheap_end =
+        (void *)(KHEAP_ADDR + total_table_entries * KHEAP_BLOCK_SIZE);
+    kheap_entry_table.entries = (KHEAP_BLOCK_TABLE_ENTRY *)kheap_end;
+    kheap_entry_table.num_entries = total_table_entries;
 
     int res =
         kheap_create(&kheap, (void *)KHEAP_ADDR, kheap_end, &kheap_entry_table);
@@ -88,41 +111,49 @@ static size_t kheap_addr_to_block_index(void *addr) {
            KHEAP_BLOCK_SIZE;
 }
 
-void *kmalloc(size_t size) {
-
-    // int search_start = 0;
+// First fit search for num_blocks (at least one) free blocks starting at a
+// multiple of align bytes, -1 if there are none
+static int kheap_find_free(size_t num_blocks, size_t align) {
+    if (num_blocks == 0) {
+        return -1;
+    }
+    size_t start = (size_t)kheap.kheap_physical_start_addr;
+    size_t first = ((align - start % align) % align) / KHEAP_BLOCK_SIZE;
+    size_t step = align / KHEAP_BLOCK_SIZE;
+    size_t i = first;
+    while (i + num_blocks <= kheap.entry_table->num_entries) {
+        size_t j = i;
+        while (j < i + num_blocks &&
+               get_kheap_entry_type(kheap.entry_table->entries[j]) ==
+                   KHEAP_BLOCK_TABLE_ENTRY_FREE) {
+            j++;
+        }
+        if (j == i + num_blocks) {
+            return i;
+        }
+        // no run can start before the taken block at j
+        i = first + ((j - first) / step + 1) * step;
+    }
+    return -1;
+}
 
+// NULL for size 0, there is no block to mark as its first
+static void *kheap_alloc(size_t size, size_t align, bool quiet) {
+    if (size == 0) {
+        return NULL;
+    }
     size_t num_blocks = (size + KHEAP_BLOCK_SIZE - 1) / (KHEAP_BLOCK_SIZE);
 
-    size_t first_alloc_block;
-    bool found = false;
+    uint32_t flags = spin_lock_irqsave(&kheap_lock);
 
     // search for contiguous blocks that fit our request
-    for (int i = 0; i < kheap.entry_table->num_entries; i++) {
-        if (get_kheap_entry_type(kheap.entry_table->entries[i]) ==
-            KHEAP_BLOCK_TABLE_ENTRY_FREE) {
-            int j = i;
-            for (; j < i + num_blocks; j++) {
-                if (get_kheap_entry_type(kheap.entry_table->entries[j]) !=
-                    KHEAP_BLOCK_TABLE_ENTRY_FREE) {
-                    break;
-                }
-            }
-
-            if (j == i + num_blocks) {
-                first_alloc_block = i;
-                found = true;
-                break; // exit j's loop
-            }
-
-            if (found) {
-                break; // exit i's loop
-            }
+    int first_alloc_block = kheap_find_free(num_blocks, align);
+    if (first_alloc_block < 0) {
+        spin_unlock_irqrestore(&kheap_lock, flags);
+        trace(TRACE_KMALLOC, num_blocks, 0);
+        if (!quiet) {
+            print("kheap: out of memory\n");
         }
-    }
-
-    if (!found) {
-        print("kheap: out of memory\n");
         return NULL;
     }
 
@@ -147,23 +178,50 @@ void *kmalloc(size_t size) {
         }
         kheap.entry_table->entries[i] = entry;
     }
+    spin_unlock_irqrestore(&kheap_lock, flags);
+    trace(TRACE_KMALLOC, num_blocks,
+          (uint32_t)kheap_block_to_addr(start_block));
 
-    // print("used start indx..");
-    // print_int((int) start_block);
-    // print("\n");
-
-    // search_start = first_alloc_block + num_blocks; // next time we start
-    // searching from here
     return kheap_block_to_addr(first_alloc_block);
 }
 
+void *kmalloc(size_t size) {
+    return kheap_alloc(size, KHEAP_BLOCK_SIZE, false);
+}
+
+// kmalloc at an address that is a multiple of align (a power of two, at
+// least a block). Failing is expected for big alignments, so it does so
+// quietly.
+void *kmalloc_aligned(size_t size, size_t align) {
+    return kheap_alloc(size, align, true);
+}
+
+// Makes every block of the allocation at ptr an allocation of its own, to
+// be kfreed one at a time
+void kheap_split(void *ptr) {
+    size_t start_block = kheap_addr_to_block_index(ptr);
+    uint32_t flags = spin_lock_irqsave(&kheap_lock);
+    for (size_t i = start_block; i < kheap.entry_table->num_entries; i++) {
+        KHEAP_BLOCK_TABLE_ENTRY entry = kheap.entry_table->entries[i];
+        kheap.entry_table->entries[i] =
+            KHEAP_BLOCK_TABLE_ENTRY_TAKEN | KHEAP_BLOCK_IS_FIRST;
+        if (!(entry & KHEAP_BLOCK_HAS_NEXT)) {
+            break;
+        }
+    }
+    spin_unlock_irqrestore(&kheap_lock, flags);
+}
+
 int kfree(void *ptr) {
 
     size_t start_block = kheap_addr_to_block_index(ptr);
 
+    int num_blocks = 0;
+    uint32_t flags = spin_lock_irqsave(&kheap_lock);
     for (size_t i = start_block; i < kheap.entry_table->num_entries; i++) {
         KHEAP_BLOCK_TABLE_ENTRY entry = kheap.entry_table->entries[i];
         kheap.entry_table->entries[i] = KHEAP_BLOCK_TABLE_ENTRY_FREE;
+        num_blocks++;
         // print("freed indx..");
         // print_int((int) i);
         // print("\n");
@@ -171,13 +229,29 @@ int kfree(void *ptr) {
             break;
         }
     }
+    spin_unlock_irqrestore(&kheap_lock, flags);
+    trace(TRACE_KFREE, num_blocks, (uint32_t)ptr);
 
     return 0;
 }
 
 void *kzalloc(size_t size) {
+    // a block is what it would get anyway, the pool has them zeroed already
+    if (size > 0 && size <= KHEAP_BLOCK_SIZE) {
+        return zpool_alloc();
+    }
     void *ptr = kmalloc(size);
-    memset(ptr, 0x0, size);
+    if (ptr) {
+        memset(ptr, 0x0, size);
+    }
+    return ptr;
+}
+
+void *kzalloc_aligned(size_t size, size_t align) {
+    void *ptr = kmalloc_aligned(size, align);
+    if (ptr) {
+        memset(ptr, 0x0, size);
+    }
     return ptr;
 }
 
@@ -192,6 +266,8 @@ int kheap_num_free_blocks() {
     return num_free;
 }
 
+int kheap_num_blocks() { return kheap.entry_table->num_entries; }
+
 // ----------------------- tests ------------------- //
 
 void kheap_test() {
@@ -203,4 +279,9 @@ void kheap_test() {
 
     if (ptr || ptr2 || ptr3 || ptr4) {
     };
+
+    // nothing to hand out, and block 0 (4 MB aligned) isn't taken over
+    if (kmalloc(0) || kzalloc(0) || kmalloc_aligned(0, 0x400000)) {
+        panic("kheap_test: size 0 allocated");
+    }
 }
\ No newline at end of file
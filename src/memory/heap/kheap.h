@@ -9,7 +9,10 @@
 // Simple block based implementation
 
 #define KHEAP_BLOCK_SIZE 4096            // 4 KB
-#define KERNEL_HEAP_SIZE_BYTES 104857600 // 100 MB (static heap size for now)
+// the heap is the ram from KHEAP_ADDR up to KHEAP_SAFE_BOUNDARY that the bios
+// memory map (e820.h) reports, this much when there's no map
+#define KERNEL_HEAP_SIZE_BYTES 104857600 // 100 MB
+#define KHEAP_MIN_SIZE 0x800000          // 8 MB, less won't boot
 
 /*
     x86 memory map(https://wiki.osdev.org/Memory_Map_(x86)):
@@ -54,11 +57,7 @@
 
 #define KHEAP_ADDR 0x01000000
 
-// For now we are using some memory from the real mode address space
-// for the kheap table
-// later we can keep the table at top of the externded memory(0x01000000)
-// and start heap from after it.
-#define KHEAP_TABLE_ADDR 0x00007E00 // (4 KiB)
+// The block table, a byte per block, takes the last blocks of the heap
 
 #define KHEAP_BLOCK_TABLE_ENTRY_TAKEN 0x01
 #define KHEAP_BLOCK_TABLE_ENTRY_FREE 0x00
@@ -80,6 +79,9 @@ struct KHEAP {
 
 void *kmalloc(size_t size);
 void *kzalloc(size_t size);
+void *kmalloc_aligned(size_t size, size_t align);
+void *kzalloc_aligned(size_t size, size_t align);
+void kheap_split(void *ptr);
 int kfree(void *ptr);
 
 int kheap_init();
@@ -87,5 +89,6 @@ int kheap_init();
 void kheap_test();
 
 int kheap_num_free_blocks();
+int kheap_num_blocks();
 
 #endif
\ No newline at end of file
@@ -0,0 +1,138 @@
+#include "zpool.h"
+#include "config.h"
+#include "console/console.h"
+#include "cpu/spinlock.h"
+#include "kernel.h"
+#include "kheap.h"
+#include "memory/memory.h"
+#include "status.h"
+#include <stdbool.h>
+
+// Pages in the pool are linked through their first word, the only one that
+// isn't zero, so the pop clears it again
+static struct spinlock zpool_lock = SPINLOCK_INIT("zpool");
+static void *zpool_head = 0;
+static void *zpool_zero = 0;
+
+struct zpool_stats zpool_stats;
+
+int zpool_init() {
+    zpool_zero = kmalloc(KHEAP_BLOCK_SIZE);
+    if (!zpool_zero) {
+        return -STATUS_NOT_ENOUGH_MEM;
+    }
+    memset(zpool_zero, 0, KHEAP_BLOCK_SIZE);
+    return STATUS_OK;
+}
+
+// A zeroed page of its own, 0 if out of memory
+void *zpool_alloc() {
+    uint32_t flags = spin_lock_irqsave(&zpool_lock);
+    void **page = zpool_head;
+    if (page) {
+        zpool_head = *page;
+        zpool_stats.pages--;
+        zpool_stats.hits++;
+    } else {
+        zpool_stats.misses++;
+    }
+    spin_unlock_irqrestore(&zpool_lock, flags);
+
+    if (page) {
+        *page = 0;
+        return page;
+    }
+    page = kmalloc(KHEAP_BLOCK_SIZE);
+    if (page) {
+        memset(page, 0, KHEAP_BLOCK_SIZE);
+    }
+    return page;
+}
+
+// Zeroes up to max free pages into the pool, fewer once it holds
+// ZPOOL_MAX_PAGES or the heap runs out. Returns how many. Doesn't need the
+// big kernel lock, the idle loop calls it without.
+int zpool_refill(int max) {
+    int n = 0;
+    while (n < max && zpool_stats.pages < ZPOOL_MAX_PAGES) {
+        // quietly, the heap running out is no news here
+        void **page = kmalloc_aligned(KHEAP_BLOCK_SIZE, KHEAP_BLOCK_SIZE);
+        if (!page) {
+            break;
+        }
+        memset(page, 0, KHEAP_BLOCK_SIZE);
+
+        uint32_t flags = spin_lock_irqsave(&zpool_lock);
+        bool full = zpool_stats.pages >= ZPOOL_MAX_PAGES;
+        if (!full) {
+            *page = zpool_head;
+            zpool_head = page;
+            zpool_stats.pages++;
+        }
+        spin_unlock_irqrestore(&zpool_lock, flags);
+        if (full) {
+            // another idle cpu filled it meanwhile
+            kfree(page);
+            break;
+        }
+        n++;
+    }
+    return n;
+}
+
+// The page of zeroes shared by every untouched anonymous user page, never
+// to be written or freed
+void *zpool_zero_page() { return zpool_zero; }
+
+// ---- tests ----
+
+static bool zpool_is_zero(uint8_t *page) {
+    for (int i = 0; i < KHEAP_BLOCK_SIZE; i++) {
+        if (page[i]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void zpool_test() {
+    void *pages[4];
+    int filled = zpool_refill(4);
+    if (filled < 0 || filled > 4 || zpool_stats.pages > ZPOOL_MAX_PAGES) {
+        panic("zpool_test: refill past its limit");
+    }
+
+    uint32_t hits = zpool_stats.hits;
+    uint32_t misses = zpool_stats.misses;
+    for (int i = 0; i < 4; i++) {
+        pages[i] = zpool_alloc();
+        if (!pages[i]) {
+            panic("zpool_test: out of memory");
+        }
+        if (!zpool_is_zero(pages[i])) {
+            panic("zpool_test: page not zeroed");
+        }
+        // dirty, so a page wrongly handed out again would show
+        memset(pages[i], 0xAB, KHEAP_BLOCK_SIZE);
+    }
+    if (zpool_stats.hits + zpool_stats.misses != hits + misses + 4 ||
+        (filled == 4 && zpool_stats.hits < hits + 4)) {
+        panic("zpool_test: pops not counted");
+    }
+    for (int i = 0; i < 4; i++) {
+        kfree(pages[i]);
+    }
+
+    // a dirtied page that went back to the heap comes out clean again
+    zpool_refill(1);
+    void *page = kzalloc(KHEAP_BLOCK_SIZE);
+    if (!page || !zpool_is_zero(page)) {
+        panic("zpool_test: kzalloc page not zeroed");
+    }
+    kfree(page);
+
+    if (!zpool_zero_page() || !zpool_is_zero(zpool_zero_page())) {
+        panic("zpool_test: zero page written");
+    }
+    println("zpool test passed");
+}
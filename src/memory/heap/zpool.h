@@ -0,0 +1,27 @@
+#ifndef ZPOOL_H
+#define ZPOOL_H
+
+#include <stdint.h>
+
+// Pages zeroed ahead of time. Idle cpus zero free pages into the pool
+// (zpool_refill), so handing out a zeroed page, to kzalloc or to a write to
+// untouched user memory, is mostly a list pop. Also owns the zero page, the
+// one page of zeroes every untouched anonymous user page maps read only.
+
+struct zpool_stats {
+    uint32_t pages;       // zeroed pages waiting in the pool
+    uint32_t hits;        // allocations the pool served
+    uint32_t misses;      // allocations zeroed on the spot, the pool was empty
+    uint32_t zero_faults; // writes that gave a zero page mapping its own page
+};
+
+extern struct zpool_stats zpool_stats;
+
+int zpool_init();
+void *zpool_alloc();
+int zpool_refill(int max);
+void *zpool_zero_page();
+
+void zpool_test();
+
+#endif
@@ -0,0 +1,170 @@
+[BITS 32]
+
+section .asm
+
+global memory_copy_forward
+global memory_copy_backward
+global memory_fill
+global memory_copy_sse2
+global memory_fill_sse2
+
+; void memory_copy_forward(void *dst, const void *src, size_t n)
+; Byte copy until dst is dword aligned, then rep movsd, then the tail bytes.
+; Safe for overlapping buffers when dst < src.
+memory_copy_forward:
+    push ebp
+    mov ebp, esp
+    push esi
+    push edi
+
+    mov edi, [ebp+8]  ; dst
+    mov esi, [ebp+12] ; src
+    mov edx, [ebp+16] ; n
+
+    mov ecx, edi      ; head = min(-dst & 3, n)
+    neg ecx
+    and ecx, 3
+    cmp ecx, edx
+    jbe .head
+    mov ecx, edx
+.head:
+    sub edx, ecx
+    rep movsb
+
+    mov ecx, edx
+    shr ecx, 2
+    rep movsd
+
+    mov ecx, edx
+    and ecx, 3
+    rep movsb
+
+    pop edi
+    pop esi
+    pop ebp
+    ret
+
+; void memory_copy_backward(void *dst, const void *src, size_t n)
+; Copies from the end, for overlapping buffers with dst > src.
+memory_copy_backward:
+    push ebp
+    mov ebp, esp
+    push esi
+    push edi
+
+    mov edi, [ebp+8]  ; dst
+    mov esi, [ebp+12] ; src
+    mov edx, [ebp+16] ; n
+
+    lea esi, [esi+edx-1]
+    lea edi, [edi+edx-1]
+    std
+
+    mov ecx, edx      ; the n & 3 bytes at the end first
+    and ecx, 3
+    rep movsb
+
+    sub esi, 3        ; point at the last whole dword left
+    sub edi, 3
+    mov ecx, edx
+    shr ecx, 2
+    rep movsd
+
+    cld
+    pop edi
+    pop esi
+    pop ebp
+    ret
+
+; void memory_fill(void *dst, int c, size_t n)
+memory_fill:
+    push ebp
+    mov ebp, esp
+    push edi
+
+    mov edi, [ebp+8]        ; dst
+    movzx eax, byte[ebp+12] ; c in all 4 bytes of eax
+    imul eax, eax, 0x01010101
+    mov edx, [ebp+16]       ; n
+
+    mov ecx, edi
+    neg ecx
+    and ecx, 3
+    cmp ecx, edx
+    jbe .head
+    mov ecx, edx
+.head:
+    sub edx, ecx
+    rep stosb
+
+    mov ecx, edx
+    shr ecx, 2
+    rep stosd
+
+    mov ecx, edx
+    and ecx, 3
+    rep stosb
+
+    pop edi
+    pop ebp
+    ret
+
+; void memory_copy_sse2(void *dst, const void *src, size_t nblocks)
+; Copies nblocks 64 byte blocks, dst must be 16 byte aligned
+memory_copy_sse2:
+    push ebp
+    mov ebp, esp
+    push esi
+    push edi
+
+    mov edi, [ebp+8]  ; dst
+    mov esi, [ebp+12] ; src
+    mov ecx, [ebp+16] ; nblocks
+    test ecx, ecx
+    jz .done
+.loop:
+    movdqu xmm0, [esi]
+    movdqu xmm1, [esi+16]
+    movdqu xmm2, [esi+32]
+    movdqu xmm3, [esi+48]
+    movdqa [edi], xmm0
+    movdqa [edi+16], xmm1
+    movdqa [edi+32], xmm2
+    movdqa [edi+48], xmm3
+    add esi, 64
+    add edi, 64
+    dec ecx
+    jnz .loop
+.done:
+    pop edi
+    pop esi
+    pop ebp
+    ret
+
+; void memory_fill_sse2(void *dst, int c, size_t nblocks)
+; Fills nblocks 64 byte blocks, dst must be 16 byte aligned
+memory_fill_sse2:
+    push ebp
+    mov ebp, esp
+    push edi
+
+    mov edi, [ebp+8]        ; dst
+    movzx eax, byte[ebp+12] ; c in all 16 bytes of xmm0
+    imul eax, eax, 0x01010101
+    movd xmm0, eax
+    pshufd xmm0, xmm0, 0
+    mov ecx, [ebp+16]       ; nblocks
+    test ecx, ecx
+    jz .done
+.loop:
+    movdqa [edi], xmm0
+    movdqa [edi+16], xmm0
+    movdqa [edi+32], xmm0
+    movdqa [edi+48], xmm0
+    add edi, 64
+    dec ecx
+    jnz .loop
+.done:
+    pop edi
+    pop ebp
+    ret
@@ -1,17 +1,88 @@
 #include "memory.h"
+#include "config.h"
+#include "console/console.h"
+#include "cpu/cpu.h"
+#include "memory/heap/kheap.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+// memory.asm
+void memory_copy_forward(void *dst, const void *src, size_t n);
+void memory_copy_backward(void *dst, const void *src, size_t n);
+void memory_fill(void *dst, int c, size_t n);
+void memory_copy_sse2(void *dst, const void *src, size_t nblocks);
+void memory_fill_sse2(void *dst, int c, size_t nblocks);
+
+#define MEMORY_SSE2_BLOCK 64
+
+static bool sse2_available = false;
+static bool use_sse2 = false;
+
+// The SSE2 path clobbers xmm registers. Nothing saves the FPU/SSE state of
+// user programs on syscalls or task switches, so it may only be turned on
+// (MEMORY_SSE2_MIN_BYTES) once that state is saved.
+void memory_init() {
+    if (cpu_has_feature_edx(CPUID_FEAT_EDX_SSE2)) {
+        cpu_enable_sse();
+        sse2_available = true;
+        use_sse2 = MEMORY_SSE2_MIN_BYTES > 0;
+    }
+}
+
+// Every other cpu needs SSE enabled too before it runs memcpy, or the SSE2
+// path faults on it
+void memory_init_ap() {
+    if (sse2_available) {
+        cpu_enable_sse();
+    }
+}
+
+// bytes needed to bring ptr up to a 16 byte boundary, at most num
+static size_t memory_sse2_head(void *ptr, size_t num) {
+    size_t head = (-(uint32_t)ptr) & (16 - 1);
+    return head < num ? head : num;
+}
 
 void *memset(void *ptr, unsigned char c, size_t num) {
-    unsigned char *p = (unsigned char *)ptr;
-    for (int i = 0; i < num; i++) {
-        p[i] = c;
+    if (!use_sse2 || num < MEMORY_SSE2_MIN_BYTES) {
+        memory_fill(ptr, c, num);
+        return ptr;
     }
+    uint8_t *p = ptr;
+    size_t head = memory_sse2_head(p, num);
+    memory_fill(p, c, head);
+    p += head;
+    num -= head;
+
+    size_t nblocks = num / MEMORY_SSE2_BLOCK;
+    memory_fill_sse2(p, c, nblocks);
+    p += nblocks * MEMORY_SSE2_BLOCK;
+    memory_fill(p, c, num % MEMORY_SSE2_BLOCK);
     return ptr;
 }
 
+// repe cmpsd finds the first dword that differs, the bytes of that dword
+// decide the result
 int memcmp(const void *ptr1, const void *ptr2, size_t num) {
-    unsigned char *p1 = (unsigned char *)ptr1;
-    unsigned char *p2 = (unsigned char *)ptr2;
-    for (int i = 0; i < num; i++) {
+    const unsigned char *p1 = ptr1;
+    const unsigned char *p2 = ptr2;
+    size_t nwords = num / 4;
+    size_t equal_words = nwords;
+    if (nwords > 0) {
+        const void *s = p1;
+        const void *d = p2;
+        size_t left = nwords;
+        uint8_t differ;
+        asm volatile("repe cmpsl\n\t"
+                     "setne %0"
+                     : "=q"(differ), "+S"(s), "+D"(d), "+c"(left)
+                     :
+                     : "cc", "memory");
+        if (differ) {
+            equal_words = nwords - left - 1;
+        }
+    }
+    for (size_t i = equal_words * 4; i < num; i++) {
         if (p1[i] != p2[i]) {
             return p1[i] - p2[i];
         }
@@ -20,9 +91,217 @@ int memcmp(const void *ptr1, const void *ptr2, size_t num) {
 }
 
 void memcpy(void *dest, const void *src, size_t num) {
+    if (!use_sse2 || num < MEMORY_SSE2_MIN_BYTES) {
+        memory_copy_forward(dest, src, num);
+        return;
+    }
+    uint8_t *d = dest;
+    const uint8_t *s = src;
+    size_t head = memory_sse2_head(d, num);
+    memory_copy_forward(d, s, head);
+    d += head;
+    s += head;
+    num -= head;
+
+    size_t nblocks = num / MEMORY_SSE2_BLOCK;
+    memory_copy_sse2(d, s, nblocks);
+    d += nblocks * MEMORY_SSE2_BLOCK;
+    s += nblocks * MEMORY_SSE2_BLOCK;
+    memory_copy_forward(d, s, num % MEMORY_SSE2_BLOCK);
+}
+
+// memcpy only ever reads a byte before writing over it when dest < src, so
+// it is only unsafe when dest starts inside src
+void *memmove(void *dest, const void *src, size_t num) {
+    uint8_t *d = dest;
+    const uint8_t *s = src;
+    if (d <= s || d >= s + num) {
+        memcpy(dest, src, num);
+    } else {
+        memory_copy_backward(dest, src, num);
+    }
+    return dest;
+}
+
+// ---- tests ----
+
+// the byte loops memcpy/memset used to be, kept as the benchmark baseline
+static void memory_copy_bytes(void *dest, const void *src, size_t num) {
     unsigned char *p1 = (unsigned char *)dest;
     unsigned char *p2 = (unsigned char *)src;
     for (int i = 0; i < num; i++) {
         p1[i] = p2[i];
     }
-}
\ No newline at end of file
+}
+
+static void memory_set_bytes(void *ptr, unsigned char c, size_t num) {
+    unsigned char *p = (unsigned char *)ptr;
+    for (int i = 0; i < num; i++) {
+        p[i] = c;
+    }
+}
+
+static void memory_test_run(char *path) {
+    uint8_t *a = kzalloc(1024);
+    uint8_t *b = kzalloc(1024);
+    if (!a || !b) {
+        println("error: memory test out of memory");
+        goto out;
+    }
+    for (int i = 0; i < 1024; i++) {
+        a[i] = i * 7;
+    }
+
+    // every head/tail combination
+    for (int off = 0; off < 16; off++) {
+        for (int len = 0; len < 300; len += 37) {
+            memset(b, 0xAA, 1024);
+            memcpy(b + off, a + 3, len);
+            if (memcmp(b + off, a + 3, len) != 0 ||
+                (off > 0 && b[off - 1] != 0xAA) || b[off + len] != 0xAA) {
+                println("error: memcpy copied the wrong bytes");
+                goto out;
+            }
+        }
+    }
+
+    memset(a + 5, 0x42, 600);
+    if (a[4] != 28 || a[5] != 0x42 || a[604] != 0x42 ||
+        a[605] != (605 * 7 & 0xFF)) {
+        println("error: memset filled the wrong bytes");
+        goto out;
+    }
+
+    memcpy(b, a, 1024);
+    b[513] ^= 1;
+    if (memcmp(a, b, 1024) == 0 || memcmp(a, b, 513) != 0 ||
+        (memcmp(a, b, 514) < 0) != (a[513] < b[513])) {
+        println("error: memcmp");
+        goto out;
+    }
+
+    // overlapping moves in both directions, checked against the byte loop
+    for (int i = 0; i < 1024; i++) {
+        a[i] = i;
+        b[i] = i;
+    }
+    memmove(a + 3, a, 500);
+    for (int i = 499; i >= 0; i--) {
+        b[i + 3] = b[i];
+    }
+    memmove(a, a + 301, 400);
+    memory_copy_bytes(b, b + 301, 400);
+    if (memcmp(a, b, 1024) != 0) {
+        println("error: memmove overlapping");
+        goto out;
+    }
+
+    print("memory test passed: ");
+    println(path);
+out:
+    if (a) {
+        kfree(a);
+    }
+    if (b) {
+        kfree(b);
+    }
+}
+
+void memory_test() {
+    bool saved_use_sse2 = use_sse2;
+    use_sse2 = false;
+    memory_test_run("rep");
+    if (sse2_available) {
+        use_sse2 = true;
+        memory_test_run("sse2");
+    }
+    use_sse2 = saved_use_sse2;
+}
+
+#define MEMORY_BENCH_BYTES (1024 * 1024) // moved per measurement
+
+typedef void (*MEMORY_COPY_FUNC)(void *dest, const void *src, size_t num);
+typedef void (*MEMORY_SET_FUNC)(void *ptr, unsigned char c, size_t num);
+
+static void memory_set_fast(void *ptr, unsigned char c, size_t num) {
+    memset(ptr, c, num);
+}
+
+static uint32_t memory_bench_copy(MEMORY_COPY_FUNC copy, void *dst, void *src,
+                                  size_t size) {
+    uint32_t iters = MEMORY_BENCH_BYTES / size;
+    copy(dst, src, size); // warm up the cache
+    uint64_t start = cpu_read_tsc();
+    for (uint32_t i = 0; i < iters; i++) {
+        copy(dst, src, size);
+    }
+    return (uint32_t)(cpu_read_tsc() - start);
+}
+
+static uint32_t memory_bench_set(MEMORY_SET_FUNC set, void *dst, size_t size) {
+    uint32_t iters = MEMORY_BENCH_BYTES / size;
+    set(dst, 0, size);
+    uint64_t start = cpu_read_tsc();
+    for (uint32_t i = 0; i < iters; i++) {
+        set(dst, 0, size);
+    }
+    return (uint32_t)(cpu_read_tsc() - start);
+}
+
+// bytes per cycle with two decimals
+static void memory_bench_print_rate(char *name, uint32_t cycles) {
+    uint32_t rate = (MEMORY_BENCH_BYTES * 100) / (cycles ? cycles : 1);
+    print(" ");
+    print(name);
+    print(" ");
+    print_int(rate / 100);
+    print(rate % 100 < 10 ? ".0" : ".");
+    print_int(rate % 100);
+}
+
+// Prints bytes/cycle of the old byte loops, the rep movsd/stosd path and the
+// SSE2 path (if the cpu has it) for a few sizes
+void memory_bench() {
+    size_t sizes[] = {64, 4096, 65536};
+    bool saved_use_sse2 = use_sse2;
+    uint8_t *src = kmalloc(65536);
+    uint8_t *dst = kmalloc(65536);
+    if (!src || !dst) {
+        println("error: memory bench out of memory");
+        goto out;
+    }
+
+    for (int i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        for (int op = 0; op < 2; op++) {
+            print(op == 0 ? "memcpy " : "memset ");
+            print_int(sizes[i]);
+            print(":");
+            uint32_t cycles;
+            use_sse2 = false;
+            cycles = op == 0
+                         ? memory_bench_copy(memory_copy_bytes, dst, src, sizes[i])
+                         : memory_bench_set(memory_set_bytes, dst, sizes[i]);
+            memory_bench_print_rate("bytes", cycles);
+            cycles = op == 0 ? memory_bench_copy(memcpy, dst, src, sizes[i])
+                             : memory_bench_set(memory_set_fast, dst, sizes[i]);
+            memory_bench_print_rate("rep", cycles);
+            if (sse2_available) {
+                use_sse2 = true;
+                cycles = op == 0
+                             ? memory_bench_copy(memcpy, dst, src, sizes[i])
+                             : memory_bench_set(memory_set_fast, dst, sizes[i]);
+                memory_bench_print_rate("sse2", cycles);
+            }
+            println(" bytes/cycle");
+        }
+    }
+
+out:
+    use_sse2 = saved_use_sse2;
+    if (src) {
+        kfree(src);
+    }
+    if (dst) {
+        kfree(dst);
+    }
+}
@@ -3,8 +3,15 @@
 
 #include <stddef.h>
 
+void memory_init();
+void memory_init_ap();
+
 void *memset(void *ptr, unsigned char c, size_t num);
 int memcmp(const void *ptr1, const void *ptr2, size_t num);
 void memcpy(void *dest, const void *src, size_t num);
+void *memmove(void *dest, const void *src, size_t num);
+
+void memory_test();
+void memory_bench();
 
-#endif
\ No newline at end of file
+#endif
@@ -1,47 +1,143 @@
 #include "paging.h"
 #include "config.h"
 #include "console/console.h"
+#include "cpu/cpu.h"
+#include "cpu/smp.h"
 #include "invariants.h"
 #include "kernel.h"
+#include "memory/heap/kcache.h"
 #include "memory/heap/kheap.h"
+#include "memory/heap/zpool.h"
+#include "memory/swap/swap.h"
 #include "status.h"
+#include "tlb.h"
+
+#define PAGING_FREE_BATCH 32 // frames paging_free_frames frees per tlb flush
+
+// a directory entry pointing to a table, what the ptes say is what counts
+#define PAGING_DIR_FLAGS                                                       \
+    (PAGE_PRESENT | PAGE_WRITE_ALLOW | PAGE_USER_ACCESS_ALLOW)
+// the bits of an entry paging_protect changes
+#define PAGING_PERM_FLAGS (PAGE_WRITE_ALLOW | PAGE_USER_ACCESS_ALLOW)
 
 struct page_table_32b kpage_table;
 
 struct page_table_32b *current_pt[N_CPU_MAX];
 
+// the cpu has pse, page tables use 4 MB pages wherever they can (see
+// kpaging_init)
+static bool paging_pse;
+
 extern void paging_load_dir(uint32_t *cr3);
 extern void paging_enable();
 
+// page directories and second level tables, without pse every task builds
+// 1025 of them
+static struct kcache page_table_cache = KCACHE_INIT(
+    "page_table", sizeof(page_table_entry) * NUM_PAGE_TABLE_ENTRIES);
+
+static page_table_entry *paging_alloc_table() {
+    return kcache_zalloc(&page_table_cache);
+}
+
+// for tables every entry of which is written right away
+static page_table_entry *paging_alloc_table_dirty() {
+    return kcache_alloc(&page_table_cache);
+}
+
+static void paging_free_table(void *table) {
+    kcache_free(&page_table_cache, table);
+}
+
+bool paging_large_pages() { return paging_pse; }
+
+static bool paging_is_large(uint32_t pde) {
+    return (pde & (PAGE_PRESENT | PAGE_LARGE)) == (PAGE_PRESENT | PAGE_LARGE);
+}
+
+// Replaces the 4 MB page at dir_idx with a table of the 4 KB pages it is made
+// of, so a part of it can change. The 4 MB of user memory behind one (see
+// paging_alloc_large) become a kzalloc'd page each. 0 if out of memory.
+static page_table_entry *paging_split_large(struct page_table_32b *pt,
+                                            int dir_idx) {
+    uint32_t pde = pt->cr3[dir_idx];
+    page_table_entry *table = paging_alloc_table_dirty();
+    if (!table) {
+        return 0;
+    }
+    uint32_t frame = pde & PAGE_LARGE_FRAME_MASK;
+    uint32_t flags = pde & ~PAGE_FRAME_LOC_MASK & ~PAGE_LARGE;
+    for (int i = 0; i < NUM_PAGE_TABLE_ENTRIES; i++) {
+        table[i] = (frame + i * PAGE_SIZE) | flags;
+    }
+    if (pde & PAGE_USER_ACCESS_ALLOW) {
+        kheap_split((void *)frame);
+    }
+    pt->cr3[dir_idx] = (uint32_t)table | PAGING_DIR_FLAGS;
+    // the same translations, but the 4 MB tlb entry has to go. One invlpg
+    // anywhere in it does that.
+    uint32_t va = dir_idx * PAGE_LARGE_SIZE;
+    tlb_flush_range(pt, va, va + PAGE_SIZE);
+    return table;
+}
+
+// Splits the 4 MB pages [vaddr_start, vaddr_end) covers only partly, after
+// that everything in the range can be changed a 4 KB page at a time and the
+// 4 MB pages left are wholly in it
+int paging_split_range(struct page_table_32b *pt, uint32_t vaddr_start,
+                       uint32_t vaddr_end) {
+    uint32_t edges[] = {vaddr_start, vaddr_end};
+    for (int i = 0; i < 2; i++) {
+        if (edges[i] % PAGE_LARGE_SIZE == 0) {
+            continue;
+        }
+        int dir_idx = edges[i] / PAGE_LARGE_SIZE;
+        if (paging_is_large(pt->cr3[dir_idx]) &&
+            !paging_split_large(pt, dir_idx)) {
+            return -STATUS_NOT_ENOUGH_MEM;
+        }
+    }
+    return STATUS_OK;
+}
+
 // Creates page tables for the complete 4gb 32 bit address space with identity
 // mapping.
 int paging_create_4gb_page_tables(uint8_t flags,
                                   struct page_table_32b *page_table) {
-    page_table_entry *pt_dir =
-        kzalloc(sizeof(page_table_entry) * NUM_PAGE_TABLE_ENTRIES);
+    page_table_entry *pt_dir = paging_alloc_table_dirty();
     if (!pt_dir) {
         return -STATUS_NOT_ENOUGH_MEM;
     }
+    if (paging_pse) {
+        // a directory of 4 MB pages and nothing else, the tables come when
+        // something smaller gets mapped in
+        for (int i = 0; i < NUM_PAGE_TABLE_ENTRIES; i++) {
+            uint32_t offset = i * PAGE_LARGE_SIZE;
+            uint32_t global = offset < KHEAP_SAFE_BOUNDARY ? PAGE_GLOBAL : 0;
+            pt_dir[i] = offset | flags | PAGE_LARGE | global;
+        }
+        page_table->cr3 = pt_dir;
+        page_table->num_levels = 2;
+        return STATUS_OK;
+    }
     int offset = 0;
     for (int i = 0; i < NUM_PAGE_TABLE_ENTRIES; i++) {
-        page_table_entry *pt_i =
-            kzalloc(sizeof(page_table_entry) * NUM_PAGE_TABLE_ENTRIES);
+        page_table_entry *pt_i = paging_alloc_table_dirty();
         if (!pt_i) {
-            if (pt_dir) {
-                kfree(pt_dir);
-            }
             for (int j = 0; j < i; j++) {
-                if (pt_dir) {
-                    uint32_t pte = pt_dir[j];
-                    uint32_t *pt_j = (uint32_t *)(pte & PAGE_FRAME_LOC_MASK);
-                    kfree(pt_j);
-                }
+                uint32_t pte = pt_dir[j];
+                uint32_t *pt_j = (uint32_t *)(pte & PAGE_FRAME_LOC_MASK);
+                paging_free_table(pt_j);
             }
+            paging_free_table(pt_dir);
             return -STATUS_NOT_ENOUGH_MEM;
         }
 
+        // the kernel's part is the same in every page table, so its tlb
+        // entries can outlive cr3 loads
+        uint32_t global = offset < KHEAP_SAFE_BOUNDARY ? PAGE_GLOBAL : 0;
         for (int j = 0; j < NUM_PAGE_TABLE_ENTRIES; j++) {
-            pt_i[j] = (offset + j * PAGE_SIZE) | flags;
+            pt_i[j] = (offset + j * PAGE_SIZE) | flags | global;
         }
 
         offset += PAGE_SIZE * NUM_PAGE_TABLE_ENTRIES;
@@ -57,8 +153,7 @@ int paging_create_4gb_page_tables(uint8_t flags,
 // Creates ONLY the 1st level page directory(zeroed out)
 int paging_init_new_mapping(struct page_table_32b *pt) {
     pt->num_levels = 2;
-    page_table_entry *pt_dir =
-        kzalloc(sizeof(page_table_entry) * NUM_PAGE_TABLE_ENTRIES);
+    page_table_entry *pt_dir = paging_alloc_table();
     if (!pt_dir) {
         return -STATUS_NOT_ENOUGH_MEM;
     }
@@ -66,19 +161,23 @@ int paging_init_new_mapping(struct page_table_32b *pt) {
     return STATUS_OK;
 }
 
-// Creates a new vpn -> pfn mapping
-// Allocates the page table if was not present
-// Returns NOT_ENOUGH_MEM if can't alloc new pt
-// or INVALID_ARG if vpn was already present and overwrite=false
-int paging_new_vpn_to_pfn(struct page_table_32b *pt, uint32_t vpn, uint32_t pfn,
-                          uint8_t flags, bool overwrite) {
+// paging_new_vpn_to_pfn without the tlb flush, *replaced is set if a
+// present mapping was overwritten, so the caller has to flush it
+static int paging_set_vpn(struct page_table_32b *pt, uint32_t vpn,
+                          uint32_t pfn, uint8_t flags, bool overwrite,
+                          bool *replaced) {
     int dir_idx = vpn >> 10;
     page_table_entry *second_level_pt;
     uint32_t pte = pt->cr3[dir_idx];
 
     if ((pte & PAGE_PRESENT) == 0) {
-        second_level_pt =
-            kzalloc(sizeof(page_table_entry) * NUM_PAGE_TABLE_ENTRIES);
+        second_level_pt = paging_alloc_table();
+        if (!second_level_pt) {
+            return -STATUS_NOT_ENOUGH_MEM;
+        }
+        pt->cr3[dir_idx] = (uint32_t)second_level_pt | PAGING_DIR_FLAGS;
+    } else if (pte & PAGE_LARGE) {
+        second_level_pt = paging_split_large(pt, dir_idx);
         if (!second_level_pt) {
             return -STATUS_NOT_ENOUGH_MEM;
         }
@@ -102,6 +201,7 @@ int paging_new_vpn_to_pfn(struct page_table_32b *pt, uint32_t vpn, uint32_t pfn,
             if (page_addr) {
                 // kfree(page_addr);
             }
+            *replaced = true;
         } else {
             return -STATUS_INVALID_ARG;
         }
@@ -110,31 +210,36 @@ int paging_new_vpn_to_pfn(struct page_table_32b *pt, uint32_t vpn, uint32_t pfn,
     uint32_t page_addr = pfn * PAGE_SIZE;
     second_level_pt[second_level_pt_idx] = page_addr | flags;
 
-    // overwrite flags in dir (the hardware uses `and` of the permissions in the
-    // 2 levels)
-    if (overwrite) {
-        pt->cr3[dir_idx] = (uint32_t)second_level_pt | flags;
-    }
+    // the hardware uses `and` of the permissions in the 2 levels, the dir
+    // allows everything so that each page can have its own
+    pt->cr3[dir_idx] = (uint32_t)second_level_pt | PAGING_DIR_FLAGS;
 
     return STATUS_OK;
 }
 
-// TODO: add more tlb flush functions
-
-// Flushes the tlb for the given virtual address
-static inline void __native_flush_tlb_single(unsigned int addr) {
-    asm volatile("invlpg (%0)" ::"r"(addr) : "memory");
+// Creates a new vpn -> pfn mapping
+// Allocates the page table if was not present
+// Returns NOT_ENOUGH_MEM if can't alloc new pt
+// or INVALID_ARG if vpn was already present and overwrite=false
+int paging_new_vpn_to_pfn(struct page_table_32b *pt, uint32_t vpn, uint32_t pfn,
+                          uint8_t flags, bool overwrite) {
+    bool replaced = false;
+    int res = paging_set_vpn(pt, vpn, pfn, flags, overwrite, &replaced);
+    if (replaced) {
+        tlb_flush_range(pt, vpn * PAGE_SIZE, (vpn + 1) * PAGE_SIZE);
+    }
+    return res;
 }
 
-// Free the frame mapping to the vpn
-// Zeroes out the pte
+// Zeroes out the pte, the caller flushes the tlb. A 4 MB page must have been
+// split first (paging_split_range).
 // DESIGN INVARIANT: No Shared Pages
-int paging_free_vpn(struct page_table_32b *pt, uint32_t vpn) {
+static void paging_clear_vpn(struct page_table_32b *pt, uint32_t vpn) {
     assert_no_page_sharing();
     int dir_idx = vpn >> 10;
     uint32_t pte = pt->cr3[dir_idx];
-    if ((pte & PAGE_PRESENT) == 0) {
-        return 0;
+    if ((pte & PAGE_PRESENT) == 0 || (pte & PAGE_LARGE)) {
+        return;
     }
     page_table_entry *second_level_pt =
         (page_table_entry *)(pte & PAGE_FRAME_LOC_MASK);
@@ -142,7 +247,7 @@ int paging_free_vpn(struct page_table_32b *pt, uint32_t vpn) {
     int second_level_pt_idx = vpn % (1 << 10);
     uint32_t second_level_pte = second_level_pt[second_level_pt_idx];
     if ((second_level_pte & PAGE_PRESENT) == 0) {
-        return 0;
+        return;
     }
     void *paddr = (void *)(second_level_pte & PAGE_FRAME_LOC_MASK);
     if (paddr) {
@@ -151,19 +256,76 @@ int paging_free_vpn(struct page_table_32b *pt, uint32_t vpn) {
     }
 
     second_level_pt[second_level_pt_idx] = 0x00;
+}
 
-    // Very important: flush the tlb
-    assert_single_cpu(); // Doesn't work on SMP
-    __native_flush_tlb_single(vpn * PAGE_SIZE);
+// The pte mapping vaddr (frame and flags), 0 if its page table isn't there.
+// In a 4 MB page, the pte its 4 KB page would have.
+uint32_t paging_get_pte(struct page_table_32b *pt, uint32_t vaddr) {
+    uint32_t pde = pt->cr3[vaddr >> 22];
+    if ((pde & PAGE_PRESENT) == 0) {
+        return 0;
+    }
+    if (pde & PAGE_LARGE) {
+        return ((pde & PAGE_LARGE_FRAME_MASK) + (vaddr & ~PAGE_LARGE_FRAME_MASK &
+                                                 PAGE_FRAME_LOC_MASK)) |
+               (pde & ~PAGE_FRAME_LOC_MASK & ~PAGE_LARGE);
+    }
+    page_table_entry *second_level_pt =
+        (page_table_entry *)(pde & PAGE_FRAME_LOC_MASK);
+    return second_level_pt[(vaddr >> 12) % (1 << 10)];
+}
 
-    return 0;
+// Where the pte of the 4 KB page at vaddr is, to be changed in place (the
+// caller flushes the tlb). 0 if there is no page table there or it is in a
+// 4 MB page.
+page_table_entry *paging_get_pte_ptr(struct page_table_32b *pt,
+                                     uint32_t vaddr) {
+    uint32_t pde = pt->cr3[vaddr >> 22];
+    if ((pde & PAGE_PRESENT) == 0 || (pde & PAGE_LARGE)) {
+        return 0;
+    }
+    page_table_entry *second_level_pt =
+        (page_table_entry *)(pde & PAGE_FRAME_LOC_MASK);
+    return &second_level_pt[(vaddr >> 12) % (1 << 10)];
 }
 
-// Requires vaddr_start and vaddr_end to be page aligned
-// Allocates new frames and creates mapping for the
-// virtual addr space [vaddr_start... vaddr_end)
-int paging_alloc_mapping(struct page_table_32b *pt, uint32_t vaddr_start,
-                         uint32_t vaddr_end, uint8_t flags) {
+// Maps the 4 MB at vpn to a 4 MB page of fresh zeroed memory, when there is
+// pse, the range up to end_vpn covers all of it and nothing but the identity
+// map is there. False if not, the caller maps 4 KB pages instead.
+static bool paging_alloc_large(struct page_table_32b *pt, uint32_t vpn,
+                               uint32_t end_vpn, uint8_t flags,
+                               bool *replaced) {
+    if (!paging_pse || vpn % NUM_PAGE_TABLE_ENTRIES != 0 ||
+        end_vpn - vpn < NUM_PAGE_TABLE_ENTRIES) {
+        return false;
+    }
+    int dir_idx = vpn >> 10;
+    uint32_t pde = pt->cr3[dir_idx];
+    if ((pde & PAGE_PRESENT) &&
+        (!(pde & PAGE_LARGE) || (pde & PAGE_USER_ACCESS_ALLOW))) {
+        return false;
+    }
+    void *frame = kzalloc_aligned(PAGE_LARGE_SIZE, PAGE_LARGE_SIZE);
+    if (!frame) {
+        return false;
+    }
+    pt->cr3[dir_idx] = (uint32_t)frame | flags | PAGE_LARGE;
+    if (pde & PAGE_PRESENT) {
+        *replaced = true;
+    }
+    return true;
+}
+
+// the pte maps the page of zeroes shared by untouched user memory
+bool paging_is_zero_page(uint32_t pte) {
+    return (pte & PAGE_FRAME_LOC_MASK) == (uint32_t)zpool_zero_page();
+}
+
+// paging_alloc_mapping and paging_map_zero, lazy maps every page to the zero
+// page instead of a frame of its own. Only the eager path takes 4 MB pages,
+// they would be zeroed up front and kept out of the swap.
+static int paging_map_range(struct page_table_32b *pt, uint32_t vaddr_start,
+                            uint32_t vaddr_end, uint8_t flags, bool lazy) {
     if (vaddr_start % PAGE_SIZE != 0 || vaddr_end % PAGE_SIZE != 0) {
         return -STATUS_INVALID_ARG;
     }
@@ -174,30 +336,82 @@ int paging_alloc_mapping(struct page_table_32b *pt, uint32_t vaddr_start,
 
     uint32_t start_vpn = vaddr_start / PAGE_SIZE;
     uint32_t end_vpn = vaddr_end / PAGE_SIZE;
-    if (vaddr_end % PAGE_SIZE != 0) {
-        end_vpn++;
-    }
 
-    for (int i = start_vpn; i < end_vpn; i++) {
-        uint32_t new_paddr = (uint32_t)kzalloc(PAGE_SIZE);
-        if (new_paddr == 0) {
-            for (int j = start_vpn; j < i; j++) {
-                paging_free_vpn(pt, j);
+    // one tlb flush for the whole range at the end
+    int res = STATUS_OK;
+    bool replaced = false;
+    uint32_t vpn = start_vpn;
+    while (vpn < end_vpn) {
+        if (!lazy && paging_alloc_large(pt, vpn, end_vpn, flags, &replaced)) {
+            vpn += NUM_PAGE_TABLE_ENTRIES;
+            continue;
+        }
+        if (lazy) {
+            uint32_t pfn = (uint32_t)zpool_zero_page() / PAGE_SIZE;
+            res = paging_set_vpn(pt, vpn, pfn, flags & ~PAGE_WRITE_ALLOW, true,
+                                 &replaced);
+        } else {
+            uint32_t new_paddr = (uint32_t)swap_alloc_page();
+            if (new_paddr == 0) {
+                res = -STATUS_NOT_ENOUGH_MEM;
+            } else {
+                uint32_t pfn = new_paddr / PAGE_SIZE;
+                res = paging_set_vpn(pt, vpn, pfn, flags, true, &replaced);
+                if (res < 0) {
+                    kfree((void *)new_paddr);
+                }
             }
-            return -STATUS_NOT_ENOUGH_MEM;
         }
-        uint32_t pfn = new_paddr / PAGE_SIZE;
-        int res = paging_new_vpn_to_pfn(pt, i, pfn, flags, true);
         if (res < 0) {
-            for (int j = start_vpn; j < i; j++) {
-                paging_free_vpn(pt, j);
-            }
-            // NO FREEING FOR NOW
-            // kfree((uint32_t *)new_paddr);
-            return res;
+            // give back the frames mapped so far, all of them pages (or 4 MB
+            // pages) of their own, so this can't fail
+            paging_free_frames(pt, vaddr_start, vpn * PAGE_SIZE);
+            break;
         }
+        vpn++;
+    }
+    if (replaced || res < 0) {
+        tlb_flush_range(pt, vaddr_start, vaddr_end);
     }
 
+    return res;
+}
+
+// Requires vaddr_start and vaddr_end to be page aligned
+// Allocates new frames and creates mapping for the
+// virtual addr space [vaddr_start... vaddr_end). Every 4 MB aligned 4 MB of
+// it gets a 4 MB page when there is memory for one.
+int paging_alloc_mapping(struct page_table_32b *pt, uint32_t vaddr_start,
+                         uint32_t vaddr_end, uint8_t flags) {
+    return paging_map_range(pt, vaddr_start, vaddr_end, flags, false);
+}
+
+// paging_alloc_mapping for memory that starts out zero, where pages may never
+// be touched. The pages, all 4 KB, map the zero page read only and get a
+// frame of their own on the first write (paging_fault_zero), nothing is
+// allocated up front but page tables.
+int paging_map_zero(struct page_table_32b *pt, uint32_t vaddr_start,
+                    uint32_t vaddr_end, uint8_t flags) {
+    return paging_map_range(pt, vaddr_start, vaddr_end, flags, true);
+}
+
+// A write to vaddr faulted. If the page maps the zero page, it gets a zeroed
+// frame of its own with flags (writable) and the write can be retried.
+// -STATUS_INVALID_ARG if the fault was about something else.
+int paging_fault_zero(struct page_table_32b *pt, uint32_t vaddr,
+                      uint8_t flags) {
+    uint32_t pte = paging_get_pte(pt, vaddr);
+    if (!(pte & PAGE_PRESENT) || !paging_is_zero_page(pte) ||
+        !(flags & PAGE_WRITE_ALLOW)) {
+        return -STATUS_INVALID_ARG;
+    }
+    void *frame = swap_alloc_page();
+    if (!frame) {
+        return -STATUS_NOT_ENOUGH_MEM;
+    }
+    uint32_t vpn = vaddr / PAGE_SIZE;
+    paging_new_vpn_to_pfn(pt, vpn, (uint32_t)frame / PAGE_SIZE, flags, true);
+    zpool_stats.zero_faults++;
     return STATUS_OK;
 }
 
@@ -206,15 +420,18 @@ int paging_free_page_table(struct page_table_32b *pt) {
     if (pt->num_levels == 1) {
         panic("single level pages not support yet..!");
     }
+    if (pt->active_cpus) {
+        panic("freeing a page table a cpu still has loaded");
+    }
     for (int i = 0; i < NUM_PAGE_TABLE_ENTRIES; i++) {
         uint32_t pte = pt->cr3[i];
-        if (!(pte & PAGE_PRESENT)) {
+        if (!(pte & PAGE_PRESENT) || (pte & PAGE_LARGE)) {
             continue;
         }
         uint32_t *second_level_pt = (uint32_t *)(pte & PAGE_FRAME_LOC_MASK);
-        kfree(second_level_pt);
+        paging_free_table(second_level_pt);
     }
-    kfree(pt->cr3);
+    paging_free_table(pt->cr3);
     return 0;
 }
 
@@ -234,9 +451,109 @@ int paging_free_va(struct page_table_32b *pt, uint32_t vaddr_start,
     if (vaddr_end % PAGE_SIZE != 0) {
         end_vpn++;
     }
+    int res = paging_split_range(pt, start_vpn * PAGE_SIZE, end_vpn * PAGE_SIZE);
+    if (res < 0) {
+        return res;
+    }
     for (uint32_t i = start_vpn; i < end_vpn; i++) {
-        paging_free_vpn(pt, i);
+        if (paging_is_large(pt->cr3[i >> 10])) {
+            // wholly in the range after the split
+            pt->cr3[i >> 10] = 0;
+            i += NUM_PAGE_TABLE_ENTRIES - 1;
+            continue;
+        }
+        paging_clear_vpn(pt, i);
+    }
+    tlb_flush_range(pt, start_vpn * PAGE_SIZE, end_vpn * PAGE_SIZE);
+    return STATUS_OK;
+}
+
+// Unmaps [vaddr_start, vaddr_end) like paging_free_va and kfrees the frames
+// behind it, each one a page or 4 MB page of its own (see
+// paging_alloc_mapping) or the zero page, which stays. Pages on the swap disk
+// give back their slot. Frames are freed a batch at a time, only once no
+// tlb can have them anymore.
+int paging_free_frames(struct page_table_32b *pt, uint32_t vaddr_start,
+                       uint32_t vaddr_end) {
+    if (vaddr_start % PAGE_SIZE != 0 || vaddr_end % PAGE_SIZE != 0 ||
+        vaddr_end < vaddr_start) {
+        return -STATUS_INVALID_ARG;
+    }
+    int res = paging_split_range(pt, vaddr_start, vaddr_end);
+    if (res < 0) {
+        return res;
+    }
+    uint32_t frames[PAGING_FREE_BATCH];
+    uint32_t va = vaddr_start;
+    while (va < vaddr_end) {
+        uint32_t pde = pt->cr3[va >> 22];
+        if (paging_is_large(pde)) {
+            pt->cr3[va >> 22] = 0;
+            tlb_flush_range(pt, va, va + PAGE_SIZE);
+            kfree((void *)(pde & PAGE_LARGE_FRAME_MASK));
+            va += PAGE_LARGE_SIZE;
+            continue;
+        }
+        uint32_t batch_start = va;
+        int n = 0;
+        for (; va < vaddr_end && n < PAGING_FREE_BATCH &&
+               !paging_is_large(pt->cr3[va >> 22]);
+             va += PAGE_SIZE) {
+            uint32_t pte = paging_get_pte(pt, va);
+            if ((pte & (PAGE_PRESENT | PAGE_SWAPPED)) == PAGE_SWAPPED) {
+                swap_free(pte >> 12);
+                *paging_get_pte_ptr(pt, va) = 0;
+            } else if (pte & PAGE_PRESENT) {
+                if (!paging_is_zero_page(pte)) {
+                    frames[n++] = pte & PAGE_FRAME_LOC_MASK;
+                }
+                paging_clear_vpn(pt, va / PAGE_SIZE);
+            }
+        }
+        tlb_flush_range(pt, batch_start, va);
+        for (int i = 0; i < n; i++) {
+            kfree((void *)frames[i]);
+        }
+    }
+    return STATUS_OK;
+}
+
+// Gives the pages mapped in [vaddr_start, vaddr_end) (page aligned) the
+// permissions in flags, keeping their frames. The zero page is never
+// writable, a write still has to fault to get a frame of its own.
+int paging_protect(struct page_table_32b *pt, uint32_t vaddr_start,
+                   uint32_t vaddr_end, uint8_t flags) {
+    if (vaddr_start % PAGE_SIZE != 0 || vaddr_end % PAGE_SIZE != 0 ||
+        vaddr_end < vaddr_start) {
+        return -STATUS_INVALID_ARG;
+    }
+    int res = paging_split_range(pt, vaddr_start, vaddr_end);
+    if (res < 0) {
+        return res;
+    }
+    uint32_t perms = flags & PAGING_PERM_FLAGS;
+    uint32_t va = vaddr_start;
+    while (va < vaddr_end) {
+        page_table_entry *pde = &pt->cr3[va >> 22];
+        if (paging_is_large(*pde)) {
+            *pde = (*pde & ~PAGING_PERM_FLAGS) | perms;
+            va += PAGE_LARGE_SIZE;
+            continue;
+        }
+        if (*pde & PAGE_PRESENT) {
+            page_table_entry *table =
+                (page_table_entry *)(*pde & PAGE_FRAME_LOC_MASK);
+            page_table_entry *pte = &table[(va >> 12) % NUM_PAGE_TABLE_ENTRIES];
+            if (*pte & PAGE_PRESENT) {
+                uint32_t p = paging_is_zero_page(*pte)
+                                 ? perms & ~PAGE_WRITE_ALLOW
+                                 : perms;
+                *pte = (*pte & ~PAGING_PERM_FLAGS) | p;
+            }
+        }
+        va += PAGE_SIZE;
     }
+    tlb_flush_range(pt, vaddr_start, vaddr_end);
     return STATUS_OK;
 }
 
@@ -253,18 +570,34 @@ int paging_free_table_and_frames(struct page_table_32b *pt) {
     return 0;
 }
 
+// The cpu's bit goes into active_cpus before cr3 is loaded and out of the old
+// table's only after, so tlb_flush_range never misses a cpu that could hold
+// entries of a table. Reloading the table already loaded would only throw
+// away good tlb entries.
 void paging_switch(struct page_table_32b *pt) {
-    // int cpu = get_cpu_id();
-    int cpu = 0;
+    int cpu = get_cpu_id();
+    struct page_table_32b *old = current_pt[cpu];
+    if (old == pt) {
+        return;
+    }
 
+    __atomic_fetch_or(&pt->active_cpus, 1u << cpu, __ATOMIC_SEQ_CST);
     paging_load_dir(pt->cr3);
+    if (old) {
+        __atomic_fetch_and(&old->active_cpus, ~(1u << cpu), __ATOMIC_SEQ_CST);
+    }
 
     current_pt[cpu] = pt;
 }
 
 void paging_load_kernel_page_table() { paging_switch(&kpage_table); }
 
+struct page_table_32b *paging_kernel_page_table() { return &kpage_table; }
+
 void kpaging_init() {
+    // before the tables are built, they are made of 4 MB pages with pse. The
+    // aps turn it on in the trampoline.
+    paging_pse = cpu_enable_large_pages();
     // Creates page tables for the complete 4gb 32 bit add
     int res = paging_create_4gb_page_tables(PAGE_PRESENT | PAGE_WRITE_ALLOW,
                                             &kpage_table);
@@ -273,6 +606,17 @@ void kpaging_init() {
     }
     paging_switch(&kpage_table);
     paging_enable();
+    cpu_enable_global_pages();
+    // the kernel writes to user memory directly, it has to fault on the zero
+    // page like the user would
+    cpu_enable_write_protect();
+}
+
+// The aps come out of the trampoline with kpage_table in cr3 already
+void kpaging_init_ap() {
+    cpu_enable_global_pages();
+    cpu_enable_write_protect();
+    paging_switch(&kpage_table);
 }
 
 bool is_page_aligned(uint32_t addr) { return (addr & (PAGE_SIZE - 1)) == 0; }
@@ -294,6 +638,10 @@ int paging_map_page(struct page_table_32b *pt, uint32_t virt_addr,
     uint32_t pt_dir_index = virt_addr / (PAGE_SIZE * NUM_PAGE_TABLE_ENTRIES);
     uint32_t pt_index =
         (virt_addr % (PAGE_SIZE * NUM_PAGE_TABLE_ENTRIES)) / PAGE_SIZE;
+    if (paging_is_large(pt_dir[pt_dir_index]) &&
+        !paging_split_large(pt, pt_dir_index)) {
+        return -STATUS_NOT_ENOUGH_MEM;
+    }
 
     uint32_t *pt_i = (uint32_t *)(pt_dir[pt_dir_index] & PAGE_FRAME_LOC_MASK);
     pt_i[pt_index] = phys_addr | flags;
@@ -341,15 +689,20 @@ int paging_map_memory_region(struct page_table_32b *pt, void *data_va_start,
         return -STATUS_INVALID_ARG;
     }
 
+    int res = STATUS_OK;
+    bool replaced = false;
     for (int i = 0; i + vpn_start < vpn_end; i++) {
-        int res = paging_new_vpn_to_pfn(pt, vpn_start + i, pfn_start + i, flags,
-                                        true);
+        res = paging_set_vpn(pt, vpn_start + i, pfn_start + i, flags, true,
+                             &replaced);
         if (res != STATUS_OK) {
-            return res;
+            break;
         }
     }
+    if (replaced) {
+        tlb_flush_range(pt, vpn_start * PAGE_SIZE, vpn_end * PAGE_SIZE);
+    }
 
-    return STATUS_OK;
+    return res;
 }
 
 // -------------------- Tests -------------------- //
@@ -367,4 +720,107 @@ void test_paging_set() {
         println("paging map pass..");
         print_int(*ptr_pa);
     }
-}
\ No newline at end of file
+}
+
+#define PAGING_TEST_BASE 0x40000000 // 4 MB aligned
+
+// the 4 MB pages of a mapping, split by a protect and freed again
+void paging_test() {
+    struct page_table_32b pt = {0};
+    if (paging_create_4gb_page_tables(PAGE_PRESENT | PAGE_WRITE_ALLOW, &pt) !=
+        STATUS_OK) {
+        panic("paging_test: no page table");
+    }
+    uint8_t flags = PAGE_PRESENT | PAGE_WRITE_ALLOW | PAGE_USER_ACCESS_ALLOW;
+    uint32_t start = PAGING_TEST_BASE - PAGE_SIZE;
+    uint32_t end = PAGING_TEST_BASE + 2 * PAGE_LARGE_SIZE + PAGE_SIZE;
+    if (paging_alloc_mapping(&pt, start, end, flags) != STATUS_OK) {
+        panic("paging_test: alloc mapping failed");
+    }
+
+    uint32_t va = PAGING_TEST_BASE + 5 * PAGE_SIZE;
+    uint32_t pde = pt.cr3[PAGING_TEST_BASE / PAGE_LARGE_SIZE];
+    if (paging_large_pages() && !paging_is_large(pde)) {
+        panic("paging_test: no 4 MB page for an aligned 4 MB");
+    }
+    if (paging_is_large(pt.cr3[start / PAGE_LARGE_SIZE])) {
+        panic("paging_test: 4 MB page for a 4 KB one");
+    }
+    uint32_t frame = paging_get_pte(&pt, va) & PAGE_FRAME_LOC_MASK;
+    *(uint32_t *)frame = 0xC0FFEE;
+
+    // a 4 KB page in the middle of a 4 MB one
+    paging_protect(&pt, va, va + PAGE_SIZE, PAGE_PRESENT |
+                                                PAGE_USER_ACCESS_ALLOW);
+    uint32_t pte = paging_get_pte(&pt, va);
+    if (paging_is_large(pt.cr3[va / PAGE_LARGE_SIZE]) ||
+        (pte & PAGE_WRITE_ALLOW) || (pte & PAGE_FRAME_LOC_MASK) != frame ||
+        !(paging_get_pte(&pt, va + PAGE_SIZE) & PAGE_WRITE_ALLOW) ||
+        *(uint32_t *)frame != 0xC0FFEE) {
+        panic("paging_test: protect of a part of a 4 MB page");
+    }
+    if (paging_large_pages() &&
+        !paging_is_large(pt.cr3[va / PAGE_LARGE_SIZE + 1])) {
+        panic("paging_test: protect split the wrong 4 MB page");
+    }
+
+    paging_free_frames(&pt, start, end);
+    for (va = start; va < end; va += PAGE_SIZE) {
+        if (paging_get_pte(&pt, va) & PAGE_PRESENT) {
+            panic("paging_test: pages left mapped");
+        }
+    }
+    // every page of the split 4 MB page was freed, it can be had again
+    if (paging_large_pages()) {
+        void *again = kmalloc_aligned(PAGE_LARGE_SIZE, PAGE_LARGE_SIZE);
+        if ((uint32_t)again != (pde & PAGE_LARGE_FRAME_MASK)) {
+            panic("paging_test: 4 MB page not freed");
+        }
+        kfree(again);
+    }
+
+    // untouched pages share the zero page, read only, until written
+    start = PAGING_TEST_BASE + PAGE_SIZE;
+    end = start + 3 * PAGE_SIZE;
+    va = start + PAGE_SIZE;
+    if (paging_map_zero(&pt, start, end, flags) != STATUS_OK) {
+        panic("paging_test: zero mapping failed");
+    }
+    pte = paging_get_pte(&pt, start);
+    if (!paging_is_zero_page(pte) || (pte & PAGE_WRITE_ALLOW)) {
+        panic("paging_test: untouched page not the zero page");
+    }
+    if (paging_fault_zero(&pt, va, flags) != STATUS_OK) {
+        panic("paging_test: write to the zero page not resolved");
+    }
+    pte = paging_get_pte(&pt, va);
+    if (paging_is_zero_page(pte) || !(pte & PAGE_WRITE_ALLOW) ||
+        *(uint32_t *)(pte & PAGE_FRAME_LOC_MASK) != 0 ||
+        paging_fault_zero(&pt, va, flags) != -STATUS_INVALID_ARG) {
+        panic("paging_test: written page has no frame of its own");
+    }
+    paging_protect(&pt, start, end, flags);
+    if ((paging_get_pte(&pt, start) & PAGE_WRITE_ALLOW) ||
+        !(paging_get_pte(&pt, va) & PAGE_WRITE_ALLOW)) {
+        panic("paging_test: protect made the zero page writable");
+    }
+    paging_free_frames(&pt, start, end);
+    if (paging_get_pte(&pt, start) & PAGE_PRESENT) {
+        panic("paging_test: zero page left mapped");
+    }
+
+    // an aligned 4 MB of it too, no 4 MB page is zeroed up front
+    start = PAGING_TEST_BASE;
+    end = start + PAGE_LARGE_SIZE;
+    if (paging_map_zero(&pt, start, end, flags) != STATUS_OK) {
+        panic("paging_test: zero mapping failed");
+    }
+    if (paging_is_large(pt.cr3[start / PAGE_LARGE_SIZE]) ||
+        !paging_is_zero_page(paging_get_pte(&pt, end - PAGE_SIZE))) {
+        panic("paging_test: 4 MB page for a zero mapping");
+    }
+    paging_free_frames(&pt, start, end);
+
+    paging_free_page_table(&pt);
+    println("paging test passed");
+}
@@ -12,21 +12,37 @@
     0b00000100                      // Page can be accessed in all ring levels
 #define PAGE_WRITE_ALLOW 0b00000010 // Page can be written to
 #define PAGE_PRESENT 0b00000001     // Page is present
+#define PAGE_ACCESSED 0x20 // set by the cpu when the page is used
+#define PAGE_GLOBAL 0x100 // kept in the tlb across cr3 loads
+#define PAGE_LARGE 0x80   // directory entry mapping a 4 MB page (pse)
+// in a pte that isn't present: the page is on the swap disk, in the slot in
+// the frame bits (see swap.h)
+#define PAGE_SWAPPED 0x200
 
 #define PAGE_FRAME_LOC_MASK 0xFFFFF000
+#define PAGE_LARGE_FRAME_MASK 0xFFC00000
 
 #define NUM_PAGE_TABLE_ENTRIES 1024
+#define PAGE_LARGE_SIZE (PAGE_SIZE * NUM_PAGE_TABLE_ENTRIES) // 4 MB
 
 typedef uint32_t page_table_entry;
 
 struct page_table_32b {
     page_table_entry *cr3;
-    int num_levels; // 1 for large pages(4 MB), 2 for normal 4KB in 32 bit mode.
+    // 1 for large pages(4 MB), 2 for normal 4KB in 32 bit mode. Tables are
+    // always 2 levels, with pse some directory entries are 4 MB pages.
+    int num_levels;
+    // bit per cpu that may have this loaded in cr3, see paging_switch
+    volatile uint32_t active_cpus;
 };
 
 void kpaging_init();
+void kpaging_init_ap();
+bool paging_large_pages();
 void paging_load_kernel_page_table();
+struct page_table_32b *paging_kernel_page_table();
 int paging_create_4gb_page_tables(uint8_t flags, struct page_table_32b *pt);
+int paging_init_new_mapping(struct page_table_32b *pt);
 int paging_free_page_table(struct page_table_32b *table_table);
 void paging_switch(struct page_table_32b *pt);
 
@@ -38,8 +54,25 @@ int paging_map_memory_region(struct page_table_32b *pt, void *data_va_start,
                              uint8_t flags);
 
 void test_paging_set();
+void paging_test();
 
+int paging_alloc_mapping(struct page_table_32b *pt, uint32_t vaddr_start,
+                         uint32_t vaddr_end, uint8_t flags);
+int paging_map_zero(struct page_table_32b *pt, uint32_t vaddr_start,
+                    uint32_t vaddr_end, uint8_t flags);
+int paging_fault_zero(struct page_table_32b *pt, uint32_t vaddr,
+                      uint8_t flags);
 int paging_free_va(struct page_table_32b *pt, uint32_t vaddr_start,
                    uint32_t vaddr_end);
+int paging_free_frames(struct page_table_32b *pt, uint32_t vaddr_start,
+                       uint32_t vaddr_end);
+int paging_split_range(struct page_table_32b *pt, uint32_t vaddr_start,
+                       uint32_t vaddr_end);
+int paging_protect(struct page_table_32b *pt, uint32_t vaddr_start,
+                   uint32_t vaddr_end, uint8_t flags);
+uint32_t paging_get_pte(struct page_table_32b *pt, uint32_t vaddr);
+page_table_entry *paging_get_pte_ptr(struct page_table_32b *pt,
+                                     uint32_t vaddr);
+bool paging_is_zero_page(uint32_t pte);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,87 @@
+#include "tlb.h"
+#include "config.h"
+#include "cpu/lapic.h"
+#include "cpu/smp.h"
+#include "cpu/spinlock.h"
+
+// One shootdown at a time: the cpu that unmapped fills this in, sends
+// TLB_SHOOTDOWN_VECTOR to every other cpu that has the page table loaded and
+// spins until all of them cleared their bit in pending
+struct tlb_request {
+    uint32_t vaddr_start;
+    uint32_t vaddr_end;
+    volatile uint32_t pending; // bit per cpu that still has to flush
+};
+
+static struct tlb_request request;
+static struct spinlock tlb_lock = SPINLOCK_INIT("tlb");
+
+static void tlb_flush_all_local() {
+    uint32_t cr3;
+    asm volatile("mov %%cr3, %0" : "=r"(cr3));
+    asm volatile("mov %0, %%cr3" ::"r"(cr3) : "memory");
+}
+
+// Past TLB_FLUSH_MAX_PAGES one cr3 reload is cheaper than the invlpgs, the
+// kernel's global entries survive it anyway
+static void tlb_flush_local(uint32_t vaddr_start, uint32_t vaddr_end) {
+    if ((vaddr_end - vaddr_start) / PAGE_SIZE > TLB_FLUSH_MAX_PAGES) {
+        tlb_flush_all_local();
+        return;
+    }
+    for (uint32_t va = vaddr_start; va < vaddr_end; va += PAGE_SIZE) {
+        asm volatile("invlpg (%0)" ::"r"(va) : "memory");
+    }
+}
+
+// Answers a pending shootdown, if there is one for this cpu. Called from the
+// IPI and by every cpu spinning on a lock the one asking might hold (the
+// big kernel lock), whose interrupts are off.
+void tlb_poll() {
+    uint32_t self = 1u << get_cpu_id();
+    if (!(__atomic_load_n(&request.pending, __ATOMIC_ACQUIRE) & self)) {
+        return;
+    }
+    tlb_flush_local(request.vaddr_start, request.vaddr_end);
+    __atomic_fetch_and(&request.pending, ~self, __ATOMIC_RELEASE);
+}
+
+// TLB_SHOOTDOWN_VECTOR, handled without the big kernel lock
+void tlb_handle_shootdown() {
+    tlb_poll();
+    lapic_eoi();
+}
+
+// Drops [vaddr_start, vaddr_end) of pt from the tlb of every cpu that has pt
+// loaded, callers change the ptes first. A whole range costs one IPI per cpu
+// no matter how many pages it has.
+void tlb_flush_range(struct page_table_32b *pt, uint32_t vaddr_start,
+                     uint32_t vaddr_end) {
+    uint32_t self = 1u << get_cpu_id();
+
+    // the pte writes must be visible before we look at who has pt loaded,
+    // see paging_switch
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    uint32_t cpus = __atomic_load_n(&pt->active_cpus, __ATOMIC_SEQ_CST);
+    if (cpus & self) {
+        tlb_flush_local(vaddr_start, vaddr_end);
+    }
+    cpus &= ~self;
+    if (!cpus) {
+        return;
+    }
+
+    spin_lock_relax(&tlb_lock, tlb_poll);
+    request.vaddr_start = vaddr_start;
+    request.vaddr_end = vaddr_end;
+    __atomic_store_n(&request.pending, cpus, __ATOMIC_RELEASE);
+    for (int i = 0; i < smp_num_cpus(); i++) {
+        if (cpus & (1u << i)) {
+            lapic_send_fixed(smp_get_cpu(i)->apic_id, TLB_SHOOTDOWN_VECTOR);
+        }
+    }
+    while (__atomic_load_n(&request.pending, __ATOMIC_ACQUIRE)) {
+        asm volatile("pause");
+    }
+    spin_unlock(&tlb_lock);
+}
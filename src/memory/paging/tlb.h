@@ -0,0 +1,12 @@
+#ifndef TLB_H
+#define TLB_H
+
+#include "paging.h"
+#include <stdint.h>
+
+void tlb_flush_range(struct page_table_32b *pt, uint32_t vaddr_start,
+                     uint32_t vaddr_end);
+void tlb_poll();
+void tlb_handle_shootdown();
+
+#endif
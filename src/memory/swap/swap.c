@@ -0,0 +1,356 @@
+#include "swap.h"
+#include "config.h"
+#include "console/console.h"
+#include "cpu/smp.h"
+#include "disk/disk.h"
+#include "kernel.h"
+#include "memory/heap/kheap.h"
+#include "memory/heap/zpool.h"
+#include "memory/memory.h"
+#include "memory/paging/tlb.h"
+#include "memory/vma/vma.h"
+#include "status.h"
+#include "task/process.h"
+#include <stdbool.h>
+
+struct swap_stats swap_stats;
+
+// 0 without a swap disk, then nothing is ever written out
+static struct disk *swap_disk;
+// a bit per slot, set if it holds a page. Slot 0 is never used, so the start
+// of the disk never looks like a file system.
+static uint8_t *swap_map;
+static uint32_t swap_next; // where the search for a free slot starts
+// the pages of a batch are copied here, to go out in one write per run of
+// consecutive slots. Allocated up front, swapping happens when there is no
+// memory.
+static uint8_t *swap_staging;
+
+// the clock hand: the process and the address it looks at next
+static int hand_pid;
+static uint32_t hand_va;
+
+// Uses the primary slave as the swap disk if there is one without a file
+// system on it
+int swap_init() {
+    if (disk_count() <= SWAP_DRIVE) {
+        return STATUS_OK;
+    }
+    struct disk *disk = get_disk(SWAP_DRIVE);
+    if (disk->fs) {
+        print("swap: disk 1 has a file system, not swapping to it\n");
+        return STATUS_OK;
+    }
+    uint32_t slots = disk->sectors / SWAP_SECTORS_PER_PAGE;
+    if (slots < 2) {
+        return STATUS_OK;
+    }
+
+    swap_map = kzalloc((slots + 7) / 8);
+    swap_staging = kmalloc(SWAP_BATCH * PAGE_SIZE);
+    if (!swap_map || !swap_staging) {
+        if (swap_map) {
+            kfree(swap_map);
+        }
+        if (swap_staging) {
+            kfree(swap_staging);
+        }
+        return -STATUS_NOT_ENOUGH_MEM;
+    }
+    swap_map[0] = 1;
+    swap_next = 1;
+    swap_stats.slots = slots - 1;
+    swap_disk = disk;
+    return STATUS_OK;
+}
+
+static bool swap_slot_used(uint32_t slot) {
+    return swap_map[slot / 8] & (1 << (slot % 8));
+}
+
+// A free slot, taken, 0 if the disk is full. Next fit, so the pages of a
+// batch mostly end up next to each other.
+static uint32_t swap_alloc_slot() {
+    uint32_t total = swap_stats.slots + 1;
+    for (uint32_t i = 0; i < total; i++) {
+        uint32_t slot = (swap_next + i) % total;
+        if (!swap_slot_used(slot)) {
+            swap_map[slot / 8] |= 1 << (slot % 8);
+            swap_next = slot + 1;
+            swap_stats.used++;
+            return slot;
+        }
+    }
+    return 0;
+}
+
+void swap_free(uint32_t slot) {
+    if (!swap_disk || slot == 0 || slot > swap_stats.slots ||
+        !swap_slot_used(slot)) {
+        panic("swap_free: slot not in use");
+    }
+    swap_map[slot / 8] &= ~(1 << (slot % 8));
+    swap_stats.used--;
+}
+
+// Writes the pages at vas (ascending, present 4 KB pages of pt) out and frees
+// their frames. They are unmapped before they are copied, so nothing can
+// write to them on the way. Returns how many went, fewer if the disk filled
+// up, or -error with all of them mapped as they were.
+static int swap_out(struct page_table_32b *pt, uint32_t *vas, int n) {
+    uint32_t slots[SWAP_BATCH];
+    page_table_entry old[SWAP_BATCH];
+    int i;
+    for (i = 0; i < n; i++) {
+        slots[i] = swap_alloc_slot();
+        if (!slots[i]) {
+            break;
+        }
+    }
+    n = i;
+    if (n == 0) {
+        return -STATUS_NOT_ENOUGH_MEM;
+    }
+
+    for (i = 0; i < n; i++) {
+        page_table_entry *pte = paging_get_pte_ptr(pt, vas[i]);
+        old[i] = *pte;
+        *pte = (slots[i] << 12) | PAGE_SWAPPED;
+    }
+    tlb_flush_range(pt, vas[0], vas[n - 1] + PAGE_SIZE);
+
+    for (i = 0; i < n; i++) {
+        memcpy(swap_staging + i * PAGE_SIZE,
+               (void *)(old[i] & PAGE_FRAME_LOC_MASK), PAGE_SIZE);
+    }
+    int res = STATUS_OK;
+    for (i = 0; i < n && res == STATUS_OK;) {
+        int run = 1;
+        while (i + run < n && slots[i + run] == slots[i] + run) {
+            run++;
+        }
+        res = disk_write_sectors(swap_disk, slots[i] * SWAP_SECTORS_PER_PAGE,
+                                 run * SWAP_SECTORS_PER_PAGE,
+                                 swap_staging + i * PAGE_SIZE);
+        i += run;
+    }
+
+    for (i = 0; i < n; i++) {
+        if (res < 0) {
+            *paging_get_pte_ptr(pt, vas[i]) = old[i];
+            swap_free(slots[i]);
+        } else {
+            kfree((void *)(old[i] & PAGE_FRAME_LOC_MASK));
+        }
+    }
+    if (res < 0) {
+        return res;
+    }
+    swap_stats.outs += n;
+    return n;
+}
+
+// Moves the hand over the pages of pt from hand_va up to end. A page used
+// since the hand last came by loses its accessed bit and stays, one that
+// wasn't goes into victims. Stops once there are max of them. The bit is
+// taken away without a tlb flush, a cpu that has the page in its tlb won't
+// set it again until the entry goes, which only makes the page look older.
+static int swap_scan(struct page_table_32b *pt, uint32_t end,
+                     uint32_t *victims, int max) {
+    int n = 0;
+    while (hand_va < end && n < max) {
+        uint32_t va = hand_va;
+        page_table_entry *pte = paging_get_pte_ptr(pt, va);
+        if (!pte) {
+            // no table or a 4 MB page, on to the next 4 MB
+            uint32_t next = (va & PAGE_LARGE_FRAME_MASK) + PAGE_LARGE_SIZE;
+            hand_va = next > va && next < end ? next : end;
+            continue;
+        }
+        hand_va += PAGE_SIZE;
+        swap_stats.scanned++;
+        if (!(*pte & PAGE_PRESENT) || paging_is_zero_page(*pte)) {
+            continue;
+        }
+        if (*pte & PAGE_ACCESSED) {
+            *pte &= ~PAGE_ACCESSED;
+            continue;
+        }
+        victims[n++] = va;
+    }
+    return n;
+}
+
+// The hand's turn at the anonymous memory of one process, from hand_va on.
+// Adds the frames freed to *freed, stopping once it is target with the hand
+// where it got to.
+static int swap_reclaim_proc(struct process *proc, int target, int *freed) {
+    struct page_table_32b *pt = &proc->task->page_table;
+    uint32_t victims[SWAP_BATCH];
+    for (struct vma *vma = vma_first(&proc->vmas); vma; vma = vma_next(vma)) {
+        if (vma->backing != VMA_FRAMES || vma->end <= hand_va) {
+            continue;
+        }
+        if (hand_va < vma->start) {
+            hand_va = vma->start;
+        }
+        while (hand_va < vma->end && *freed < target) {
+            int max = target - *freed;
+            int n = swap_scan(pt, vma->end, victims,
+                              max < SWAP_BATCH ? max : SWAP_BATCH);
+            if (n == 0) {
+                continue;
+            }
+            int res = swap_out(pt, victims, n);
+            if (res < 0) {
+                return res;
+            }
+            *freed += res;
+        }
+        if (*freed >= target) {
+            break;
+        }
+    }
+    return STATUS_OK;
+}
+
+// Frees up to target frames of user memory by writing pages out to the swap
+// disk, CLOCK (second chance): the hand goes round the anonymous memory of
+// every process in address order, see swap_scan. Pages go out a batch
+// (SWAP_BATCH) at a time, with one tlb flush and mostly one disk write.
+// Needs the big kernel lock, it changes every process' page table. Returns
+// the frames freed.
+int swap_reclaim(int target) {
+    if (!swap_disk || !kernel_lock_held()) {
+        return 0;
+    }
+    swap_stats.reclaims++;
+    int freed = 0;
+    // twice round, the first time round may only take accessed bits away
+    for (int visited = 0; visited <= 2 * MAX_PROCS; visited++) {
+        struct process *proc = get_proc_by_pid(hand_pid);
+        if (proc && proc->status == PROC_CAN_START && proc->task) {
+            if (swap_reclaim_proc(proc, target, &freed) < 0 ||
+                freed >= target) {
+                break;
+            }
+        }
+        hand_pid = (hand_pid + 1) % MAX_PROCS;
+        hand_va = 0;
+    }
+    return freed;
+}
+
+// A zeroed page for user memory. When there is none left, pages of user
+// memory go out to the swap disk to make room.
+void *swap_alloc_page() {
+    void *page = zpool_alloc();
+    if (!page && swap_reclaim(SWAP_BATCH) > 0) {
+        page = zpool_alloc();
+    }
+    return page;
+}
+
+// A fault on the page at vaddr. If it is on the swap disk it is read back
+// into a frame of its own mapped with flags, and the access can be retried.
+// -STATUS_INVALID_ARG if the fault was about something else.
+int swap_in(struct page_table_32b *pt, uint32_t vaddr, uint8_t flags) {
+    page_table_entry *pte = paging_get_pte_ptr(pt, vaddr);
+    if (!pte || (*pte & (PAGE_PRESENT | PAGE_SWAPPED)) != PAGE_SWAPPED) {
+        return -STATUS_INVALID_ARG;
+    }
+    uint32_t slot = *pte >> 12;
+    void *frame = swap_alloc_page();
+    if (!frame) {
+        return -STATUS_NOT_ENOUGH_MEM;
+    }
+    int res = disk_read_sectors(swap_disk, slot * SWAP_SECTORS_PER_PAGE,
+                                SWAP_SECTORS_PER_PAGE, frame);
+    if (res < 0) {
+        kfree(frame);
+        return res;
+    }
+    // it wasn't present, there is nothing to flush
+    *pte = (uint32_t)frame | flags;
+    swap_free(slot);
+    swap_stats.ins++;
+    return STATUS_OK;
+}
+
+// ---- tests ----
+
+#define SWAP_TEST_BASE 0x40000000
+#define SWAP_TEST_PAGES 4
+
+static uint32_t swap_test_frame(struct page_table_32b *pt, int i) {
+    return paging_get_pte(pt, SWAP_TEST_BASE + i * PAGE_SIZE) &
+           PAGE_FRAME_LOC_MASK;
+}
+
+// the clock's pick, out to the disk and back, with a page of the test's own
+void swap_test() {
+    if (!swap_disk) {
+        println("swap test passed, no swap disk to test with");
+        return;
+    }
+    int saved_pid = hand_pid;
+    uint32_t saved_va = hand_va;
+    struct page_table_32b pt = {0};
+    if (paging_create_4gb_page_tables(PAGE_PRESENT | PAGE_WRITE_ALLOW, &pt) !=
+        STATUS_OK) {
+        panic("swap_test: no page table");
+    }
+    uint8_t flags = PAGE_PRESENT | PAGE_WRITE_ALLOW | PAGE_USER_ACCESS_ALLOW;
+    uint32_t start = SWAP_TEST_BASE;
+    uint32_t end = start + SWAP_TEST_PAGES * PAGE_SIZE;
+    if (paging_alloc_mapping(&pt, start, end, flags) != STATUS_OK) {
+        panic("swap_test: alloc mapping failed");
+    }
+    for (int i = 0; i < SWAP_TEST_PAGES; i++) {
+        uint32_t *page = (uint32_t *)swap_test_frame(&pt, i);
+        page[0] = 0x5A000000 + i;
+        page[PAGE_SIZE / 4 - 1] = i;
+    }
+
+    // page 1 was used since the hand came by, the others weren't
+    *paging_get_pte_ptr(&pt, start + PAGE_SIZE) |= PAGE_ACCESSED;
+    hand_va = start;
+    uint32_t victims[SWAP_BATCH];
+    int n = swap_scan(&pt, end, victims, SWAP_BATCH);
+    if (n != SWAP_TEST_PAGES - 1 || victims[0] != start ||
+        victims[1] != start + 2 * PAGE_SIZE ||
+        (paging_get_pte(&pt, start + PAGE_SIZE) & PAGE_ACCESSED)) {
+        panic("swap_test: clock picked the wrong pages");
+    }
+
+    uint32_t used = swap_stats.used;
+    if (swap_out(&pt, victims, n) != n || swap_stats.used != used + n) {
+        panic("swap_test: pages not written out");
+    }
+    for (int i = 0; i < n; i++) {
+        uint32_t pte = paging_get_pte(&pt, victims[i]);
+        if ((pte & PAGE_PRESENT) || !(pte & PAGE_SWAPPED)) {
+            panic("swap_test: page written out still mapped");
+        }
+    }
+
+    if (swap_in(&pt, start, flags) != STATUS_OK ||
+        swap_in(&pt, start, flags) != -STATUS_INVALID_ARG) {
+        panic("swap_test: page not read back in");
+    }
+    uint32_t *page = (uint32_t *)swap_test_frame(&pt, 0);
+    if (page[0] != 0x5A000000 || page[PAGE_SIZE / 4 - 1] != 0 ||
+        !(paging_get_pte(&pt, start) & PAGE_WRITE_ALLOW)) {
+        panic("swap_test: page read back wrong");
+    }
+
+    // the pages still out give their slots back
+    paging_free_frames(&pt, start, end);
+    if (swap_stats.used != used) {
+        panic("swap_test: slots of freed pages kept");
+    }
+    paging_free_page_table(&pt);
+    hand_pid = saved_pid;
+    hand_va = saved_va;
+    println("swap test passed");
+}
@@ -0,0 +1,35 @@
+#ifndef SWAP_H
+#define SWAP_H
+
+#include "memory/paging/paging.h"
+#include <stdint.h>
+
+// Pages of user memory written out to the swap disk (the primary slave,
+// SWAP_DRIVE) when the kernel heap runs out. The disk is an array of page
+// sized slots, a page out there has a pte that isn't present with
+// PAGE_SWAPPED and its slot in the frame bits. Touching it faults it back in
+// (swap_in). Which pages go is decided by a CLOCK over the anonymous memory
+// of every process, see swap_reclaim. 4 MB pages and the zero page stay.
+
+#define SWAP_SECTORS_PER_PAGE (PAGE_SIZE / DISK_SECTOR_SIZE)
+
+struct swap_stats {
+    uint32_t slots;    // pages the swap disk holds, 0 without one
+    uint32_t used;     // slots holding a page
+    uint32_t outs;     // pages written out
+    uint32_t ins;      // pages read back in
+    uint32_t scanned;  // ptes the clock hand went past
+    uint32_t reclaims; // times memory ran out and swap_reclaim ran
+};
+
+extern struct swap_stats swap_stats;
+
+int swap_init();
+void *swap_alloc_page();
+int swap_reclaim(int target);
+int swap_in(struct page_table_32b *pt, uint32_t vaddr, uint8_t flags);
+void swap_free(uint32_t slot);
+
+void swap_test();
+
+#endif
@@ -0,0 +1,429 @@
+#include "vma.h"
+#include "console/console.h"
+#include "kernel.h"
+#include "memory/heap/kcache.h"
+#include "memory/heap/kheap.h"
+#include "status.h"
+
+static struct kcache vma_cache = KCACHE_INIT("vma", sizeof(struct vma));
+
+static struct vma *vma_of(struct rb_node *node) {
+    return node ? rb_entry(node, struct vma, node) : 0;
+}
+
+static bool vma_aligned(uint32_t start, uint32_t end) {
+    return start % PAGE_SIZE == 0 && end % PAGE_SIZE == 0 && start < end;
+}
+
+struct vma *vma_first(struct vma_tree *tree) {
+    return vma_of(rb_first(&tree->root));
+}
+
+struct vma *vma_next(struct vma *vma) { return vma_of(rb_next(&vma->node)); }
+
+// The vma addr is in, 0 if none
+struct vma *vma_find(struct vma_tree *tree, uint32_t addr) {
+    struct vma *vma = tree->last_found;
+    if (vma && vma->start <= addr && addr < vma->end) {
+        return vma;
+    }
+    struct rb_node *node = tree->root.node;
+    while (node) {
+        vma = vma_of(node);
+        if (addr < vma->start) {
+            node = node->left;
+        } else if (addr >= vma->end) {
+            node = node->right;
+        } else {
+            tree->last_found = vma;
+            return vma;
+        }
+    }
+    return 0;
+}
+
+// The lowest vma that overlaps [start, end), 0 if none does
+struct vma *vma_find_overlap(struct vma_tree *tree, uint32_t start,
+                             uint32_t end) {
+    // the lowest one that ends after start
+    struct vma *found = 0;
+    struct rb_node *node = tree->root.node;
+    while (node) {
+        struct vma *vma = vma_of(node);
+        if (vma->end > start) {
+            found = vma;
+            node = node->left;
+        } else {
+            node = node->right;
+        }
+    }
+    return found && found->start < end ? found : 0;
+}
+
+// only memory that is a page each can be cut anywhere later, the rest stays
+// as it was mapped
+static bool vma_can_merge(struct vma *vma, uint8_t prot, uint8_t type,
+                          uint8_t backing) {
+    return vma && backing == VMA_FRAMES && vma->backing == VMA_FRAMES &&
+           vma->prot == prot && vma->type == type;
+}
+
+static void vma_link(struct vma_tree *tree, struct vma *vma) {
+    struct rb_node **link = &tree->root.node;
+    struct rb_node *parent = 0;
+    while (*link) {
+        parent = *link;
+        if (vma->start < vma_of(parent)->start) {
+            link = &parent->left;
+        } else {
+            link = &parent->right;
+        }
+    }
+    rb_link(&vma->node, parent, link);
+    rb_insert(&tree->root, &vma->node);
+    tree->count++;
+}
+
+static void vma_erase(struct vma_tree *tree, struct vma *vma) {
+    rb_erase(&tree->root, &vma->node);
+    tree->count--;
+    if (tree->last_found == vma) {
+        tree->last_found = 0;
+    }
+    if (vma->backing == VMA_RUN) {
+        kfree(vma->run);
+    }
+    kcache_free(&vma_cache, vma);
+}
+
+// Records [start, end) (page aligned, nothing there yet), merged into the
+// vma before or after it when they are alike. run is the memory behind a
+// VMA_RUN vma.
+int vma_insert(struct vma_tree *tree, uint32_t start, uint32_t end,
+               uint8_t prot, uint8_t type, uint8_t backing, void *run) {
+    if (!vma_aligned(start, end)) {
+        return -STATUS_INVALID_ARG;
+    }
+    struct vma *next = vma_find_overlap(tree, start, 0xFFFFFFFF);
+    if (next && next->start < end) {
+        return -STATUS_INVALID_MEMORY_REGION;
+    }
+    struct vma *prev = next ? vma_of(rb_prev(&next->node))
+                            : vma_of(rb_last(&tree->root));
+
+    bool with_prev = prev && prev->end == start &&
+                     vma_can_merge(prev, prot, type, backing);
+    bool with_next = next && next->start == end &&
+                     vma_can_merge(next, prot, type, backing);
+    if (with_prev && with_next) {
+        prev->end = next->end;
+        vma_erase(tree, next);
+        return STATUS_OK;
+    }
+    if (with_prev) {
+        prev->end = end;
+        return STATUS_OK;
+    }
+    if (with_next) {
+        // still between the same neighbours, the tree stays ordered
+        next->start = start;
+        return STATUS_OK;
+    }
+
+    struct vma *vma = kcache_zalloc(&vma_cache);
+    if (!vma) {
+        return -STATUS_NOT_ENOUGH_MEM;
+    }
+    vma->start = start;
+    vma->end = end;
+    vma->prot = prot;
+    vma->type = type;
+    vma->backing = backing;
+    vma->run = run;
+    vma_link(tree, vma);
+    return STATUS_OK;
+}
+
+static void vma_unmap_pages(struct page_table_32b *pt, struct vma *vma,
+                            uint32_t start, uint32_t end) {
+    if (vma->backing == VMA_FRAMES) {
+        paging_free_frames(pt, start, end);
+    } else {
+        paging_free_va(pt, start, end);
+    }
+}
+
+// Unmaps [start, end) (page aligned), cutting the vmas in it down or in two
+// as needed. A VMA_RUN vma can only go as a whole. Gaps are fine.
+int vma_unmap(struct vma_tree *tree, struct page_table_32b *pt, uint32_t start,
+              uint32_t end) {
+    if (!vma_aligned(start, end)) {
+        return -STATUS_INVALID_ARG;
+    }
+
+    // check everything before changing anything
+    struct vma *split = 0;
+    for (struct vma *vma = vma_find_overlap(tree, start, end);
+         vma && vma->start < end; vma = vma_next(vma)) {
+        bool partial = start > vma->start || end < vma->end;
+        if (partial && vma->backing == VMA_RUN) {
+            return -STATUS_INVALID_MEMORY_REGION;
+        }
+        if (start > vma->start && end < vma->end) {
+            // the middle of one vma, its tail becomes a vma of its own
+            split = kcache_zalloc(&vma_cache);
+            if (!split) {
+                return -STATUS_NOT_ENOUGH_MEM;
+            }
+        }
+    }
+    // the 4 MB pages cut at the edges, unmapping can't fail after this
+    int res = paging_split_range(pt, start, end);
+    if (res < 0) {
+        if (split) {
+            kcache_free(&vma_cache, split);
+        }
+        return res;
+    }
+
+    struct vma *vma = vma_find_overlap(tree, start, end);
+    while (vma && vma->start < end) {
+        struct vma *next = vma_next(vma);
+        uint32_t cut_start = start > vma->start ? start : vma->start;
+        uint32_t cut_end = end < vma->end ? end : vma->end;
+        vma_unmap_pages(pt, vma, cut_start, cut_end);
+
+        if (cut_start == vma->start && cut_end == vma->end) {
+            vma_erase(tree, vma);
+        } else if (cut_start == vma->start) {
+            vma->start = cut_end;
+        } else if (cut_end == vma->end) {
+            vma->end = cut_start;
+        } else {
+            *split = *vma;
+            split->start = cut_end;
+            vma->end = cut_start;
+            vma_link(tree, split);
+        }
+        vma = next;
+    }
+    return STATUS_OK;
+}
+
+// Merges the alike vmas that touch from the one at or before start through
+// the one at end
+static void vma_merge_range(struct vma_tree *tree, uint32_t start,
+                            uint32_t end) {
+    struct vma *vma = start ? vma_find(tree, start - 1) : 0;
+    if (!vma) {
+        vma = vma_find_overlap(tree, start, end);
+    }
+    while (vma && vma->start <= end) {
+        struct vma *next = vma_next(vma);
+        if (next && next->start == vma->end &&
+            vma_can_merge(next, vma->prot, vma->type, vma->backing)) {
+            vma->end = next->end;
+            vma_erase(tree, next);
+            continue;
+        }
+        vma = next;
+    }
+}
+
+// Gives [start, end) (page aligned, mapped without holes) the protection
+// prot, cutting the vmas at its edges. Like unmapping, a VMA_RUN vma can only
+// change as a whole.
+int vma_protect(struct vma_tree *tree, struct page_table_32b *pt,
+                uint32_t start, uint32_t end, uint8_t prot) {
+    if (!vma_aligned(start, end)) {
+        return -STATUS_INVALID_ARG;
+    }
+
+    // check everything before changing anything
+    int cuts = 0;
+    uint32_t covered = start;
+    for (struct vma *vma = vma_find_overlap(tree, start, end);
+         vma && vma->start < end; vma = vma_next(vma)) {
+        if (vma->start > covered) {
+            break;
+        }
+        bool partial = start > vma->start || end < vma->end;
+        if (partial && vma->backing == VMA_RUN) {
+            return -STATUS_INVALID_MEMORY_REGION;
+        }
+        cuts += (start > vma->start) + (end < vma->end);
+        covered = vma->end;
+    }
+    if (covered < end) {
+        return -STATUS_INVALID_MEMORY_REGION;
+    }
+    int res = STATUS_OK;
+    struct vma *spare[2] = {0};
+    for (int i = 0; i < cuts; i++) {
+        spare[i] = kcache_zalloc(&vma_cache);
+        if (!spare[i]) {
+            res = -STATUS_NOT_ENOUGH_MEM;
+            goto out;
+        }
+    }
+    res = paging_protect(pt, start, end, vma_page_flags(prot));
+    if (res < 0) {
+        goto out;
+    }
+
+    struct vma *vma = vma_find_overlap(tree, start, end);
+    while (vma && vma->start < end) {
+        if (vma->start < start) {
+            // the head keeps its protection, the rest goes on as a vma of
+            // its own
+            struct vma *rest = spare[--cuts];
+            *rest = *vma;
+            rest->start = start;
+            vma->end = start;
+            vma_link(tree, rest);
+            vma = rest;
+        }
+        if (vma->end > end) {
+            struct vma *tail = spare[--cuts];
+            *tail = *vma;
+            tail->start = end;
+            vma->end = end;
+            vma_link(tree, tail);
+        }
+        vma->prot = prot;
+        vma = vma_next(vma);
+    }
+    vma_merge_range(tree, start, end);
+    return STATUS_OK;
+
+out:
+    for (int i = 0; i < 2; i++) {
+        if (spare[i]) {
+            kcache_free(&vma_cache, spare[i]);
+        }
+    }
+    return res;
+}
+
+// Unmaps everything, for a process that is going away
+void vma_unmap_all(struct vma_tree *tree, struct page_table_32b *pt) {
+    struct vma *vma;
+    while ((vma = vma_first(tree))) {
+        vma_unmap_pages(pt, vma, vma->start, vma->end);
+        vma_erase(tree, vma);
+    }
+}
+
+// the pte flags for a protection, 32 bit paging can't say no to reads or
+// execution
+uint8_t vma_page_flags(uint8_t prot) {
+    uint8_t flags = PAGE_PRESENT | PAGE_USER_ACCESS_ALLOW;
+    if (prot & VMA_WRITE) {
+        flags |= PAGE_WRITE_ALLOW;
+    }
+    return flags;
+}
+
+// ---- tests ----
+
+#define VMA_TEST_BASE 0x40000000
+#define VMA_TEST_PAGE(n) (VMA_TEST_BASE + (n) * PAGE_SIZE)
+
+static void vma_test_expect(struct vma_tree *tree, int count, uint32_t *ranges,
+                            char *what) {
+    if (tree->count != count) {
+        panic(what);
+    }
+    struct vma *vma = vma_first(tree);
+    for (int i = 0; i < count; i++, vma = vma_next(vma)) {
+        if (!vma || vma->start != ranges[2 * i] ||
+            vma->end != ranges[2 * i + 1]) {
+            panic(what);
+        }
+    }
+}
+
+void vma_test() {
+    struct page_table_32b pt = {0};
+    struct vma_tree tree = {0};
+    if (paging_init_new_mapping(&pt) != STATUS_OK) {
+        panic("vma_test: no page table");
+    }
+    uint8_t rw = VMA_READ | VMA_WRITE;
+
+    // pages 0-7 mapped in two goes merge into one vma
+    paging_alloc_mapping(&pt, VMA_TEST_PAGE(0), VMA_TEST_PAGE(8),
+                         vma_page_flags(rw));
+    vma_insert(&tree, VMA_TEST_PAGE(4), VMA_TEST_PAGE(8), rw, VMA_ANON,
+               VMA_FRAMES, 0);
+    vma_insert(&tree, VMA_TEST_PAGE(0), VMA_TEST_PAGE(4), rw, VMA_ANON,
+               VMA_FRAMES, 0);
+    uint32_t merged[] = {VMA_TEST_PAGE(0), VMA_TEST_PAGE(8)};
+    vma_test_expect(&tree, 1, merged, "vma_test: adjacent vmas not merged");
+    if (vma_insert(&tree, VMA_TEST_PAGE(7), VMA_TEST_PAGE(9), rw, VMA_ANON,
+                   VMA_FRAMES, 0) != -STATUS_INVALID_MEMORY_REGION) {
+        panic("vma_test: overlapping insert allowed");
+    }
+
+    // a page in the middle read only and back, the vmas split and merge
+    vma_protect(&tree, &pt, VMA_TEST_PAGE(2), VMA_TEST_PAGE(3), VMA_READ);
+    uint32_t protected[] = {VMA_TEST_PAGE(0), VMA_TEST_PAGE(2),
+                            VMA_TEST_PAGE(2), VMA_TEST_PAGE(3),
+                            VMA_TEST_PAGE(3), VMA_TEST_PAGE(8)};
+    vma_test_expect(&tree, 3, protected, "vma_test: protect didn't split");
+    if (paging_get_pte(&pt, VMA_TEST_PAGE(2)) & PAGE_WRITE_ALLOW ||
+        !(paging_get_pte(&pt, VMA_TEST_PAGE(3)) & PAGE_WRITE_ALLOW)) {
+        panic("vma_test: protect changed the wrong ptes");
+    }
+    vma_protect(&tree, &pt, VMA_TEST_PAGE(2), VMA_TEST_PAGE(3), rw);
+    vma_test_expect(&tree, 1, merged, "vma_test: protect didn't merge");
+    if (vma_protect(&tree, &pt, VMA_TEST_PAGE(7), VMA_TEST_PAGE(9),
+                    VMA_READ) != -STATUS_INVALID_MEMORY_REGION) {
+        panic("vma_test: protected a hole");
+    }
+
+    // a hole in the middle splits it, the pages there are gone
+    vma_unmap(&tree, &pt, VMA_TEST_PAGE(3), VMA_TEST_PAGE(5));
+    uint32_t split[] = {VMA_TEST_PAGE(0), VMA_TEST_PAGE(3), VMA_TEST_PAGE(5),
+                        VMA_TEST_PAGE(8)};
+    vma_test_expect(&tree, 2, split, "vma_test: unmap didn't split");
+    if (paging_get_pte(&pt, VMA_TEST_PAGE(3)) & PAGE_PRESENT ||
+        !(paging_get_pte(&pt, VMA_TEST_PAGE(5)) & PAGE_PRESENT)) {
+        panic("vma_test: unmap left the wrong pages");
+    }
+    if (vma_find(&tree, VMA_TEST_PAGE(4)) ||
+        vma_find(&tree, VMA_TEST_PAGE(7) + 10) == 0) {
+        panic("vma_test: vma_find is off");
+    }
+
+    // a different protection doesn't merge, many vmas stay ordered
+    for (int i = 0; i < 64; i++) {
+        vma_insert(&tree, VMA_TEST_PAGE(100 + 2 * i),
+                   VMA_TEST_PAGE(101 + 2 * i), VMA_READ, VMA_ANON, VMA_FRAMES,
+                   0);
+    }
+    if (tree.count != 66 ||
+        vma_find(&tree, VMA_TEST_PAGE(150))->start != VMA_TEST_PAGE(150) ||
+        vma_find(&tree, VMA_TEST_PAGE(151))) {
+        panic("vma_test: lookup among many vmas failed");
+    }
+
+    // one range across the tail of one, the head of the other and the gap
+    vma_unmap(&tree, &pt, VMA_TEST_PAGE(2), VMA_TEST_PAGE(6));
+    uint32_t trimmed[] = {VMA_TEST_PAGE(0), VMA_TEST_PAGE(2), VMA_TEST_PAGE(6),
+                          VMA_TEST_PAGE(8)};
+    vma_unmap(&tree, &pt, VMA_TEST_PAGE(100), VMA_TEST_PAGE(228));
+    vma_test_expect(&tree, 2, trimmed, "vma_test: unmap didn't trim");
+
+    vma_unmap_all(&tree, &pt);
+    if (tree.count != 0 || tree.root.node) {
+        panic("vma_test: vmas left");
+    }
+    for (int i = 0; i < 8; i++) {
+        if (paging_get_pte(&pt, VMA_TEST_PAGE(i)) & PAGE_PRESENT) {
+            panic("vma_test: pages left mapped");
+        }
+    }
+    paging_free_page_table(&pt);
+    println("vma test passed");
+}
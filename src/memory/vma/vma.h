@@ -0,0 +1,60 @@
+#ifndef VMA_H
+#define VMA_H
+
+#include "lib/rbtree/rbtree.h"
+#include "memory/paging/paging.h"
+#include <stdint.h>
+
+// The mapped user memory of a process, one vma per run of pages with the
+// same protection and backing, in a red-black tree ordered by address.
+// The tree only records, the caller maps the pages (except that unmapping a
+// range through here also unmaps its pages).
+
+// protection
+#define VMA_READ 0x1
+#define VMA_WRITE 0x2
+#define VMA_EXEC 0x4
+
+// what it is
+enum { VMA_ANON, VMA_HEAP, VMA_STACK, VMA_IMAGE };
+
+// who owns the frames behind it
+enum {
+    VMA_FRAMES,   // a page each (or the zero page), freed as they are unmapped
+    VMA_RUN,      // one kzalloc'd run for all of it (run), freed with it
+    VMA_BORROWED, // memory the process frees itself (its image, its stack)
+};
+
+struct vma {
+    struct rb_node node;
+    uint32_t start; // page aligned, [start, end)
+    uint32_t end;
+    uint8_t prot;
+    uint8_t type;
+    uint8_t backing;
+    void *run;
+};
+
+struct vma_tree {
+    struct rb_root root;
+    uint32_t count;
+    struct vma *last_found; // tried first by vma_find
+};
+
+struct vma *vma_find(struct vma_tree *tree, uint32_t addr);
+struct vma *vma_find_overlap(struct vma_tree *tree, uint32_t start,
+                             uint32_t end);
+struct vma *vma_first(struct vma_tree *tree);
+struct vma *vma_next(struct vma *vma);
+int vma_insert(struct vma_tree *tree, uint32_t start, uint32_t end,
+               uint8_t prot, uint8_t type, uint8_t backing, void *run);
+int vma_unmap(struct vma_tree *tree, struct page_table_32b *pt, uint32_t start,
+              uint32_t end);
+int vma_protect(struct vma_tree *tree, struct page_table_32b *pt,
+                uint32_t start, uint32_t end, uint8_t prot);
+void vma_unmap_all(struct vma_tree *tree, struct page_table_32b *pt);
+uint8_t vma_page_flags(uint8_t prot);
+
+void vma_test();
+
+#endif
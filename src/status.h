@@ -27,5 +27,11 @@
 
 #define STATUS_PROC_EXCEPTION 15
 
+#define STATUS_OUT_OF_FILES 16
+
+#define STATUS_DISK_FULL 17
+
+#define STATUS_FILE_BUSY 18
+
 #define MAGIC_ERROR 19891213
 #endif
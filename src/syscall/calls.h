@@ -13,6 +13,22 @@ enum SYS_CALLS {
     SYS_CALL7_CREATE_PROCESS,
     SYS_CALL8_EXIT,
     SYS_CALL9_WAIT_PID,
+    SYS_CALL10_TTY_READ,
+    SYS_CALL11_TTY_SET_MODE,
+    SYS_CALL12_TRACE_READ,
+    SYS_CALL13_PROF_CONTROL,
+    SYS_CALL14_PROF_READ,
+    SYS_CALL15_YIELD,
+    SYS_CALL16_FOPEN,
+    SYS_CALL17_FREAD,
+    SYS_CALL18_FSTAT,
+    SYS_CALL19_FCLOSE,
+    SYS_CALL20_SBRK,
+    SYS_CALL21_MPROTECT,
+    SYS_CALL22_FWRITE,
+    SYS_CALL23_UNLINK,
+    SYS_CALL24_FTRUNCATE,
+    SYS_CALL25_FSYNC,
 };
 
 void *syscall_print(struct interrupt_frame *frame);
@@ -20,11 +36,27 @@ void *syscall_get_char(struct interrupt_frame *frame);
 void *syscall_put_char(struct interrupt_frame *frame);
 void *syscall_mmap(struct interrupt_frame *frame);
 void *syscall_munmap(struct interrupt_frame *frame);
+void *syscall_mprotect(struct interrupt_frame *frame);
+void *syscall_sbrk(struct interrupt_frame *frame);
 void *syscall_clear_screen(struct interrupt_frame *frame);
+void *syscall_tty_read(struct interrupt_frame *frame);
+void *syscall_tty_set_mode(struct interrupt_frame *frame);
+void *syscall_trace_read(struct interrupt_frame *frame);
+void *syscall_prof_control(struct interrupt_frame *frame);
+void *syscall_prof_read(struct interrupt_frame *frame);
+void *syscall_fopen(struct interrupt_frame *frame);
+void *syscall_fread(struct interrupt_frame *frame);
+void *syscall_fwrite(struct interrupt_frame *frame);
+void *syscall_unlink(struct interrupt_frame *frame);
+void *syscall_ftruncate(struct interrupt_frame *frame);
+void *syscall_fsync(struct interrupt_frame *frame);
+void *syscall_fstat(struct interrupt_frame *frame);
+void *syscall_fclose(struct interrupt_frame *frame);
 
 // Windows style process creation, for now we don't have fork and exec
 void *syscall_create_process(struct interrupt_frame *frame);
 void *syscall_exit(struct interrupt_frame *frame);
 void *syscall_wait_pid(struct interrupt_frame *frame);
+void *syscall_yield(struct interrupt_frame *frame);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,158 @@
+#include "calls.h"
+#include "config.h"
+#include "fs/file.h"
+#include "idt/idt.h"
+#include "lib/string/string.h"
+#include "status.h"
+#include "task/process.h"
+#include "task/task.h"
+
+#define FILE_MODE_MAX 4
+
+// Files of a process are numbered from 1, open_files holds the kernel fds
+
+// the kernel fd behind the process' fd, 0 if it isn't open
+static int syscall_kernel_fd(int fd) {
+    if (fd < 1 || fd > PROCESS_MAX_OPEN_FILES) {
+        return 0;
+    }
+    return task_current()->proc->open_files[fd - 1];
+}
+
+// copies a user string of at most max - 1 characters, cut off if longer
+static int syscall_copy_string(char *dst, const char *src, int max) {
+    if (verify_user_pointer((void *)src) != STATUS_OK) {
+        return -STATUS_INVALID_USER_MEM_ACCESS;
+    }
+    strncpy(dst, src, max - 1);
+    dst[max - 1] = '\0';
+    return STATUS_OK;
+}
+
+// int fopen(const char* path, const char* mode);
+// Opens path ("0:/hello.txt", "9:/meminfo") for reading ("r"), writing ("w",
+// creates or empties it) or appending ("a"), returns the fd (>= 1) or -error
+void *syscall_fopen(struct interrupt_frame *frame) {
+    const char *user_path = task_get_stack_item(task_current(), 1);
+    const char *user_mode = task_get_stack_item(task_current(), 0);
+    char path[FS_MAX_PATH_LEN];
+    char mode[FILE_MODE_MAX];
+    if (syscall_copy_string(path, user_path, sizeof(path)) != STATUS_OK ||
+        syscall_copy_string(mode, user_mode, sizeof(mode)) != STATUS_OK) {
+        return (void *)-STATUS_INVALID_USER_MEM_ACCESS;
+    }
+
+    struct process *proc = task_current()->proc;
+    for (int i = 0; i < PROCESS_MAX_OPEN_FILES; i++) {
+        if (proc->open_files[i] != 0) {
+            continue;
+        }
+        int kfd = kfopen(path, mode);
+        if (kfd <= 0) {
+            return (void *)-STATUS_IO_ERROR;
+        }
+        proc->open_files[i] = kfd;
+        return (void *)(i + 1);
+    }
+    return (void *)-STATUS_OUT_OF_FILES;
+}
+
+// int fread(void* buf, int size, int nmembs, int fd);
+// Reads nmembs items of size bytes, returns the number of items read
+void *syscall_fread(struct interrupt_frame *frame) {
+    void *buf = task_get_stack_item(task_current(), 3);
+    uint32_t size = (uint32_t)task_get_stack_item(task_current(), 2);
+    uint32_t nmembs = (uint32_t)task_get_stack_item(task_current(), 1);
+    int kfd = syscall_kernel_fd((int)task_get_stack_item(task_current(), 0));
+    if (!kfd) {
+        return (void *)-STATUS_INVALID_ARG;
+    }
+    if (size == 0 || nmembs == 0 || nmembs > 0xFFFFFFFF / size) {
+        return (void *)-STATUS_INVALID_ARG;
+    }
+    // read straight into the user's memory, it is mapped while we run
+    uint32_t end = (uint32_t)buf + size * nmembs;
+    if (verify_user_pointer(buf) != STATUS_OK || end < (uint32_t)buf) {
+        return (void *)-STATUS_INVALID_USER_MEM_ACCESS;
+    }
+    return (void *)kfread(buf, size, nmembs, kfd);
+}
+
+// int fwrite(const void* buf, int size, int nmembs, int fd);
+// Writes nmembs items of size bytes, returns the number of items written
+void *syscall_fwrite(struct interrupt_frame *frame) {
+    const void *buf = task_get_stack_item(task_current(), 3);
+    uint32_t size = (uint32_t)task_get_stack_item(task_current(), 2);
+    uint32_t nmembs = (uint32_t)task_get_stack_item(task_current(), 1);
+    int kfd = syscall_kernel_fd((int)task_get_stack_item(task_current(), 0));
+    if (!kfd) {
+        return (void *)-STATUS_INVALID_ARG;
+    }
+    if (size == 0 || nmembs == 0 || nmembs > 0xFFFFFFFF / size) {
+        return (void *)-STATUS_INVALID_ARG;
+    }
+    // the file system copies straight from the user's memory
+    uint32_t end = (uint32_t)buf + size * nmembs;
+    if (verify_user_pointer((void *)buf) != STATUS_OK ||
+        end < (uint32_t)buf) {
+        return (void *)-STATUS_INVALID_USER_MEM_ACCESS;
+    }
+    return (void *)kfwrite(buf, size, nmembs, kfd);
+}
+
+// int unlink(const char* path);
+// Removes the file, not while some process has it open
+void *syscall_unlink(struct interrupt_frame *frame) {
+    const char *user_path = task_get_stack_item(task_current(), 0);
+    char path[FS_MAX_PATH_LEN];
+    if (syscall_copy_string(path, user_path, sizeof(path)) != STATUS_OK) {
+        return (void *)-STATUS_INVALID_USER_MEM_ACCESS;
+    }
+    return (void *)kfunlink(path);
+}
+
+// int ftruncate(int fd, int size);
+void *syscall_ftruncate(struct interrupt_frame *frame) {
+    int kfd = syscall_kernel_fd((int)task_get_stack_item(task_current(), 1));
+    uint32_t size = (uint32_t)task_get_stack_item(task_current(), 0);
+    if (!kfd) {
+        return (void *)-STATUS_INVALID_ARG;
+    }
+    return (void *)kftruncate(kfd, size);
+}
+
+// int fsync(int fd);
+// Returns once what was written to the file is on the disk
+void *syscall_fsync(struct interrupt_frame *frame) {
+    int kfd = syscall_kernel_fd((int)task_get_stack_item(task_current(), 0));
+    if (!kfd) {
+        return (void *)-STATUS_INVALID_ARG;
+    }
+    return (void *)kfsync(kfd);
+}
+
+// int fstat(int fd, struct file_stat* stat);
+void *syscall_fstat(struct interrupt_frame *frame) {
+    int kfd = syscall_kernel_fd((int)task_get_stack_item(task_current(), 1));
+    void *user_stat = task_get_stack_item(task_current(), 0);
+    if (!kfd) {
+        return (void *)-STATUS_INVALID_ARG;
+    }
+    struct file_stat stat;
+    int res = kfstat(kfd, &stat);
+    if (res != STATUS_OK) {
+        return (void *)res;
+    }
+    return (void *)copy_data_to_user(user_stat, &stat, sizeof(stat));
+}
+
+// int fclose(int fd);
+void *syscall_fclose(struct interrupt_frame *frame) {
+    int fd = (int)task_get_stack_item(task_current(), 0);
+    int kfd = syscall_kernel_fd(fd);
+    if (!kfd) {
+        return (void *)-STATUS_INVALID_ARG;
+    }
+    task_current()->proc->open_files[fd - 1] = 0;
+    return (void *)kfclose(kfd);
+}
@@ -0,0 +1,105 @@
+#include "calls.h"
+#include "config.h"
+#include "idt/idt.h"
+#include "status.h"
+#include "task/task.h"
+#include "trace/prof.h"
+#include "trace/trace.h"
+
+#define TRACE_READ_CHUNK 32
+#define PROF_READ_CHUNK 16
+
+// All of [buf, buf + len) is user memory. Checked before anything is drained,
+// what is drained can't go back and would be lost without a trace.
+static int perf_check_buffer(uint8_t *buf, uint32_t len) {
+    if (len == 0) {
+        return STATUS_OK;
+    }
+    if (verify_user_pointer(buf) != STATUS_OK ||
+        verify_user_pointer(buf + len - 1) != STATUS_OK || buf + len < buf) {
+        return -STATUS_INVALID_USER_MEM_ACCESS;
+    }
+    return STATUS_OK;
+}
+
+// int trace_read(void* buf, int len);
+// Moves as many whole trace events as fit in len bytes to buf, returns the
+// number of bytes, 0 if there was nothing to read
+void *syscall_trace_read(struct interrupt_frame *frame) {
+    uint8_t *buf = task_get_stack_item(task_current(), 1);
+    int len = (int)task_get_stack_item(task_current(), 0);
+    if (len < 0) {
+        return (void *)-STATUS_INVALID_ARG;
+    }
+
+    struct trace_event events[TRACE_READ_CHUNK];
+    int max = len / sizeof(struct trace_event);
+    int res = perf_check_buffer(buf, max * sizeof(struct trace_event));
+    if (res < 0) {
+        return (void *)res;
+    }
+    int total = 0;
+    while (total < max) {
+        int want = max - total;
+        if (want > TRACE_READ_CHUNK) {
+            want = TRACE_READ_CHUNK;
+        }
+        int n = trace_drain(events, want);
+        if (n == 0) {
+            break;
+        }
+        int nbytes = n * sizeof(struct trace_event);
+        res = copy_data_to_user(buf + total * sizeof(struct trace_event),
+                                    events, nbytes);
+        if (res < 0) {
+            return (void *)res;
+        }
+        total += n;
+    }
+    return (void *)(total * sizeof(struct trace_event));
+}
+
+// int prof_control(int mode);
+// Turns the sampling profiler off, on, or on with faster timers (enum
+// PROF_MODE)
+void *syscall_prof_control(struct interrupt_frame *frame) {
+    int mode = (int)task_get_stack_item(task_current(), 0);
+    return (void *)prof_set_mode(mode);
+}
+
+// int prof_read(void* buf, int len);
+// Moves as many whole samples as fit in len bytes to buf, returns the number
+// of bytes, 0 if there was nothing to read
+void *syscall_prof_read(struct interrupt_frame *frame) {
+    uint8_t *buf = task_get_stack_item(task_current(), 1);
+    int len = (int)task_get_stack_item(task_current(), 0);
+    if (len < 0) {
+        return (void *)-STATUS_INVALID_ARG;
+    }
+
+    struct prof_sample samples[PROF_READ_CHUNK];
+    int max = len / sizeof(struct prof_sample);
+    int res = perf_check_buffer(buf, max * sizeof(struct prof_sample));
+    if (res < 0) {
+        return (void *)res;
+    }
+    int total = 0;
+    while (total < max) {
+        int want = max - total;
+        if (want > PROF_READ_CHUNK) {
+            want = PROF_READ_CHUNK;
+        }
+        int n = prof_drain(samples, want);
+        if (n == 0) {
+            break;
+        }
+        int nbytes = n * sizeof(struct prof_sample);
+        res = copy_data_to_user(buf + total * sizeof(struct prof_sample),
+                                    samples, nbytes);
+        if (res < 0) {
+            return (void *)res;
+        }
+        total += n;
+    }
+    return (void *)(total * sizeof(struct prof_sample));
+}
@@ -1,4 +1,5 @@
 #include "console/console.h"
+#include "dev/tty.h"
 #include "idt/idt.h"
 #include "invariants.h"
 #include "memory/heap/kheap.h"
@@ -19,7 +20,9 @@ static int _create_proccess(const char *file_path, int argc, int len,
     if (res != STATUS_OK) {
         return res;
     }
-    process_set_parent_pid(proc, task_current()->proc->pid);
+    struct process *parent = task_current()->proc;
+    process_set_parent_pid(proc, parent->pid);
+    process_set_terminal(proc, parent->terminal);
 
     char *args_kspace = kzalloc(len);
     copy_data_from_user(args_kspace, args, len);
@@ -30,6 +33,12 @@ static int _create_proccess(const char *file_path, int argc, int len,
         // TODO: free the process if the arguments are not added
         return res;
     }
+
+    // a child started from the foreground takes over the terminal until it
+    // exits, see process_exit
+    if (tty_get_foreground(parent->terminal) == parent->pid) {
+        tty_set_foreground(proc->terminal, proc->pid);
+    }
     return proc->pid;
 }
 
@@ -56,4 +65,14 @@ void *syscall_exit(struct interrupt_frame *frame) {
 void *syscall_wait_pid(struct interrupt_frame *frame) {
     int pid = (int)task_get_stack_item(task_current(), 0);
     return (void *)process_waitpid(task_current()->proc, pid);
-}
\ No newline at end of file
+}
+// void yield();
+// Goes to the back of the run queue, returns 0 once the task runs again
+void *syscall_yield(struct interrupt_frame *frame) {
+    // we come back through task_return, not through the syscall return path
+    task_current()->registers.eax = 0;
+    task_switch_to_next_and_run();
+
+    // We never return here
+    return (void *)0;
+}
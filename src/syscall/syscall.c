@@ -25,4 +25,20 @@ void register_syscalls() {
     syscall_register_command(SYS_CALL7_CREATE_PROCESS, syscall_create_process);
     syscall_register_command(SYS_CALL8_EXIT, syscall_exit);
     syscall_register_command(SYS_CALL9_WAIT_PID, syscall_wait_pid);
+    syscall_register_command(SYS_CALL10_TTY_READ, syscall_tty_read);
+    syscall_register_command(SYS_CALL11_TTY_SET_MODE, syscall_tty_set_mode);
+    syscall_register_command(SYS_CALL12_TRACE_READ, syscall_trace_read);
+    syscall_register_command(SYS_CALL13_PROF_CONTROL, syscall_prof_control);
+    syscall_register_command(SYS_CALL14_PROF_READ, syscall_prof_read);
+    syscall_register_command(SYS_CALL15_YIELD, syscall_yield);
+    syscall_register_command(SYS_CALL16_FOPEN, syscall_fopen);
+    syscall_register_command(SYS_CALL17_FREAD, syscall_fread);
+    syscall_register_command(SYS_CALL18_FSTAT, syscall_fstat);
+    syscall_register_command(SYS_CALL19_FCLOSE, syscall_fclose);
+    syscall_register_command(SYS_CALL20_SBRK, syscall_sbrk);
+    syscall_register_command(SYS_CALL21_MPROTECT, syscall_mprotect);
+    syscall_register_command(SYS_CALL22_FWRITE, syscall_fwrite);
+    syscall_register_command(SYS_CALL23_UNLINK, syscall_unlink);
+    syscall_register_command(SYS_CALL24_FTRUNCATE, syscall_ftruncate);
+    syscall_register_command(SYS_CALL25_FSYNC, syscall_fsync);
 }
@@ -9,23 +9,25 @@ enum {
     O_READ = 1,
     O_WRITE = 2,
     O_EXEC = 4,
+    O_POPULATE = 8, // mmap only
 };
 
 // int mmap(void* va_start, void* va_end, int flags);
-// va_start and va_end must be page aligned
+// va_start and va_end must be page aligned, nothing may be mapped there yet.
+// With O_POPULATE the memory gets zeroed frames up front, a 4 MB page for
+// every aligned 4 MB of it, instead of faulting them in one at a time.
 void *syscall_mmap(struct interrupt_frame *frame) {
     void *va_start = task_get_stack_item(task_current(), 2);
     void *va_end = task_get_stack_item(task_current(), 1);
     int user_flags = (uint32_t)task_get_stack_item(task_current(), 0);
 
-    uint8_t page_flags = PAGE_PRESENT | PAGE_USER_ACCESS_ALLOW;
+    uint8_t prot = VMA_READ;
     if (user_flags & O_WRITE) {
-        page_flags |= PAGE_WRITE_ALLOW;
+        prot |= VMA_WRITE;
+    }
+    if (user_flags & O_EXEC) {
+        prot |= VMA_EXEC;
     }
-
-    // if (user_flags & O_EXEC) {
-    //     page_flags |= PAGE_EXEC_ALLOW;
-    // }
 
     void *va_start_aligned = paging_down_align_addr(va_start);
     void *va_end_aligned = paging_up_align_addr(va_end);
@@ -40,30 +42,25 @@ void *syscall_mmap(struct interrupt_frame *frame) {
         return (void *)-STATUS_INVALID_USER_MEM_ACCESS;
     }
 
-    uint32_t nbytes = (uint32_t)va_end_aligned - (uint32_t)va_start_aligned;
-    // alloc memory
-    void *pa_start = kzalloc(nbytes);
-    if (!pa_start) {
-        return (void *)-STATUS_NOT_ENOUGH_MEM;
+    struct process *proc = task_current()->proc;
+    uint32_t start = (uint32_t)va_start_aligned;
+    uint32_t end = (uint32_t)va_end_aligned;
+    if (vma_find_overlap(&proc->vmas, start, end)) {
+        return (void *)-STATUS_INVALID_MEMORY_REGION;
     }
 
+    // a frame per page, so any part of it can be unmapped later. Until the
+    // first write to it that is the zero page, unless it is populated.
     struct page_table_32b *pt = &task_current()->page_table;
-
-    // add to task's memory regions
-    int block_idx = process_add_vmem_block(task_current()->proc,
-                                           va_start_aligned, va_end_aligned);
-
-    if (block_idx < 0) {
-        kfree(pa_start);
-        return (void *)block_idx;
+    int res = user_flags & O_POPULATE
+                  ? paging_alloc_mapping(pt, start, end, vma_page_flags(prot))
+                  : paging_map_zero(pt, start, end, vma_page_flags(prot));
+    if (res != STATUS_OK) {
+        return (void *)res;
     }
-
-    int res = paging_map_memory_region(pt, va_start_aligned, pa_start,
-                                       va_end_aligned, page_flags);
+    res = vma_insert(&proc->vmas, start, end, prot, VMA_ANON, VMA_FRAMES, 0);
     if (res != STATUS_OK) {
-        task_current()->proc->vmem_blocks_start[block_idx] = 0;
-        task_current()->proc->vmem_blocks_end[block_idx] = 0;
-        kfree(pa_start);
+        paging_free_frames(pt, start, end);
         return (void *)res;
     }
 
@@ -71,12 +68,80 @@ void *syscall_mmap(struct interrupt_frame *frame) {
     return (void *)STATUS_OK;
 }
 
-// Should only pass addr earlier passed as va_start to mmap
-// unmaps the complete memory region returned by mmap
-// int munmap(void* addr);
-// returns 0 on success -STATUS_INVALID_MEMORY_REGION if invalid addr
+// int munmap(void* va_start, void* va_end);
+// Unmaps the pages in [va_start, va_end) (page aligned), any part of what
+// mmap mapped, across several mmaps or the holes between them. Returns 0 on
+// success, -STATUS_INVALID_MEMORY_REGION if nothing mmap'd is there or the
+// range touches memory mmap didn't map.
 void *syscall_munmap(struct interrupt_frame *frame) {
-    void *addr = task_get_stack_item(task_current(), 0);
+    void *va_start = task_get_stack_item(task_current(), 1);
+    void *va_end = task_get_stack_item(task_current(), 0);
+    if (va_start != paging_down_align_addr(va_start) ||
+        va_end != paging_down_align_addr(va_end)) {
+        return (void *)-STATUS_INVALID_ARG;
+    }
+    if (verify_user_pointer(va_start) != STATUS_OK ||
+        verify_user_pointer(va_end) != STATUS_OK || va_start >= va_end) {
+        return (void *)-STATUS_INVALID_MEMORY_REGION;
+    }
+
+    struct process *proc = task_current()->proc;
+    uint32_t start = (uint32_t)va_start;
+    uint32_t end = (uint32_t)va_end;
+    struct vma *vma = vma_find_overlap(&proc->vmas, start, end);
+    if (!vma) {
+        return (void *)-STATUS_INVALID_MEMORY_REGION;
+    }
+    // the heap, stack and image have their own ways of going away
+    for (; vma && vma->start < end; vma = vma_next(vma)) {
+        if (vma->type != VMA_ANON) {
+            return (void *)-STATUS_INVALID_MEMORY_REGION;
+        }
+    }
+
+    return (void *)vma_unmap(&proc->vmas, &task_current()->page_table, start,
+                             end);
+}
 
-    return (void *)process_free_vmem_block(task_current()->proc, addr);
-}
\ No newline at end of file
+// int mprotect(void* va_start, void* va_end, int flags);
+// Gives the pages in [va_start, va_end) (page aligned, all of them mapped)
+// the protection in flags, as for mmap. Reading can't be taken away and
+// O_EXEC is only recorded, 32 bit paging has no way to say no to either.
+void *syscall_mprotect(struct interrupt_frame *frame) {
+    void *va_start = task_get_stack_item(task_current(), 2);
+    void *va_end = task_get_stack_item(task_current(), 1);
+    int user_flags = (uint32_t)task_get_stack_item(task_current(), 0);
+    if (va_start != paging_down_align_addr(va_start) ||
+        va_end != paging_down_align_addr(va_end)) {
+        return (void *)-STATUS_INVALID_ARG;
+    }
+    if (verify_user_pointer(va_start) != STATUS_OK ||
+        verify_user_pointer(va_end) != STATUS_OK || va_start >= va_end) {
+        return (void *)-STATUS_INVALID_MEMORY_REGION;
+    }
+
+    uint8_t prot = VMA_READ;
+    if (user_flags & O_WRITE) {
+        prot |= VMA_WRITE;
+    }
+    if (user_flags & O_EXEC) {
+        prot |= VMA_EXEC;
+    }
+    return (void *)vma_protect(&task_current()->proc->vmas,
+                               &task_current()->page_table, (uint32_t)va_start,
+                               (uint32_t)va_end, prot);
+}
+
+// void* sbrk(int increment);
+// Moves the program break, the end of the heap right after the program, by
+// increment bytes (may be negative). Returns the old break, so sbrk(0) is the
+// current one, or -error.
+void *syscall_sbrk(struct interrupt_frame *frame) {
+    int increment = (int)task_get_stack_item(task_current(), 0);
+    uint32_t old_brk;
+    int res = process_sbrk(task_current()->proc, increment, &old_brk);
+    if (res != STATUS_OK) {
+        return (void *)res;
+    }
+    return (void *)old_brk;
+}
@@ -1,8 +1,11 @@
 #include "console/console.h"
-#include "dev/keyboard.h"
+#include "config.h"
+#include "dev/tty.h"
 #include "idt/idt.h"
 #include "memory/heap/kheap.h"
 #include "memory/memory.h"
+#include "status.h"
+#include "task/process.h"
 #include "task/task.h"
 
 // print(void* str, uint32_t len);
@@ -15,23 +18,75 @@ void *syscall_print(struct interrupt_frame *frame) {
     }
     copy_data_from_user(buf, str, len);
     // memcpy(buf, str, len);
-    printn(buf, len);
+    terminal_printn(task_current()->proc->terminal, buf, len);
     kfree(buf);
     return 0;
 }
 
+// the tty of the calling process if it owns it, 0 for background processes
+static struct tty *syscall_foreground_tty() {
+    struct process *proc = task_current()->proc;
+    if (tty_get_foreground(proc->terminal) != proc->pid) {
+        return 0;
+    }
+    return tty_get(proc->terminal);
+}
+
+// Non blocking, returns 0 if no key is queued
 void *syscall_get_char(struct interrupt_frame *frame) {
-    char c = keyboard_pop(task_current());
+    struct tty *tty = syscall_foreground_tty();
+    if (!tty) {
+        return 0;
+    }
+    char c = tty_getc(tty);
     return (void *)((int)c);
 }
 
+// int tty_read(char* buf, int len);
+// Blocks until input is available, in canonical mode returns a whole line
+// including its '\n' (or the first len characters of it)
+void *syscall_tty_read(struct interrupt_frame *frame) {
+    char *buf = task_get_stack_item(task_current(), 1);
+    int len = (int)task_get_stack_item(task_current(), 0);
+    if (len <= 0) {
+        return (void *)-STATUS_INVALID_ARG;
+    }
+    if (len > TTY_LINE_MAX) {
+        len = TTY_LINE_MAX;
+    }
+
+    struct tty *tty = syscall_foreground_tty();
+    char kbuf[TTY_LINE_MAX];
+    int n = tty ? tty_read(tty, kbuf, len) : 0;
+    if (n == 0) {
+        // the syscall restarts when the tty wakes us up, nothing was consumed
+        task_sleep(tty_get(task_current()->proc->terminal));
+    }
+
+    int res = copy_data_to_user(buf, kbuf, n);
+    if (res < 0) {
+        return (void *)res;
+    }
+    return (void *)n;
+}
+
+// int tty_mode(int mode);
+void *syscall_tty_set_mode(struct interrupt_frame *frame) {
+    int mode = (int)task_get_stack_item(task_current(), 0);
+    struct tty *tty = tty_get(task_current()->proc->terminal);
+    if (!tty) {
+        return (void *)-STATUS_INVALID_ARG;
+    }
+    return (void *)tty_set_mode(tty, mode);
+}
+
 void *syscall_put_char(struct interrupt_frame *frame) {
     char c = (char)task_get_stack_item(task_current(), 0);
-    print_char(c);
+    terminal_print_char(task_current()->proc->terminal, c);
     return 0;
 }
 
 void *syscall_clear_screen(struct interrupt_frame *frame) {
-    clear_screen();
+    terminal_clear(task_current()->proc->terminal);
     return 0;
 }
\ No newline at end of file
@@ -1,6 +1,9 @@
 #include "process.h"
+#include "bench/bench.h"
 #include "config.h"
 #include "console/console.h"
+#include "cpu/spinlock.h"
+#include "dev/tty.h"
 #include "fs/file.h"
 #include "invariants.h"
 #include "kernel.h"
@@ -13,9 +16,9 @@
 #include "status.h"
 #include "task/task.h"
 
-struct process *current_proc = 0;
-
 struct process procs[MAX_PROCS];
+// the status (UNUSED or not) and pid of the slots in procs
+static struct spinlock procs_lock;
 
 static int process_load_binary(const char *filename, struct process *proc) {
     int res = 0;
@@ -84,6 +87,7 @@ void procs_init() {
     for (int i = 0; i < MAX_PROCS; i++) {
         procs[i].status = PROC_UNUSED;
     }
+    spin_lock_init(&procs_lock, "procs");
 }
 
 static void process_init(struct process *process) {
@@ -94,35 +98,60 @@ void process_set_parent_pid(struct process *proc, int pid) {
     proc->parent_pid = pid;
 }
 
-struct process *current_process() { return current_proc; }
+void process_set_terminal(struct process *proc, int terminal) {
+    proc->terminal = terminal;
+}
 
+// per cpu, it is whatever the current task belongs to
+struct process *current_process() {
+    struct task *task = task_current();
+    return task ? task->proc : 0;
+}
+
+// Claims a free slot (status CREATING) so no other cpu can take it too,
+// returns its pid or -1
 int get_free_slot() {
+    int pid = -1;
+    spin_lock(&procs_lock);
     for (int i = 0; i < MAX_PROCS; i++) {
         if (procs[i].status == PROC_UNUSED) {
-            return i;
+            process_init(procs + i);
+            procs[i].pid = i;
+            procs[i].status = PROC_CREATING;
+            pid = i;
+            break;
         }
     }
-    return -1;
+    spin_unlock(&procs_lock);
+    return pid;
 }
 
 int free_pid_slot(int pid) {
+    int res = -STATUS_INVALID_ARG;
+    spin_lock(&procs_lock);
     for (int i = 0; i < MAX_PROCS; i++) {
         if (procs[i].pid == pid) {
             procs[i].status = PROC_UNUSED;
             process_init(procs + i);
-            return STATUS_OK;
+            res = STATUS_OK;
+            break;
         }
     }
-    return -STATUS_INVALID_ARG;
+    spin_unlock(&procs_lock);
+    return res;
 }
 
 struct process *get_proc_by_pid(int pid) {
+    struct process *proc = 0;
+    spin_lock(&procs_lock);
     for (int i = 0; i < MAX_PROCS; i++) {
-        if (procs[i].pid == pid) {
-            return procs + i;
+        if (procs[i].status != PROC_UNUSED && procs[i].pid == pid) {
+            proc = procs + i;
+            break;
         }
     }
-    return 0;
+    spin_unlock(&procs_lock);
+    return proc;
 }
 
 // Try to reap process if it is zombie and parent is waiting on it
@@ -163,6 +192,10 @@ int process_exit(struct process *proc, int status) {
     // For now though this is fine. Change this later to paging_free_va,
     // when we introduce separate heap for user processes.
 
+    // unmapped before the memory behind the image and stack goes, the frames
+    // of mmap'd regions and the heap are freed with them
+    vma_unmap_all(&proc->vmas, &proc->task->page_table);
+
     // safe to free all of this because we running in the global kernel stack
     // or kstack of the proc
     if (proc->file_type == PROC_FILE_TYPE_BINARY) {
@@ -171,33 +204,60 @@ int process_exit(struct process *proc, int status) {
         kfree(elf_memory(proc->elf_file));
     }
 
-    for (int i = 0; i < PROCESS_VMEM_MAX_BLOCKS; i++) {
-        if (proc->vmem_blocks_start[i] != 0) {
-            process_free_vmem_block(proc, proc->vmem_blocks_start[i]);
-        }
-    }
-
     if (proc->stack_paddr) {
         kfree(proc->stack_paddr);
     }
 
-    if (proc == current_proc) {
-        current_proc = 0;
+    for (int i = 0; i < PROCESS_MAX_OPEN_FILES; i++) {
+        if (proc->open_files[i]) {
+            kfclose(proc->open_files[i]);
+            proc->open_files[i] = 0;
+        }
+    }
+
+    // hand the terminal back to the parent (usually the shell waiting on us)
+    if (tty_get_foreground(proc->terminal) == proc->pid) {
+        struct process *parent = get_proc_by_pid(proc->parent_pid);
+        tty_set_foreground(proc->terminal,
+                           (parent && parent != proc) ? parent->pid : -1);
     }
 
     // waiting for parent to reap
     proc->status = PROC_ZOMBIE;
     proc->exit_status = status;
+    bench_process_exited(proc, status);
 
     return 0;
 }
 
+static int process_map_stack(struct process *proc) {
+    void *stack_start = (void *)DEFAULT_USER_STACK_START;
+    void *stack_end = (void *)DEFAULT_USER_STACK_END;
+
+    // NOTE : stack_start > stack_end
+    int res = vma_insert(&proc->vmas, (uint32_t)stack_end,
+                         (uint32_t)stack_start, VMA_READ | VMA_WRITE,
+                         VMA_STACK, VMA_BORROWED, 0);
+    if (res != STATUS_OK) {
+        return res;
+    }
+    return paging_map_memory_region(
+        &proc->task->page_table, stack_end, proc->stack_paddr, stack_start,
+        PAGE_PRESENT | PAGE_WRITE_ALLOW | PAGE_USER_ACCESS_ALLOW);
+}
+
 static int process_map_binary(struct process *proc) {
     int res = STATUS_OK;
     struct page_table_32b *pt = &proc->task->page_table;
     void *data_start = (void *)DEFAULT_USER_PROG_ENTRY;
     void *data_end =
         paging_up_align_addr((void *)(DEFAULT_USER_PROG_ENTRY + proc->size));
+    res = vma_insert(&proc->vmas, (uint32_t)data_start, (uint32_t)data_end,
+                     VMA_READ | VMA_WRITE | VMA_EXEC, VMA_IMAGE, VMA_BORROWED,
+                     0);
+    if (res != STATUS_OK) {
+        return res;
+    }
     res = paging_map_memory_region(
         pt, data_start, proc->code_data_paddr, data_end,
         PAGE_PRESENT | PAGE_WRITE_ALLOW | PAGE_USER_ACCESS_ALLOW);
@@ -205,54 +265,53 @@ static int process_map_binary(struct process *proc) {
     if (res != STATUS_OK) {
         return res;
     }
+    proc->heap_start = proc->brk = (uint32_t)data_end;
 
-    void *stack_start = (void *)DEFAULT_USER_STACK_START;
-    void *stack_end = (void *)DEFAULT_USER_STACK_END;
-
-    // NOTE : stack_start > stack_end
-    res = paging_map_memory_region(
-        pt, stack_end, proc->stack_paddr, stack_start,
-        PAGE_PRESENT | PAGE_WRITE_ALLOW | PAGE_USER_ACCESS_ALLOW);
-
-    return res;
+    return process_map_stack(proc);
 }
 
-int process_add_vmem_block(struct process *proc, void *va_start, void *va_end) {
-    for (int i = 0; i < PROCESS_VMEM_MAX_BLOCKS; i++) {
-        if (proc->vmem_blocks_start[i] == 0) {
-            proc->vmem_blocks_start[i] = va_start;
-            proc->vmem_blocks_end[i] = va_end;
-            return i;
-        }
+// Moves the program break by increment bytes, mapping zeroed pages as it
+// grows past a page and freeing them as it shrinks below one. The old break
+// goes to old_brk.
+int process_sbrk(struct process *proc, int increment, uint32_t *old_brk) {
+    struct page_table_32b *pt = &proc->task->page_table;
+    uint32_t brk = proc->brk + increment;
+    // wrapping around 4GB either way
+    if ((increment > 0 && brk < proc->brk) ||
+        (increment < 0 && brk > proc->brk) || brk < proc->heap_start) {
+        return -STATUS_INVALID_ARG;
     }
-    return -STATUS_OUT_OF_VMEM_BLOCKS;
-}
-
-int process_get_vmem_block(struct process *proc, void *va_start) {
-    for (int i = 0; i < PROCESS_VMEM_MAX_BLOCKS; i++) {
-        if (proc->vmem_blocks_start[i] == va_start) {
-            return i;
-        }
+    uint32_t mapped_end = (uint32_t)paging_up_align_addr((void *)proc->brk);
+    uint32_t new_end = (uint32_t)paging_up_align_addr((void *)brk);
+    if (new_end < brk) {
+        // rounded past 4GB
+        return -STATUS_INVALID_ARG;
     }
-    return -STATUS_INVALID_ARG;
-}
 
-int process_free_vmem_block(struct process *proc, void *va_start) {
-    int block_id = process_get_vmem_block(proc, va_start);
-    if (block_id < 0) {
-        return block_id;
+    if (new_end > mapped_end) {
+        // the heap can't grow into anything else
+        if (vma_find_overlap(&proc->vmas, mapped_end, new_end)) {
+            return -STATUS_INVALID_MEMORY_REGION;
+        }
+        uint8_t prot = VMA_READ | VMA_WRITE;
+        int res =
+            paging_map_zero(pt, mapped_end, new_end, vma_page_flags(prot));
+        if (res < 0) {
+            return res;
+        }
+        // grows the heap's vma, if there is one already
+        res = vma_insert(&proc->vmas, mapped_end, new_end, prot, VMA_HEAP,
+                         VMA_FRAMES, 0);
+        if (res < 0) {
+            paging_free_frames(pt, mapped_end, new_end);
+            return res;
+        }
+    } else if (new_end < mapped_end) {
+        vma_unmap(&proc->vmas, pt, new_end, mapped_end);
     }
-    // should loop over all tasks and free and do tlb shootdown
-    // but for now we support only 1 task per process
-    struct page_table_32b *pt = &proc->task->page_table;
-    void *va_end = proc->vmem_blocks_end[block_id];
-
-    // TODO: For now this does not free anything actually,
-    // freeing is deferred until shared pages are introduced
-    paging_free_va(pt, (uint32_t)va_start, (uint32_t)va_end);
 
-    proc->vmem_blocks_start[block_id] = 0;
-    proc->vmem_blocks_end[block_id] = 0;
+    *old_brk = proc->brk;
+    proc->brk = brk;
     return STATUS_OK;
 }
 
@@ -277,6 +336,8 @@ static int process_map_elf(struct process *proc) {
 
         void *pa_start =
             paging_down_align_addr(elf_phdr_phys_address(elf_file, ph));
+        // memory of its own behind the segment, freed with its vma
+        void *run = 0;
 
         if (ph->p_memsz == 0) {
             println("[Warning] process_map_elf: empty segment");
@@ -300,26 +361,34 @@ static int process_map_elf(struct process *proc) {
             // https://www.cs.cmu.edu/afs/cs/academic/class/15213-f00/docs/elf.pdf
             // Page 34
             memcpy(pa_start, elf_phdr_phys_address(elf_file, ph), ph->p_filesz);
-
-            // Don't forget to free this memory
-            // Done: memory added as a vmem heap block
-            process_add_vmem_block(proc, pa_start, pa_start + ph->p_memsz);
+            run = pa_start;
         }
 
         void *va_start = paging_down_align_addr((void *)ph->p_vaddr);
         void *va_end =
             paging_up_align_addr((void *)(ph->p_vaddr + ph->p_memsz));
 
-        int flags = PAGE_PRESENT | PAGE_USER_ACCESS_ALLOW;
+        uint8_t prot = VMA_READ;
         if (ph->p_flags & PF_W) {
-            flags |= PAGE_WRITE_ALLOW;
+            prot |= VMA_WRITE;
+        }
+        if (ph->p_flags & PF_X) {
+            prot |= VMA_EXEC;
         }
 
         if (va_end <= va_start) {
             println("[Warning] process_map_elf: empty segment");
+            kfree(run);
             continue;
         }
 
+        res = vma_insert(&proc->vmas, (uint32_t)va_start, (uint32_t)va_end,
+                         prot, VMA_IMAGE, run ? VMA_RUN : VMA_BORROWED, run);
+        if (res != STATUS_OK) {
+            kfree(run);
+            return res;
+        }
+
         // TODO: For now most of the times pa_start is part of the elf_file
         // which we copied into memory Later on we would want to use a separate
         // heap for processes and only map memory from there and not from the
@@ -328,23 +397,18 @@ static int process_map_elf(struct process *proc) {
         // TODO: memory leak, don't forget to free the elf_file_memory somewhere
         // else when we do that, for now it is freed in process_free
 
-        res = paging_map_memory_region(pt, va_start, pa_start, va_end, flags);
+        res = paging_map_memory_region(pt, va_start, pa_start, va_end,
+                                       vma_page_flags(prot));
         if (res != STATUS_OK) {
             return res;
         }
+        if ((uint32_t)va_end > proc->heap_start) {
+            proc->heap_start = (uint32_t)va_end;
+        }
     }
+    proc->brk = proc->heap_start;
 
-    // map the stack
-
-    void *stack_start = (void *)DEFAULT_USER_STACK_START;
-    void *stack_end = (void *)DEFAULT_USER_STACK_END;
-
-    // NOTE : stack_start > stack_end
-    res = paging_map_memory_region(
-        pt, stack_end, proc->stack_paddr, stack_start,
-        PAGE_PRESENT | PAGE_WRITE_ALLOW | PAGE_USER_ACCESS_ALLOW);
-
-    return res;
+    return process_map_stack(proc);
 }
 
 static int process_map_memory(struct process *proc) {
@@ -364,13 +428,14 @@ static int process_map_memory(struct process *proc) {
     return res;
 }
 
-struct process *process_current() { return current_proc; }
+struct process *process_current() { return current_process(); }
 
+// The current process follows the current task, this only checks that the
+// process is allowed to run
 void set_current_process(struct process *proc) {
     if (proc->status != PROC_CAN_START) {
         panic("set_current_process called, but process is not ready to run");
     }
-    current_proc = proc;
 }
 
 int process_new(const char *filename, struct process **process_out) {
@@ -383,7 +448,6 @@ int process_new(const char *filename, struct process **process_out) {
     }
 
     struct process *proc = &procs[pid];
-    process_init(proc);
 
     // allocate stack for main thread of the process
     void *stack_ptr = kzalloc(DEFAULT_USER_STACK_SIZE);
@@ -412,17 +476,15 @@ int process_new(const char *filename, struct process **process_out) {
     if (res != STATUS_OK) {
         goto out;
     }
-    proc->keyboard.head = 0;
-    proc->keyboard.tail = 0;
     proc->pid = pid;
     proc->status = PROC_CREATING;
-    memset(proc->keyboard.buf, 0, sizeof(proc->keyboard.buf));
     *process_out = proc;
 
 out:
     if (ISERR(res)) {
         // TODO: free memory
         // proc_free(proc);
+        free_pid_slot(pid);
     }
     return res;
 }
@@ -2,6 +2,7 @@
 #define PROCESS_H
 
 #include "config.h"
+#include "memory/vma/vma.h"
 #include "task/task.h"
 #include <stdint.h>
 
@@ -36,19 +37,28 @@ struct process {
 
     uint32_t size;
 
+    // what the main task is sleeping on while TASK_BLOCKED, see task_sleep
     void *chan;
 
     char program_file[FS_MAX_PATH_LEN + 10];
 
-    void *vmem_blocks_start[PROCESS_VMEM_MAX_BLOCKS];
-    void *vmem_blocks_end[PROCESS_VMEM_MAX_BLOCKS];
+    // virtual terminal the process reads from and writes to
+    int terminal;
+
+    // program break, the heap runs from heap_start (the page after the
+    // program) to brk and is mapped up to brk rounded up to a page
+    uint32_t heap_start;
+    uint32_t brk;
+
+    // everything mapped in its user memory
+    struct vma_tree vmas;
+    // kernel fds (kfopen) of the files the process has open, 0 if free
     int open_files[PROCESS_MAX_OPEN_FILES];
 
-    struct keyboard_buffer {
-        char buf[PROCESS_KEYBOARD_BUFFER_SIZE];
-        int head;
-        int tail;
-    } keyboard;
+    // shown by procfs
+    uint32_t ticks; // scheduler ticks that interrupted it
+    uint32_t page_faults;
+    uint32_t syscalls[NUM_SYS_CALLS];
 };
 
 void procs_init();
@@ -57,10 +67,11 @@ void set_current_process(struct process *proc);
 struct process *process_current();
 int process_exit(struct process *proc, int status);
 int process_waitpid(struct process *proc, int waitpid);
+int process_reap(struct process *proc);
 int process_add_arguments(struct process *proc, int argc, int len, char *args);
-int process_add_vmem_block(struct process *proc, void *va_start, void *va_end);
-int process_get_vmem_block(struct process *proc, void *va_start);
-int process_free_vmem_block(struct process *proc, void *va_start);
+int process_sbrk(struct process *proc, int increment, uint32_t *old_brk);
 void process_set_parent_pid(struct process *proc, int pid);
+void process_set_terminal(struct process *proc, int terminal);
+struct process *get_proc_by_pid(int pid);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,137 @@
+#include "sched.h"
+#include "config.h"
+#include "cpu/cpu.h"
+#include "cpu/smp.h"
+#include "task.h"
+
+// Runs under the big kernel lock, which is also what keeps one cpu from
+// walking a queue another cpu is stealing from
+
+static void sched_rq_append(struct run_queue *rq, struct task *task) {
+    task->rq_next = 0;
+    task->rq_prev = rq->tail;
+    if (rq->tail) {
+        rq->tail->rq_next = task;
+    } else {
+        rq->head = task;
+    }
+    rq->tail = task;
+    rq->len++;
+    task->on_rq = true;
+}
+
+static void sched_rq_unlink(struct run_queue *rq, struct task *task) {
+    if (task->rq_prev) {
+        task->rq_prev->rq_next = task->rq_next;
+    } else {
+        rq->head = task->rq_next;
+    }
+    if (task->rq_next) {
+        task->rq_next->rq_prev = task->rq_prev;
+    } else {
+        rq->tail = task->rq_prev;
+    }
+    task->rq_next = 0;
+    task->rq_prev = 0;
+    rq->len--;
+    task->on_rq = false;
+}
+
+// To the back of the queue of task->cpu
+void sched_enqueue(struct task *task) {
+    if (task->on_rq) {
+        return;
+    }
+    sched_rq_append(&smp_get_cpu(task->cpu)->rq, task);
+}
+
+void sched_dequeue(struct task *task) {
+    if (!task->on_rq) {
+        return;
+    }
+    sched_rq_unlink(&smp_get_cpu(task->cpu)->rq, task);
+}
+
+// Called when task leaves the cpu, starts its cache hot period
+void sched_task_stopped(struct task *task) { task->last_ran = cpu_read_tsc(); }
+
+// A task that ran very recently still has its working set in the cache of
+// the cpu it ran on, moving it costs more than waiting a little
+static bool sched_task_cache_hot(struct task *task, uint64_t now) {
+    return now - task->last_ran < SCHED_MIGRATION_COST_CYCLES;
+}
+
+// New tasks have no cache to lose, they go to the shortest queue
+int sched_pick_cpu() {
+    int best = get_cpu_id();
+    for (int i = 0; i < smp_num_cpus(); i++) {
+        struct cpu *cpu = smp_get_cpu(i);
+        if (cpu->started && cpu->rq.len < smp_get_cpu(best)->rq.len) {
+            best = i;
+        }
+    }
+    return best;
+}
+
+static struct cpu *sched_find_busiest(struct cpu *self) {
+    struct cpu *busiest = 0;
+    for (int i = 0; i < smp_num_cpus(); i++) {
+        struct cpu *cpu = smp_get_cpu(i);
+        if (cpu == self || !cpu->started || cpu->rq.len == 0) {
+            continue;
+        }
+        if (!busiest || cpu->rq.len > busiest->rq.len) {
+            busiest = cpu;
+        }
+    }
+    return busiest;
+}
+
+// Moves up to half (rounded up) of the busiest queue to cpu. The head of a
+// queue has waited the longest, so it is walked from there and cache hot
+// tasks are skipped, unless the last SCHED_CACHE_NICE_TRIES attempts all came
+// back empty handed. Returns the number of tasks moved.
+static int sched_steal(struct cpu *cpu) {
+    struct cpu *busiest = sched_find_busiest(cpu);
+    if (!busiest) {
+        return 0;
+    }
+
+    int want = (busiest->rq.len + 1) / 2;
+    bool ignore_hot = cpu->rq.balance_failed >= SCHED_CACHE_NICE_TRIES;
+    uint64_t now = cpu_read_tsc();
+    int stolen = 0;
+
+    struct task *task = busiest->rq.head;
+    while (task && stolen < want) {
+        struct task *next = task->rq_next;
+        if (ignore_hot || !sched_task_cache_hot(task, now)) {
+            sched_rq_unlink(&busiest->rq, task);
+            task->cpu = cpu->id;
+            sched_rq_append(&cpu->rq, task);
+            stolen++;
+        } else {
+            cpu->rq.hot_skipped++;
+        }
+        task = next;
+    }
+
+    if (stolen == 0) {
+        cpu->rq.balance_failed++;
+    } else {
+        cpu->rq.balance_failed = 0;
+        cpu->rq.stolen += stolen;
+    }
+    return stolen;
+}
+
+// Head of our own queue, stealing first if it is empty. 0 if there is
+// nothing we are willing to run right now.
+struct task *sched_pick_next(struct cpu *cpu) {
+    if (!cpu->rq.head && !sched_steal(cpu)) {
+        return 0;
+    }
+    struct task *task = cpu->rq.head;
+    sched_rq_unlink(&cpu->rq, task);
+    return task;
+}
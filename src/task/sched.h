@@ -0,0 +1,31 @@
+#ifndef SCHED_H
+#define SCHED_H
+
+#include <stdint.h>
+
+struct task;
+struct cpu;
+
+// FIFO of READY tasks, one per cpu (struct cpu). A task goes back on the
+// queue of the cpu it last ran on so its cache stays warm, idle cpus steal
+// from the busiest queue.
+struct run_queue {
+    struct task *head;
+    struct task *tail;
+    int len;
+
+    // idle balancing attempts in a row that found only cache hot tasks
+    int balance_failed;
+
+    // stats
+    uint32_t stolen;      // tasks this cpu took from other queues
+    uint32_t hot_skipped; // tasks left alone because they were cache hot
+};
+
+void sched_enqueue(struct task *task);
+void sched_dequeue(struct task *task);
+void sched_task_stopped(struct task *task);
+int sched_pick_cpu();
+struct task *sched_pick_next(struct cpu *cpu);
+
+#endif
@@ -1,19 +1,33 @@
 #include "task.h"
 #include "config.h"
 #include "console/console.h"
+#include "cpu/smp.h"
+#include "disk/bcache.h"
 #include "invariants.h"
 #include "kernel.h"
 #include "loader/elfloader.h"
+#include "memory/heap/kcache.h"
 #include "memory/heap/kheap.h"
+#include "memory/heap/zpool.h"
 #include "memory/memory.h"
 #include "process.h"
+#include "sched.h"
 #include "status.h"
+#include "trace/trace.h"
 
-struct task *curr_task = 0;
+// every task, whatever its state
 struct task *tasks_ll_head = 0;
 struct task *tasks_ll_tail = 0;
 
-struct task *task_current() { return curr_task; }
+static struct kcache task_cache = KCACHE_INIT("task", sizeof(struct task));
+
+struct task *task_current() { return cpu_current()->current_task; }
+
+// READY tasks are on the run queue of a cpu, see sched.c
+static void task_make_ready(struct task *task) {
+    task->state = TASK_READY;
+    sched_enqueue(task);
+}
 
 int task_init(struct task *task, struct process *proc) {
     memset(task, 0, sizeof(struct task));
@@ -47,7 +61,7 @@ int task_init(struct task *task, struct process *proc) {
 struct task *task_new(struct process *proc) {
     int res = 0;
 
-    struct task *task = kzalloc(sizeof(struct task));
+    struct task *task = kcache_zalloc(&task_cache);
 
     if (!task) {
         return 0;
@@ -55,7 +69,7 @@ struct task *task_new(struct process *proc) {
 
     res = task_init(task, proc);
     if (res != STATUS_OK) {
-        kfree(task);
+        kcache_free(&task_cache, task);
         return 0;
     }
 
@@ -71,17 +85,10 @@ struct task *task_new(struct process *proc) {
         tasks_ll_tail = task;
     }
 
-    return task;
-}
+    task->cpu = sched_pick_cpu();
+    sched_enqueue(task);
 
-struct task *task_get_next() {
-    if (!curr_task) {
-        return 0;
-    }
-    if (!curr_task->next) {
-        return tasks_ll_head;
-    }
-    return curr_task->next;
+    return task;
 }
 
 int task_free(struct task *task) {
@@ -91,6 +98,7 @@ int task_free(struct task *task) {
     if (task->state != TASK_DEAD) {
         panic("Trying to free a task that is not dead");
     }
+    sched_dequeue(task);
 
     paging_free_page_table(&task->page_table);
 
@@ -107,24 +115,37 @@ int task_free(struct task *task) {
     if (task == tasks_ll_tail) {
         tasks_ll_tail = task->prev;
     }
-    if (task == curr_task) {
-        curr_task = 0;
+    // a dead task can only still be current on the cpu that is running
+    // its exit, and that cpu is not idle so it holds the kernel lock
+    if (task == task_current()) {
+        cpu_current()->current_task = 0;
     }
 
-    kfree(task);
+    kcache_free(&task_cache, task);
     return 0;
 }
 
 int task_switch(struct task *task) {
-    if (curr_task && curr_task->state == TASK_RUNNING) {
+    struct cpu *cpu = cpu_current();
+    struct task *prev = cpu->current_task;
+    if (prev != task) {
+        trace(TRACE_SWITCH, prev ? prev->proc->pid : TRACE_PID_IDLE,
+              task->proc->pid);
+    }
+    if (prev && prev != task) {
+        sched_task_stopped(prev);
+    }
+    if (prev && prev != task && prev->state == TASK_RUNNING) {
         // set only if curr task exits and it is running
         // other wise the task may be modified by other parts of the code
         // or even be set to null
         // for ex during exit, task state is set to dead
         // during a blocking call, task state will be set to blocked
-        curr_task->state = TASK_READY;
+        task_make_ready(prev);
     }
-    curr_task = task;
+    sched_dequeue(task);
+    cpu->current_task = task;
+    task->cpu = cpu->id;
     task->state = TASK_RUNNING;
     set_current_process(task->proc);
     // DESIGN INVARIANT: All the kernel memory is mapped(identity) into the task
@@ -138,23 +159,77 @@ int task_switch_and_run(struct task *task) {
         panic("Can't switch to a non ready task");
     }
     task_switch(task);
+    // back to user mode, other cpus may enter the kernel now
+    kernel_unlock();
     task_return(&task->registers);
     return 0;
 }
 
+// Waits for the next interrupt with interrupts enabled, the clock handler
+// does not switch tasks when it interrupts the kernel. Zeroes pages for the
+// zpool first, a batch at a time so a task woken meanwhile doesn't wait long,
+// and only sleeps once there is nothing left to zero. Writes back the buffer
+// cache's old dirty sectors before, that needs the big kernel lock.
+static void task_idle() {
+    bcache_sync_expired();
+    kernel_unlock();
+    if (zpool_refill(ZPOOL_REFILL_BATCH) > 0) {
+        // let in the interrupts that came meanwhile
+        asm volatile("sti; nop; cli" ::: "memory");
+    } else {
+        asm volatile("sti; hlt; cli" ::: "memory");
+    }
+    kernel_lock();
+}
+
 void task_switch_and_run_any() {
-    assert_single_cpu();
+    assert_kernel_big_lock();
     assert_interrupt_handler_cli_always();
 
-    struct task *task = tasks_ll_head;
-    while (task) {
-        if (task->state == TASK_READY) {
+    struct cpu *cpu = cpu_current();
+    if (cpu->current_task && cpu->current_task->state == TASK_RUNNING) {
+        task_make_ready(cpu->current_task);
+    }
+    while (1) {
+        struct task *task = sched_pick_next(cpu);
+        if (task) {
             task_switch_and_run(task);
         }
-        task = task->next;
+        // nothing to run, one of the interrupts will wake somebody up. Let go
+        // of the old task's address space first, another cpu may free it
+        // while we sleep.
+        if (cpu->current_task) {
+            trace(TRACE_SWITCH, cpu->current_task->proc->pid, TRACE_PID_IDLE);
+            sched_task_stopped(cpu->current_task);
+        }
+        cpu->current_task = 0;
+        paging_load_kernel_page_table();
+        task_idle();
     }
-    // if single cpu and cli then we are in a deadlock!
-    panic("Deadlock: No ready task found\n");
+}
+
+// Puts the current task to sleep on chan and runs something else. The
+// syscall that got us here is restarted from scratch once the task is woken
+// up, so callers must sleep before changing any state. Never returns.
+void task_sleep(void *chan) {
+    assert_single_task_per_process();
+    struct task *task = task_current();
+    // rewind to the `int 0x80` (2 bytes), eax still holds the syscall number
+    task->registers.eip -= 2;
+    task->state = TASK_BLOCKED;
+    assert_kernel_big_lock(); // nobody can wake us before we are switched out
+    task->proc->chan = chan;
+    task_switch_and_run_any();
+}
+
+// Makes the task runnable again if it is sleeping on chan
+bool task_wakeup(struct task *task, void *chan) {
+    if (task->state != TASK_BLOCKED || task->proc->chan != chan) {
+        return false;
+    }
+    task->proc->chan = 0;
+    task_make_ready(task);
+    return true;
 }
 
 // Run the init process, and sets the parent pid to itself
@@ -167,6 +242,7 @@ void task_run_init_task() {
 }
 
 void task_save_current_state(struct interrupt_frame *frame) {
+    struct task *curr_task = task_current();
     if (!curr_task) {
         panic("Saved state called but no curr task");
     }
@@ -198,6 +274,16 @@ int copy_data_from_user(void *dst, void *src, uint32_t nbytes) {
     return STATUS_OK;
 };
 
+int copy_data_to_user(void *dst, void *src, uint32_t nbytes) {
+    if (((uint32_t)dst) < KHEAP_SAFE_BOUNDARY ||
+        ((uint32_t)dst) + nbytes < KHEAP_SAFE_BOUNDARY) {
+        return -STATUS_INVALID_USER_MEM_ACCESS;
+    }
+    memcpy(dst, src, nbytes);
+
+    return STATUS_OK;
+}
+
 // checks if ptr is in user space
 int verify_user_pointer(void *ptr) {
     if (((uint32_t)ptr) < KHEAP_SAFE_BOUNDARY) {
@@ -223,19 +309,10 @@ void task_switch_to_next_and_run() {
         panic("No curr task");
     }
     if (start->state == TASK_RUNNING) {
-        // set to ready only if it was running
-        start->state = TASK_READY;
+        // set to ready only if it was running, to the back of our queue
+        task_make_ready(start);
     }
-
-    struct task *next = task_get_next();
-    while (next != start) {
-        if (next->state == TASK_READY) {
-            break;
-        }
-        next = task_get_next();
-    }
-
-    task_switch_and_run(next);
+    task_switch_and_run_any();
 }
 
 // NOT USED
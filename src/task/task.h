@@ -41,11 +41,18 @@ struct task {
     struct task *prev;
 
     void *kstack;
+
+    // cpu whose run queue the task is on, or last ran on
+    int cpu;
+    bool on_rq;
+    struct task *rq_next;
+    struct task *rq_prev;
+    // tsc when it last left a cpu, see sched_task_stopped
+    uint64_t last_ran;
 };
 
 struct task *task_new(struct process *proc);
 struct task *task_current();
-struct task *task_get_next();
 int task_free(struct task *task);
 
 int task_switch(struct task *task);
@@ -53,6 +60,8 @@ int task_switch_and_run(struct task *task);
 void task_switch_and_run_any();
 void task_switch_to_next_and_run();
 void task_run_init_task();
+void task_sleep(void *chan);
+bool task_wakeup(struct task *task, void *chan);
 
 // asm functions
 void task_return(struct registers *regs);
@@ -60,6 +69,7 @@ void restore_general_purpose_registers(struct registers *regs);
 void user_registers();
 void task_save_current_state(struct interrupt_frame *frame);
 int copy_data_from_user(void *dst, void *src, uint32_t nbytes);
+int copy_data_to_user(void *dst, void *src, uint32_t nbytes);
 void *task_get_stack_item(struct task *task, int index);
 
 int verify_user_pointer(void *ptr);
@@ -0,0 +1,200 @@
+#include "prof.h"
+#include "cpu/cpu.h"
+#include "cpu/lapic.h"
+#include "cpu/smp.h"
+#include "kernel.h"
+#include "memory/heap/kheap.h"
+#include "memory/memory.h"
+#include "status.h"
+#include "task/process.h"
+#include "task/task.h"
+
+// Same scheme as the trace rings: only the owning cpu writes (from its timer
+// interrupt), only the drain reads, head and tail run freely.
+struct prof_buffer {
+    struct prof_sample *samples;
+    uint32_t head; // owned by the reader
+    uint32_t tail; // owned by the cpu
+    uint32_t dropped;
+    uint32_t dropped_reported; // owned by the reader
+
+    // this cpu's timer runs PROF_TIMER_MULTIPLIER times faster, only every
+    // PROF_TIMER_MULTIPLIER-th tick drives the scheduler
+    bool fast;
+    uint32_t ticks;
+} __attribute__((aligned(64)));
+
+#define PROF_MASK (PROF_BUFFER_SAMPLES - 1)
+
+static struct prof_buffer buffers[N_CPU_MAX];
+static bool prof_ready = false;
+static volatile int prof_mode = PROF_OFF;
+
+// After smp_init, every running cpu gets a ring. Profiling can't be turned on
+// if there is not enough memory.
+void prof_init() {
+    if (!PROF_ENABLED) {
+        return;
+    }
+    for (int i = 0; i < smp_num_cpus(); i++) {
+        buffers[i].samples =
+            kzalloc(PROF_BUFFER_SAMPLES * sizeof(struct prof_sample));
+        if (!buffers[i].samples) {
+            return;
+        }
+    }
+    prof_ready = true;
+}
+
+// Every cpu picks the new mode up (and changes its timer rate) on its next
+// tick
+int prof_set_mode(int mode) {
+    if (mode != PROF_OFF && mode != PROF_ON && mode != PROF_ON_FAST) {
+        return -STATUS_INVALID_ARG;
+    }
+    if (mode != PROF_OFF && !prof_ready) {
+        return -STATUS_NOT_ENOUGH_MEM;
+    }
+    prof_mode = mode;
+    return STATUS_OK;
+}
+
+// The bsp is driven by the PIT, the others by their lapic timer
+static void prof_set_timer_rate(int cpu, uint32_t mult) {
+    if (cpu == 0) {
+        pit_timer_set_rate(mult);
+    } else {
+        lapic_timer_set_rate(mult);
+    }
+}
+
+// A tick from user mode runs on the task's page tables, so its stack can be
+// read directly. There are no frame pointers (-fomit-frame-pointer), every
+// word that points into the program image is kept, prof.py throws away the
+// ones that don't follow a call instruction.
+static void prof_scan_user_stack(struct prof_sample *s, struct task *task,
+                                 uint32_t esp) {
+    if (esp < DEFAULT_USER_STACK_END || esp >= DEFAULT_USER_STACK_START) {
+        return;
+    }
+    uint32_t text_end = DEFAULT_USER_PROG_ENTRY + task->proc->size;
+    uint32_t *word = (uint32_t *)esp;
+    uint32_t *end = (uint32_t *)DEFAULT_USER_STACK_START;
+    if (end - word > PROF_STACK_SCAN_WORDS) {
+        end = word + PROF_STACK_SCAN_WORDS;
+    }
+    int n = 0;
+    for (; word < end && n < PROF_STACK_DEPTH; word++) {
+        if (*word >= DEFAULT_USER_PROG_ENTRY && *word < text_end) {
+            s->stack[n++] = *word;
+        }
+    }
+}
+
+static void prof_record(struct prof_buffer *pb, int cpu,
+                        struct interrupt_frame *frame) {
+    uint32_t tail = pb->tail;
+    if (tail - __atomic_load_n(&pb->head, __ATOMIC_ACQUIRE) > PROF_MASK) {
+        pb->dropped++;
+        return;
+    }
+    struct prof_sample *s = &pb->samples[tail & PROF_MASK];
+    memset(s, 0, sizeof(struct prof_sample));
+    struct task *task = cpu_current()->current_task;
+    s->pid = task ? task->proc->pid : PROF_PID_IDLE;
+    s->cpu = cpu;
+    s->eip = frame->eip;
+    if ((frame->cs & 0x3) == 0) {
+        s->flags = PROF_SAMPLE_KERNEL;
+    } else if (task) {
+        prof_scan_user_stack(s, task, frame->esp);
+    }
+    __atomic_store_n(&pb->tail, tail + 1, __ATOMIC_RELEASE);
+}
+
+// Called on every timer interrupt before anything else, interrupts are off.
+// Returns whether this tick should also drive the scheduler.
+bool prof_tick(struct interrupt_frame *frame) {
+    if (!PROF_ENABLED) {
+        return true;
+    }
+    int cpu = get_cpu_id();
+    struct prof_buffer *pb = &buffers[cpu];
+    int mode = prof_mode;
+
+    bool fast = mode == PROF_ON_FAST;
+    if (fast != pb->fast) {
+        prof_set_timer_rate(cpu, fast ? PROF_TIMER_MULTIPLIER : 1);
+        pb->fast = fast;
+        pb->ticks = 0;
+    }
+    if (mode != PROF_OFF && pb->samples) {
+        prof_record(pb, cpu, frame);
+    }
+    pb->ticks++;
+    return !pb->fast || pb->ticks % PROF_TIMER_MULTIPLIER == 0;
+}
+
+// Moves up to max samples of all cpus to out. Drops since the last drain show
+// up as one PROF_SAMPLE_LOST sample per cpu. Only one drain may run at a time
+// (the big kernel lock).
+int prof_drain(struct prof_sample *out, int max) {
+    int n = 0;
+    for (int cpu = 0; cpu < smp_num_cpus() && n < max; cpu++) {
+        struct prof_buffer *pb = &buffers[cpu];
+        if (!pb->samples) {
+            continue;
+        }
+        uint32_t dropped = __atomic_load_n(&pb->dropped, __ATOMIC_RELAXED);
+        if (dropped != pb->dropped_reported) {
+            memset(&out[n], 0, sizeof(struct prof_sample));
+            out[n].cpu = cpu;
+            out[n].flags = PROF_SAMPLE_LOST;
+            out[n].eip = dropped - pb->dropped_reported;
+            n++;
+            pb->dropped_reported = dropped;
+        }
+        uint32_t head = pb->head;
+        uint32_t tail = __atomic_load_n(&pb->tail, __ATOMIC_ACQUIRE);
+        while (head != tail && n < max) {
+            out[n++] = pb->samples[head & PROF_MASK];
+            head++;
+        }
+        __atomic_store_n(&pb->head, head, __ATOMIC_RELEASE);
+    }
+    return n;
+}
+
+// ----------------------- tests ------------------- //
+
+void prof_test() {
+    struct prof_sample out[4];
+    if (!PROF_ENABLED) {
+        return;
+    }
+    if (!prof_ready) {
+        prof_init();
+    }
+    int old_mode = prof_mode;
+    while (prof_drain(out, 4) > 0) {
+    }
+
+    // a tick from the idle loop with profiling on, the mode is left alone so
+    // the timer rate doesn't change under us
+    struct interrupt_frame frame;
+    memset(&frame, 0, sizeof(frame));
+    frame.cs = KERNEL_CODE_SEGMENT;
+    frame.eip = (uint32_t)prof_test;
+    prof_mode = buffers[get_cpu_id()].fast ? PROF_ON_FAST : PROF_ON;
+    prof_tick(&frame);
+    prof_mode = old_mode;
+
+    int n = prof_drain(out, 4);
+    if (n != 1 || out[0].eip != (uint32_t)prof_test ||
+        !(out[0].flags & PROF_SAMPLE_KERNEL) || out[0].cpu != get_cpu_id()) {
+        panic("prof_test: sample missing or wrong");
+    }
+    if (prof_set_mode(PROF_ON_FAST + 1) != -STATUS_INVALID_ARG) {
+        panic("prof_test: bad mode accepted");
+    }
+}
@@ -0,0 +1,43 @@
+#ifndef PROF_H
+#define PROF_H
+
+#include "config.h"
+#include "idt/idt.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+// Sampling profiler: every timer tick records what the interrupted cpu was
+// running, decoded on the host by prof.py. The layout of struct prof_sample
+// is shared with it.
+
+enum PROF_MODE {
+    PROF_OFF,
+    PROF_ON,      // one sample per scheduler tick
+    PROF_ON_FAST, // timers run PROF_TIMER_MULTIPLIER times faster
+};
+
+// flags of a sample
+#define PROF_SAMPLE_KERNEL 0x1 // eip is a kernel address
+#define PROF_SAMPLE_LOST 0x2   // not a sample, eip samples dropped on cpu
+
+// pid of samples taken while the cpu had no task (the idle loop)
+#define PROF_PID_IDLE 0xFFFF
+
+struct prof_sample {
+    uint16_t pid;
+    uint8_t cpu;
+    uint8_t flags;
+    uint32_t eip;
+    // words found on the user stack that may be return addresses, innermost
+    // first, 0 if there are fewer
+    uint32_t stack[PROF_STACK_DEPTH];
+} __attribute__((packed));
+
+void prof_init();
+int prof_set_mode(int mode);
+bool prof_tick(struct interrupt_frame *frame);
+int prof_drain(struct prof_sample *out, int max);
+
+void prof_test();
+
+#endif
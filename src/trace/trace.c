@@ -0,0 +1,126 @@
+#include "trace.h"
+#include "cpu/cpu.h"
+#include "cpu/smp.h"
+#include "kernel.h"
+#include "memory/heap/kheap.h"
+#include "memory/memory.h"
+
+// One ring per cpu, only that cpu writes into it (with interrupts off, so
+// an interrupt can't trace in the middle of a record) and only the drain
+// reads from it. head and tail run freely like in struct ringbuf, so there
+// are no locks and nothing shared between cpus on the write side.
+struct trace_buffer {
+    struct trace_event *events;
+    uint32_t head; // next event to drain, owned by the reader
+    uint32_t tail; // next free slot, owned by the cpu
+    uint32_t dropped;          // events thrown away because the ring was full
+    uint32_t dropped_reported; // owned by the reader
+} __attribute__((aligned(64)));
+
+#define TRACE_MASK (TRACE_BUFFER_EVENTS - 1)
+
+static struct trace_buffer buffers[N_CPU_MAX];
+static bool trace_on = false;
+
+// After smp_init, every cpu that is running gets a ring. Tracing stays off if
+// there is not enough memory.
+void trace_init() {
+    if (!TRACE_ENABLED) {
+        return;
+    }
+    for (int i = 0; i < smp_num_cpus(); i++) {
+        buffers[i].events =
+            kzalloc(TRACE_BUFFER_EVENTS * sizeof(struct trace_event));
+        if (!buffers[i].events) {
+            return;
+        }
+    }
+    trace_on = true;
+}
+
+void trace(uint8_t type, uint16_t arg0, uint32_t arg1) {
+    if (!TRACE_ENABLED || !trace_on) {
+        return;
+    }
+    uint32_t flags = cpu_irq_save();
+    int cpu = get_cpu_id();
+    struct trace_buffer *tb = &buffers[cpu];
+    uint32_t tail = tb->tail;
+    if (tail - __atomic_load_n(&tb->head, __ATOMIC_ACQUIRE) >
+        TRACE_MASK) {
+        tb->dropped++;
+    } else {
+        struct trace_event *ev = &tb->events[tail & TRACE_MASK];
+        ev->tsc = cpu_read_tsc();
+        ev->type = type;
+        ev->cpu = cpu;
+        ev->arg0 = arg0;
+        ev->arg1 = arg1;
+        __atomic_store_n(&tb->tail, tail + 1, __ATOMIC_RELEASE);
+    }
+    cpu_irq_restore(flags);
+}
+
+// Moves up to max events of all cpus to out, every cpu's events in order but
+// the cpus one after the other. Drops since the last drain show up as one
+// TRACE_LOST event per cpu. Only one drain may run at a time (the big kernel
+// lock).
+int trace_drain(struct trace_event *out, int max) {
+    int n = 0;
+    for (int cpu = 0; cpu < smp_num_cpus() && n < max; cpu++) {
+        struct trace_buffer *tb = &buffers[cpu];
+        if (!tb->events) {
+            continue;
+        }
+        uint32_t dropped = __atomic_load_n(&tb->dropped, __ATOMIC_RELAXED);
+        if (dropped != tb->dropped_reported) {
+            out[n++] = (struct trace_event){.tsc = cpu_read_tsc(),
+                                            .type = TRACE_LOST,
+                                            .cpu = cpu,
+                                            .arg1 = dropped -
+                                                    tb->dropped_reported};
+            tb->dropped_reported = dropped;
+        }
+        uint32_t head = tb->head;
+        uint32_t tail = __atomic_load_n(&tb->tail, __ATOMIC_ACQUIRE);
+        while (head != tail && n < max) {
+            out[n++] = tb->events[head & TRACE_MASK];
+            head++;
+        }
+        __atomic_store_n(&tb->head, head, __ATOMIC_RELEASE);
+    }
+    return n;
+}
+
+// ----------------------- tests ------------------- //
+
+void trace_test() {
+    struct trace_event out[4];
+    if (!TRACE_ENABLED) {
+        return;
+    }
+    if (!trace_on) {
+        trace_init();
+    }
+    while (trace_drain(out, 4) > 0) {
+    }
+
+    trace(TRACE_SYSCALL_ENTER, 7, 42);
+    trace(TRACE_SYSCALL_EXIT, 7, 0);
+    int n = trace_drain(out, 4);
+    if (n != 2 || out[0].type != TRACE_SYSCALL_ENTER || out[0].arg1 != 42 ||
+        out[1].type != TRACE_SYSCALL_EXIT || out[1].tsc < out[0].tsc) {
+        panic("trace_test: events lost or out of order");
+    }
+
+    // a full ring drops new events and says so on the next drain
+    for (int i = 0; i < TRACE_BUFFER_EVENTS + 3; i++) {
+        trace(TRACE_KFREE, 1, i);
+    }
+    n = trace_drain(out, 1);
+    if (n != 1 || out[0].type != TRACE_LOST || out[0].arg1 != 3) {
+        panic("trace_test: drops not reported");
+    }
+    while (trace_drain(out, 4) > 0) {
+    }
+}
@@ -0,0 +1,43 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include "config.h"
+#include <stdint.h>
+
+// Binary trace of kernel events, decoded on the host by trace.py. The layout
+// of struct trace_event and the event numbers are shared with it.
+
+enum TRACE_EVENT_TYPE {
+    TRACE_NONE,
+    TRACE_SYSCALL_ENTER, // arg0 syscall number, arg1 pid
+    TRACE_SYSCALL_EXIT,  // arg0 syscall number, arg1 result
+    TRACE_IRQ_ENTER,     // arg0 vector, arg1 interrupted eip
+    TRACE_IRQ_EXIT,      // arg0 vector
+    TRACE_SWITCH,        // arg0 pid switched away from, arg1 pid switched to
+    TRACE_KMALLOC,       // arg0 blocks, arg1 address (0 if it failed)
+    TRACE_KFREE,         // arg0 blocks, arg1 address
+    TRACE_DISK_READ,     // arg0 sectors, arg1 lba, when the command is sent
+    TRACE_DISK_READ_DONE, // arg0 sectors, arg1 lba
+    TRACE_DISK_WRITE,     // arg0 sectors, arg1 lba, when the command is sent
+    TRACE_DISK_WRITE_DONE, // arg0 sectors, arg1 lba, flushed to the disk
+    TRACE_LOST,          // arg1 events dropped on cpu since the last one
+};
+
+// pid of the idle loop in TRACE_SWITCH
+#define TRACE_PID_IDLE 0xFFFF
+
+struct trace_event {
+    uint64_t tsc;
+    uint8_t type;
+    uint8_t cpu;
+    uint16_t arg0;
+    uint32_t arg1;
+} __attribute__((packed));
+
+void trace_init();
+void trace(uint8_t type, uint16_t arg0, uint32_t arg1);
+int trace_drain(struct trace_event *out, int max);
+
+void trace_test();
+
+#endif
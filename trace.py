@@ -0,0 +1,223 @@
+#!/usr/bin/env python3
+"""Decodes a kernel trace dumped by the `trace` user program.
+
+The dump is the text the program prints (TRACE BEGIN, one `T <hex>` line per
+event, TRACE END), e.g. copied from the serial console. Every event is the 16
+raw bytes of `struct trace_event` in src/trace/trace.h.
+
+    python3 trace.py dump.txt              # timeline
+    python3 trace.py --summary dump.txt    # latencies per syscall, irq, disk
+    python3 trace.py --mhz 2400 dump.txt   # times in us instead of cycles
+"""
+
+import argparse
+import struct
+import sys
+from collections import defaultdict
+
+# keep in sync with enum TRACE_EVENT_TYPE
+EVENTS = [
+    "NONE",
+    "SYSCALL_ENTER",
+    "SYSCALL_EXIT",
+    "IRQ_ENTER",
+    "IRQ_EXIT",
+    "SWITCH",
+    "KMALLOC",
+    "KFREE",
+    "DISK_READ",
+    "DISK_READ_DONE",
+    "DISK_WRITE",
+    "DISK_WRITE_DONE",
+    "LOST",
+]
+PID_IDLE = 0xFFFF
+
+SYSCALLS = [
+    "hello_sum", "print", "get_char", "put_char", "mmap", "munmap",
+    "clear_screen", "create_process", "exit", "wait_pid", "tty_read",
+    "tty_set_mode", "trace_read",
+]
+
+EVENT = struct.Struct("<QBBHI")
+
+
+def parse(lines):
+    events = []
+    for line in lines:
+        line = line.strip()
+        if not line.startswith("T "):
+            continue
+        raw = bytes.fromhex(line[2:])
+        if len(raw) != EVENT.size:
+            continue
+        tsc, typ, cpu, arg0, arg1 = EVENT.unpack(raw)
+        events.append((tsc, typ, cpu, arg0, arg1))
+    # each cpu's events come out in order, but one cpu after the other
+    events.sort(key=lambda e: e[0])
+    return events
+
+
+def name(typ):
+    return EVENTS[typ] if typ < len(EVENTS) else "?%d" % typ
+
+
+def syscall_name(num):
+    return SYSCALLS[num] if num < len(SYSCALLS) else "syscall%d" % num
+
+
+def pid_name(pid):
+    return "idle" if pid == PID_IDLE else str(pid)
+
+
+def describe(typ, arg0, arg1):
+    kind = name(typ)
+    if kind == "SYSCALL_ENTER":
+        return "%s pid %d" % (syscall_name(arg0), arg1)
+    if kind == "SYSCALL_EXIT":
+        res = arg1 - (1 << 32) if arg1 & 0x80000000 else arg1
+        return "%s = %d" % (syscall_name(arg0), res)
+    if kind == "IRQ_ENTER":
+        return "vector 0x%x eip 0x%08x" % (arg0, arg1)
+    if kind == "IRQ_EXIT":
+        return "vector 0x%x" % arg0
+    if kind == "SWITCH":
+        return "%s -> %s" % (pid_name(arg0), pid_name(arg1))
+    if kind in ("KMALLOC", "KFREE"):
+        return "%d blocks at 0x%08x" % (arg0, arg1)
+    if kind in ("DISK_READ", "DISK_READ_DONE", "DISK_WRITE",
+                "DISK_WRITE_DONE"):
+        return "%d sectors at lba %d" % (arg0, arg1)
+    if kind == "LOST":
+        return "%d events dropped" % arg1
+    return "%d %d" % (arg0, arg1)
+
+
+class Clock:
+    def __init__(self, mhz):
+        self.mhz = mhz
+
+    def fmt(self, cycles):
+        if self.mhz:
+            return "%.3fus" % (cycles / self.mhz)
+        return "%dc" % cycles
+
+
+def timeline(events, clock, out):
+    if not events:
+        return
+    start = events[0][0]
+    for tsc, typ, cpu, arg0, arg1 in events:
+        out.write("%14s cpu%-2d %-15s %s\n" % (clock.fmt(tsc - start), cpu,
+                                            name(typ),
+                                            describe(typ, arg0, arg1)))
+
+
+class Stat:
+    def __init__(self):
+        self.samples = []
+
+    def add(self, value):
+        self.samples.append(value)
+
+    def row(self, label, clock):
+        s = sorted(self.samples)
+        n = len(s)
+        return "%-24s %7d %12s %12s %12s %12s" % (
+            label, n, clock.fmt(sum(s) // n), clock.fmt(s[n // 2]),
+            clock.fmt(s[min(n - 1, n * 99 // 100)]), clock.fmt(s[-1]))
+
+
+def summary(events, clock, out):
+    syscalls = defaultdict(Stat)
+    irqs = defaultdict(Stat)
+    disk = Stat()
+    disk_write = Stat()
+    switches = defaultdict(int)
+    kmalloc_blocks = 0
+    kmallocs = kfrees = lost = 0
+    # per cpu: open syscall, open irqs, open disk read
+    open_syscall = {}
+    open_irqs = defaultdict(list)
+    open_disk = {}
+    open_disk_write = {}
+
+    for tsc, typ, cpu, arg0, arg1 in events:
+        kind = name(typ)
+        if kind == "SYSCALL_ENTER":
+            open_syscall[cpu] = (arg0, tsc)
+        elif kind == "SYSCALL_EXIT":
+            if cpu in open_syscall and open_syscall[cpu][0] == arg0:
+                syscalls[arg0].add(tsc - open_syscall.pop(cpu)[1])
+        elif kind == "IRQ_ENTER":
+            open_irqs[cpu].append((arg0, tsc))
+        elif kind == "IRQ_EXIT":
+            stack = open_irqs[cpu]
+            while stack and stack[-1][0] != arg0:
+                stack.pop()
+            if stack:
+                irqs[arg0].add(tsc - stack.pop()[1])
+        elif kind == "SWITCH":
+            switches[cpu] += 1
+            # a timer irq that switched tasks never returns
+            open_irqs[cpu] = []
+            open_syscall.pop(cpu, None)
+        elif kind == "KMALLOC":
+            kmallocs += 1
+            kmalloc_blocks += arg0
+        elif kind == "KFREE":
+            kfrees += 1
+        elif kind == "DISK_READ":
+            open_disk[cpu] = tsc
+        elif kind == "DISK_READ_DONE":
+            if cpu in open_disk:
+                disk.add(tsc - open_disk.pop(cpu))
+        elif kind == "DISK_WRITE":
+            open_disk_write[cpu] = tsc
+        elif kind == "DISK_WRITE_DONE":
+            if cpu in open_disk_write:
+                disk_write.add(tsc - open_disk_write.pop(cpu))
+        elif kind == "LOST":
+            lost += arg1
+
+    span = events[-1][0] - events[0][0] if events else 0
+    out.write("%d events over %s, %d lost\n\n" % (len(events),
+                                                  clock.fmt(span), lost))
+    header = "%-24s %7s %12s %12s %12s %12s\n" % ("", "count", "mean",
+                                                   "p50", "p99", "max")
+    out.write(header)
+    for num in sorted(syscalls):
+        out.write(syscalls[num].row("syscall " + syscall_name(num), clock) +
+                  "\n")
+    for vec in sorted(irqs):
+        out.write(irqs[vec].row("irq 0x%x" % vec, clock) + "\n")
+    if disk.samples:
+        out.write(disk.row("disk read", clock) + "\n")
+    if disk_write.samples:
+        out.write(disk_write.row("disk write", clock) + "\n")
+    out.write("\nkmalloc %d (%d blocks), kfree %d\n" % (kmallocs,
+                                                       kmalloc_blocks, kfrees))
+    for cpu in sorted(switches):
+        out.write("cpu%d: %d context switches\n" % (cpu, switches[cpu]))
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("dump", nargs="?", help="trace dump, default stdin")
+    parser.add_argument("--summary", action="store_true",
+                        help="latency table instead of the timeline")
+    parser.add_argument("--mhz", type=float, default=0,
+                        help="tsc frequency, to print times in us")
+    args = parser.parse_args()
+
+    lines = open(args.dump) if args.dump else sys.stdin
+    events = parse(lines)
+    clock = Clock(args.mhz)
+    if args.summary:
+        summary(events, clock, sys.stdout)
+    else:
+        timeline(events, clock, sys.stdout)
+
+
+if __name__ == "__main__":
+    main()